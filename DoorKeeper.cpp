@@ -23,13 +23,28 @@
 #include <ChaCha.h>
 #include <DoorKeeper.h>
 #include <EEPROM.h>
+#include <cstddef>
 #include <cstring>
+#include "esp8266_peri.h"
 
 
 
 
 arducrypt acrypt(sizeof(MessagePayload));
 
+static_assert(MAXRELAISNR <= 8, "relay masks are 8 bit");
+static_assert(sizeof(AuditResponse) <= ARDUCRYPTMESSAGESIZE,
+		"AUDITRECORDS do not fit into a message");
+static_assert(sizeof(StatsResponse) <= ARDUCRYPTMESSAGESIZE,
+		"STATSVALUES do not fit into a message");
+static_assert(DOORKEEPERMETRICS_BUCKETS + 2 <= STATSVALUES,
+		"histogram does not fit into a StatsResponse");
+static_assert(sizeof(User) <= DOORKEEPERJOURNAL_DATASIZE,
+		"user does not fit into a journal record");
+static_assert(
+		MAXUSERS < (DOORKEEPERJOURNAL_SECTORS - 1) * DOORKEEPERJOURNAL_RECORDS,
+		"journal too small for MAXUSERS, increase DOORKEEPERJOURNAL_SECTORS");
+
 /**
  * \brief init with DoorKeeperConfig
  */
@@ -37,6 +52,8 @@ void DoorKeeper::initKeeper(DoorKeeperConfig* conf) {
 	config = conf;
 
 	for (int i = 0; i < MAXRELAISNR; i++) {
+		relaisTimers[i].job = RELAISTIMER;
+		relaisTimers[i].arg = i;
 		if (config->pins[i].portpin != 0xff) {
 			DOORKEEPERDEBUG_PRINT(F("init portpin: "));
 			DOORKEEPERDEBUG_PRINTLN(config->pins[i].portpin);
@@ -45,7 +62,20 @@ void DoorKeeper::initKeeper(DoorKeeperConfig* conf) {
 		}
 	}
 
+	bulkTimer.job = BULKTIMER;
+	policy.begin(userAccess, MAXUSERS, config->schedules,
+			config->scheduleCount);
 	initUserDb();
+	// the log must not share sectors with the journal
+	if (config->auditLog == true
+			&& (config->auditSector + DOORKEEPERAUDIT_SECTORS
+					<= config->journalSector
+					|| config->auditSector
+							>= config->journalSector + DOORKEEPERJOURNAL_SECTORS)) {
+		audit.begin(config->auditSector);
+	}
+	// tickets of the last boot are invalid
+	arducrypt::generateTicketKey(&ticketKey);
 }
 
 /**
@@ -58,23 +88,51 @@ void DoorKeeper::initTime(timestruct* time) {
 	DOORKEEPERDEBUG_PRINT(F("."));
 	DOORKEEPERDEBUG_PRINT((t->tm_mon + 1));
 	DOORKEEPERDEBUG_PRINT(F("."));DOORKEEPERDEBUG_PRINTLN(t->tm_year);
+	updateTime();
 }
 
+/**
+ * \brief time base of the tickets, takes the date and hour for the access
+ * checks from the time source
+ */
 void DoorKeeper::CB1000ms(ulong time) {
 	act_ms = time;
-
-	if (timeObj.timercallback != NULL) {
-		timeObj.duration -= 0x01;
-	}
+	updateTime();
 }
 
+/**
+ * \brief advances the timer wheel to millis() and runs the due jobs
+ */
 void DoorKeeper::checkTimer() {
-	if (timeObj.timercallback != NULL && timeObj.duration == 0x00) {
-		(this->*timeObj.timercallback)(timeObj.relaisNr, timeObj.state);
-		timeObj.timercallback = NULL;
+	ulong now = millis();
+	timers.advance(now);
+	DoorKeeperTimerNode* node;
+	while ((node = timers.nextExpired(now)) != NULL) {
+		switch (node->job) {
+		case RELAISTIMER:
+			DOORKEEPERLOG_DEBUG(DKEV_TIMEREXPIRED, node->arg, 0);
+			setRelais(node->arg, relaisRestore[node->arg]);
+			audit.record(act_ms, DOORKEEPERAUDIT_NOUSER, AUDITRELAISTIMER,
+					node->arg,
+					relaisRestore[node->arg] == true ?
+							RelaisStatus::CLOSE : RelaisStatus::OPEN, AUDITOK);
+			break;
+		case BULKTIMER:
+			if (bulkSession != NULL) {
+				abortBulk();
+			}
+			break;
+		}
 	}
 }
 
+/**
+ * \brief counters of the timer wheel
+ */
+DoorKeeperTimerStats DoorKeeper::getTimerStats() {
+	return timers.getStats();
+}
+
 /**
  * \brief add a default handler (will be called when a 'non standard' message was received.
  * callback is responsible for setting correct 'type' in output buffer.
@@ -91,65 +149,179 @@ boolean DoorKeeper::isStarted(DoorKeeperSession* session) {
 }
 
 void DoorKeeper::endSession(DoorKeeperSession* session) {
+	if (session->userindex != INVALIDINDEX) {
+		DOORKEEPERMETRICS_COUNT(DKCNT_SESSIONSENDED);
+	}
 	session->userindex = INVALIDINDEX;
 	session->cryptSession.decrypt.clear();
 	session->cryptSession.encrypt.clear();
+	session->cryptSession.aead.clear();
+	session->aead = false;
+	// nobody can commit the open transfer of this session any more
+	if (bulkSession == session) {
+		abortBulk();
+	}
 }
 
-void DoorKeeper::addChecksum(uint8_t* message, uint32_t* chksum) {
-	*chksum = acrypt.calcChecksum((uint8_t *) message, DATALENGTH);
+/**
+ * \brief checksum of the used data bytes, in compact frames the frame
+ * header (incl. length) is covered too
+ */
+uint32_t DoorKeeper::frameChecksum(DoorKeeperMessage* buffer,
+		MessagePayload* payload, int length, DoorKeeperSession* session) {
+	arducryptcrc crc;
+	if (session->compactFrame == true) {
+		uint8_t header[DOORKEEPERCOMPACTHEADERSIZE];
+		frameHeader(header, buffer, DOORKEEPERFRAME_COMPACTHEADER2, length);
+		crc.update(header, DOORKEEPERCOMPACTHEADERSIZE);
+	}
+	crc.update((uint8_t*) &payload->data, length);
+	return crc.finalize();
 }
 
-boolean DoorKeeper::verifyChecksum(uint8_t* message, uint32_t chksum) {
-	DOORKEEPERDEBUG_PRINT(F("checksum: "));
-	DOORKEEPERDEBUG_HEXPRINT((uint8_t* )&chksum, CHECKSUMSIZE);
-	DOORKEEPERDEBUG_PRINTLN();
+void DoorKeeper::addChecksum(DoorKeeperMessage* buffer,
+		MessagePayload* payload, int length, DoorKeeperSession* session) {
+	payload->checksum = frameChecksum(buffer, payload, length, session);
+}
 
-	uint32_t chk = acrypt.calcChecksum((uint8_t *) message, DATALENGTH);
-	DOORKEEPERDEBUG_PRINT(F("calculated checksum: "));
-	DOORKEEPERDEBUG_HEXPRINT((uint8_t* )&chk, CHECKSUMSIZE);
-	DOORKEEPERDEBUG_PRINTLN();
-	if (chk == chksum) {
+boolean DoorKeeper::verifyChecksum(DoorKeeperMessage* buffer,
+		MessagePayload* payload, int length, DoorKeeperSession* session) {
+	uint32_t chk = frameChecksum(buffer, payload, length, session);
+	if (chk == payload->checksum) {
 		return true;
 	}
 	return false;
 }
 
-boolean DoorKeeper::decrypt_data(MessagePayload* doorkeeperplain,
-		MessagePayload* doorkeepercrypted, DoorKeeperSession* session) {
-	DOORKEEPERDEBUG_PRINT(F("crypted: "));
-	DOORKEEPERDEBUG_HEXPRINT((uint8_t* )doorkeepercrypted, PAYLOADLENGTH);
+/**
+ * \brief decrypts the used bytes of the data and the checksum in place,
+ * the rest of the data is cleared (compact frames).
+ * AEAD frames are decrypted and authenticated in one pass (no checksum)
+ */
+boolean DoorKeeper::decrypt_data(DoorKeeperMessage* doorkeeperBufferIn,
+		DoorKeeperSession* session) {
 	// decrypt if session is started ;)
 	if (isStarted(session) == true) {
-		acrypt.decrypt((uint8_t*) doorkeeperplain, (uint8_t*) doorkeepercrypted,
-				&session->cryptSession);
-		return verifyChecksum((uint8_t*) doorkeeperplain,
-				doorkeeperplain->checksum);
+		int length = session->frameLength;
+		MessagePayload* doorkeepercrypted = &doorkeeperBufferIn->message;
+		MessagePayload* doorkeeperplain = doorkeepercrypted;
+		memset((uint8_t*) &doorkeeperplain->data + length, 0,
+				DATALENGTH - length);
+		if (session->aead != session->aeadFrame) {
+			// no unauthenticated frames in an AEAD session
+			DOORKEEPERLOG_WARN(DKEV_FRAMEINVALID,
+					doorkeeperBufferIn->messagetype, session->aead);
+			DOORKEEPERMETRICS_COUNT(DKCNT_FRAMEERRORS);
+			return false;
+		}
+		boolean valid;
+		if (session->aeadFrame == true) {
+			uint8_t header[DOORKEEPERCOMPACTHEADERSIZE];
+			frameHeader(header, doorkeeperBufferIn,
+					DOORKEEPERFRAME_AEADHEADER2, length);
+			valid = acrypt.decryptAead((uint8_t*) &doorkeeperplain->data,
+					(uint8_t*) &doorkeepercrypted->data, length, header,
+					DOORKEEPERCOMPACTHEADERSIZE, session->frameTag,
+					&session->cryptSession, ARDUCRYPTAEAD_TOSERVER);
+		} else {
+			acrypt.decrypt((uint8_t*) &doorkeeperplain->data,
+					(uint8_t*) &doorkeepercrypted->data,
+					&session->cryptSession, length);
+			acrypt.decrypt((uint8_t*) &doorkeeperplain->checksum,
+					(uint8_t*) &doorkeepercrypted->checksum,
+					&session->cryptSession, CHECKSUMSIZE);
+			valid = verifyChecksum(doorkeeperBufferIn, doorkeeperplain,
+					length, session);
+		}
+		if (valid == false) {
+			DOORKEEPERMETRICS_COUNT(DKCNT_CHECKSUMERRORS);
+		}
+		return valid;
 	} else {
-		DOORKEEPERDEBUG_PRINT(F("session not started"));
+		DOORKEEPERLOG_WARN(DKEV_SESSIONNOTSTARTED, 0, 0);
+		DOORKEEPERMETRICS_COUNT(DKCNT_NOSESSION);
 		return false;
 	}
 }
 
+/**
+ * \brief adds the checksum and encrypts the payload of the response,
+ * the message type has to be set (length of compact frames).
+ * doorkeeperplain may be the payload of doorkeeperBufferOut (in place)
+ */
 boolean DoorKeeper::encrypt_data(MessagePayload* doorkeeperplain,
-		MessagePayload* doorkeepercrypted, DoorKeeperSession* session) {
-	DOORKEEPERDEBUG_PRINT(F("plain: "));
-	DOORKEEPERDEBUG_HEXPRINT((uint8_t* )doorkeeperplain, PAYLOADLENGTH);
+		DoorKeeperMessage* doorkeeperBufferOut, DoorKeeperSession* session) {
 	// decrypt if session is started ;)
 	if (isStarted(session) == true) {
-		addChecksum((uint8_t*) doorkeeperplain, &doorkeeperplain->checksum);
-		acrypt.encrypt((uint8_t*) doorkeeperplain, (uint8_t*) doorkeepercrypted,
-				&session->cryptSession);
+		int length = payloadLength(doorkeeperBufferOut, session);
+		MessagePayload* doorkeepercrypted = &doorkeeperBufferOut->message;
+		if (session->aeadFrame == true) {
+			uint8_t header[DOORKEEPERCOMPACTHEADERSIZE];
+			frameHeader(header, doorkeeperBufferOut,
+					DOORKEEPERFRAME_AEADHEADER2, length);
+			return acrypt.encryptAead((uint8_t*) &doorkeeperplain->data,
+					(uint8_t*) &doorkeepercrypted->data, length, header,
+					DOORKEEPERCOMPACTHEADERSIZE, session->frameTag,
+					&session->cryptSession, ARDUCRYPTAEAD_TOCLIENT);
+		}
+		addChecksum(doorkeeperBufferOut, doorkeeperplain, length, session);
+		acrypt.encrypt((uint8_t*) &doorkeeperplain->data,
+				(uint8_t*) &doorkeepercrypted->data, &session->cryptSession,
+				length);
+		acrypt.encrypt((uint8_t*) &doorkeeperplain->checksum,
+				(uint8_t*) &doorkeepercrypted->checksum, &session->cryptSession,
+				CHECKSUMSIZE);
 		return true;
 	} else {
-		DOORKEEPERDEBUG_PRINT(F("session not started"));
+		DOORKEEPERLOG_WARN(DKEV_SESSIONNOTSTARTED, 0, 0);
 		return false;
 	}
 }
 
+/**
+ * \brief used data bytes of the response, all of them for fixed frames
+ */
+int DoorKeeper::payloadLength(DoorKeeperMessage* bufferOut,
+		DoorKeeperSession* session) {
+	if (session->compactFrame == true) {
+		return messageLength(bufferOut->messagetype);
+	}
+	return DATALENGTH;
+}
+
+/**
+ * \brief echoes the compact / AEAD frame request of a handshake if enabled
+ */
+void DoorKeeper::acceptFraming(uint8_t requested,
+		DoorKeeperMessage* bufferOut, DoorKeeperSession* session) {
+	if (config->compactFrames == true
+			&& (requested & DOORKEEPERFRAME_COMPACT) != 0) {
+		bufferOut->reserved |= DOORKEEPERFRAME_COMPACT;
+	}
+	session->aead = config->aeadFrames == true
+			&& (requested & DOORKEEPERFRAME_AEAD) != 0;
+	if (session->aead == true) {
+		bufferOut->reserved |= DOORKEEPERFRAME_AEAD;
+	}
+}
+
+/**
+ * \brief header of a compact or AEAD frame, covered by checksum or tag
+ */
+void DoorKeeper::frameHeader(uint8_t* header, DoorKeeperMessage* buffer,
+		uint8_t header2, int length) {
+	header[0] = DOORKEEPERFRAME_HEADER1;
+	header[1] = header2;
+	header[2] = buffer->messagetype;
+	header[3] = buffer->reserved;
+	header[4] = length;
+}
+
 boolean DoorKeeper::isMessageEncrypted(DoorKeeperMessage* doorkeeperBufferIn) {
 
-	if (doorkeeperBufferIn->messagetype != MesType::STARTSESSIONREQUEST) {
+	if (doorkeeperBufferIn->messagetype != MesType::STARTSESSIONREQUEST
+			&& doorkeeperBufferIn->messagetype
+					!= MesType::RESUMESESSIONREQUEST) {
 		return true;
 	}
 	return false;
@@ -165,115 +337,149 @@ void DoorKeeper::clearBuffer(MessagePayload* body, int size) {
  * session for encryption/decryption: session
  * response: doorkeeperBufferOut
  * returns TRUE if a response was generated (available in doorkeeperBufferOut),
- * FALSE otherwise
+ * FALSE otherwise.
+ * doorkeeperBufferIn is decrypted in place and read through const views,
+ * the response is built and encrypted in place in doorkeeperBufferOut.
+ * They must not overlap, 4 byte aligned buffers keep crc and cipher on
+ * word loads.
  */
 boolean DoorKeeper::handleMessage(DoorKeeperMessage* doorkeeperBufferIn,
 		DoorKeeperMessage* doorkeeperBufferOut, DoorKeeperSession* session) {
-	DOORKEEPERDEBUG_PRINT(F("handleMessage:"));
-	DOORKEEPERDEBUG_HEXPRINT((uint8_t* )doorkeeperBufferIn,
-			sizeof(DoorKeeperMessage));
-	MessagePayload databuffer;
+	uint8_t type = doorkeeperBufferIn->messagetype;
+	uint32_t start = DOORKEEPERMETRICS_CYCLES();
+	DOORKEEPERMETRICS_MESSAGE(type);
+	boolean response = dispatchMessage(doorkeeperBufferIn,
+			doorkeeperBufferOut, session);
+	// handshakes are timed by stage
+	if (type != MesType::STARTSESSIONREQUEST) {
+		DOORKEEPERMETRICS_TIME(DKHIST_REQUEST, start);
+	}
+	return response;
+}
+
+/**
+ * \brief checks and handles one message, see handleMessage
+ */
+boolean DoorKeeper::dispatchMessage(DoorKeeperMessage* doorkeeperBufferIn,
+		DoorKeeperMessage* doorkeeperBufferOut, DoorKeeperSession* session) {
+	busy = true;
+	DOORKEEPERLOG_DEBUG(DKEV_MESSAGE, doorkeeperBufferIn->messagetype,
+			doorkeeperBufferIn->reserved);
 
 	// if encyrpted ... decrypt
 	if (isMessageEncrypted(doorkeeperBufferIn) == true) {
-		DOORKEEPERDEBUG_PRINT(F("encrypted data: "));
-		DOORKEEPERDEBUG_HEXPRINT((uint8_t* )&(doorkeeperBufferIn->message),
-				PAYLOADLENGTH);
-		if (decrypt_data(&databuffer, &(doorkeeperBufferIn->message),
-				session)==true) {
-			DOORKEEPERDEBUG_PRINT(F("unencrypted data: "));
-			DOORKEEPERDEBUG_HEXPRINT((uint8_t* )&databuffer, PAYLOADLENGTH);
-		} else {
-			DOORKEEPERDEBUG_PRINT(F("unencrypted data: checksum error!"));
+		if (decrypt_data(doorkeeperBufferIn, session) == false) {
+			DOORKEEPERLOG_WARN(DKEV_CHECKSUMERROR,
+					doorkeeperBufferIn->messagetype, 0);
 			return false;
 		}
 
 	} else {
-		// copy to buffer
-		memcpy(&databuffer, &doorkeeperBufferIn->message, PAYLOADLENGTH);
-		DOORKEEPERDEBUG_PRINT(F("copied data: "));
-		DOORKEEPERDEBUG_HEXPRINT((uint8_t* )&databuffer, PAYLOADLENGTH);
 		// chsum
-		if (verifyChecksum((uint8_t*) &databuffer, databuffer.checksum) == false) {
-			DOORKEEPERDEBUG_PRINTLN(F("checksum error!"));
+		if (verifyChecksum(doorkeeperBufferIn, &doorkeeperBufferIn->message,
+				session->frameLength, session) == false) {
+			DOORKEEPERLOG_WARN(DKEV_CHECKSUMERROR,
+					doorkeeperBufferIn->messagetype, 0);
+			DOORKEEPERMETRICS_COUNT(DKCNT_CHECKSUMERRORS);
 			return false;
 		}
 	}
 
-	switch (doorkeeperBufferIn->messagetype) {
+	const MessageData* request = &doorkeeperBufferIn->message.data;
+	MessagePayload* response = &doorkeeperBufferOut->message;
 
-	case MesType::STARTSESSIONREQUEST:
+	switch (doorkeeperBufferIn->messagetype) {
 
-		//
-		DOORKEEPERDEBUG_PRINT(F("STARTSESSIONREQUEST:"));
-		DOORKEEPERDEBUG_HEXPRINT((uint8_t* )&databuffer.data,
-				sizeof(StartSessionRequest));
-		DOORKEEPERDEBUG_PRINT(F("userpublickey:"));
-		DOORKEEPERDEBUG_HEXPRINT(
-				(uint8_t* )databuffer.data.startSessionRequest.clientPubKey,
-				KEYSIZE);
-		DOORKEEPERDEBUG_PRINT(F("sessionpublickey:"));
-		DOORKEEPERDEBUG_HEXPRINT(
-				(uint8_t* )databuffer.data.startSessionRequest.sessionClientPubKey,
-				KEYSIZE);
-		DOORKEEPERDEBUG_PRINT(F("signature:"));
-		DOORKEEPERDEBUG_HEXPRINT(
-				(uint8_t* )databuffer.data.startSessionRequest.signature,
-				SIGNATURESIZE);
-
-		if (isAuthenticated(databuffer.data.startSessionRequest,
-				session) == true) {
+	case MesType::STARTSESSIONREQUEST: {
+		// the session changes only if the handshake succeeds
+		int userindex = isAuthenticated(&request->startSessionRequest,
+				session);
+		if (userindex != INVALIDINDEX) {
 			if (acrypt.generateSession(&session->cryptSession,
-					(arducryptkey*) databuffer.data.startSessionRequest.sessionClientPubKey)==true) {
+					(arducryptkey*) request->startSessionRequest.sessionClientPubKey)==true) {
+				session->userindex = userindex;
 				memcpy(
-						doorkeeperBufferOut->message.data.startSessionResponse.sessionServerPubKey,
+						response->data.startSessionResponse.sessionServerPubKey,
 						session->cryptSession.publicKey, KEYSIZE);
-				memcpy(
-						doorkeeperBufferOut->message.data.startSessionResponse.sessionIV,
+				memcpy(response->data.startSessionResponse.sessionIV,
 						session->cryptSession.iv, IVSIZE);
+				uint32_t start = DOORKEEPERMETRICS_CYCLES();
 				acrypt.sign(config->serverkeys,
-						(uint8_t*) &doorkeeperBufferOut->message.data.startSessionResponse.sessionServerPubKey,
-						(arducryptsignature*) &doorkeeperBufferOut->message.data.startSessionResponse.signature,
+						(uint8_t*) &response->data.startSessionResponse.sessionServerPubKey,
+						(arducryptsignature*) &response->data.startSessionResponse.signature,
 						KEYSIZE + IVSIZE);
+				DOORKEEPERMETRICS_TIME(DKHIST_SIGN, start);
 
-// checksum
-				addChecksum((uint8_t*) &doorkeeperBufferOut->message,
-						&doorkeeperBufferOut->message.checksum);
 				setMessageType(doorkeeperBufferOut,
 						MesType::STARTSESSIONRESPONSE);
+				acceptFraming(doorkeeperBufferIn->reserved,
+						doorkeeperBufferOut, session);
+// checksum
+				addChecksum(doorkeeperBufferOut, response,
+						payloadLength(doorkeeperBufferOut, session), session);
+				DOORKEEPERLOG_INFO(DKEV_SESSIONSTARTED, session->userindex, 0);
+				DOORKEEPERMETRICS_COUNT(DKCNT_SESSIONSSTARTED);
+				audit.record(act_ms, session->userindex, AUDITSESSION, 0, 0,
+						AUDITOK);
 				return true;
 			}
-
-		} else {
-
+			DOORKEEPERLOG_ERROR(DKEV_SESSIONFAILED, userindex, 0);
 		}
 		break;
+	}
 
+	case MesType::RESUMESESSIONREQUEST:
+		if (resumeSession(&request->resumeSessionRequest,
+				&response->data.resumeSessionResponse, session) == true) {
+			setMessageType(doorkeeperBufferOut,
+					MesType::RESUMESESSIONRESPONSE);
+			acceptFraming(doorkeeperBufferIn->reserved, doorkeeperBufferOut,
+					session);
+			addChecksum(doorkeeperBufferOut, response,
+					payloadLength(doorkeeperBufferOut, session), session);
+			DOORKEEPERLOG_INFO(DKEV_SESSIONRESUMED, session->userindex, 0);
+			DOORKEEPERMETRICS_COUNT(DKCNT_SESSIONSRESUMED);
+			audit.record(act_ms, session->userindex, AUDITRESUMED, 0, 0,
+					AUDITOK);
+			return true;
+		}
+		break;
+	case MesType::TICKETREQUEST:
+		clearBuffer(response, PAYLOADLENGTH);
+		issueTicket(&response->data.ticketResponse, session);
+		setMessageType(doorkeeperBufferOut, MesType::TICKETRESPONSE);
+		// the secret is encrypted in place, no plain copy is left
+		encrypt_data(response, doorkeeperBufferOut, session);
+		return true;
+		break;
 	case MesType::RELAISREQUEST:
-		switchRelais(databuffer.data.relaisRequest);
+		audit.record(act_ms, session->userindex, AUDITRELAIS,
+				request->relaisRequest.relaisnumber,
+				request->relaisRequest.relaisstate,
+				switchRelais(&request->relaisRequest) == true ?
+						AUDITOK : AUDITFAILED);
 		// do a encryption to keep counter sync!
 //		encrypt_data(&databuffer, &doorkeeperBufferOut->message, session);
 		return false;
 		break;
 	case MesType::FIRMWAREREQUEST:
-		clearBuffer(&databuffer, PAYLOADLENGTH);
-		getFirmware(&databuffer);
+		clearBuffer(response, PAYLOADLENGTH);
+		getFirmware(response);
 //		addChecksum(&databuffer);
-		encrypt_data(&databuffer, &doorkeeperBufferOut->message, session);
 		setMessageType(doorkeeperBufferOut, MesType::FIRMWARERESPONSE);
+		encrypt_data(response, doorkeeperBufferOut, session);
 		return true;
 		break;
 	case MesType::ADDKEYREQUEST:
 		if (isAdminSession(session) != true) {
 			return false;
 		}
-		if (handleAddKeyRequest(databuffer.data.addKeyRequest) == true) {
-			clearBuffer(&databuffer, PAYLOADLENGTH);
-			databuffer.data.addKeyResponse.status_ = 0x01;
+		if (handleAddKeyRequest(&request->addKeyRequest) == true) {
+			clearBuffer(response, PAYLOADLENGTH);
+			response->data.addKeyResponse.status_ = 0x01;
 //			addChecksum(&databuffer);
-			encrypt_data(&databuffer, &doorkeeperBufferOut->message, session);
 			setMessageType(doorkeeperBufferOut, MesType::ADDKEYRESPONSE);
-
+			encrypt_data(response, doorkeeperBufferOut, session);
 			return true;
 		}
 		return false;
@@ -282,33 +488,100 @@ boolean DoorKeeper::handleMessage(DoorKeeperMessage* doorkeeperBufferIn,
 		if (isAdminSession(session) != true) {
 			return false;
 		}
-		if (handleRemoveKeyRequest(databuffer.data.removeKeyRequest) == true) {
-			clearBuffer(&databuffer, PAYLOADLENGTH);
-			databuffer.data.removeKeyResponse.status_ = 0x01;
+		if (handleRemoveKeyRequest(&request->removeKeyRequest) == true) {
+			clearBuffer(response, PAYLOADLENGTH);
+			response->data.removeKeyResponse.status_ = 0x01;
 //			addChecksum(&databuffer);
-			encrypt_data(&databuffer, &doorkeeperBufferOut->message, session);
 			setMessageType(doorkeeperBufferOut, MesType::REMOVEKEYRESPONSE);
+			encrypt_data(response, doorkeeperBufferOut, session);
 			return true;
 		}
 		return false;
 		break;
+	case MesType::SCHEDULEREQUEST:
+		if (isAdminSession(session) != true) {
+			return false;
+		}
+		clearBuffer(response, PAYLOADLENGTH);
+		response->data.scheduleResponse.status_ = handleScheduleRequest(
+				&request->scheduleRequest);
+		setMessageType(doorkeeperBufferOut, MesType::SCHEDULERESPONSE);
+		encrypt_data(response, doorkeeperBufferOut, session);
+		return true;
+		break;
+	case MesType::AUDITREQUEST:
+		if (isAdminSession(session) != true) {
+			return false;
+		}
+		clearBuffer(response, PAYLOADLENGTH);
+		handleAuditRequest(&request->auditRequest,
+				&response->data.auditResponse);
+		setMessageType(doorkeeperBufferOut, MesType::AUDITRESPONSE);
+		encrypt_data(response, doorkeeperBufferOut, session);
+		return true;
+		break;
+	case MesType::STATSREQUEST:
+		if (isAdminSession(session) != true) {
+			return false;
+		}
+		clearBuffer(response, PAYLOADLENGTH);
+		handleStatsRequest(&request->statsRequest,
+				&response->data.statsResponse);
+		setMessageType(doorkeeperBufferOut, MesType::STATSRESPONSE);
+		encrypt_data(response, doorkeeperBufferOut, session);
+		return true;
+		break;
+	case MesType::BULKKEYREQUEST:
+		if (isAdminSession(session) != true) {
+			return false;
+		}
+		clearBuffer(response, PAYLOADLENGTH);
+		if (handleBulkKeyRequest(&request->bulkKeyRequest,
+				&response->data.bulkKeyResponse, session) == true) {
+			setMessageType(doorkeeperBufferOut, MesType::BULKKEYRESPONSE);
+			encrypt_data(response, doorkeeperBufferOut, session);
+			return true;
+		}
+		return false;
+		break;
+	case MesType::MULTIRELAISREQUEST:
+		clearBuffer(response, PAYLOADLENGTH);
+		handleMultiRelaisRequest(&request->multiRelaisRequest,
+				&response->data.multiRelaisResponse);
+		if (request->multiRelaisRequest.mask != 0) {
+			audit.record(act_ms, session->userindex, AUDITRELAISMASK,
+					request->multiRelaisRequest.mask,
+					request->multiRelaisRequest.states,
+					(request->multiRelaisRequest.mask
+							& ~response->data.multiRelaisResponse.relais) == 0 ?
+							AUDITOK : AUDITFAILED);
+		}
+		setMessageType(doorkeeperBufferOut, MesType::MULTIRELAISRESPONSE);
+		encrypt_data(response, doorkeeperBufferOut, session);
+		return true;
+		break;
 	case MesType::STATUSREQUEST:
-		if (handleStatusRequest(&databuffer) == true) {
+		clearBuffer(response, PAYLOADLENGTH);
+		if (handleStatusRequest(&request->statusRequest,
+				&response->data.statusResponse) == true) {
 //			addChecksum(&databuffer);
-			encrypt_data(&databuffer, &doorkeeperBufferOut->message, session);
 			setMessageType(doorkeeperBufferOut, MesType::STATUSRESPONSE);
+			encrypt_data(response, doorkeeperBufferOut, session);
 			return true;
 		}
 		return false;
 		break;
 	default:
-		DOORKEEPERDEBUG_PRINTLN(F("unknown messagetype!"));
-		// callback
+		DOORKEEPERLOG_INFO(DKEV_UNKNOWNTYPE, doorkeeperBufferIn->messagetype,
+				0);
+		// callback, the response is written to the (decrypted) request
 		if (defaultCallback(doorkeeperBufferIn->messagetype,
-				doorkeeperBufferIn->reserved, &databuffer,
+				doorkeeperBufferIn->reserved, &doorkeeperBufferIn->message,
 				doorkeeperBufferOut) == true) {
-			encrypt_data(&databuffer, &doorkeeperBufferOut->message, session);
 			// message type has to be set by callback
+			setHeader(doorkeeperBufferOut);
+			encrypt_data(&doorkeeperBufferIn->message, doorkeeperBufferOut,
+					session);
 			return true;
 		}
 		break;
@@ -318,37 +591,429 @@ boolean DoorKeeper::handleMessage(DoorKeeperMessage* doorkeeperBufferIn,
 	return false;
 }
 
+/**
+ * \brief
+ * handles a fixed (DoorKeeperMessageSize) or compact frame (frameSize),
+ * the response is sent in the same format.
+ * frameIn and frameOut need DOORKEEPERFRAMEMAXSIZE bytes and should be 4 byte
+ * aligned. Compact frames are unpacked / packed in place, frameIn is
+ * decrypted in place.
+ * returns the size of the response in frameOut, 0 if there is none
+ */
+int DoorKeeper::handleFrame(uint8_t* frameIn, uint8_t* frameOut,
+		DoorKeeperSession* session) {
+	if (frameIn[0] != DOORKEEPERFRAME_HEADER1) {
+		DOORKEEPERLOG_WARN(DKEV_FRAMEINVALID, frameIn[0], 0);
+		return 0;
+	}
+	if (frameIn[1] == DOORKEEPERFRAME_HEADER2) {
+		if (handleMessage((DoorKeeperMessage*) frameIn,
+				(DoorKeeperMessage*) frameOut, session) == true) {
+			return DoorKeeperMessageSize;
+		}
+		return 0;
+	}
+	int length = frameIn[DOORKEEPERCOMPACTHEADERSIZE - 1];
+	boolean aeadFrame = frameIn[1] == DOORKEEPERFRAME_AEADHEADER2;
+	boolean valid = length <= DATALENGTH;
+	if (aeadFrame == true) {
+		// only encrypted messages, the tag needs a session key
+		valid = valid && config->aeadFrames == true
+				&& isMessageEncrypted((DoorKeeperMessage*) frameIn) == true;
+	} else {
+		valid = valid && frameIn[1] == DOORKEEPERFRAME_COMPACTHEADER2
+				&& config->compactFrames == true;
+	}
+	if (valid == false) {
+		DOORKEEPERLOG_WARN(DKEV_FRAMEINVALID, frameIn[1], length);
+		return 0;
+	}
+	// unpack to a fixed message in place, unused data bytes are 0
+	DoorKeeperMessage* in = (DoorKeeperMessage*) frameIn;
+	DoorKeeperMessage* out = (DoorKeeperMessage*) frameOut;
+	uint8_t* trailer = frameIn + DOORKEEPERCOMPACTHEADERSIZE + length;
+	uint32_t checksum = 0;
+	if (aeadFrame == true) {
+		memcpy(session->frameTag, trailer, ARDUCRYPTTAGSIZE);
+	} else {
+		memcpy(&checksum, trailer, CHECKSUMSIZE);
+	}
+	memmove(&in->message.data, frameIn + DOORKEEPERCOMPACTHEADERSIZE, length);
+	memset((uint8_t*) &in->message.data + length, 0, DATALENGTH - length);
+	in->message.checksum = checksum;
+	memset(frameOut, 0, HEADERLEN);
+
+	session->compactFrame = true;
+	session->aeadFrame = aeadFrame;
+	session->frameLength = length;
+	boolean response = handleMessage(in, out, session);
+	session->compactFrame = false;
+	session->aeadFrame = false;
+	session->frameLength = DATALENGTH;
+	if (response == false) {
+		return 0;
+	}
+	// pack the response in place
+	length = messageLength(out->messagetype);
+	checksum = out->message.checksum;
+	memmove(frameOut + DOORKEEPERCOMPACTHEADERSIZE, &out->message.data,
+			length);
+	frameOut[DOORKEEPERCOMPACTHEADERSIZE - 1] = length;
+	trailer = frameOut + DOORKEEPERCOMPACTHEADERSIZE + length;
+	if (aeadFrame == true) {
+		frameOut[1] = DOORKEEPERFRAME_AEADHEADER2;
+		memcpy(trailer, session->frameTag, ARDUCRYPTTAGSIZE);
+		return DOORKEEPERCOMPACTHEADERSIZE + length + ARDUCRYPTTAGSIZE;
+	}
+	frameOut[1] = DOORKEEPERFRAME_COMPACTHEADER2;
+	memcpy(trailer, &checksum, CHECKSUMSIZE);
+	return DOORKEEPERCOMPACTHEADERSIZE + length + CHECKSUMSIZE;
+}
+
+/**
+ * \brief first step of a StartSession handshake on a worker thread.
+ * takes a fixed StartSessionRequest frame with a valid checksum from a known
+ * and valid user and copies everything runHandshake needs into job.
+ * returns false for all other frames, hand them to handleFrame
+ */
+boolean DoorKeeper::beginHandshake(uint8_t* frameIn, DoorKeeperHandshake* job,
+		DoorKeeperSession* session) {
+	DoorKeeperMessage* in = (DoorKeeperMessage*) frameIn;
+	if (frameIn[0] != DOORKEEPERFRAME_HEADER1
+			|| frameIn[1] != DOORKEEPERFRAME_HEADER2
+			|| in->messagetype != MesType::STARTSESSIONREQUEST
+			|| verifyChecksum(in, &in->message, DATALENGTH, session) == false) {
+		return false;
+	}
+	const StartSessionRequest* request = &in->message.data.startSessionRequest;
+	int userindex = findUser(request->clientPubKey);
+	if (userindex == INVALIDINDEX || checkValidation(userindex) == false) {
+		return false;
+	}
+	busy = true;
+	DOORKEEPERLOG_DEBUG(DKEV_MESSAGE, in->messagetype, in->reserved);
+	DOORKEEPERMETRICS_MESSAGE(in->messagetype);
+	job->request = *request;
+	job->framing = in->reserved;
+	job->userindex = userindex;
+	job->userKeyValid = userKeyValid[userindex];
+	if (job->userKeyValid == true) {
+		job->userKey = userKeys[userindex];
+	}
+	job->serverKeys = config->serverkeys;
+	job->verified = false;
+	job->established = false;
+	memset(job->stageCycles, 0, sizeof(job->stageCycles));
+	return true;
+}
+
+/**
+ * \brief public key operations of a handshake: signature check, key
+ * exchange and the signature of the response. uses job only, thread safe
+ */
+void DoorKeeper::runHandshake(DoorKeeperHandshake* job) {
+	runHandshakes(&job, 1);
+}
+
+/**
+ * \brief runHandshake for count jobs, their signatures are checked as one
+ * batch (arducrypt::validateSignatures). uses the jobs only, thread safe
+ */
+void DoorKeeper::runHandshakes(DoorKeeperHandshake** jobs, int count) {
+	arducryptbatchitem items[ARDUCRYPTBATCHMAX];
+	boolean valid[ARDUCRYPTBATCHMAX];
+	for (int first = 0; first < count; first += ARDUCRYPTBATCHMAX) {
+		int used = count - first;
+		if (used > ARDUCRYPTBATCHMAX) {
+			used = ARDUCRYPTBATCHMAX;
+		}
+		uint32_t start = DOORKEEPERMETRICS_CYCLES();
+		for (int i = 0; i < used; i++) {
+			DoorKeeperHandshake* job = jobs[first + i];
+			StartSessionRequest* request = &job->request;
+			items[i].signature = (arducryptsignature*) request->signature;
+			items[i].message = request->sessionClientPubKey;
+			items[i].length = KEYSIZE;
+			items[i].key = (arducryptkey*) request->clientPubKey;
+			items[i].point = job->userKeyValid == true ? &job->userKey : NULL;
+		}
+		arducrypt::validateSignatures(items, used, valid);
+		// the batch is timed, every handshake gets its share
+		uint32_t cycles = (DOORKEEPERMETRICS_CYCLES() - start) / used;
+		for (int i = 0; i < used; i++) {
+			DoorKeeperHandshake* job = jobs[first + i];
+			job->verified = valid[i];
+			job->stageCycles[DKHIST_VERIFY] = cycles;
+			if (job->verified == true) {
+				respondHandshake(job);
+			}
+		}
+	}
+}
+
+/**
+ * \brief key exchange and signature of a verified handshake
+ */
+void DoorKeeper::respondHandshake(DoorKeeperHandshake* job) {
+	StartSessionRequest* request = &job->request;
+	StartSessionResponse* response = &job->response;
+	job->established = arducrypt::exchangeKeys(request->sessionClientPubKey,
+			response->sessionServerPubKey, response->sessionIV, job->secret,
+			&job->stageCycles[DKHIST_DH1]);
+	if (job->established == false) {
+		return;
+	}
+	uint32_t start = DOORKEEPERMETRICS_CYCLES();
+	arducrypt::sign(job->serverKeys, response->sessionServerPubKey,
+			(arducryptsignature*) response->signature, KEYSIZE + IVSIZE);
+	job->stageCycles[DKHIST_SIGN] = DOORKEEPERMETRICS_CYCLES() - start;
+}
+
+/**
+ * \brief last step of a handshake: starts the session and writes the
+ * StartSessionResponse frame. returns its size, 0 if the handshake failed
+ * (or the user was removed in the meantime)
+ */
+int DoorKeeper::endHandshake(DoorKeeperHandshake* job, uint8_t* frameOut,
+		DoorKeeperSession* session) {
+	busy = true;
+	int size = 0;
+	// the stages ran on a worker, the metrics belong to this thread
+	DOORKEEPERMETRICS_RECORD(DKHIST_VERIFY, job->stageCycles[DKHIST_VERIFY]);
+	if (job->verified == true) {
+		DOORKEEPERMETRICS_RECORD(DKHIST_DH1, job->stageCycles[DKHIST_DH1]);
+		DOORKEEPERMETRICS_RECORD(DKHIST_DH2, job->stageCycles[DKHIST_DH2]);
+	}
+	if (job->established == true) {
+		DOORKEEPERMETRICS_RECORD(DKHIST_SIGN, job->stageCycles[DKHIST_SIGN]);
+	}
+	if (job->verified == false) {
+		DOORKEEPERLOG_WARN(DKEV_SIGNATUREINVALID, job->userindex, 0);
+		DOORKEEPERMETRICS_COUNT(DKCNT_AUTHFAILURES);
+		audit.record(act_ms, session->userindex, AUDITDENIED, 0, 0,
+				AUDITSIGNATURE);
+	} else if (job->established == false) {
+		DOORKEEPERLOG_ERROR(DKEV_DHFAILED, 0, 0);
+		DOORKEEPERLOG_ERROR(DKEV_SESSIONFAILED, job->userindex, 0);
+	} else if (findUser(job->request.clientPubKey) != job->userindex
+			|| checkValidation(job->userindex) == false) {
+		DOORKEEPERLOG_WARN(DKEV_UNKNOWNUSER, 0, 0);
+		DOORKEEPERMETRICS_COUNT(DKCNT_AUTHFAILURES);
+	} else {
+		session->userindex = job->userindex;
+		memcpy(session->cryptSession.publicKey,
+				job->response.sessionServerPubKey, KEYSIZE);
+		memcpy(session->cryptSession.iv, job->response.sessionIV, IVSIZE);
+		arducrypt::initSession(&session->cryptSession, job->secret);
+
+		DoorKeeperMessage* out = (DoorKeeperMessage*) frameOut;
+		MessagePayload* response = &out->message;
+		clearBuffer(response, PAYLOADLENGTH);
+		response->data.startSessionResponse = job->response;
+		setMessageType(out, MesType::STARTSESSIONRESPONSE);
+		acceptFraming(job->framing, out, session);
+		addChecksum(out, response, DATALENGTH, session);
+		DOORKEEPERLOG_INFO(DKEV_SESSIONSTARTED, session->userindex, 0);
+		DOORKEEPERMETRICS_COUNT(DKCNT_SESSIONSSTARTED);
+		audit.record(act_ms, session->userindex, AUDITSESSION, 0, 0, AUDITOK);
+		size = DoorKeeperMessageSize;
+	}
+	memset(job->secret, 0, KEYSIZE);
+	return size;
+}
+
+/**
+ * \brief
+ * size of the frame starting with header (4 bytes, 5 for compact and AEAD
+ * frames), 0 if the header is invalid
+ */
+int DoorKeeper::frameSize(uint8_t* header) {
+	if (header[0] != DOORKEEPERFRAME_HEADER1) {
+		return 0;
+	}
+	if (header[1] == DOORKEEPERFRAME_HEADER2) {
+		return DoorKeeperMessageSize;
+	}
+	int length = header[DOORKEEPERCOMPACTHEADERSIZE - 1];
+	if (length > ARDUCRYPTMESSAGESIZE) {
+		return 0;
+	}
+	if (header[1] == DOORKEEPERFRAME_COMPACTHEADER2) {
+		return DOORKEEPERCOMPACTHEADERSIZE + length + CHECKSUMSIZE;
+	}
+	if (header[1] == DOORKEEPERFRAME_AEADHEADER2) {
+		return DOORKEEPERCOMPACTHEADERSIZE + length + ARDUCRYPTTAGSIZE;
+	}
+	return 0;
+}
+
+/**
+ * \brief used data bytes of a message type in compact frames,
+ * unknown (custom) types use all of them
+ */
+uint8_t DoorKeeper::messageLength(uint8_t messagetype) {
+	switch (messagetype) {
+	case MesType::STARTSESSIONREQUEST:
+		return sizeof(StartSessionRequest);
+	case MesType::STARTSESSIONRESPONSE:
+		return sizeof(StartSessionResponse);
+	case MesType::RESUMESESSIONREQUEST:
+		return sizeof(ResumeSessionRequest);
+	case MesType::RESUMESESSIONRESPONSE:
+		return sizeof(ResumeSessionResponse);
+	case MesType::FIRMWAREREQUEST:
+	case MesType::TICKETREQUEST:
+		return 0;
+	case MesType::FIRMWARERESPONSE:
+		return sizeof(FirmwareResponse);
+	case MesType::TICKETRESPONSE:
+		return sizeof(TicketResponse);
+	case MesType::STATUSREQUEST:
+		return sizeof(StatusRequest);
+	case MesType::STATUSRESPONSE:
+		return sizeof(StatusResponse);
+	case MesType::RELAISREQUEST:
+		return sizeof(RelaisRequest);
+	case MesType::MULTIRELAISREQUEST:
+		return sizeof(MultiRelaisRequest);
+	case MesType::MULTIRELAISRESPONSE:
+		return sizeof(MultiRelaisResponse);
+	case MesType::ADDKEYREQUEST:
+		return sizeof(AddKeyRequest);
+	case MesType::ADDKEYRESPONSE:
+		return sizeof(AddKeyResponse);
+	case MesType::REMOVEKEYREQUEST:
+		return sizeof(RemoveKeyRequest);
+	case MesType::REMOVEKEYRESPONSE:
+		return sizeof(RemoveKeyResponse);
+	case MesType::SCHEDULEREQUEST:
+		return sizeof(ScheduleRequest);
+	case MesType::SCHEDULERESPONSE:
+		return sizeof(ScheduleResponse);
+	case MesType::AUDITREQUEST:
+		return sizeof(AuditRequest);
+	case MesType::AUDITRESPONSE:
+		return sizeof(AuditResponse);
+	case MesType::STATSREQUEST:
+		return sizeof(StatsRequest);
+	case MesType::STATSRESPONSE:
+		return sizeof(StatsResponse);
+	case MesType::BULKKEYREQUEST:
+		return sizeof(BulkKeyRequest);
+	case MesType::BULKKEYRESPONSE:
+		return sizeof(BulkKeyResponse);
+	default:
+		return ARDUCRYPTMESSAGESIZE;
+	}
+}
+
 boolean DoorKeeper::defaultCallback(uint8_t messagetype, uint8_t reservedbyte,
 		MessagePayload* databuffer, DoorKeeperMessage* doorkeeperBufferOut) {
 	if (defaultcallback == NULL) {
-		DOORKEEPERDEBUG_PRINTLN(F("defaultCallback is NULL"));
+		DOORKEEPERLOG_WARN(DKEV_NOHANDLER, messagetype, 0);
 		return false;
 	}
 	// callback
-	DOORKEEPERDEBUG_PRINTLN(F("calling defaultCallback"));
 	return (*defaultcallback)(messagetype, reservedbyte, databuffer,
 			doorkeeperBufferOut);
 }
 
+/**
+ * \brief takes an entry from the free list, the caller has to fill it
+ */
 int DoorKeeper::getFreeUser() {
+	if (freeUserCount == 0) {
+		return INVALIDINDEX;
+	}
+	freeUserCount--;
+	return freeUsers[freeUserCount];
+}
+
+void DoorKeeper::releaseUser(int index) {
+	freeUsers[freeUserCount] = index;
+	freeUserCount++;
+}
+
+boolean DoorKeeper::isFreeUser(int index) {
+	return userDb.users[index].validToDay == 0xff;
+}
+
+/**
+ * \brief public keys are random, the first bytes are a good enough hash
+ */
+uint32_t DoorKeeper::userHash(const uint8_t* userkey) {
+	return ((uint32_t) userkey[0]) | ((uint32_t) userkey[1] << 8)
+			| ((uint32_t) userkey[2] << 16) | ((uint32_t) userkey[3] << 24);
+}
+
+void DoorKeeper::indexUser(int index) {
+	uint32_t slot = userHash(userDb.users[index].userPubKey)
+			& (USERINDEXSIZE - 1);
+	while (userIndex[slot] != INVALIDINDEX) {
+		slot = (slot + 1) & (USERINDEXSIZE - 1);
+	}
+	userIndex[slot] = index;
+}
+
+/**
+ * \brief removes user 'index' from the hash index (backward shift, no
+ * tombstones). the key of the user has to be still valid.
+ */
+void DoorKeeper::unindexUser(int index) {
+	uint32_t slot = userHash(userDb.users[index].userPubKey)
+			& (USERINDEXSIZE - 1);
+	while (userIndex[slot] != index) {
+		if (userIndex[slot] == INVALIDINDEX) {
+			return;
+		}
+		slot = (slot + 1) & (USERINDEXSIZE - 1);
+	}
+	uint32_t next = slot;
+	while (true) {
+		next = (next + 1) & (USERINDEXSIZE - 1);
+		if (userIndex[next] == INVALIDINDEX) {
+			break;
+		}
+		uint32_t home = userHash(userDb.users[userIndex[next]].userPubKey)
+				& (USERINDEXSIZE - 1);
+		// move entry back if its home slot is not between slot and next
+		if (((next - home) & (USERINDEXSIZE - 1))
+				>= ((next - slot) & (USERINDEXSIZE - 1))) {
+			userIndex[slot] = userIndex[next];
+			slot = next;
+		}
+	}
+	userIndex[slot] = INVALIDINDEX;
+}
+
+/**
+ * \brief rebuilds hash index and free list from userDb
+ */
+void DoorKeeper::buildUserIndex() {
+	for (int slot = 0; slot < USERINDEXSIZE; slot++) {
+		userIndex[slot] = INVALIDINDEX;
+	}
 	for (int index = 0; index < MAXUSERS; index++) {
-		if (userDb.users[index].validToDay == 0xff
-				&& userDb.users[index].validToDay == 0xff
-				&& userDb.users[index].validToDay == 0xff) {
-			DOORKEEPERDEBUG_PRINT(F("free user entry found: "));
-			DOORKEEPERDEBUG_PRINTLN(index);
-			return index;
+		if (isFreeUser(index) == false
+				&& findUser(userDb.users[index].userPubKey) == INVALIDINDEX) {
+			indexUser(index);
+		}
+	}
+	freeUserCount = 0;
+	for (int index = MAXUSERS - 1; index >= 0; index--) {
+		if (isFreeUser(index) == true) {
+			releaseUser(index);
 		}
 	}
-	return INVALIDINDEX;
 }
 
-boolean DoorKeeper::handleRemoveKeyRequest(RemoveKeyRequest keyrequest) {
-	DOORKEEPERDEBUG_PRINTLN(F("handle remove key"));
-	int userindex = findUser(keyrequest.clientPubKey);
+boolean DoorKeeper::handleRemoveKeyRequest(
+		const RemoveKeyRequest* keyrequest) {
+	int userindex = findUser(keyrequest->clientPubKey);
 	if (userindex == INVALIDINDEX) {
 		return false;
 	}
+	unindexUser(userindex);
 	memset(&userDb.users[userindex], 0xff, KEYSIZE);
 	userDb.users[userindex].validFromDay = 0xff;
 	userDb.users[userindex].validFromMonth = 0xff;
@@ -356,108 +1021,407 @@ boolean DoorKeeper::handleRemoveKeyRequest(RemoveKeyRequest keyrequest) {
 	userDb.users[userindex].validToDay = 0xff;
 	userDb.users[userindex].validToMonth = 0xff;
 	userDb.users[userindex].validToYear = 0xff;
-	userDb.modified = userindex;
+	userDb.users[userindex].schedule = DOORKEEPERPOLICY_NONE;
+	userKeyValid[userindex] = false;
+	policy.never(userindex);
+	releaseUser(userindex);
+	markDirty(userindex);
+	DOORKEEPERLOG_INFO(DKEV_USERREMOVED, userindex, 0);
 	return true;
 }
 
-boolean DoorKeeper::handleStatusRequest(MessagePayload* statusRequest) {
-	DOORKEEPERDEBUG_PRINTLN(F("handleStatusRequest"));
-	uint8_t relais = statusRequest->data.statusRequest.relaisnr;
+boolean DoorKeeper::handleStatusRequest(const StatusRequest* statusRequest,
+		StatusResponse* statusResponse) {
+	uint8_t relais = statusRequest->relaisnr;
 	//check status
-	statusRequest->data.statusResponse.relaisstate = getRelaisState(relais);
+	statusResponse->relaisnr = relais;
+	statusResponse->relaisstate = getRelaisState(relais);
 	return true;
 }
 
-boolean DoorKeeper::handleAddKeyRequest(AddKeyRequest keyrequest) {
-	DOORKEEPERDEBUG_PRINTLN(F("handle add key"));
-
-	int userindex = findUser(keyrequest.clientPubKey);
+boolean DoorKeeper::handleAddKeyRequest(const AddKeyRequest* keyrequest) {
+	int userindex = findUser(keyrequest->clientPubKey);
 	if (userindex == INVALIDINDEX) {
 		// add new key
 		userindex = getFreeUser();
 		if (userindex == INVALIDINDEX) {
 			// no free space!
+			DOORKEEPERLOG_WARN(DKEV_DBFULL, 0, 0);
 			return false;
 		}
-		DOORKEEPERDEBUG_PRINT(F("add new user "));
-		DOORKEEPERDEBUG_PRINTLN(userindex);
-		memcpy(&userDb.users[userindex], keyrequest.clientPubKey, KEYSIZE);
-		userDb.users[userindex].validFromDay = keyrequest.validFromDay;
-		userDb.users[userindex].validFromMonth = keyrequest.validFromMonth;
-		userDb.users[userindex].validFromYear = keyrequest.validFromYear;
-		userDb.users[userindex].validToDay = keyrequest.validtoDay;
-		userDb.users[userindex].validToMonth = keyrequest.validtoMonth;
-		userDb.users[userindex].validToYear = keyrequest.validtoYear;
-		userDb.modified = userindex;
+		memcpy(&userDb.users[userindex], keyrequest->clientPubKey, KEYSIZE);
+		userDb.users[userindex].validFromDay = keyrequest->validFromDay;
+		userDb.users[userindex].validFromMonth = keyrequest->validFromMonth;
+		userDb.users[userindex].validFromYear = keyrequest->validFromYear;
+		userDb.users[userindex].validToDay = keyrequest->validtoDay;
+		userDb.users[userindex].validToMonth = keyrequest->validtoMonth;
+		userDb.users[userindex].validToYear = keyrequest->validtoYear;
+		userDb.users[userindex].schedule = DOORKEEPERPOLICY_NONE;
+		indexUser(userindex);
+		prepareUserKey(userindex);
+		compileAccess(userindex);
+		markDirty(userindex);
+		DOORKEEPERLOG_INFO(DKEV_USERADDED, userindex, 0);
 		return true;
 	} else {
 		// update existing
-		DOORKEEPERDEBUG_PRINT(F("updating user "));
-		DOORKEEPERDEBUG_PRINTLN(userindex);
-		userDb.users[userindex].validFromDay = keyrequest.validFromDay;
-		userDb.users[userindex].validFromMonth = keyrequest.validFromMonth;
-		userDb.users[userindex].validFromYear = keyrequest.validFromYear;
-		userDb.users[userindex].validToDay = keyrequest.validtoDay;
-		userDb.users[userindex].validToMonth = keyrequest.validtoMonth;
-		userDb.users[userindex].validToYear = keyrequest.validtoYear;
-		userDb.modified = userindex;
+		userDb.users[userindex].validFromDay = keyrequest->validFromDay;
+		userDb.users[userindex].validFromMonth = keyrequest->validFromMonth;
+		userDb.users[userindex].validFromYear = keyrequest->validFromYear;
+		userDb.users[userindex].validToDay = keyrequest->validtoDay;
+		userDb.users[userindex].validToMonth = keyrequest->validtoMonth;
+		userDb.users[userindex].validToYear = keyrequest->validtoYear;
+		compileAccess(userindex);
+		markDirty(userindex);
+		DOORKEEPERLOG_INFO(DKEV_USERUPDATED, userindex, 0);
 		return true;
 	}
 	return false;
 }
 
+/**
+ * \brief applies one frame of a bulk key transfer with handleAddKeyRequest /
+ * handleRemoveKeyRequest. The changes stay in RAM (dirty, not flushed) until
+ * the commit frame writes them as one journal transaction, an aborted or
+ * failed transfer is rolled back. Changes of other sessions made during a
+ * transfer are committed or rolled back with it.
+ * returns true if a response has to be sent: on errors, commit, abort and
+ * for frames with BULKACK.
+ */
+boolean DoorKeeper::handleBulkKeyRequest(const BulkKeyRequest* request,
+		BulkKeyResponse* response, DoorKeeperSession* session) {
+	ulong now = millis();
+	memset(response, 0, sizeof(BulkKeyResponse));
+	response->frame = request->frame;
+	if (bulkSession != NULL && now - bulkLastMs >= DOORKEEPERBULK_TIMEOUTMS) {
+		abortBulk();
+	}
+	if ((request->flags & BULKBEGIN) != 0) {
+		if (bulkSession != NULL && bulkSession != session) {
+			response->status_ = BULKBUSY;
+			return true;
+		}
+		if (bulkSession == session) {
+			// restarted by the client
+			abortBulk();
+		}
+		// changes made before are not part of the transfer, an abort
+		// would drop them
+		if (userDb.dirtyCount > 0 && flushUserDb(now, false) == false) {
+			response->status_ = BULKERROR;
+			return true;
+		}
+		bulkSession = session;
+		bulkFrame = 0;
+		bulkApplied = 0;
+		bulkFailed = 0;
+		DOORKEEPERLOG_INFO(DKEV_BULKSTARTED, 0, 0);
+	}
+	if (bulkSession != session) {
+		response->status_ = BULKNOTSTARTED;
+		return true;
+	}
+	bulkLastMs = now;
+	timers.start(&bulkTimer, DOORKEEPERBULK_TIMEOUTMS);
+	if ((request->flags & BULKABORT) != 0) {
+		abortBulk();
+		return true;
+	}
+	if (request->frame != bulkFrame || request->count > BULKKEYRECORDS) {
+		// lost or repeated frame
+		abortBulk();
+		response->status_ = BULKSEQUENCE;
+		return true;
+	}
+	bulkFrame++;
+
+	for (uint8_t n = 0; n < request->count; n++) {
+		if ((request->removeMask & (1 << n)) != 0) {
+			// a RemoveKeyRequest is the key only, same start as the record
+			// removing an unknown key is no error
+			if (handleRemoveKeyRequest(
+					(const RemoveKeyRequest*) request->keys[n].clientPubKey)
+					== true) {
+				bulkApplied++;
+			}
+		} else if (handleAddKeyRequest(&request->keys[n]) == true) {
+			bulkApplied++;
+		} else {
+			bulkFailed++;
+		}
+	}
+	response->applied = bulkApplied;
+	response->failed = bulkFailed;
+
+	if ((request->flags & BULKCOMMIT) != 0) {
+		commitBulk(response);
+		return true;
+	}
+	if (bulkFailed > 0) {
+		// the commit will fail, tell the client early
+		response->status_ = BULKERROR;
+		return true;
+	}
+	return (request->flags & BULKACK) != 0;
+}
+
+/**
+ * \brief writes all changes of the transfer with one journal transaction,
+ * nothing is written if a record failed or the journal is full
+ */
+void DoorKeeper::commitBulk(BulkKeyResponse* response) {
+	if (bulkFailed > 0) {
+		abortBulk();
+		response->status_ = BULKERROR;
+		return;
+	}
+	if (flushUserDb(millis(), true) == false) {
+		// no room in the journal
+		abortBulk();
+		response->status_ = BULKERROR;
+		return;
+	}
+	DOORKEEPERLOG_INFO(DKEV_BULKCOMMITTED, bulkFrame, bulkApplied);
+	bulkSession = NULL;
+	timers.cancel(&bulkTimer);
+	response->status_ = BULKOK;
+}
+
+/**
+ * \brief drops the changes of the open transfer, the modified users are
+ * read back from where they were loaded at boot (journal or EEPROM)
+ */
+void DoorKeeper::abortBulk() {
+	DOORKEEPERLOG_WARN(DKEV_BULKABORTED, bulkFrame, bulkApplied);
+	bulkSession = NULL;
+	timers.cancel(&bulkTimer);
+	if (userDbFromEeprom == true) {
+		EEPROM.begin(sizeof(Users));
+	}
+	for (unsigned int i = 0; i < sizeof(userDb.dirty); i++) {
+		uint8_t bits = userDb.dirty[i];
+		for (int k = 0; bits != 0; k++, bits >>= 1) {
+			if ((bits & 1) != 0) {
+				restoreUser(i * 8 + k);
+			}
+		}
+	}
+	if (userDbFromEeprom == true) {
+		EEPROM.end();
+	}
+	buildUserIndex();
+	clearDirty();
+}
+
+void DoorKeeper::restoreUser(int index) {
+	if (userDbFromEeprom == true) {
+		loadUser(&userDb.users[index], index);
+	} else if (journal.read(index, (uint8_t*) &userDb.users[index]) == false) {
+		memset(&userDb.users[index], 0xff, sizeof(User));
+	}
+	prepareUserKey(index);
+	compileAccess(index);
+}
+
 void DoorKeeper::getFirmware(MessagePayload* body) {
 	body->data.firmwareResponse.major = MAJOR;
 	body->data.firmwareResponse.minor = MINOR;
 	body->data.firmwareResponse.build = BUILD;
 }
 
-void DoorKeeper::switchRelais(RelaisRequest relaisRequest) {
-	DOORKEEPERDEBUG_PRINT(F("switchRelais: nr="));
-	DOORKEEPERDEBUG_HEXPRINTBYTE(relaisRequest.relaisnumber);
-	DOORKEEPERDEBUG_PRINT(F(" , state="));
-	DOORKEEPERDEBUG_HEXPRINTBYTE(relaisRequest.relaisstate);
-	DOORKEEPERDEBUG_PRINT(F(" , duration="));
-	DOORKEEPERDEBUG_HEXPRINTBYTE(relaisRequest.duration_s);
-	DOORKEEPERDEBUG_PRINTLN();
-	if (timeObj.timercallback != NULL) {
-		DOORKEEPERDEBUG_PRINTLN(F("timer active!"));
-		return;
+/**
+ * \brief switches a relay, with a duration it is switched back by its own
+ * timer. a new request for a relay replaces its running timer, the other
+ * relays are not affected
+ */
+boolean DoorKeeper::switchRelais(const RelaisRequest* relaisRequest) {
+	uint8_t nr = relaisRequest->relaisnumber;
+	uint32_t durationMs = relaisRequest->duration_s * 1000UL
+			+ relaisRequest->duration_ms;
+	DOORKEEPERLOG_INFO(DKEV_RELAIS, nr,
+			((uint32_t) relaisRequest->relaisstate << 24) | durationMs);
+	if (nr >= MAXRELAISNR || config->pins[nr].portpin == 0xff) {
+		DOORKEEPERLOG_WARN(DKEV_INVALIDRELAIS, nr, 0);
+		return false;
 	}
 	// switch ...
-	if (relaisRequest.relaisstate == RelaisStatus::OPEN
-			|| relaisRequest.relaisstate == RelaisStatus::CLOSE) {
+	if (relaisRequest->relaisstate == RelaisStatus::OPEN
+			|| relaisRequest->relaisstate == RelaisStatus::CLOSE) {
 		boolean on = false;
-		if (relaisRequest.relaisstate == RelaisStatus::CLOSE) {
+		if (relaisRequest->relaisstate == RelaisStatus::CLOSE) {
 			on = true;
 		}
-		setRelais(relaisRequest.relaisnumber, on);
-		if (relaisRequest.duration_s != 0x00) {
-			DOORKEEPERDEBUG_PRINTLN(F("activating timer"));
-			// set timer
-			timeObj.duration = relaisRequest.duration_s;
-			timeObj.relaisNr = relaisRequest.relaisnumber;
-			timeObj.state = !on;
-			timeObj.timercallback = &DoorKeeper::setRelais;
+		if (relaisTimers[nr].active == true) {
+			DOORKEEPERLOG_INFO(DKEV_TIMERACTIVE, nr,
+					timers.remaining(&relaisTimers[nr]));
+			timers.cancel(&relaisTimers[nr]);
+		}
+		setRelais(nr, on);
+		if (durationMs != 0) {
+			relaisRestore[nr] = !on;
+			timers.start(&relaisTimers[nr], durationMs);
+		}
+		return true;
+	}
+	return false;
+}
+
+/**
+ * \brief switches the relays of request->mask at once, the response has
+ * the states of all relays (read only with an empty mask)
+ */
+void DoorKeeper::handleMultiRelaisRequest(const MultiRelaisRequest* request,
+		MultiRelaisResponse* response) {
+	DOORKEEPERLOG_INFO(DKEV_RELAISMASK, request->mask, request->states);
+	if (request->mask != 0) {
+		setRelaisMask(request->mask, request->states);
+	}
+	response->states = getRelaisMask();
+	response->relais = 0;
+	for (int nr = 0; nr < MAXRELAISNR; nr++) {
+		if (config->pins[nr].portpin != 0xff) {
+			response->relais |= 1 << nr;
 		}
 	}
+}
 
+/**
+ * \brief one page of the audit log, request->from = response->next of the
+ * last page continues
+ */
+void DoorKeeper::handleAuditRequest(const AuditRequest* request,
+		AuditResponse* response) {
+	uint8_t max = request->max;
+	if (max == 0 || max > AUDITRECORDS) {
+		max = AUDITRECORDS;
+	}
+	response->count = audit.read(request->from, response->records, max,
+			&response->next);
+	response->last = audit.last();
+}
+
+/**
+ * \brief one page of the metrics (see STATSPAGES), an unknown page has no
+ * values
+ */
+void DoorKeeper::handleStatsRequest(const StatsRequest* request,
+		StatsResponse* response) {
+	uint8_t page = request->page;
+	response->page = page;
+	response->pages = STATSPAGES;
+	response->bucketShift = DOORKEEPERMETRICS_SHIFT;
+	response->cycleHz = ESP.getCpuFreqMHz() * 1000000UL;
+	uint8_t count = 0;
+	if (page == STATSCOUNTERPAGE) {
+		for (; count < DKCNT_COUNTERS; count++) {
+			response->values[count] = dkMetrics.getCounter(count);
+		}
+	} else if (page < STATSHISTOGRAMPAGE) {
+		uint8_t type = (page - STATSMESSAGEPAGE) * STATSVALUES;
+		for (; count < STATSVALUES && type < DOORKEEPERMETRICS_TYPES;
+				count++, type++) {
+			response->values[count] = dkMetrics.getMessages(type);
+		}
+	} else if (page < STATSPAGES) {
+		const DoorKeeperHistogramData* h = dkMetrics.getHistogram(
+				page - STATSHISTOGRAMPAGE);
+		response->values[count++] = h->count;
+		response->values[count++] = h->maxCycles;
+		for (uint8_t b = 0; b < DOORKEEPERMETRICS_BUCKETS; b++) {
+			response->values[count++] = h->buckets[b];
+		}
+	}
+	response->count = count;
+	if ((request->flags & STATSRESET) != 0) {
+		dkMetrics.reset();
+	}
+}
+
+/**
+ * \brief sets the relays of mask to states (bit n set: closed). GPIO 0..15
+ * are written with one store to the output register, so interlocked
+ * outputs change in the same cycle. GPIO16 is not in this register: its
+ * relay is opened before and closed after the store, it is never closed
+ * together with one still to be opened. running timers of the relays are
+ * cancelled
+ */
+void DoorKeeper::setRelaisMask(uint8_t mask, uint8_t states) {
+	uint32_t pins = 0;
+	uint32_t high = 0;
+	// GPIO16 relays to close after the store
+	uint8_t closeLater = 0;
+	for (int nr = 0; nr < MAXRELAISNR; nr++) {
+		if ((mask & (1 << nr)) == 0) {
+			continue;
+		}
+		DKPin* pin = &config->pins[nr];
+		if (pin->portpin == 0xff) {
+			DOORKEEPERLOG_WARN(DKEV_INVALIDRELAIS, nr, 0);
+			continue;
+		}
+		timers.cancel(&relaisTimers[nr]);
+		boolean closed = (states & (1 << nr)) != 0;
+		if (pin->portpin >= 16) {
+			if (closed == true) {
+				closeLater |= 1 << nr;
+			} else {
+				digitalWrite(pin->portpin, pin->OFF);
+			}
+			continue;
+		}
+		pins |= 1UL << pin->portpin;
+		if ((closed == true ? pin->ON : pin->OFF) == HIGH) {
+			high |= 1UL << pin->portpin;
+		}
+	}
+	if (pins != 0) {
+		// no interrupt may change other outputs between read and store
+		noInterrupts();
+		GPO = (GPO & ~pins) | high;
+		interrupts();
+	}
+	for (int nr = 0; nr < MAXRELAISNR; nr++) {
+		if ((closeLater & (1 << nr)) != 0) {
+			digitalWrite(config->pins[nr].portpin, config->pins[nr].ON);
+		}
+	}
+}
+
+/**
+ * \brief states of all relays from one read of the input register,
+ * bit n set: relay n closed
+ */
+uint8_t DoorKeeper::getRelaisMask() {
+	uint32_t levels = GPI;
+	uint8_t states = 0;
+	for (int nr = 0; nr < MAXRELAISNR; nr++) {
+		DKPin* pin = &config->pins[nr];
+		if (pin->portpin == 0xff) {
+			continue;
+		}
+		uint8_t level;
+		if (pin->portpin >= 16) {
+			level = digitalRead(pin->portpin);
+		} else {
+			level = (levels >> pin->portpin) & 1 ? HIGH : LOW;
+		}
+		if (level == pin->ON) {
+			states |= 1 << nr;
+		}
+	}
+	return states;
 }
 
 uint8_t DoorKeeper::getRelaisState(byte nr) {
-	DOORKEEPERDEBUG_PRINT(F("getRelais "));
-	DOORKEEPERDEBUG_PRINT(nr);
 	byte relstatus = 0x00;
 
-	if (nr > MAXRELAISNR) {
-		DOORKEEPERDEBUG_PRINTLN(F("relais nr not valid"));
+	if (nr >= MAXRELAISNR) {
+		DOORKEEPERLOG_WARN(DKEV_INVALIDRELAIS, nr, 0);
 	} else {
 		if (digitalRead(config->pins[nr].portpin) == config->pins[nr].ON) {
 			relstatus = CLOSE;
-			DOORKEEPERDEBUG_PRINTLN(F(" on"));
 		} else {
 			relstatus = OPEN;
-			DOORKEEPERDEBUG_PRINTLN(F(" off"));
 		}
 	}
 
@@ -465,241 +1429,531 @@ uint8_t DoorKeeper::getRelaisState(byte nr) {
 }
 
 void DoorKeeper::setRelais(byte nr, boolean on) {
-	DOORKEEPERDEBUG_PRINT(F("setRelais "));
-	DOORKEEPERDEBUG_PRINT(nr);
-	if (on) {
-		DOORKEEPERDEBUG_PRINTLN(F(" on"));
-	} else {
-		DOORKEEPERDEBUG_PRINTLN(F(" off"));
-	}
-
-	if (nr > MAXRELAISNR) {
-		DOORKEEPERDEBUG_PRINTLN(F("relais nr not valid"));
+	if (nr >= MAXRELAISNR || config->pins[nr].portpin == 0xff) {
+		DOORKEEPERLOG_WARN(DKEV_INVALIDRELAIS, nr, 0);
 		return;
 	}
 	digitalWrite(config->pins[nr].portpin,
-			on == true ? config->pins[nr].ON : config->pins[nr].ON);
+			on == true ? config->pins[nr].ON : config->pins[nr].OFF);
 }
 
 void DoorKeeper::setMessageType(DoorKeeperMessage* buffer, MesType type) {
 	setHeader(buffer);
 	buffer->messagetype = type;
+	buffer->reserved = 0x00;
 }
 
-boolean DoorKeeper::isAuthenticated(StartSessionRequest request,
+/**
+ * \brief returns the index of the user of a StartSessionRequest with a valid
+ * signature, INVALIDINDEX otherwise. session is not changed, a bad signature
+ * is audited for the user of the running session
+ */
+int DoorKeeper::isAuthenticated(const StartSessionRequest* request,
 		DoorKeeperSession* session) {
-	if (isValidUser(request, session) == true) {
-		DOORKEEPERDEBUG_PRINTLN(F("user valid!"));
-		if (isSignatureValid(request) == true) {
-			DOORKEEPERDEBUG_PRINTLN(F("signature valid!"));
-			return true;
-		} else {
-			DOORKEEPERDEBUG_PRINT(F("signature invalid!"));
+	int userindex = isValidUser(request);
+	if (userindex != INVALIDINDEX) {
+		uint32_t start = DOORKEEPERMETRICS_CYCLES();
+		boolean valid = isSignatureValid(request, userindex);
+		DOORKEEPERMETRICS_TIME(DKHIST_VERIFY, start);
+		if (valid == true) {
+			return userindex;
 		}
+		DOORKEEPERLOG_WARN(DKEV_SIGNATUREINVALID, userindex, 0);
+		DOORKEEPERMETRICS_COUNT(DKCNT_AUTHFAILURES);
+		audit.record(act_ms, session->userindex, AUDITDENIED, 0, 0,
+				AUDITSIGNATURE);
+	}
+	return INVALIDINDEX;
+}
+
+/**
+ * \brief new ticket for the user of a started session.
+ * the client keeps ticket and secret to resume the session without a new
+ * Curve25519 / Ed25519 handshake (see resumeSession)
+ */
+void DoorKeeper::issueTicket(TicketResponse* response,
+		DoorKeeperSession* session) {
+	arducryptticketcontent content;
+	content.expires = act_ms + DOORKEEPERTICKETLIFETIME;
+	memcpy(content.clientPubKey, userDb.users[session->userindex].userPubKey,
+			KEYSIZE);
+	for (int i = 0; i < KEYSIZE; i++) {
+		content.secret[i] = (uint8_t) RANDOM_REG32;
+	}
+	acrypt.sealTicket(&ticketKey, &content, &response->ticket);
+	memcpy(response->secret, content.secret, KEYSIZE);
+	DOORKEEPERLOG_INFO(DKEV_TICKETISSUED, session->userindex,
+			content.expires);
+	memset(&content, 0, sizeof(content));
+}
+
+/**
+ * \brief starts a session from a ticket, symmetric operations only.
+ * ticket has to be sealed by this server and not expired, client has to
+ * prove the ticket secret and the user has to be still valid.
+ * a failed resume leaves the running session of the connection unchanged.
+ */
+boolean DoorKeeper::resumeSession(const ResumeSessionRequest* request,
+		ResumeSessionResponse* response, DoorKeeperSession* session) {
+	arducryptticketcontent content;
+	uint8_t proof[TICKETMACSIZE];
+	boolean resumed = false;
+
+	// the running session stays as it is until the ticket is accepted
+	if (acrypt.openTicket(&ticketKey, &request->ticket, &content) == false) {
+		DOORKEEPERLOG_WARN(DKEV_TICKETINVALID, 0, 0);
+		DOORKEEPERMETRICS_COUNT(DKCNT_AUTHFAILURES);
+		return false;
+	}
+	arducrypt::ticketProof(content.secret, &request->ticket,
+			request->clientNonce, proof);
+	if (arducrypt::verifyProof(proof, request->proof) == false) {
+		DOORKEEPERLOG_WARN(DKEV_TICKETINVALID, 1, 0);
+	} else if ((int32_t) (content.expires - (uint32_t) act_ms) <= 0) {
+		DOORKEEPERLOG_WARN(DKEV_TICKETEXPIRED, 0, content.expires);
 	} else {
-		DOORKEEPERDEBUG_PRINT(F("no valid user!"));
+		int userindex = findUser(content.clientPubKey);
+		if (userindex == INVALIDINDEX) {
+			DOORKEEPERLOG_WARN(DKEV_UNKNOWNUSER, 0, 0);
+		} else if (checkValidation(userindex) == false) {
+			DOORKEEPERLOG_WARN(DKEV_USEREXPIRED, userindex, 0);
+			audit.record(act_ms, userindex, AUDITDENIED, 0, 0, AUDITEXPIRED);
+		} else {
+			// wipes the keys of the running session
+			endSession(session);
+			acrypt.resumeSession(&session->cryptSession, content.secret,
+					request->clientNonce);
+			memcpy(response->sessionIV, session->cryptSession.iv, IVSIZE);
+			arducrypt::serverProof(content.secret, request->clientNonce,
+					response->sessionIV, response->proof);
+			session->userindex = userindex;
+			resumed = true;
+		}
 	}
-	return false;
+	if (resumed == false) {
+		DOORKEEPERMETRICS_COUNT(DKCNT_AUTHFAILURES);
+	}
+	memset(&content, 0, sizeof(content));
+	return resumed;
 }
 
-int DoorKeeper::findUser(uint8_t* userkey) {
-	for (int index = 0; index < MAXUSERS; index++) {
-		if (memcmp(userDb.users[index].userPubKey, userkey,
-		KEYSIZE) == 0) {
+int DoorKeeper::findUser(const uint8_t* userkey) {
+	uint32_t slot = userHash(userkey) & (USERINDEXSIZE - 1);
+	while (userIndex[slot] != INVALIDINDEX) {
+		int index = userIndex[slot];
+		if (memcmp(userDb.users[index].userPubKey, userkey, KEYSIZE) == 0) {
 			return index;
 		}
+		slot = (slot + 1) & (USERINDEXSIZE - 1);
 	}
 	return INVALIDINDEX;
 }
 
-boolean DoorKeeper::fromDateValid(int userindex, uint8_t actYear,
-		uint8_t actMonth, uint8_t actDay) {
-	DOORKEEPERDEBUG_PRINT(F("valid from y/m/d "));
-	DOORKEEPERDEBUG_PRINT(userDb.users[userindex].validFromYear);
-	DOORKEEPERDEBUG_PRINT(F("/"));
-	DOORKEEPERDEBUG_PRINT(userDb.users[userindex].validFromMonth);
-	DOORKEEPERDEBUG_PRINT(F("/"));
-	DOORKEEPERDEBUG_PRINTLN(userDb.users[userindex].validFromDay);
-	if ((userDb.users[userindex].validFromYear == 0xff)
-			&& (userDb.users[userindex].validFromMonth == 0xff)
-			&& (userDb.users[userindex].validFromDay == 0xff)) {
-		// valid from now ;)
-		return true;
-	} else if ((userDb.users[userindex].validFromYear < actYear)
-			|| ((userDb.users[userindex].validFromYear == actYear)
-					&& (userDb.users[userindex].validFromMonth < actMonth))
-			|| ((userDb.users[userindex].validFromYear == actYear)
-					&& (userDb.users[userindex].validFromMonth == actMonth)
-					&& (userDb.users[userindex].validFromDay <= actDay))) {
-		return true;
-	}
-	return false;
+/**
+ * \brief user may enter now: date and hour of the week (see updateTime)
+ * against its compiled dates and schedule
+ */
+boolean DoorKeeper::checkValidation(int userindex) {
+	return policy.allowed(userindex);
 }
 
-boolean DoorKeeper::toDateValid(int userindex, uint8_t actYear,
-		uint8_t actMonth, uint8_t actDay) {
-	DOORKEEPERDEBUG_PRINT(F("valid till y/m/d "));
-	DOORKEEPERDEBUG_PRINT(userDb.users[userindex].validToYear);
-	DOORKEEPERDEBUG_PRINT(F("/"));
-	DOORKEEPERDEBUG_PRINT(userDb.users[userindex].validToMonth);
-	DOORKEEPERDEBUG_PRINT(F("/"));
-	DOORKEEPERDEBUG_PRINTLN(userDb.users[userindex].validToDay);
-	if ((userDb.users[userindex].validToYear > actYear)
-			|| ((userDb.users[userindex].validToYear == actYear)
-					&& (userDb.users[userindex].validToMonth > actMonth))
-			|| ((userDb.users[userindex].validToYear == actYear)
-					&& (userDb.users[userindex].validToMonth == actMonth)
-					&& (userDb.users[userindex].validToDay >= actDay))) {
-		return true;
+/**
+ * \brief compiles dates and schedule of a user for checkValidation. admins
+ * are always allowed, free entries never
+ */
+void DoorKeeper::compileAccess(int index) {
+	User* user = &userDb.users[index];
+	if (isFreeUser(index) == true) {
+		policy.never(index);
+	} else if (isAdminUser(index) == true) {
+		policy.always(index);
+	} else {
+		policy.compile(index, &user->validFromYear, &user->validToYear,
+				user->schedule);
 	}
-	return false;
 }
 
-boolean DoorKeeper::checkValidation(int userindex) {
+/**
+ * \brief current date and hour of the week from the time source
+ */
+void DoorKeeper::updateTime() {
+	if (t == NULL) {
+		return;
+	}
 	// is this true ??
 	uint8_t year = t->tm_year - 2000;
 	// is 0 .. 11
 	uint8_t month = t->tm_mon + 1;
-	uint8_t day = t->tm_mday;
-	DOORKEEPERDEBUG_PRINT(F("act date y/m/d "));
-	DOORKEEPERDEBUG_PRINT(year);
-	DOORKEEPERDEBUG_PRINT(F("/"));
-	DOORKEEPERDEBUG_PRINT(month);
-	DOORKEEPERDEBUG_PRINT(F("/"));
-	DOORKEEPERDEBUG_PRINTLN(day);
-
-	if ((fromDateValid(userindex, year, month, day) == true)
-			&& (toDateValid(userindex, year, month, day))) {
-		return true;
+	policy.setTime(year, month, t->tm_mday, t->tm_wday, t->tm_hour);
+}
+
+/**
+ * \brief sets the schedule of a user (admin session only)
+ */
+uint8_t DoorKeeper::handleScheduleRequest(const ScheduleRequest* request) {
+	int userindex = findUser(request->clientPubKey);
+	if (userindex == INVALIDINDEX) {
+		return SCHEDULEUNKNOWNUSER;
 	}
-	return false;
+	if (policy.isSchedule(request->schedule) == false) {
+		return SCHEDULEINVALID;
+	}
+	userDb.users[userindex].schedule = request->schedule;
+	compileAccess(userindex);
+	markDirty(userindex);
+	DOORKEEPERLOG_INFO(DKEV_SCHEDULESET, userindex, request->schedule);
+	return SCHEDULEOK;
 }
 
-boolean DoorKeeper::isValidUser(StartSessionRequest request,
-		DoorKeeperSession* session) {
-	int userindex = findUser(request.clientPubKey);
+/**
+ * \brief index of the known and valid user of request, INVALIDINDEX
+ * otherwise
+ */
+int DoorKeeper::isValidUser(const StartSessionRequest* request) {
+	int userindex = findUser(request->clientPubKey);
 	if (userindex == INVALIDINDEX) {
-		return false;
+		DOORKEEPERLOG_WARN(DKEV_UNKNOWNUSER, 0, 0);
+		DOORKEEPERMETRICS_COUNT(DKCNT_AUTHFAILURES);
+		return INVALIDINDEX;
 	}
-	if (checkValidation(userindex) == true) {
-		session->userindex = userindex;
-		return true;
-	} else {
-		DOORKEEPERDEBUG_PRINTLN(F("Userkey expired!"));
-		session->userindex = INVALIDINDEX;
+	if (checkValidation(userindex) == false) {
+		DOORKEEPERLOG_WARN(DKEV_USEREXPIRED, userindex, 0);
+		DOORKEEPERMETRICS_COUNT(DKCNT_AUTHFAILURES);
+		audit.record(act_ms, userindex, AUDITDENIED, 0, 0, AUDITEXPIRED);
+		return INVALIDINDEX;
 	}
-	return false;
+	return userindex;
 }
 
 boolean DoorKeeper::isAdminSession(DoorKeeperSession* session) {
-	return isAdminUser(session->userindex);
+	if (isAdminUser(session->userindex) == true) {
+		return true;
+	}
+	DOORKEEPERLOG_WARN(DKEV_NOADMIN, session->userindex, 0);
+	DOORKEEPERMETRICS_COUNT(DKCNT_AUTHFAILURES);
+	return false;
 }
 
 boolean DoorKeeper::isAdminUser(int index) {
 	if ((userDb.users[index].validToYear == 0xee)
 			&& (userDb.users[index].validToMonth == 0xee)
 			&& (userDb.users[index].validToDay == 0xee)) {
-		DOORKEEPERDEBUG_PRINTLN(F("user is admin!"));
 		return true;
 	}
-	DOORKEEPERDEBUG_PRINTLN(F("user is NO admin!"));
 	return false;
 }
 
-boolean DoorKeeper::isSignatureValid(StartSessionRequest request) {
+boolean DoorKeeper::isSignatureValid(const StartSessionRequest* request,
+		int userindex) {
+	if (userKeyValid[userindex] == true) {
+		return acrypt.validateSignature(
+				(arducryptsignature*) request->signature,
+				(uint8_t*) request->sessionClientPubKey, KEYSIZE,
+				(arducryptkey*) request->clientPubKey, &userKeys[userindex]);
+	}
 	bool verified = acrypt.validateSignature(
-			(arducryptsignature*) &request.signature,
-			(uint8_t*) &request.sessionClientPubKey, KEYSIZE,
-			(arducryptkey*) &request.clientPubKey);
+			(arducryptsignature*) request->signature,
+			(uint8_t*) request->sessionClientPubKey, KEYSIZE,
+			(arducryptkey*) request->clientPubKey);
 
 	return verified;
 }
 
+/**
+ * \brief decodes the public key of user 'index' once, so that a handshake
+ * does not have to decompress it again (see isSignatureValid)
+ */
+void DoorKeeper::prepareUserKey(int index) {
+	userKeyValid[index] = false;
+	if (isFreeUser(index) == true) {
+		// free entry
+		return;
+	}
+	userKeyValid[index] = arducrypt::preparePublicKey(&userKeys[index],
+			(arducryptkey*) userDb.users[index].userPubKey);
+}
+
 void DoorKeeper::setHeader(DoorKeeperMessage* doorkeeperBuffer) {
-	doorkeeperBuffer->headerbyte1 = 0x23;
-	doorkeeperBuffer->headerbyte2 = 0x42;
+	doorkeeperBuffer->headerbyte1 = DOORKEEPERFRAME_HEADER1;
+	doorkeeperBuffer->headerbyte2 = DOORKEEPERFRAME_HEADER2;
 }
 
 void DoorKeeper::loadUser(User* user, int userIndex) {
 	if (userIndex < 0 || userIndex >= MAXUSERS) {
 		return;
 	}
-	int address = sizeof(User);
+	// the EEPROM layout has no schedule
+	const int size = offsetof(User, schedule);
+	int address = size;
 	address *= userIndex;
 	uint8_t* userPtr = (uint8_t*) user;
-	for (unsigned int i = 0; i < sizeof(User); i++) {
+	for (int i = 0; i < size; i++) {
 		*userPtr = EEPROM.read(address + i);
 		userPtr++;
 	}
+	user->schedule = DOORKEEPERPOLICY_NONE;
 	DOORKEEPERDEBUG_PRINT(F("load user: "));
 	DOORKEEPERDEBUG_HEXPRINT((uint8_t* )user, sizeof(User));
 }
 
-void DoorKeeper::storeUser(User* user, int userIndex) {
+/**
+ * \brief appends the user to the flash journal, free entries as delete record.
+ * written with the next journal.commit(). returns false if the record is
+ * lost (a full batch could not be written).
+ * while the users are read from EEPROM (no journal sectors, or the journal
+ * has not taken over yet) the user is written to EEPROM instead, between
+ * EEPROM.begin() and EEPROM.commit() of the caller
+ */
+boolean DoorKeeper::storeUser(User* user, int userIndex) {
 	if (userIndex < 0 || userIndex >= MAXUSERS) {
-		DOORKEEPERDEBUG_PRINT(F("invalid index: "));
-		DOORKEEPERDEBUG_PRINTLN(userIndex);
-		return;
+		return false;
 	}
-	EEPROM.begin(sizeof(Users));
-	int address = sizeof(User);
-	address *= userIndex;
-	uint8_t* userPtr = (uint8_t*) user;
-	for (unsigned int i = 0; i < sizeof(User); i++) {
-		EEPROM.write(address + i, *userPtr);
-		userPtr++;
+	boolean stored;
+	if (userDbFromEeprom == true) {
+		// the EEPROM layout has no schedule
+		const int size = offsetof(User, schedule);
+		uint8_t* userPtr = (uint8_t*) user;
+		for (int i = 0; i < size; i++) {
+			EEPROM.write(userIndex * size + i, userPtr[i]);
+		}
+		stored = true;
+	} else if (user->validToDay == 0xff) {
+		stored = journal.remove(userIndex);
+	} else {
+		stored = journal.append(userIndex, (uint8_t*) user);
 	}
-	EEPROM.end();
-	DOORKEEPERDEBUG_PRINT(F("store user: "));
-	DOORKEEPERDEBUG_HEXPRINT((uint8_t* )user, sizeof(User));
+	if (stored == true) {
+		DOORKEEPERLOG_INFO(DKEV_USERSTORED, userIndex, 0);
+	}
+	return stored;
 }
 
-void DoorKeeper::storeUserIndex(int index) {
-	storeUser(&userDb.users[index], index);
+boolean DoorKeeper::storeUserIndex(int index) {
+	return storeUser(&userDb.users[index], index);
 }
 
+/**
+ * \brief reads the user db from EEPROM (layout before the journal)
+ */
 void DoorKeeper::loadUserDb() {
+	EEPROM.begin(sizeof(Users));
 	for (int i = 0; i < MAXUSERS; i++) {
 		loadUser(&userDb.users[i], i);
 	}
-	userDb.modified = INVALIDINDEX;
+	EEPROM.end();
 }
 
+/**
+ * \brief replays the flash journal. until the journal has taken over the
+ * EEPROM user db, the users are read from EEPROM; with saveDB they are
+ * copied to the journal, without it the flash is only read. without usable
+ * journal sectors the users stay in EEPROM and are written there.
+ */
 void DoorKeeper::initUserDb() {
-	EEPROM.begin(sizeof(Users));
-	loadUserDb();
-	EEPROM.end();
+	memset(userDb.users, 0xff, sizeof(userDb.users));
+	userDbFromEeprom = false;
+	if (journal.begin(config->journalSector, journalPositions,
+			(uint8_t*) userDb.users, sizeof(User), MAXUSERS, config->saveDB)
+			== false) {
+		loadUserDb();
+		userDbFromEeprom = true;
+		boolean stored = config->saveDB;
+		for (int i = 0; i < MAXUSERS && stored == true; i++) {
+			if (isFreeUser(i) == false) {
+				stored = journal.append(i, (uint8_t*) &userDb.users[i]);
+			}
+		}
+		// the next boot reads EEPROM again if the copy is not complete
+		if (stored == true && journal.takeOver() == true) {
+			userDbFromEeprom = false;
+		}
+	}
+	for (int i = 0; i < MAXUSERS; i++) {
+		prepareUserKey(i);
+		compileAccess(i);
+	}
+	buildUserIndex();
+	clearDirty();
 }
 
 void DoorKeeper::dumpUserDb() {
 	DOORKEEPERDEBUG_PRINT(F("userdb: "));
-	int x = sizeof(User) * MAXUSERS;
-	DOORKEEPERDEBUG_HEXPRINT((uint8_t * )&userDb, x);
+	DOORKEEPERDEBUG_HEXPRINT((uint8_t * )&userDb, sizeof(User) * MAXUSERS);
 
 }
 
 void DoorKeeper::eraseDB() {
-	DOORKEEPERDEBUG_PRINTLN(F("eraseDB!!!!!!!"));
+	DOORKEEPERLOG_WARN(DKEV_DBERASED, 0, 0);
+	if (userDbFromEeprom == true) {
+		EEPROM.begin(sizeof(Users));
+	}
 	for (int i = 0; i < MAXUSERS; i++) {
-		memset(&userDb.users[i], 0xff, sizeof(User));
-		storeUser(&userDb.users[i], i);
+		if (isFreeUser(i) == false) {
+			memset(&userDb.users[i], 0xff, sizeof(User));
+			userKeyValid[i] = false;
+			policy.never(i);
+			storeUser(&userDb.users[i], i);
+		}
 	}
+	if (userDbFromEeprom == true) {
+		EEPROM.end();
+	} else {
+		journal.commit();
+	}
+	buildUserIndex();
+}
+
+void DoorKeeper::markDirty(int index) {
+	uint8_t bit = 1 << (index & 7);
+	lastDirtyMs = millis();
+	if ((userDb.dirty[index >> 3] & bit) == 0) {
+		userDb.dirty[index >> 3] |= bit;
+		if (userDb.dirtyCount == 0) {
+			firstDirtyMs = lastDirtyMs;
+		}
+		userDb.dirtyCount++;
+	}
+}
+
+void DoorKeeper::clearDirty() {
+	memset(userDb.dirty, 0, sizeof(userDb.dirty));
+	userDb.dirtyCount = 0;
+}
+
+/**
+ * \brief writes all modified users with one journal commit.
+ * atomic: as journal transaction, dropped as a whole if interrupted.
+ * returns false if the journal could not take them, the users stay
+ * modified then
+ */
+boolean DoorKeeper::flushUserDb(ulong now, boolean atomic) {
+	if (config->saveDB == false) {
+		DOORKEEPERLOG_INFO(DKEV_DBNOTSAVED, userDb.dirtyCount, 0);
+		clearDirty();
+		return true;
+	}
+	uint32_t commitsBefore = journal.getStats().commits;
+	boolean written;
+	if (userDbFromEeprom == true) {
+		EEPROM.begin(sizeof(Users));
+		written = true;
+	} else {
+		written = atomic == false
+				|| journal.beginTransaction(userDb.dirtyCount) == true;
+	}
+	for (unsigned int i = 0; i < sizeof(userDb.dirty) && written == true;
+			i++) {
+		uint8_t bits = userDb.dirty[i];
+		for (int k = 0; bits != 0 && written == true; k++, bits >>= 1) {
+			if ((bits & 1) != 0) {
+				written = storeUserIndex(i * 8 + k);
+			}
+		}
+	}
+	if (userDbFromEeprom == true) {
+		// one EEPROM commit for all users, atomic like a transaction
+		written = EEPROM.commit();
+		EEPROM.end();
+	} else if (written == false) {
+		// without end marker the records written so far are not replayed
+		journal.abortTransaction();
+	} else if (atomic == true) {
+		written = journal.endTransaction();
+	} else {
+		written = journal.commit();
+	}
+
+	flushStats.flushes++;
+	flushStats.commits += journal.getStats().commits - commitsBefore;
+	flushFailed = written == false;
+	if (written == false) {
+		// the users stay modified, doorkeeperLoop tries again
+		DOORKEEPERLOG_ERROR(DKEV_DBFLUSHFAILED, userDb.dirtyCount, 0);
+		flushStats.failures++;
+		failedFlushMs = now;
+		return false;
+	}
+	flushStats.records += userDb.dirtyCount;
+	flushStats.lastLatencyMs = now - firstDirtyMs;
+	if (flushStats.lastLatencyMs > flushStats.maxLatencyMs) {
+		flushStats.maxLatencyMs = flushStats.lastLatencyMs;
+	}
+	clearDirty();
+	return true;
 }
 
 void DoorKeeper::doorkeeperLoop() {
 
-	int modifiedIndex = userDb.modified;
-	if (modifiedIndex != INVALIDINDEX) {
-		if (config->saveDB == false) {
-			DOORKEEPERDEBUG_PRINTLN(
-					F("dbsave is set to false! do not store to eeprom!"));
-		} else {
-			DOORKEEPERDEBUG_PRINT(F("db was modified ... updating entry "));
-			DOORKEEPERDEBUG_PRINTLN(modifiedIndex);
-			storeUserIndex(modifiedIndex);
+	// changes of an open bulk transfer are only written by its commit, a
+	// stalled transfer is aborted by its timer (checkTimer)
+	if (bulkSession == NULL && userDb.dirtyCount > 0) {
+		ulong now = millis();
+		if (flushFailed == true) {
+			// give compaction time to make room
+			if (now - failedFlushMs >= config->flushMaxDelayMs) {
+				flushUserDb(now, false);
+			}
+		} else if (userDb.dirtyCount >= config->flushThreshold
+				|| now - lastDirtyMs >= config->flushQuietMs
+				|| now - firstDirtyMs >= config->flushMaxDelayMs) {
+			flushUserDb(now, false);
 		}
-		userDb.modified = INVALIDINDEX;
 	}
+
+	audit.flushStep(millis(), false);
+
+	// format log records and precompute session keys only if there was no
+	// traffic in the last pass
+	if (busy == false) {
+		dkLog.drain(DOORKEEPERLOG_DRAINMAX);
+		acrypt.refillKeyPool();
+		journal.compactStep();
+	}
+	busy = false;
+}
+
+/**
+ * \brief writes the modified users now, an open bulk transfer is dropped
+ */
+void DoorKeeper::flush() {
+	if (bulkSession != NULL) {
+		abortBulk();
+	}
+	if (userDb.dirtyCount > 0) {
+		flushUserDb(millis(), false);
+	}
+	while (audit.flushStep(millis(), true) == true) {
+	}
+}
+
+/**
+ * \brief hit / miss counters of the ephemeral key pool
+ */
+arducryptpoolstats DoorKeeper::getKeyPoolStats() {
+	return acrypt.getKeyPoolStats();
+}
+
+/**
+ * \brief write-behind counters of the user db
+ */
+DoorKeeperFlushStats DoorKeeper::getFlushStats() {
+	DoorKeeperFlushStats stats = flushStats;
+	stats.pending = userDb.dirtyCount;
+	return stats;
+}
+
+/**
+ * \brief records and flash writes of the audit log
+ */
+DoorKeeperAuditStats DoorKeeper::getAuditStats() {
+	return audit.getStats();
+}
+
+/**
+ * \brief appends, compactions and erase counters of the user journal
+ */
+DoorKeeperJournalStats DoorKeeper::getJournalStats() {
+	return journal.getStats();
 }
 
 User* DoorKeeper::getUser(int index) {
@@ -710,9 +1964,16 @@ User* DoorKeeper::getUser(int index) {
 }
 
 void DoorKeeper::addUser(User* user) {
-	DOORKEEPERDEBUG_PRINTLN(F("add user to db"));
-
-	int index = getFreeUser();
+	int index = findUser(user->userPubKey);
+	if (index != INVALIDINDEX) {
+		// already loaded from flash, update validity only
+		userDb.users[index].validToDay = user->validToDay;
+		userDb.users[index].validToMonth = user->validToMonth;
+		userDb.users[index].validToYear = user->validToYear;
+		compileAccess(index);
+		return;
+	}
+	index = getFreeUser();
 	if (index != INVALIDINDEX) {
 		for (int i = 0; i < KEYSIZE; i++) {
 			userDb.users[index].userPubKey[i] = user->userPubKey[i];
@@ -720,8 +1981,11 @@ void DoorKeeper::addUser(User* user) {
 		userDb.users[index].validToDay = user->validToDay;
 		userDb.users[index].validToMonth = user->validToMonth;
 		userDb.users[index].validToYear = user->validToYear;
+		indexUser(index);
+		prepareUserKey(index);
+		compileAccess(index);
 	} else {
-		DOORKEEPERDEBUG_PRINTLN(F("no free entry available!"));
+		DOORKEEPERLOG_ERROR(DKEV_DBFULL, 0, 0);
 	}
 
 }
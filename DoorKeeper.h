@@ -25,10 +25,18 @@
 
 #include <arducrypt.h>
 #include <Arduino.h>
+#include <DoorKeeperAudit.h>
+#include <DoorKeeperJournal.h>
+#include <DoorKeeperLog.h>
+#include <DoorKeeperMetrics.h>
+#include <DoorKeeperPolicy.h>
+#include <DoorKeeperTimer.h>
 #include <stdint.h>
 #include <sys/types.h>
 
-#define DOORKEEPERDEBUG 1
+// verbose, blocking hex dumps for development only.
+// define DOORKEEPERDEBUG (build flag) to enable, see DoorKeeperLog.h for
+// the event log which is on by default.
 
 #ifdef DOORKEEPERDEBUG
 #define DOORKEEPERDEBUG_HEXPRINT(x,y) arducrypt::printHex(x,y)
@@ -74,7 +82,21 @@ enum MesType
 	ADDKEYREQUEST = 0x06,
 	ADDKEYRESPONSE = 0x07,
 	REMOVEKEYREQUEST = 0x08,
-	REMOVEKEYRESPONSE = 0x09
+	REMOVEKEYRESPONSE = 0x09,
+	TICKETREQUEST = 0x0a,
+	TICKETRESPONSE = 0x0b,
+	BULKKEYREQUEST = 0x0c,
+	BULKKEYRESPONSE = 0x0d,
+	MULTIRELAISREQUEST = 0x0e,
+	MULTIRELAISRESPONSE = 0x0f,
+	RESUMESESSIONREQUEST = 0x11,
+	RESUMESESSIONRESPONSE = 0x21,
+	SCHEDULEREQUEST = 0x12,
+	SCHEDULERESPONSE = 0x13,
+	AUDITREQUEST = 0x14,
+	AUDITRESPONSE = 0x15,
+	STATSREQUEST = 0x16,
+	STATSRESPONSE = 0x17
 
 };
 typedef uint8_t MessageType;
@@ -92,6 +114,22 @@ struct StartSessionResponse {
 	uint8_t signature[SIGNATURESIZE];
 };
 
+struct TicketResponse {
+	arducryptticket ticket;
+	uint8_t secret[KEYSIZE];
+};
+
+struct ResumeSessionRequest {
+	arducryptticket ticket;
+	uint8_t clientNonce[TICKETNONCESIZE];
+	uint8_t proof[TICKETMACSIZE];
+};
+
+struct ResumeSessionResponse {
+	uint8_t sessionIV[IVSIZE];
+	uint8_t proof[TICKETMACSIZE];
+};
+
 struct FirmwareResponse {
 	uint8_t major;
 	uint8_t minor;
@@ -110,7 +148,24 @@ struct StatusResponse {
 struct RelaisRequest {
 	uint8_t relaisnumber;
 	uint8_t relaisstate;
+	// switched back after duration_s * 1000 + duration_ms, 0: stays
 	uint8_t duration_s;
+	uint8_t reserved;
+	uint16_t duration_ms;
+};
+
+struct MultiRelaisRequest {
+	// relays to switch, bit n: relay n. 0: only read the states
+	uint8_t mask;
+	// bit n set: relay n closed, clear: open
+	uint8_t states;
+};
+
+struct MultiRelaisResponse {
+	// bit n set: relay n closed
+	uint8_t states;
+	// bit n set: relay n has a pin
+	uint8_t relais;
 };
 
 struct AddKeyRequest {
@@ -135,21 +190,145 @@ struct RemoveKeyResponse {
 	uint8_t status_;
 };
 
+enum ScheduleStatus
+	: uint8_t {
+		SCHEDULEOK = 0x00,
+	SCHEDULEUNKNOWNUSER = 0x01,
+	SCHEDULEINVALID = 0x02
+};
+
+struct ScheduleRequest {
+	uint8_t clientPubKey[KEYSIZE];
+	// DoorKeeperConfig schedule (1 ..), 0: none
+	uint8_t schedule;
+};
+
+struct ScheduleResponse {
+	uint8_t status_;
+};
+
+// audit records per AuditResponse
+#define AUDITRECORDS 7
+
+struct AuditRequest {
+	// first sequence number, 0: oldest
+	uint32_t from;
+	// max. records, 0: AUDITRECORDS
+	uint8_t max;
+};
+
+struct AuditResponse {
+	// sequence number for the next request
+	uint32_t next;
+	// newest sequence number
+	uint32_t last;
+	uint8_t count;
+	uint8_t reserved[3];
+	DoorKeeperAuditRecord records[AUDITRECORDS];
+};
+
+// values per StatsResponse
+#define STATSVALUES 24
+
+/*
+ * pages of the metrics: counters (DoorKeeperCounter), received messages per
+ * type (STATSVALUES types per page), one page per histogram
+ * (DoorKeeperHistogram: count, maxCycles, buckets)
+ */
+#define STATSCOUNTERPAGE 0
+#define STATSMESSAGEPAGE 1
+#define STATSHISTOGRAMPAGE (STATSMESSAGEPAGE \
+	+ (DOORKEEPERMETRICS_TYPES + STATSVALUES - 1) / STATSVALUES)
+#define STATSPAGES (STATSHISTOGRAMPAGE + DKHIST_HISTOGRAMS)
+
+enum StatsFlags
+	: uint8_t {
+		// clears all metrics after this page was read
+	STATSRESET = 0x01
+};
+
+struct StatsRequest {
+	uint8_t page;
+	uint8_t flags;
+};
+
+struct StatsResponse {
+	uint8_t page;
+	uint8_t pages;
+	// values used
+	uint8_t count;
+	// histogram bucket n starts at 2^(n + bucketShift) cycles (n > 0)
+	uint8_t bucketShift;
+	// cycles per second of the histograms
+	uint32_t cycleHz;
+	uint32_t values[STATSVALUES];
+};
+
+// key records per BulkKeyRequest frame
+#define BULKKEYRECORDS 3
+
+enum BulkKeyFlags
+	: uint8_t {
+		BULKBEGIN = 0x01, BULKCOMMIT = 0x02, BULKABORT = 0x04, BULKACK = 0x08
+};
+
+enum BulkKeyStatus
+	: uint8_t {
+		BULKOK = 0x00,
+	BULKERROR = 0x01,
+	BULKSEQUENCE = 0x02,
+	BULKBUSY = 0x03,
+	BULKNOTSTARTED = 0x04
+};
+
+struct BulkKeyRequest {
+	uint8_t flags;
+	// records used in this frame
+	uint8_t count;
+	// bit n set: keys[n] is removed
+	uint8_t removeMask;
+	uint8_t reserved;
+	// frame number in the transfer, starting with 0
+	uint16_t frame;
+	AddKeyRequest keys[BULKKEYRECORDS];
+};
+
+struct BulkKeyResponse {
+	uint8_t status_;
+	uint8_t reserved;
+	uint16_t frame;
+	uint16_t applied;
+	uint16_t failed;
+};
+
 struct CustomRequest {
-	uint8_t data[];
+	uint8_t data[ARDUCRYPTMESSAGESIZE];
 };
 
 union MessageData {
 	StartSessionRequest startSessionRequest;
 	StartSessionResponse startSessionResponse;
+	TicketResponse ticketResponse;
+	ResumeSessionRequest resumeSessionRequest;
+	ResumeSessionResponse resumeSessionResponse;
 	FirmwareResponse firmwareResponse;
 	StatusRequest statusRequest;
 	StatusResponse statusResponse;
 	RelaisRequest relaisRequest;
+	MultiRelaisRequest multiRelaisRequest;
+	MultiRelaisResponse multiRelaisResponse;
 	AddKeyRequest addKeyRequest;
 	AddKeyResponse addKeyResponse;
 	RemoveKeyRequest removeKeyRequest;
 	RemoveKeyResponse removeKeyResponse;
+	ScheduleRequest scheduleRequest;
+	ScheduleResponse scheduleResponse;
+	AuditRequest auditRequest;
+	AuditResponse auditResponse;
+	StatsRequest statsRequest;
+	StatsResponse statsResponse;
+	BulkKeyRequest bulkKeyRequest;
+	BulkKeyResponse bulkKeyResponse;
 	CustomRequest custom;
 };
 
@@ -168,7 +347,43 @@ struct __attribute__((packed)) DoorKeeperMessage {
 
 const uint32_t DoorKeeperMessageSize = sizeof(DoorKeeperMessage);
 
+/*
+ * Compact frames (see protocol.md): header2 0x43 and a length byte after the
+ * header, only length data bytes and the checksum are sent. A client asks
+ * for them with DOORKEEPERFRAME_COMPACT in the reserved byte of the
+ * StartSession/ResumeSession request, the response echoes the bit if the
+ * server accepts. Fixed frames are always accepted.
+ *
+ * AEAD frames (header2 0x44, DOORKEEPERFRAME_AEAD) have the same layout but
+ * a ChaCha20-Poly1305 tag instead of the checksum. Once negotiated, encrypted
+ * messages of the session are only accepted in AEAD frames.
+ */
+#define DOORKEEPERFRAME_HEADER1 0x23
+#define DOORKEEPERFRAME_HEADER2 0x42
+#define DOORKEEPERFRAME_COMPACTHEADER2 0x43
+#define DOORKEEPERFRAME_AEADHEADER2 0x44
+#define DOORKEEPERFRAME_COMPACT 0x01
+#define DOORKEEPERFRAME_AEAD 0x02
+// header of a compact frame incl. length byte
+#define DOORKEEPERCOMPACTHEADERSIZE 5
+// buffer size for handleFrame
+#define DOORKEEPERFRAMEMAXSIZE (DOORKEEPERCOMPACTHEADERSIZE \
+		+ ARDUCRYPTMESSAGESIZE + ARDUCRYPTTAGSIZE)
+
+#ifndef MAXUSERS
 #define MAXUSERS 10
+#endif
+
+/**
+ * \brief smallest power of 2 >= n
+ */
+constexpr int userIndexSize(int n) {
+	return n <= 1 ? 1 : 2 * userIndexSize((n + 1) / 2);
+}
+
+// slots of the user key hash index, at most half of them are used
+#define USERINDEXSIZE userIndexSize(2 * MAXUSERS)
+
 struct User {
 	uint8_t userPubKey[KEYSIZE];
 	uint8_t validFromYear;
@@ -177,16 +392,84 @@ struct User {
 	uint8_t validToYear;
 	uint8_t validToMonth;
 	uint8_t validToDay;
+	// DoorKeeperConfig schedule (1 ..), 0 / 0xff: none
+	uint8_t schedule;
 };
 struct Users {
 	User users[MAXUSERS];
-	int modified;
+	// entries changed since the last flush
+	uint8_t dirty[(MAXUSERS + 7) / 8];
+	uint16_t dirtyCount;
+};
+
+// write-behind: modified users are flushed after a quiet period, when
+// this many are pending or at the latest MAXDELAYMS after the first change
+#ifndef DOORKEEPERFLUSH_QUIETMS
+#define DOORKEEPERFLUSH_QUIETMS 500
+#endif
+#ifndef DOORKEEPERFLUSH_MAXDELAYMS
+#define DOORKEEPERFLUSH_MAXDELAYMS 5000
+#endif
+#ifndef DOORKEEPERFLUSH_THRESHOLD
+#define DOORKEEPERFLUSH_THRESHOLD 8
+#endif
+
+/**
+ * flush counters, latency = time from the first change to its flush
+ */
+struct DoorKeeperFlushStats {
+	uint32_t flushes;
+	uint32_t records;
+	uint32_t commits;
+	uint32_t lastLatencyMs;
+	uint32_t maxLatencyMs;
+	// flushes the journal could not take, retried after flushMaxDelayMs
+	uint32_t failures;
+	uint16_t pending;
 };
 
+// a bulk key transfer without a frame for this long is aborted
+#ifndef DOORKEEPERBULK_TIMEOUTMS
+#define DOORKEEPERBULK_TIMEOUTMS 10000
+#endif
+
+/**
+ * state of one connection, servers with several connections keep them in
+ * DoorKeeperSessions
+ */
 struct DoorKeeperSession {
-	char name[32];
 	arducryptsession cryptSession;
 	int userindex = -1;
+	// AEAD frames negotiated
+	boolean aead = false;
+	// set by handleFrame while a compact or AEAD frame is handled
+	boolean compactFrame = false;
+	boolean aeadFrame = false;
+	uint8_t frameLength = ARDUCRYPTMESSAGESIZE;
+	uint8_t frameTag[ARDUCRYPTTAGSIZE];
+};
+
+/**
+ * StartSession handshake in three steps, for servers which run the public
+ * key operations on worker threads: beginHandshake and endHandshake on the
+ * thread which owns keeper and session, runHandshake on any thread (it only
+ * uses the job). Without workers handleFrame does all of it.
+ */
+struct DoorKeeperHandshake {
+	// set by beginHandshake
+	StartSessionRequest request;
+	uint8_t framing;
+	int userindex;
+	boolean userKeyValid;
+	arducryptpoint userKey;
+	arducryptkeypair* serverKeys;
+	// set by runHandshake
+	boolean verified;
+	boolean established;
+	// cycles of the stages, DoorKeeperHistogram VERIFY .. SIGN
+	uint32_t stageCycles[DKHIST_SIGN + 1];
+	uint8_t secret[KEYSIZE];
+	StartSessionResponse response;
 };
 
 struct DKPin {
@@ -198,11 +481,32 @@ struct DKPin {
 
 #define MAXRELAISNR 4
 
+// lifetime of a session ticket in seconds (time base of CB1000ms)
+#ifndef DOORKEEPERTICKETLIFETIME
+#define DOORKEEPERTICKETLIFETIME 86400
+#endif
+
 
 struct DoorKeeperConfig {
 	arducryptkeypair* serverkeys;
 	boolean saveDB = false;
 	DKPin pins[MAXRELAISNR];
+	// first flash sector of the user journal
+	uint32_t journalSector = DOORKEEPERJOURNAL_SECTOR;
+	uint16_t flushQuietMs = DOORKEEPERFLUSH_QUIETMS;
+	uint16_t flushThreshold = DOORKEEPERFLUSH_THRESHOLD;
+	uint16_t flushMaxDelayMs = DOORKEEPERFLUSH_MAXDELAYMS;
+	// accept compact frames
+	boolean compactFrames = true;
+	// accept AEAD frames
+	boolean aeadFrames = true;
+	// weekly schedules of the users (User::schedule), not copied
+	const DoorKeeperSchedule* schedules = NULL;
+	uint8_t scheduleCount = 0;
+	// audit log of sessions and relays, first flash sector (no default on
+	// the esp8266, apart from the journal sectors)
+	boolean auditLog = false;
+	uint32_t auditSector = DOORKEEPERAUDIT_SECTOR;
 };
 
 class DoorKeeper {
@@ -213,6 +517,17 @@ public:
 
 	boolean handleMessage(DoorKeeperMessage* doorkeeperBufferIn,
 			DoorKeeperMessage* doorkeeperBufferOut, DoorKeeperSession* session);
+	int handleFrame(uint8_t* frameIn, uint8_t* frameOut,
+			DoorKeeperSession* session);
+	static int frameSize(uint8_t* header);
+	static uint8_t messageLength(uint8_t messagetype);
+
+	boolean beginHandshake(uint8_t* frameIn, DoorKeeperHandshake* job,
+			DoorKeeperSession* session);
+	static void runHandshake(DoorKeeperHandshake* job);
+	static void runHandshakes(DoorKeeperHandshake** jobs, int count);
+	int endHandshake(DoorKeeperHandshake* job, uint8_t* frameOut,
+			DoorKeeperSession* session);
 
 	void addDefaultHandler(
 			boolean (*usercallback)(uint8_t, uint8_t, MessagePayload*,
@@ -220,73 +535,156 @@ public:
 
 	void addUser(User* u);
 	User* getUser(int index);
+	arducryptpoolstats getKeyPoolStats();
+	DoorKeeperJournalStats getJournalStats();
+	DoorKeeperFlushStats getFlushStats();
+	DoorKeeperAuditStats getAuditStats();
 
 // called from a cyclic timer
 	void CB1000ms(ulong time);
-// called from loop
+// called from loop, runs the due relay timers and jobs
 	void checkTimer();
+	DoorKeeperTimerStats getTimerStats();
 // called from loop
 	void doorkeeperLoop();
+// called when the connection of session is closed
+	void endSession(DoorKeeperSession* session);
+// called before shutdown
+	void flush();
 
 private:
 
+	static void respondHandshake(DoorKeeperHandshake* job);
+	boolean dispatchMessage(DoorKeeperMessage* doorkeeperBufferIn,
+			DoorKeeperMessage* doorkeeperBufferOut, DoorKeeperSession* session);
 	boolean isStarted(DoorKeeperSession* session);
-	void endSession(DoorKeeperSession* session);
-	void addChecksum(uint8_t* message, uint32_t* chksum);
-	boolean verifyChecksum(uint8_t* message, uint32_t chksum);
-	boolean decrypt_data(MessagePayload* doorkeeperplain,
-			MessagePayload* doorkeepercrypted, DoorKeeperSession* session);
+	uint32_t frameChecksum(DoorKeeperMessage* buffer, MessagePayload* payload,
+			int length, DoorKeeperSession* session);
+	void addChecksum(DoorKeeperMessage* buffer, MessagePayload* payload,
+			int length, DoorKeeperSession* session);
+	boolean verifyChecksum(DoorKeeperMessage* buffer, MessagePayload* payload,
+			int length, DoorKeeperSession* session);
+	boolean decrypt_data(DoorKeeperMessage* doorkeeperBufferIn,
+			DoorKeeperSession* session);
 	boolean encrypt_data(MessagePayload* doorkeeperplain,
-			MessagePayload* doorkeepercrypted, DoorKeeperSession* session);
+			DoorKeeperMessage* doorkeeperBufferOut, DoorKeeperSession* session);
+	int payloadLength(DoorKeeperMessage* bufferOut,
+			DoorKeeperSession* session);
+	void acceptFraming(uint8_t requested,
+			DoorKeeperMessage* bufferOut, DoorKeeperSession* session);
+	void frameHeader(uint8_t* header, DoorKeeperMessage* buffer,
+			uint8_t header2, int length);
 	boolean isMessageEncrypted(DoorKeeperMessage* doorkeeperBufferIn);
 	void clearBuffer(MessagePayload* body, int size);
 	boolean defaultCallback(uint8_t messagetype, uint8_t reservedbyte,
 			MessagePayload* databuffer, DoorKeeperMessage* doorkeeperBufferOut);
 	int getFreeUser();
-	boolean handleRemoveKeyRequest(RemoveKeyRequest keyrequest);
-	boolean handleStatusRequest(MessagePayload* statusRequest);
-	boolean handleAddKeyRequest(AddKeyRequest keyrequest);
+	void releaseUser(int index);
+	boolean isFreeUser(int index);
+	uint32_t userHash(const uint8_t* userkey);
+	void indexUser(int index);
+	void unindexUser(int index);
+	void buildUserIndex();
+	boolean handleRemoveKeyRequest(const RemoveKeyRequest* keyrequest);
+	boolean handleStatusRequest(const StatusRequest* statusRequest,
+			StatusResponse* statusResponse);
+	boolean handleAddKeyRequest(const AddKeyRequest* keyrequest);
+	boolean handleBulkKeyRequest(const BulkKeyRequest* request,
+			BulkKeyResponse* response, DoorKeeperSession* session);
+	void commitBulk(BulkKeyResponse* response);
+	void abortBulk();
+	void restoreUser(int index);
 	void getFirmware(MessagePayload* body);
-	void switchRelais(RelaisRequest relaisRequest);
+	boolean switchRelais(const RelaisRequest* relaisRequest);
+	void handleAuditRequest(const AuditRequest* request,
+			AuditResponse* response);
+	void handleStatsRequest(const StatsRequest* request,
+			StatsResponse* response);
+	void handleMultiRelaisRequest(const MultiRelaisRequest* request,
+			MultiRelaisResponse* response);
 	uint8_t getRelaisState(byte nr);
 	void setRelais(byte nr, boolean on);
+	void setRelaisMask(uint8_t mask, uint8_t states);
+	uint8_t getRelaisMask();
 	void setMessageType(DoorKeeperMessage* bufferOut, MesType type);
-	boolean isAuthenticated(StartSessionRequest request,
+	int isAuthenticated(const StartSessionRequest* request,
 			DoorKeeperSession* session);
-	int findUser(uint8_t* userkey);
-	boolean fromDateValid(int userindex, uint8_t actYear, uint8_t actMonth,
-			uint8_t actDay);
-	boolean toDateValid(int userindex, uint8_t actYear, uint8_t actMonth,
-			uint8_t actDay);
+	void issueTicket(TicketResponse* response, DoorKeeperSession* session);
+	boolean resumeSession(const ResumeSessionRequest* request,
+			ResumeSessionResponse* response, DoorKeeperSession* session);
+	int findUser(const uint8_t* userkey);
 	boolean checkValidation(int userindex);
-	boolean isValidUser(StartSessionRequest request, DoorKeeperSession* session);
+	void compileAccess(int index);
+	void updateTime();
+	uint8_t handleScheduleRequest(const ScheduleRequest* request);
+	int isValidUser(const StartSessionRequest* request);
 	boolean isAdminSession(DoorKeeperSession* session);
 	boolean isAdminUser(int index);
-	boolean isSignatureValid(StartSessionRequest request);
+	boolean isSignatureValid(const StartSessionRequest* request,
+			int userindex);
+	void prepareUserKey(int index);
 	void setHeader(DoorKeeperMessage* doorkeeperBuffer);
 	void loadUser(User* user, int userIndex);
-	void storeUser(User* user, int userIndex);
-	void storeUserIndex(int index);
+	boolean storeUser(User* user, int userIndex);
+	boolean storeUserIndex(int index);
+	void markDirty(int index);
+	void clearDirty();
+	boolean flushUserDb(ulong now, boolean atomic);
 	void loadUserDb();
 	void initUserDb();
 	void dumpUserDb();
 	void eraseDB();
-	struct TimerObj {
-		uint8_t duration;
-		byte relaisNr;
-		boolean state;
-		void (DoorKeeper::*timercallback)(byte, boolean) = NULL;
+	// jobs of the timer wheel
+	enum TimerJob
+		: uint8_t {
+			RELAISTIMER, BULKTIMER
 	};
-	TimerObj timeObj;
+	DoorKeeperTimer timers;
+	// one timer per relay, switches it back to relaisRestore
+	DoorKeeperTimerNode relaisTimers[MAXRELAISNR];
+	boolean relaisRestore[MAXRELAISNR];
+	DoorKeeperTimerNode bulkTimer;
+	// compiled dates and schedules of the users
+	DoorKeeperPolicy policy;
+	DoorKeeperAccess userAccess[MAXUSERS];
 
 	DoorKeeperConfig* config;
 	Users userDb;
+	// decoded user keys, kept in sync with userDb (see prepareUserKey)
+	arducryptpoint userKeys[MAXUSERS];
+	boolean userKeyValid[MAXUSERS] = { };
+	arducryptticketkey ticketKey;
+	// open addressing (linear probing) index: user key -> userDb index
+	int16_t userIndex[USERINDEXSIZE];
+	// stack of free userDb entries, lowest index on top
+	int16_t freeUsers[MAXUSERS];
+	int freeUserCount = 0;
+	DoorKeeperJournal journal;
+	DoorKeeperAudit audit;
+	// journal position of the last record of each user
+	uint16_t journalPositions[MAXUSERS];
+	// the users are read from and written to EEPROM: no journal sectors, or
+	// the journal has not taken over the EEPROM user db (see initUserDb)
+	boolean userDbFromEeprom = false;
+	ulong firstDirtyMs = 0;
+	ulong lastDirtyMs = 0;
+	// last flushUserDb failed at failedFlushMs
+	boolean flushFailed = false;
+	ulong failedFlushMs = 0;
+	DoorKeeperFlushStats flushStats = { };
+	// open bulk key transfer, changes are kept in RAM (dirty) until commit
+	DoorKeeperSession* bulkSession = NULL;
+	uint16_t bulkFrame = 0;
+	uint16_t bulkApplied = 0;
+	uint16_t bulkFailed = 0;
+	ulong bulkLastMs = 0;
 	ulong act_ms = 0;
+	boolean busy = false;
 
 	boolean (*defaultcallback)(uint8_t, uint8_t, MessagePayload*,
 			DoorKeeperMessage*) = NULL;
 
-	timestruct* t;
+	timestruct* t = NULL;
 	const int PAYLOADLENGTH = sizeof(MessagePayload);
 	const int DATALENGTH = sizeof(MessageData);
 	const int HEADERLEN = sizeof(DoorKeeperMessage) - PAYLOADLENGTH;
@@ -0,0 +1,266 @@
+/*
+ * Copyright (C) 2017 A. Koller - akandroid75@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <DoorKeeperAudit.h>
+#include <DoorKeeperLog.h>
+#include <arducryptcrc.h>
+#include <cstddef>
+#include <cstring>
+
+static_assert(DOORKEEPERAUDIT_SECTORS >= 2, "DOORKEEPERAUDIT_SECTORS < 2");
+static_assert((DOORKEEPERAUDIT_RINGSIZE & (DOORKEEPERAUDIT_RINGSIZE - 1)) == 0
+		&& DOORKEEPERAUDIT_RINGSIZE <= 128,
+		"DOORKEEPERAUDIT_RINGSIZE has to be a power of 2 <= 128");
+
+#define RINGMASK (DOORKEEPERAUDIT_RINGSIZE - 1)
+
+/**
+ * \brief finds the newest record in the sectors from firstSector on, new
+ * records are appended after it. sectors without a valid record are erased.
+ * sectors refused by DoorKeeperJournal::checkSectors are not touched, the
+ * log stays off then.
+ * returns false if the log was empty
+ */
+boolean DoorKeeperAudit::begin(uint32_t firstSector) {
+	first = firstSector;
+	started = false;
+	if (DoorKeeperJournal::checkSectors(first, DOORKEEPERAUDIT_SECTORS)
+			== false) {
+		DOORKEEPERLOG_ERROR(DKEV_FLASHREFUSED, DOORKEEPERAUDIT_SECTORS, first);
+		return false;
+	}
+	started = true;
+	uint16_t used[DOORKEEPERAUDIT_SECTORS];
+	int newest = -1;
+	for (uint8_t s = 0; s < DOORKEEPERAUDIT_SECTORS; s++) {
+		sectorSequence[s] = 0;
+		used[s] = 0;
+		for (uint16_t slot = 0; slot < DOORKEEPERAUDIT_RECORDS; slot++) {
+			DoorKeeperAuditRecord record;
+			ESP.flashRead(recordAddress(s, slot), (uint32_t*) &record,
+					sizeof(record));
+			if (record.sequence == 0xffffffff) {
+				// erased, records are appended without gaps
+				break;
+			}
+			used[s] = slot + 1;
+			if (sectorSequence[s] == 0 && valid(&record) == true) {
+				sectorSequence[s] = record.sequence - slot;
+			}
+		}
+		if (used[s] > 0 && sectorSequence[s] == 0) {
+			// not written by the log
+			ESP.flashEraseSector(first + s);
+			erases++;
+			used[s] = 0;
+		}
+		if (sectorSequence[s] != 0
+				&& (newest < 0 || sectorSequence[s] > sectorSequence[newest])) {
+			newest = s;
+		}
+	}
+	if (newest < 0) {
+		// the first flushStep erases sector 0 and starts there
+		head = DOORKEEPERAUDIT_SECTORS - 1;
+		headSlot = DOORKEEPERAUDIT_RECORDS;
+		nextSequence = 1;
+		return false;
+	}
+	head = newest;
+	headSlot = used[head];
+	nextSequence = sectorSequence[head] + headSlot;
+	return true;
+}
+
+/**
+ * \brief stores one record, never blocks. if the ring is full the record
+ * is dropped and counted
+ */
+void DoorKeeperAudit::record(uint32_t time, uint16_t user, uint8_t action,
+		uint8_t relais, uint8_t state, uint8_t result) {
+	if (started == false) {
+		return;
+	}
+	if ((uint8_t) (ringHead - ringTail) >= DOORKEEPERAUDIT_RINGSIZE) {
+		dropped++;
+		return;
+	}
+	if (ringHead == ringTail) {
+		pendingMs = millis();
+	}
+	DoorKeeperAuditRecord* r = &ring[ringHead & RINGMASK];
+	r->sequence = nextSequence++;
+	r->time = time;
+	r->user = user;
+	r->action = action;
+	r->relais = relais;
+	r->state = state;
+	r->result = result;
+	r->crc = recordCrc(r);
+	ringHead++;
+	recorded++;
+}
+
+/**
+ * \brief one flash operation: erases the oldest sector if the head sector is
+ * full, or writes the pending records with one write. only if BATCH records
+ * are pending, the oldest is MAXDELAYMS old or force is set.
+ * returns false if there was nothing to do
+ */
+boolean DoorKeeperAudit::flushStep(uint32_t now, boolean force) {
+	uint8_t pending = ringHead - ringTail;
+	if (pending == 0) {
+		return false;
+	}
+	if (force == false && pending < DOORKEEPERAUDIT_BATCH
+			&& now - pendingMs < DOORKEEPERAUDIT_MAXDELAYMS) {
+		return false;
+	}
+	if (headSlot >= DOORKEEPERAUDIT_RECORDS) {
+		head = (head + 1) % DOORKEEPERAUDIT_SECTORS;
+		headSlot = 0;
+		sectorSequence[head] = 0;
+		erases++;
+		if (ESP.flashEraseSector(first + head) == false) {
+			DOORKEEPERLOG_ERROR(DKEV_AUDITFAILED, head, 0);
+			failed++;
+			// skip the sector
+			headSlot = DOORKEEPERAUDIT_RECORDS;
+		}
+		return true;
+	}
+	uint8_t tail = ringTail & RINGMASK;
+	uint16_t n = pending;
+	if (n > DOORKEEPERAUDIT_RECORDS - headSlot) {
+		n = DOORKEEPERAUDIT_RECORDS - headSlot;
+	}
+	if (n > DOORKEEPERAUDIT_RINGSIZE - tail) {
+		// wraps, the rest with the next call
+		n = DOORKEEPERAUDIT_RINGSIZE - tail;
+	}
+	if (headSlot == 0) {
+		sectorSequence[head] = ring[tail].sequence;
+	}
+	if (ESP.flashWrite(recordAddress(head, headSlot), (uint32_t*) &ring[tail],
+			n * sizeof(DoorKeeperAuditRecord)) == false) {
+		// the slots are not written again, read() skips them
+		DOORKEEPERLOG_ERROR(DKEV_AUDITFAILED, head, headSlot);
+		failed++;
+	}
+	headSlot += n;
+	ringTail += n;
+	flushed += n;
+	flushes++;
+	return true;
+}
+
+/**
+ * \brief copies up to max records with a sequence number >= from (the
+ * oldest one if it is gone), flushed or not. next: sequence number to ask
+ * for next time. returns the number of records
+ */
+uint8_t DoorKeeperAudit::read(uint32_t from, DoorKeeperAuditRecord* records,
+		uint8_t max, uint32_t* next) {
+	uint32_t sequence = firstSequence();
+	if (from > sequence) {
+		sequence = from;
+	}
+	uint32_t ringSequence =
+			ringHead != ringTail ?
+					ring[ringTail & RINGMASK].sequence : nextSequence;
+	uint8_t count = 0;
+	for (; count < max && sequence < nextSequence; sequence++) {
+		if (sequence >= ringSequence) {
+			records[count++] = ring[(ringTail + (sequence - ringSequence))
+					& RINGMASK];
+		} else if (readFlash(sequence, &records[count]) == true) {
+			count++;
+		}
+	}
+	*next = sequence;
+	return count;
+}
+
+/**
+ * \brief sequence number of the newest record, 0: none
+ */
+uint32_t DoorKeeperAudit::last() {
+	return nextSequence - 1;
+}
+
+DoorKeeperAuditStats DoorKeeperAudit::getStats() {
+	DoorKeeperAuditStats stats;
+	stats.recorded = recorded;
+	stats.dropped = dropped;
+	stats.flushed = flushed;
+	stats.flushes = flushes;
+	stats.erases = erases;
+	stats.failed = failed;
+	stats.first = firstSequence();
+	stats.next = nextSequence;
+	stats.pending = ringHead - ringTail;
+	return stats;
+}
+
+/**
+ * \brief oldest sequence number in flash or RAM
+ */
+uint32_t DoorKeeperAudit::firstSequence() {
+	uint32_t oldest =
+			ringHead != ringTail ?
+					ring[ringTail & RINGMASK].sequence : nextSequence;
+	for (uint8_t s = 0; s < DOORKEEPERAUDIT_SECTORS; s++) {
+		if (sectorSequence[s] != 0 && sectorSequence[s] < oldest) {
+			oldest = sectorSequence[s];
+		}
+	}
+	return oldest;
+}
+
+boolean DoorKeeperAudit::readFlash(uint32_t sequence,
+		DoorKeeperAuditRecord* record) {
+	for (uint8_t s = 0; s < DOORKEEPERAUDIT_SECTORS; s++) {
+		uint16_t slots = s == head ? headSlot : DOORKEEPERAUDIT_RECORDS;
+		if (sectorSequence[s] == 0 || sequence < sectorSequence[s]
+				|| sequence - sectorSequence[s] >= slots) {
+			continue;
+		}
+		return ESP.flashRead(recordAddress(s, sequence - sectorSequence[s]),
+				(uint32_t*) record, sizeof(DoorKeeperAuditRecord)) == true
+				&& valid(record) == true && record->sequence == sequence;
+	}
+	return false;
+}
+
+uint32_t DoorKeeperAudit::recordAddress(uint8_t sector, uint16_t slot) {
+	return (first + sector) * DOORKEEPERJOURNAL_SECTORSIZE
+			+ slot * sizeof(DoorKeeperAuditRecord);
+}
+
+uint16_t DoorKeeperAudit::recordCrc(DoorKeeperAuditRecord* record) {
+	return arducryptcrc::calculate((uint8_t*) record,
+			offsetof(DoorKeeperAuditRecord, crc));
+}
+
+boolean DoorKeeperAudit::valid(DoorKeeperAuditRecord* record) {
+	return record->sequence != 0xffffffff && record->crc == recordCrc(record);
+}
@@ -0,0 +1,174 @@
+/*
+ * Copyright (C) 2017 A. Koller - akandroid75@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef DOORKEEPERAUDIT_H_
+#define DOORKEEPERAUDIT_H_
+
+#include <Arduino.h>
+#include <DoorKeeperJournal.h>
+#include <stdint.h>
+
+/*
+ * Audit log: who switched which relay and started a session when.
+ *
+ * record() stores a fixed size binary record with the next sequence number
+ * in a RAM ring and never blocks. flushStep() (from doorkeeperLoop) writes
+ * the pending records to a circular log in DOORKEEPERAUDIT_SECTORS flash
+ * sectors, as a batch with one flash write, and does at most one flash
+ * operation per call: when the head sector is full the oldest sector is
+ * erased in a pass of its own and its records are lost.
+ *
+ * Record n of a sector has the sequence number of its first record + n, so
+ * read() finds a sequence number in flash without an index. At boot begin()
+ * takes the newest sector as head and continues after its last record.
+ *
+ * sector:  record | record | ... (erased slots: 0xff)
+ */
+
+// flash sectors of the log, >= 2
+#ifndef DOORKEEPERAUDIT_SECTORS
+#define DOORKEEPERAUDIT_SECTORS 2
+#endif
+
+// first flash sector. no default on the esp8266, the same rules as for the
+// journal sectors apply (DoorKeeperJournal::checkSectors); above the
+// journal on the host (flash stand-in starts at 0)
+#ifndef DOORKEEPERAUDIT_SECTOR
+#ifdef ARDUINO_ARCH_ESP8266
+#define DOORKEEPERAUDIT_SECTOR DOORKEEPERJOURNAL_NOSECTOR
+#else
+#define DOORKEEPERAUDIT_SECTOR \
+	(DOORKEEPERJOURNAL_SECTOR + DOORKEEPERJOURNAL_SECTORS)
+#endif
+#endif
+
+// records in RAM, power of 2
+#ifndef DOORKEEPERAUDIT_RINGSIZE
+#define DOORKEEPERAUDIT_RINGSIZE 32
+#endif
+
+// pending records written at once, older ones after MAXDELAYMS
+#ifndef DOORKEEPERAUDIT_BATCH
+#define DOORKEEPERAUDIT_BATCH 8
+#endif
+#ifndef DOORKEEPERAUDIT_MAXDELAYMS
+#define DOORKEEPERAUDIT_MAXDELAYMS 2000
+#endif
+
+// user of records without one (relay timer)
+#define DOORKEEPERAUDIT_NOUSER 0xffff
+
+enum DoorKeeperAuditAction
+	: uint8_t {
+		AUDITSESSION = 0x01,
+	AUDITRESUMED = 0x02,
+	AUDITDENIED = 0x03,
+	// relais: relay number, state: RelaisStatus
+	AUDITRELAIS = 0x04,
+	// relais: mask, state: states of the mask
+	AUDITRELAISMASK = 0x05,
+	// relay switched back by its timer, state: RelaisStatus
+	AUDITRELAISTIMER = 0x06
+};
+
+enum DoorKeeperAuditResult
+	: uint8_t {
+		AUDITOK = 0x00,
+	// relay not configured
+	AUDITFAILED = 0x01,
+	// outside the valid dates or schedule
+	AUDITEXPIRED = 0x02,
+	AUDITSIGNATURE = 0x03
+};
+
+struct DoorKeeperAuditRecord {
+	uint32_t sequence;
+	// act_ms (CB1000ms time base)
+	uint32_t time;
+	uint16_t user;
+	uint8_t action;
+	uint8_t relais;
+	uint8_t state;
+	uint8_t result;
+	// low half of the CRC-32 of the fields above
+	uint16_t crc;
+};
+
+#define DOORKEEPERAUDIT_RECORDS \
+	(DOORKEEPERJOURNAL_SECTORSIZE / sizeof(DoorKeeperAuditRecord))
+
+struct DoorKeeperAuditStats {
+	uint32_t recorded;
+	// ring full
+	uint32_t dropped;
+	uint32_t flushed;
+	uint32_t flushes;
+	uint32_t erases;
+	uint32_t failed;
+	// oldest and next sequence number
+	uint32_t first;
+	uint32_t next;
+	uint8_t pending;
+};
+
+class DoorKeeperAudit {
+
+public:
+	boolean begin(uint32_t firstSector);
+	void record(uint32_t time, uint16_t user, uint8_t action, uint8_t relais,
+			uint8_t state, uint8_t result);
+	boolean flushStep(uint32_t now, boolean force);
+	uint8_t read(uint32_t from, DoorKeeperAuditRecord* records, uint8_t max,
+			uint32_t* next);
+	uint32_t last();
+	DoorKeeperAuditStats getStats();
+
+private:
+	uint32_t firstSequence();
+	boolean readFlash(uint32_t sequence, DoorKeeperAuditRecord* record);
+	uint32_t recordAddress(uint8_t sector, uint16_t slot);
+	static uint16_t recordCrc(DoorKeeperAuditRecord* record);
+	boolean valid(DoorKeeperAuditRecord* record);
+
+	boolean started = false;
+	uint32_t first = 0;
+	// sequence number of slot 0 of every sector, 0: sector empty
+	uint32_t sectorSequence[DOORKEEPERAUDIT_SECTORS] = { };
+	uint8_t head = 0;
+	uint16_t headSlot = 0;
+	// sequence number of the next record
+	uint32_t nextSequence = 1;
+
+	DoorKeeperAuditRecord ring[DOORKEEPERAUDIT_RINGSIZE];
+	uint8_t ringHead = 0;
+	uint8_t ringTail = 0;
+	uint32_t pendingMs = 0;
+
+	uint32_t recorded = 0;
+	uint32_t dropped = 0;
+	uint32_t flushed = 0;
+	uint32_t flushes = 0;
+	uint32_t erases = 0;
+	uint32_t failed = 0;
+};
+
+#endif /* DOORKEEPERAUDIT_H_ */
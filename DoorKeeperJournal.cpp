@@ -0,0 +1,604 @@
+/*
+ * Copyright (C) 2017 A. Koller - akandroid75@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <DoorKeeperJournal.h>
+#include <DoorKeeperLog.h>
+#include <arducryptcrc.h>
+#include <cstddef>
+#include <cstring>
+
+#define JOURNALMAGIC 0x314a4b44
+#define JOURNALFREE 0xffffffff
+#define JOURNALPUT 0x50
+#define JOURNALDELETE 0x44
+#define JOURNALEND 0x45
+#define JOURNALOWNER 0x00000000
+
+#ifdef ARDUINO_ARCH_ESP8266
+extern "C" uint32_t _FS_end;
+extern "C" uint32_t _EEPROM_start;
+#endif
+
+/**
+ * \brief reads all sectors and replays the records into entries
+ * (count entries of entrySize bytes, entries without record are left as
+ * they are). positions has to hold count entries.
+ * writable: sectors never used by the journal are formatted, else the
+ * flash is only read and nothing can be appended.
+ * returns false if the journal does not hold the entries yet (takeOver)
+ */
+boolean DoorKeeperJournal::begin(uint32_t firstSector, uint16_t* pos,
+		uint8_t* entries, uint16_t size, uint16_t entryCount,
+		boolean canWrite) {
+	first = firstSector;
+	positions = pos;
+	entrySize = size;
+	count = entryCount;
+	writable = canWrite;
+	owner = false;
+	freeSectors = 0;
+	head = 0;
+	headSlot = DOORKEEPERJOURNAL_RECORDS;
+	lastSequence = 0;
+	lastTransaction = 0;
+	for (uint16_t i = 0; i < count; i++) {
+		positions[i] = DOORKEEPERJOURNAL_NOPOS;
+	}
+	for (uint8_t s = 0; s < DOORKEEPERJOURNAL_SECTORS; s++) {
+		sequence[s] = JOURNALFREE;
+		eraseCount[s] = 0;
+	}
+	if (checkSectors(first, DOORKEEPERJOURNAL_SECTORS) == false) {
+		DOORKEEPERLOG_ERROR(DKEV_FLASHREFUSED, DOORKEEPERJOURNAL_SECTORS, first);
+		writable = false;
+		return false;
+	}
+
+	int used = 0;
+	for (uint8_t s = 0; s < DOORKEEPERJOURNAL_SECTORS; s++) {
+		DoorKeeperJournalSector header;
+		ESP.flashRead((first + s) * DOORKEEPERJOURNAL_SECTORSIZE,
+				(uint32_t*) &header, sizeof(header));
+		if (header.magic != JOURNALMAGIC) {
+			// never used by the journal
+			if (writable == true) {
+				formatSector(s);
+			}
+			continue;
+		}
+		if (header.owner == JOURNALOWNER) {
+			owner = true;
+		}
+		eraseCount[s] = header.eraseCount;
+		sequence[s] = header.sequence;
+		if (header.sequence == JOURNALFREE) {
+			freeSectors++;
+		} else {
+			used++;
+			if (header.sequence >= lastSequence) {
+				lastSequence = header.sequence;
+				head = s;
+			}
+		}
+	}
+
+	if (used == 0) {
+		// the head is opened by the first commit
+		return owner;
+	}
+
+	// newest sector first, the first record found for an entry wins
+	uint32_t previous = JOURNALFREE;
+	uint8_t ended = 0;
+	uint32_t dropped = 0;
+	for (int k = 0; k < used; k++) {
+		int next = -1;
+		for (uint8_t s = 0; s < DOORKEEPERJOURNAL_SECTORS; s++) {
+			if (sequence[s] != JOURNALFREE && sequence[s] < previous
+					&& (next < 0 || sequence[s] > sequence[next])) {
+				next = s;
+			}
+		}
+		replaySector(next, entries, &ended, &dropped);
+		previous = sequence[next];
+	}
+	if (corrupt > 0) {
+		DOORKEEPERLOG_WARN(DKEV_JOURNALCORRUPT, 0, corrupt);
+	}
+	if (dropped > 0) {
+		DOORKEEPERLOG_WARN(DKEV_JOURNALABORTED, lastTransaction, dropped);
+	}
+	if (owner == false) {
+		// records of an interrupted take over, superseded by the next one
+		for (uint16_t i = 0; i < count; i++) {
+			positions[i] = DOORKEEPERJOURNAL_NOPOS;
+		}
+	}
+	return owner;
+}
+
+/**
+ * \brief marks the journal as the store of the entries, begin() replays
+ * them from now on. call it once all entries taken over are committed.
+ */
+boolean DoorKeeperJournal::takeOver() {
+	if (writable == false || commit() == false) {
+		return false;
+	}
+	uint32_t mark = JOURNALOWNER;
+	boolean marked = false;
+	for (uint8_t s = 0; s < DOORKEEPERJOURNAL_SECTORS; s++) {
+		// the owner word is still erased, it can be written now
+		marked = ESP.flashWrite(
+				(first + s) * DOORKEEPERJOURNAL_SECTORSIZE
+						+ offsetof(DoorKeeperJournalSector, owner), &mark,
+				sizeof(mark)) || marked;
+	}
+	if (marked == false) {
+		DOORKEEPERLOG_ERROR(DKEV_JOURNALFAILED, 0, 0);
+		return false;
+	}
+	owner = true;
+	return true;
+}
+
+/**
+ * \brief sectors first .. first + sectors - 1 may be used by the journal or
+ * the audit log. on the esp8266 they have to lie between the end of the
+ * filesystem and the EEPROM sector, nothing else uses these sectors.
+ */
+boolean DoorKeeperJournal::checkSectors(uint32_t first, uint8_t sectors) {
+	if (first == DOORKEEPERJOURNAL_NOSECTOR) {
+		return false;
+	}
+#ifdef ARDUINO_ARCH_ESP8266
+	uint32_t fsEnd = ((uint32_t) &_FS_end - 0x40200000
+			+ DOORKEEPERJOURNAL_SECTORSIZE - 1) / DOORKEEPERJOURNAL_SECTORSIZE;
+	uint32_t eeprom = ((uint32_t) &_EEPROM_start - 0x40200000)
+			/ DOORKEEPERJOURNAL_SECTORSIZE;
+	if (first < fsEnd || first + sectors > eeprom) {
+		return false;
+	}
+#endif
+	return true;
+}
+
+/**
+ * \brief replays the records of sector from the last to the first one.
+ * ended: transaction of the nearest newer end marker, a record of a
+ * transaction is only taken if it is the same (dropped counts the others)
+ */
+void DoorKeeperJournal::replaySector(uint8_t sector, uint8_t* entries,
+		uint8_t* ended, uint32_t* dropped) {
+	DoorKeeperJournalRecord record;
+	uint16_t end = 0;
+	uint16_t slot = DOORKEEPERJOURNAL_RECORDS;
+	while (slot-- > 0) {
+		readRecord(sector, slot, &record);
+		if (*(uint32_t*) &record == 0xffffffff) {
+			// erased
+			continue;
+		}
+		if (end == 0) {
+			end = slot + 1;
+		}
+		if (record.crc != recordCrc(&record) || record.index >= count) {
+			// torn write
+			corrupt++;
+			continue;
+		}
+		if (lastTransaction == 0) {
+			lastTransaction = record.reserved;
+		}
+		if (record.type == JOURNALEND) {
+			*ended = record.reserved;
+			continue;
+		}
+		if (record.reserved != 0 && record.reserved != *ended) {
+			// transaction without end marker
+			(*dropped)++;
+			continue;
+		}
+		if (positions[record.index] != DOORKEEPERJOURNAL_NOPOS) {
+			// there is a newer record
+			continue;
+		}
+		if (record.type == JOURNALPUT) {
+			memcpy(entries + record.index * entrySize, record.data, entrySize);
+		} else {
+			memset(entries + record.index * entrySize, 0xff, entrySize);
+		}
+		positions[record.index] = sector * DOORKEEPERJOURNAL_RECORDS + slot;
+	}
+	if (sector == head) {
+		headSlot = end;
+	}
+}
+
+/**
+ * \brief reads the committed content of entry 'index' from flash.
+ * returns false if the entry has no record or was removed
+ */
+boolean DoorKeeperJournal::read(uint16_t index, uint8_t* data) {
+	if (index >= count || positions[index] == DOORKEEPERJOURNAL_NOPOS) {
+		return false;
+	}
+	DoorKeeperJournalRecord record;
+	readRecord(positions[index] / DOORKEEPERJOURNAL_RECORDS,
+			positions[index] % DOORKEEPERJOURNAL_RECORDS, &record);
+	if (record.type != JOURNALPUT) {
+		return false;
+	}
+	memcpy(data, record.data, entrySize);
+	return true;
+}
+
+/**
+ * \brief records staged until endTransaction() are only replayed if its end
+ * marker was written. Makes room for 'records' records first, there is no
+ * compaction while the transaction is open (it would drop the records it
+ * replaces). returns false if they do not fit.
+ */
+boolean DoorKeeperJournal::beginTransaction(uint16_t records) {
+	if (writable == false || commit() == false) {
+		return false;
+	}
+	// every sector is compacted at most once
+	uint8_t rounds = DOORKEEPERJOURNAL_SECTORS;
+	while ((uint32_t) (DOORKEEPERJOURNAL_RECORDS - headSlot)
+			+ (uint32_t) freeSectors * DOORKEEPERJOURNAL_RECORDS < records + 1u) {
+		if (rounds-- == 0 || compact() == false) {
+			DOORKEEPERLOG_ERROR(DKEV_JOURNALFULL, head, records);
+			return false;
+		}
+	}
+	// id 0 marks records outside of a transaction
+	lastTransaction = lastTransaction == 0xff ? 1 : lastTransaction + 1;
+	transaction = lastTransaction;
+	transactionSlot = headSlot;
+	transactionSequence = lastSequence;
+	return true;
+}
+
+/**
+ * \brief stages the end marker and commits. Only then the positions of the
+ * records of the transaction are published
+ */
+boolean DoorKeeperJournal::endTransaction() {
+	boolean done = stage(JOURNALEND, 0, NULL) && commit();
+	if (done == true) {
+		publishTransaction();
+	}
+	transaction = 0;
+	return done;
+}
+
+/**
+ * \brief points positions to the records of the open transaction. They lie
+ * behind the head slot at beginTransaction, in that sector and the ones
+ * opened since (there is no compaction while the transaction is open)
+ */
+void DoorKeeperJournal::publishTransaction() {
+	DoorKeeperJournalRecord record;
+	for (uint32_t next = transactionSequence; next <= lastSequence; next++) {
+		int sector = -1;
+		for (uint8_t s = 0; s < DOORKEEPERJOURNAL_SECTORS; s++) {
+			if (sequence[s] == next) {
+				sector = s;
+			}
+		}
+		if (sector < 0) {
+			continue;
+		}
+		uint16_t slot = next == transactionSequence ? transactionSlot : 0;
+		uint16_t end = sector == head ? headSlot : DOORKEEPERJOURNAL_RECORDS;
+		for (; slot < end; slot++) {
+			readRecord(sector, slot, &record);
+			if (record.crc != recordCrc(&record) || record.index >= count
+					|| record.reserved != transaction
+					|| record.type == JOURNALEND) {
+				continue;
+			}
+			positions[record.index] = sector * DOORKEEPERJOURNAL_RECORDS
+					+ slot;
+		}
+	}
+}
+
+/**
+ * \brief drops the buffered records and the open transaction, its records
+ * already written have no end marker and are not replayed. positions still
+ * point to the records before the transaction
+ */
+void DoorKeeperJournal::abortTransaction() {
+	batchCount = 0;
+	transaction = 0;
+}
+
+/**
+ * \brief buffers the new content of entry 'index' (entrySize bytes)
+ */
+boolean DoorKeeperJournal::append(uint16_t index, uint8_t* data) {
+	return stage(JOURNALPUT, index, data);
+}
+
+/**
+ * \brief buffers a delete record, entry reads as 0xff after replay
+ */
+boolean DoorKeeperJournal::remove(uint16_t index) {
+	return stage(JOURNALDELETE, index, NULL);
+}
+
+boolean DoorKeeperJournal::stage(uint8_t type, uint16_t index,
+		uint8_t* data) {
+	if (writable == false || index >= count) {
+		return false;
+	}
+	if (batchCount == DOORKEEPERJOURNAL_BATCH && commit() == false) {
+		return false;
+	}
+	DoorKeeperJournalRecord* record = &batch[batchCount];
+	memset(record, 0xff, sizeof(DoorKeeperJournalRecord));
+	record->type = type;
+	record->reserved = transaction;
+	record->index = index;
+	if (data != NULL) {
+		memcpy(record->data, data, entrySize);
+	}
+	record->crc = recordCrc(record);
+	batchCount++;
+	return true;
+}
+
+/**
+ * \brief writes the buffered records to consecutive slots of the head
+ */
+boolean DoorKeeperJournal::commit() {
+	uint8_t done = 0;
+	while (done < batchCount) {
+		if (makeRoom() == false) {
+			batchCount = 0;
+			return false;
+		}
+		uint16_t n = batchCount - done;
+		if (n > DOORKEEPERJOURNAL_RECORDS - headSlot) {
+			n = DOORKEEPERJOURNAL_RECORDS - headSlot;
+		}
+		if (ESP.flashWrite(recordAddress(head, headSlot),
+				(uint32_t*) &batch[done], n * sizeof(DoorKeeperJournalRecord))
+				== false) {
+			DOORKEEPERLOG_ERROR(DKEV_JOURNALFAILED, head, headSlot);
+			headSlot += n;
+			batchCount = 0;
+			return false;
+		}
+		for (uint16_t k = 0; k < n; k++) {
+			if (batch[done + k].reserved != 0) {
+				// published by endTransaction
+				continue;
+			}
+			positions[batch[done + k].index] = head * DOORKEEPERJOURNAL_RECORDS
+					+ headSlot + k;
+		}
+		headSlot += n;
+		done += n;
+		commits++;
+	}
+	appends += batchCount;
+	batchCount = 0;
+	return true;
+}
+
+/**
+ * \brief opens a new head sector if the current one is full
+ */
+boolean DoorKeeperJournal::makeRoom() {
+	while (headSlot >= DOORKEEPERJOURNAL_RECORDS) {
+		if (freeSectors == 0) {
+			DOORKEEPERLOG_ERROR(DKEV_JOURNALFULL, head, 0);
+			return false;
+		}
+		openHead();
+		if (freeSectors == 0 && transaction == 0) {
+			// background compaction did not keep up
+			foregroundCompactions++;
+			compact();
+		}
+	}
+	return true;
+}
+
+/**
+ * \brief writes record to the next slot of the head sector, caller checks
+ * that there is one
+ */
+boolean DoorKeeperJournal::writeRecord(DoorKeeperJournalRecord* record) {
+	record->crc = recordCrc(record);
+	if (ESP.flashWrite(recordAddress(head, headSlot), (uint32_t*) record,
+			sizeof(DoorKeeperJournalRecord)) == false) {
+		DOORKEEPERLOG_ERROR(DKEV_JOURNALFAILED, head, headSlot);
+		// do not write the slot again
+		headSlot++;
+		return false;
+	}
+	positions[record->index] = head * DOORKEEPERJOURNAL_RECORDS + headSlot;
+	headSlot++;
+	return true;
+}
+
+boolean DoorKeeperJournal::readRecord(uint8_t sector, uint16_t slot,
+		DoorKeeperJournalRecord* record) {
+	return ESP.flashRead(recordAddress(sector, slot), (uint32_t*) record,
+			sizeof(DoorKeeperJournalRecord));
+}
+
+uint32_t DoorKeeperJournal::recordAddress(uint8_t sector, uint16_t slot) {
+	return (first + sector) * DOORKEEPERJOURNAL_SECTORSIZE
+			+ sizeof(DoorKeeperJournalSector)
+			+ slot * sizeof(DoorKeeperJournalRecord);
+}
+
+uint32_t DoorKeeperJournal::recordCrc(DoorKeeperJournalRecord* record) {
+	return arducryptcrc::calculate((uint8_t*) record,
+			sizeof(DoorKeeperJournalRecord) - sizeof(record->crc));
+}
+
+/**
+ * \brief erases sector and writes a header with the new erase count
+ */
+boolean DoorKeeperJournal::formatSector(uint8_t sector) {
+	DoorKeeperJournalSector header;
+	sequence[sector] = JOURNALFREE;
+	if (ESP.flashEraseSector(first + sector) == false) {
+		DOORKEEPERLOG_ERROR(DKEV_JOURNALFAILED, sector, 0);
+		return false;
+	}
+	eraseCount[sector]++;
+	header.magic = JOURNALMAGIC;
+	header.eraseCount = eraseCount[sector];
+	header.sequence = JOURNALFREE;
+	header.owner = owner == true ? JOURNALOWNER : 0xffffffff;
+	ESP.flashWrite((first + sector) * DOORKEEPERJOURNAL_SECTORSIZE,
+			(uint32_t*) &header, sizeof(header));
+	freeSectors++;
+	return true;
+}
+
+/**
+ * \brief takes the free sector with the lowest erase count as new head
+ */
+boolean DoorKeeperJournal::openHead() {
+	int next = -1;
+	for (uint8_t s = 0; s < DOORKEEPERJOURNAL_SECTORS; s++) {
+		if (sequence[s] == JOURNALFREE
+				&& (next < 0 || eraseCount[s] < eraseCount[next])) {
+			next = s;
+		}
+	}
+	if (next < 0) {
+		return false;
+	}
+	lastSequence++;
+	sequence[next] = lastSequence;
+	// the sequence word is still erased, it can be written now
+	ESP.flashWrite(
+			(first + next) * DOORKEEPERJOURNAL_SECTORSIZE
+					+ offsetof(DoorKeeperJournalSector, sequence),
+			&lastSequence, sizeof(lastSequence));
+	freeSectors--;
+	head = next;
+	headSlot = 0;
+	return true;
+}
+
+int DoorKeeperJournal::oldestSector() {
+	int oldest = -1;
+	for (uint8_t s = 0; s < DOORKEEPERJOURNAL_SECTORS; s++) {
+		if (sequence[s] != JOURNALFREE && s != head
+				&& (oldest < 0 || sequence[s] < sequence[oldest])) {
+			oldest = s;
+		}
+	}
+	return oldest;
+}
+
+/**
+ * \brief moves the live records of the oldest sector to the head and
+ * erases it
+ */
+boolean DoorKeeperJournal::compact() {
+	int victim = oldestSector();
+	if (victim < 0) {
+		return false;
+	}
+	DoorKeeperJournalRecord record;
+	uint16_t base = victim * DOORKEEPERJOURNAL_RECORDS;
+	uint16_t live = 0;
+	for (uint16_t slot = 0; slot < DOORKEEPERJOURNAL_RECORDS; slot++) {
+		readRecord(victim, slot, &record);
+		if (record.index < count && positions[record.index] == base + slot
+				&& record.type == JOURNALPUT) {
+			live++;
+		}
+	}
+	if (DOORKEEPERJOURNAL_RECORDS - headSlot < live
+			&& openHead() == false) {
+		return false;
+	}
+	uint16_t moved = 0;
+	for (uint16_t slot = 0; slot < DOORKEEPERJOURNAL_RECORDS; slot++) {
+		readRecord(victim, slot, &record);
+		if (record.index >= count || positions[record.index] != base + slot) {
+			// superseded, torn or erased
+			continue;
+		}
+		if (record.type == JOURNALPUT) {
+			// live records of a transaction are committed, the end marker
+			// is not relocated
+			record.reserved = 0x00;
+			writeRecord(&record);
+			moved++;
+		} else {
+			positions[record.index] = DOORKEEPERJOURNAL_NOPOS;
+		}
+	}
+	relocated += moved;
+	formatSector(victim);
+	compactions++;
+	DOORKEEPERLOG_INFO(DKEV_JOURNALCOMPACTED, victim, moved);
+	return true;
+}
+
+/**
+ * \brief background compaction, call it when there is nothing else to do.
+ * compacts one sector if less than DOORKEEPERJOURNAL_RESERVE are free and
+ * no transaction is open.
+ */
+boolean DoorKeeperJournal::compactStep() {
+	if (writable == false || freeSectors >= DOORKEEPERJOURNAL_RESERVE
+			|| transaction != 0) {
+		return false;
+	}
+	return compact();
+}
+
+DoorKeeperJournalStats DoorKeeperJournal::getStats() {
+	DoorKeeperJournalStats stats;
+	stats.appends = appends;
+	stats.commits = commits;
+	stats.relocated = relocated;
+	stats.compactions = compactions;
+	stats.foregroundCompactions = foregroundCompactions;
+	stats.corrupt = corrupt;
+	stats.minEraseCount = eraseCount[0];
+	stats.maxEraseCount = eraseCount[0];
+	for (uint8_t s = 1; s < DOORKEEPERJOURNAL_SECTORS; s++) {
+		if (eraseCount[s] < stats.minEraseCount) {
+			stats.minEraseCount = eraseCount[s];
+		}
+		if (eraseCount[s] > stats.maxEraseCount) {
+			stats.maxEraseCount = eraseCount[s];
+		}
+	}
+	stats.freeSectors = freeSectors;
+	return stats;
+}
@@ -0,0 +1,196 @@
+/*
+ * Copyright (C) 2017 A. Koller - akandroid75@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef DOORKEEPERJOURNAL_H_
+#define DOORKEEPERJOURNAL_H_
+
+#include <Arduino.h>
+#include <stdint.h>
+
+/*
+ * Log structured user store.
+ *
+ * Every change of a user entry is appended as a CRC32 protected record to a
+ * ring of flash sectors, a sector is only erased when its records have been
+ * relocated (compaction). At boot the records are replayed from the newest
+ * to the oldest, the last written record of an entry wins.
+ *
+ * sector:  header (16 byte) | record | record | ... (erased slots: 0xff)
+ * record:  type | reserved | index | data (DOORKEEPERJOURNAL_DATASIZE) | crc
+ *
+ * Compaction always takes the oldest sector. Records which are still the
+ * last one of their entry are appended to the head sector again, delete
+ * records are dropped (there is no older record of that entry left).
+ * It runs in idle loop passes (compactStep) while less than
+ * DOORKEEPERJOURNAL_RESERVE sectors are free, and in the foreground only if
+ * the head sector is full and no free sector is left.
+ *
+ * append / remove only buffer the record, commit() writes all buffered
+ * records with one flash write (two if the head sector is full).
+ *
+ * Records staged between beginTransaction() and endTransaction() carry the
+ * transaction id in the reserved byte, endTransaction() appends an end marker
+ * with the same id. They are only replayed if the nearest newer end marker is
+ * theirs, so a transaction interrupted by a reset is dropped as a whole.
+ * read() and compaction only see them after endTransaction(), an aborted
+ * transaction leaves the entries as they were.
+ *
+ * The journal only holds the entries after takeOver(), until then begin()
+ * drops the replayed records and the caller keeps its old store. Opened
+ * read only, it never erases or writes flash.
+ */
+
+#define DOORKEEPERJOURNAL_SECTORSIZE 4096
+
+// number of flash sectors, >= 2
+#ifndef DOORKEEPERJOURNAL_SECTORS
+#define DOORKEEPERJOURNAL_SECTORS 4
+#endif
+
+// free sectors kept by background compaction
+#ifndef DOORKEEPERJOURNAL_RESERVE
+#define DOORKEEPERJOURNAL_RESERVE 2
+#endif
+
+// no flash sectors given
+#define DOORKEEPERJOURNAL_NOSECTOR 0xffffffff
+
+// first flash sector. on the esp8266 there is no default: the sectors have
+// to lie between the end of the filesystem (_FS_end) and the EEPROM sector,
+// see checkSectors
+#ifndef DOORKEEPERJOURNAL_SECTOR
+#ifdef ARDUINO_ARCH_ESP8266
+#define DOORKEEPERJOURNAL_SECTOR DOORKEEPERJOURNAL_NOSECTOR
+#else
+#define DOORKEEPERJOURNAL_SECTOR 0
+#endif
+#endif
+
+// records buffered until commit()
+#ifndef DOORKEEPERJOURNAL_BATCH
+#define DOORKEEPERJOURNAL_BATCH 8
+#endif
+
+// payload of one record (>= sizeof(User))
+#define DOORKEEPERJOURNAL_DATASIZE 40
+
+#define DOORKEEPERJOURNAL_NOPOS 0xffff
+
+struct DoorKeeperJournalSector {
+	uint32_t magic;
+	uint32_t eraseCount;
+	// 0xffffffff: sector is free
+	uint32_t sequence;
+	// 0xffffffff: the user db is still read from elsewhere (see takeOver)
+	uint32_t owner;
+};
+
+struct DoorKeeperJournalRecord {
+	uint8_t type;
+	uint8_t reserved;
+	uint16_t index;
+	uint8_t data[DOORKEEPERJOURNAL_DATASIZE];
+	uint32_t crc;
+};
+
+#define DOORKEEPERJOURNAL_RECORDS \
+	((DOORKEEPERJOURNAL_SECTORSIZE - sizeof(DoorKeeperJournalSector)) \
+			/ sizeof(DoorKeeperJournalRecord))
+
+struct DoorKeeperJournalStats {
+	uint32_t appends;
+	uint32_t commits;
+	uint32_t relocated;
+	uint32_t compactions;
+	uint32_t foregroundCompactions;
+	uint32_t corrupt;
+	uint32_t minEraseCount;
+	uint32_t maxEraseCount;
+	uint8_t freeSectors;
+};
+
+class DoorKeeperJournal {
+
+public:
+	boolean begin(uint32_t firstSector, uint16_t* positions, uint8_t* entries,
+			uint16_t entrySize, uint16_t count, boolean writable);
+	boolean takeOver();
+	boolean append(uint16_t index, uint8_t* data);
+	boolean remove(uint16_t index);
+	boolean commit();
+	boolean read(uint16_t index, uint8_t* data);
+	boolean beginTransaction(uint16_t records);
+	boolean endTransaction();
+	void abortTransaction();
+	boolean compactStep();
+	DoorKeeperJournalStats getStats();
+
+	static boolean checkSectors(uint32_t first, uint8_t sectors);
+
+private:
+	boolean stage(uint8_t type, uint16_t index, uint8_t* data);
+	boolean makeRoom();
+	boolean writeRecord(DoorKeeperJournalRecord* record);
+	boolean readRecord(uint8_t sector, uint16_t slot,
+			DoorKeeperJournalRecord* record);
+	uint32_t recordAddress(uint8_t sector, uint16_t slot);
+	uint32_t recordCrc(DoorKeeperJournalRecord* record);
+	boolean formatSector(uint8_t sector);
+	boolean openHead();
+	int oldestSector();
+	boolean compact();
+	void publishTransaction();
+	void replaySector(uint8_t sector, uint8_t* entries, uint8_t* ended,
+			uint32_t* dropped);
+
+	uint32_t first = 0;
+	uint16_t* positions = NULL;
+	uint16_t entrySize = 0;
+	uint16_t count = 0;
+	boolean writable = false;
+	// the journal holds the entries (takeOver)
+	boolean owner = false;
+
+	uint32_t sequence[DOORKEEPERJOURNAL_SECTORS];
+	uint32_t eraseCount[DOORKEEPERJOURNAL_SECTORS];
+	uint8_t freeSectors = 0;
+	uint8_t head = 0;
+	uint16_t headSlot = DOORKEEPERJOURNAL_RECORDS;
+	uint32_t lastSequence = 0;
+	DoorKeeperJournalRecord batch[DOORKEEPERJOURNAL_BATCH];
+	uint8_t batchCount = 0;
+	// id of the open transaction, 0: none
+	uint8_t transaction = 0;
+	uint8_t lastTransaction = 0;
+	// head slot and sequence at beginTransaction, its records follow
+	uint16_t transactionSlot = 0;
+	uint32_t transactionSequence = 0;
+
+	uint32_t appends = 0;
+	uint32_t commits = 0;
+	uint32_t relocated = 0;
+	uint32_t compactions = 0;
+	uint32_t foregroundCompactions = 0;
+	uint32_t corrupt = 0;
+};
+
+#endif /* DOORKEEPERJOURNAL_H_ */
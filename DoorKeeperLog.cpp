@@ -0,0 +1,168 @@
+/*
+ * Copyright (C) 2017 A. Koller - akandroid75@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <DoorKeeperLog.h>
+#include <HardwareSerial.h>
+
+static_assert((DOORKEEPERLOG_RINGSIZE & (DOORKEEPERLOG_RINGSIZE - 1)) == 0
+		&& DOORKEEPERLOG_RINGSIZE <= 128,
+		"DOORKEEPERLOG_RINGSIZE has to be a power of 2 <= 128");
+
+DoorKeeperLog dkLog;
+
+/**
+ * \brief formats up to maxRecords records to Serial.
+ * stops early if the serial tx buffer has no room for another line,
+ * so draining never blocks the loop.
+ * returns the number of records written.
+ */
+uint8_t DoorKeeperLog::drain(uint8_t maxRecords) {
+	uint8_t count = 0;
+	if (dropped != 0
+			&& Serial.availableForWrite() >= DOORKEEPERLOG_LINEMAX) {
+		Serial.print(F("log: "));
+		Serial.print(dropped);
+		Serial.println(F(" records dropped"));
+		dropped = 0;
+	}
+	while (head != tail && count < maxRecords) {
+		if (Serial.availableForWrite() < DOORKEEPERLOG_LINEMAX) {
+			break;
+		}
+		format(&ring[tail & (DOORKEEPERLOG_RINGSIZE - 1)]);
+		tail++;
+		count++;
+	}
+	return count;
+}
+
+void DoorKeeperLog::format(DoorKeeperLogRecord* r) {
+	static const char levels[] = "-EWID";
+	Serial.print(r->ms);
+	Serial.print(' ');
+	Serial.print(levels[r->level <= DOORKEEPERLOG_DEBUGLEVEL ? r->level : 0]);
+	Serial.print(' ');
+	Serial.print(eventName(r->event));
+	Serial.print(' ');
+	Serial.print(r->arg0);
+	Serial.print(' ');
+	Serial.println(r->arg1);
+}
+
+const __FlashStringHelper* DoorKeeperLog::eventName(uint8_t event) {
+	switch (event) {
+	case DKEV_MESSAGE:
+		return F("message");
+	case DKEV_CHECKSUMERROR:
+		return F("checksum error");
+	case DKEV_SESSIONNOTSTARTED:
+		return F("session not started");
+	case DKEV_UNKNOWNUSER:
+		return F("unknown user");
+	case DKEV_USEREXPIRED:
+		return F("userkey expired");
+	case DKEV_SIGNATUREINVALID:
+		return F("signature invalid");
+	case DKEV_SESSIONSTARTED:
+		return F("session started");
+	case DKEV_SESSIONFAILED:
+		return F("session failed");
+	case DKEV_NOADMIN:
+		return F("user is no admin");
+	case DKEV_USERADDED:
+		return F("user added");
+	case DKEV_USERUPDATED:
+		return F("user updated");
+	case DKEV_USERREMOVED:
+		return F("user removed");
+	case DKEV_DBFULL:
+		return F("no free user entry");
+	case DKEV_USERSTORED:
+		return F("user stored");
+	case DKEV_DBNOTSAVED:
+		return F("saveDB false, not stored");
+	case DKEV_DBERASED:
+		return F("db erased");
+	case DKEV_RELAIS:
+		return F("relais");
+	case DKEV_TIMERACTIVE:
+		return F("timer replaced");
+	case DKEV_TIMEREXPIRED:
+		return F("timer expired");
+	case DKEV_INVALIDRELAIS:
+		return F("relais nr not valid");
+	case DKEV_UNKNOWNTYPE:
+		return F("unknown messagetype");
+	case DKEV_NOHANDLER:
+		return F("defaultCallback is NULL");
+	case DKEV_DHFAILED:
+		return F("dh2 failed");
+	case DKEV_CLIENTCONNECTED:
+		return F("client connected");
+	case DKEV_CLIENTREAD:
+		return F("client read");
+	case DKEV_CLIENTCLOSED:
+		return F("client closed");
+	case DKEV_TICKETISSUED:
+		return F("ticket issued");
+	case DKEV_TICKETINVALID:
+		return F("ticket not valid");
+	case DKEV_TICKETEXPIRED:
+		return F("ticket expired");
+	case DKEV_SESSIONRESUMED:
+		return F("session resumed");
+	case DKEV_JOURNALCOMPACTED:
+		return F("journal sector compacted");
+	case DKEV_JOURNALCORRUPT:
+		return F("journal records corrupt");
+	case DKEV_JOURNALFULL:
+		return F("journal full");
+	case DKEV_JOURNALFAILED:
+		return F("flash write failed");
+	case DKEV_JOURNALABORTED:
+		return F("journal transaction aborted");
+	case DKEV_BULKSTARTED:
+		return F("bulk transfer started");
+	case DKEV_BULKCOMMITTED:
+		return F("bulk transfer committed");
+	case DKEV_BULKABORTED:
+		return F("bulk transfer aborted");
+	case DKEV_FRAMEINVALID:
+		return F("frame invalid");
+	case DKEV_STREAMRESYNC:
+		return F("stream resync");
+	case DKEV_SESSIONEVICTED:
+		return F("session evicted");
+	case DKEV_RELAISMASK:
+		return F("relais mask");
+	case DKEV_SCHEDULESET:
+		return F("schedule set");
+	case DKEV_AUDITFAILED:
+		return F("audit log failed");
+	case DKEV_FLASHREFUSED:
+		return F("flash sectors refused");
+	case DKEV_DBFLUSHFAILED:
+		return F("user db not written");
+	default:
+		return F("event");
+	}
+}
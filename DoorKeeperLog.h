@@ -0,0 +1,185 @@
+/*
+ * Copyright (C) 2017 A. Koller - akandroid75@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef DOORKEEPERLOG_H_
+#define DOORKEEPERLOG_H_
+
+#include <Arduino.h>
+#include <stdint.h>
+
+/*
+ * Deferred event log.
+ *
+ * The hot path only stores a small binary record (event id and two
+ * arguments) in a RAM ring. Records are formatted and written to Serial
+ * later by drain(), which DoorKeeper::doorkeeperLoop calls when no message
+ * was handled in the last loop pass.
+ *
+ * Levels above DOORKEEPERLOG_LEVEL are compiled out, the arguments are not
+ * evaluated.
+ */
+
+#define DOORKEEPERLOG_NONE 0
+#define DOORKEEPERLOG_ERRORLEVEL 1
+#define DOORKEEPERLOG_WARNLEVEL 2
+#define DOORKEEPERLOG_INFOLEVEL 3
+#define DOORKEEPERLOG_DEBUGLEVEL 4
+
+#ifndef DOORKEEPERLOG_LEVEL
+#define DOORKEEPERLOG_LEVEL DOORKEEPERLOG_WARNLEVEL
+#endif
+
+// number of records, power of 2 <= 128 (uint8_t head and tail)
+#ifndef DOORKEEPERLOG_RINGSIZE
+#define DOORKEEPERLOG_RINGSIZE 32
+#endif
+
+// max. number of records formatted per drain() call
+#ifndef DOORKEEPERLOG_DRAINMAX
+#define DOORKEEPERLOG_DRAINMAX 4
+#endif
+
+// free space in the serial tx buffer needed to format one record
+#define DOORKEEPERLOG_LINEMAX 48
+
+#if DOORKEEPERLOG_LEVEL >= DOORKEEPERLOG_ERRORLEVEL
+#define DOORKEEPERLOG_ERROR(e,a,b) dkLog.record(DOORKEEPERLOG_ERRORLEVEL,e,a,b)
+#else
+#define DOORKEEPERLOG_ERROR(e,a,b) do {} while (0)
+#endif
+
+#if DOORKEEPERLOG_LEVEL >= DOORKEEPERLOG_WARNLEVEL
+#define DOORKEEPERLOG_WARN(e,a,b) dkLog.record(DOORKEEPERLOG_WARNLEVEL,e,a,b)
+#else
+#define DOORKEEPERLOG_WARN(e,a,b) do {} while (0)
+#endif
+
+#if DOORKEEPERLOG_LEVEL >= DOORKEEPERLOG_INFOLEVEL
+#define DOORKEEPERLOG_INFO(e,a,b) dkLog.record(DOORKEEPERLOG_INFOLEVEL,e,a,b)
+#else
+#define DOORKEEPERLOG_INFO(e,a,b) do {} while (0)
+#endif
+
+#if DOORKEEPERLOG_LEVEL >= DOORKEEPERLOG_DEBUGLEVEL
+#define DOORKEEPERLOG_DEBUG(e,a,b) dkLog.record(DOORKEEPERLOG_DEBUGLEVEL,e,a,b)
+#else
+#define DOORKEEPERLOG_DEBUG(e,a,b) do {} while (0)
+#endif
+
+enum DoorKeeperEvent
+	: uint8_t {
+		DKEV_MESSAGE = 0x01,
+	DKEV_CHECKSUMERROR,
+	DKEV_SESSIONNOTSTARTED,
+	DKEV_UNKNOWNUSER,
+	DKEV_USEREXPIRED,
+	DKEV_SIGNATUREINVALID,
+	DKEV_SESSIONSTARTED,
+	DKEV_SESSIONFAILED,
+	DKEV_NOADMIN,
+	DKEV_USERADDED,
+	DKEV_USERUPDATED,
+	DKEV_USERREMOVED,
+	DKEV_DBFULL,
+	DKEV_USERSTORED,
+	DKEV_DBNOTSAVED,
+	DKEV_DBERASED,
+	DKEV_RELAIS,
+	DKEV_TIMERACTIVE,
+	DKEV_TIMEREXPIRED,
+	DKEV_INVALIDRELAIS,
+	DKEV_UNKNOWNTYPE,
+	DKEV_NOHANDLER,
+	DKEV_DHFAILED,
+	DKEV_CLIENTCONNECTED,
+	DKEV_CLIENTREAD,
+	DKEV_CLIENTCLOSED,
+	DKEV_TICKETISSUED,
+	DKEV_TICKETINVALID,
+	DKEV_TICKETEXPIRED,
+	DKEV_SESSIONRESUMED,
+	DKEV_JOURNALCOMPACTED,
+	DKEV_JOURNALCORRUPT,
+	DKEV_JOURNALFULL,
+	DKEV_JOURNALFAILED,
+	DKEV_JOURNALABORTED,
+	DKEV_BULKSTARTED,
+	DKEV_BULKCOMMITTED,
+	DKEV_BULKABORTED,
+	DKEV_FRAMEINVALID,
+	DKEV_STREAMRESYNC,
+	DKEV_SESSIONEVICTED,
+	DKEV_RELAISMASK,
+	DKEV_SCHEDULESET,
+	DKEV_AUDITFAILED,
+	DKEV_FLASHREFUSED,
+	DKEV_DBFLUSHFAILED
+};
+
+struct DoorKeeperLogRecord {
+	uint32_t ms;
+	uint8_t level;
+	uint8_t event;
+	uint16_t arg0;
+	uint32_t arg1;
+};
+
+class DoorKeeperLog {
+
+public:
+	/**
+	 * \brief stores one record, never blocks.
+	 * if the ring is full the record is dropped and counted.
+	 */
+	void record(uint8_t level, uint8_t event, uint16_t arg0, uint32_t arg1) {
+		if ((uint8_t) (head - tail) >= DOORKEEPERLOG_RINGSIZE) {
+			dropped++;
+			return;
+		}
+		DoorKeeperLogRecord* r = &ring[head & (DOORKEEPERLOG_RINGSIZE - 1)];
+		r->ms = millis();
+		r->level = level;
+		r->event = event;
+		r->arg0 = arg0;
+		r->arg1 = arg1;
+		head++;
+	}
+
+	uint8_t drain(uint8_t maxRecords);
+
+	boolean isEmpty() {
+		return head == tail && dropped == 0;
+	}
+
+private:
+	void format(DoorKeeperLogRecord* r);
+	const __FlashStringHelper* eventName(uint8_t event);
+
+	DoorKeeperLogRecord ring[DOORKEEPERLOG_RINGSIZE];
+	uint8_t head = 0;
+	uint8_t tail = 0;
+	uint16_t dropped = 0;
+};
+
+extern DoorKeeperLog dkLog;
+
+#endif /* DOORKEEPERLOG_H_ */
@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2017 A. Koller - akandroid75@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <DoorKeeperMetrics.h>
+#include <cstring>
+
+DoorKeeperMetrics dkMetrics;
+
+uint32_t DoorKeeperMetrics::getMessages(uint8_t type) {
+	return type < DOORKEEPERMETRICS_TYPES ? messages[type] : 0;
+}
+
+uint32_t DoorKeeperMetrics::getCounter(uint8_t counter) {
+	return counter < DKCNT_COUNTERS ? counters[counter] : 0;
+}
+
+const DoorKeeperHistogramData* DoorKeeperMetrics::getHistogram(
+		uint8_t histogram) {
+	return histogram < DKHIST_HISTOGRAMS ? &histograms[histogram] : NULL;
+}
+
+/**
+ * \brief upper bound in cycles of the bucket with the percent-th
+ * percentile (the max for the last bucket), 0 if nothing was recorded
+ */
+uint32_t DoorKeeperMetrics::percentile(uint8_t histogram, uint8_t percent) {
+	const DoorKeeperHistogramData* h = getHistogram(histogram);
+	if (h == NULL || h->count == 0) {
+		return 0;
+	}
+	uint32_t rank = ((uint64_t) h->count * percent + 99) / 100;
+	uint32_t seen = 0;
+	for (uint8_t b = 0; b < DOORKEEPERMETRICS_BUCKETS - 1; b++) {
+		seen += h->buckets[b];
+		if (seen >= rank && seen > 0) {
+			uint32_t bound = (2UL << (b + DOORKEEPERMETRICS_SHIFT)) - 1;
+			return bound < h->maxCycles ? bound : h->maxCycles;
+		}
+	}
+	return h->maxCycles;
+}
+
+void DoorKeeperMetrics::reset() {
+	memset(messages, 0, sizeof(messages));
+	memset(counters, 0, sizeof(counters));
+	memset(histograms, 0, sizeof(histograms));
+}
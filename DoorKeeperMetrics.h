@@ -0,0 +1,146 @@
+/*
+ * Copyright (C) 2017 A. Koller - akandroid75@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef DOORKEEPERMETRICS_H_
+#define DOORKEEPERMETRICS_H_
+
+#include <Arduino.h>
+#include <stdint.h>
+
+/*
+ * Protocol metrics.
+ *
+ * Counts the received messages per type and protocol events (checksum,
+ * frame and authentication failures, sessions) and keeps latency
+ * histograms of the handshake stages and of the symmetric requests in CPU
+ * cycles (ESP.getCycleCount()). Recording is an increment, or a cycle
+ * counter read and a count leading zeros for a histogram, so it can stay on;
+ * build with DOORKEEPERMETRICS 0 to compile it out.
+ *
+ * Histogram bucket 0 counts durations < 2^(SHIFT + 1) cycles, bucket n
+ * 2^(n + SHIFT) .. 2^(n + SHIFT + 1) - 1 cycles, the last one everything
+ * above (with 80 MHz: < 25 us, 25 us .. 51 us, ... >= 6.7 s).
+ */
+
+#ifndef DOORKEEPERMETRICS
+#define DOORKEEPERMETRICS 1
+#endif
+
+#define DOORKEEPERMETRICS_BUCKETS 20
+#define DOORKEEPERMETRICS_SHIFT 10
+
+// message types 0 .. TYPES - 1 are counted one by one, others as type 0
+#define DOORKEEPERMETRICS_TYPES 0x30
+
+#if DOORKEEPERMETRICS
+#define DOORKEEPERMETRICS_MESSAGE(t) dkMetrics.message(t)
+#define DOORKEEPERMETRICS_COUNT(c) dkMetrics.count(c)
+#define DOORKEEPERMETRICS_CYCLES() ESP.getCycleCount()
+#define DOORKEEPERMETRICS_RECORD(h,cycles) dkMetrics.time(h, cycles)
+#else
+#define DOORKEEPERMETRICS_MESSAGE(t) do {} while (0)
+#define DOORKEEPERMETRICS_COUNT(c) do {} while (0)
+#define DOORKEEPERMETRICS_CYCLES() 0
+#define DOORKEEPERMETRICS_RECORD(h,cycles) ((void) (cycles))
+#endif
+
+// cycles since start (a DOORKEEPERMETRICS_CYCLES() value)
+#define DOORKEEPERMETRICS_TIME(h,start) \
+	DOORKEEPERMETRICS_RECORD(h, DOORKEEPERMETRICS_CYCLES() - (start))
+
+enum DoorKeeperCounter
+	: uint8_t {
+		DKCNT_CHECKSUMERRORS,
+	DKCNT_FRAMEERRORS,
+	// encrypted message without a started session
+	DKCNT_NOSESSION,
+	// unknown or expired key, bad signature or ticket, no admin
+	DKCNT_AUTHFAILURES,
+	DKCNT_SESSIONSSTARTED,
+	DKCNT_SESSIONSRESUMED,
+	DKCNT_SESSIONSEVICTED,
+	DKCNT_SESSIONSENDED,
+	DKCNT_COUNTERS
+};
+
+enum DoorKeeperHistogram
+	: uint8_t {
+		// handshake: signature check of the client
+	DKHIST_VERIFY,
+	// ephemeral key pair (from the key pool: almost 0)
+	DKHIST_DH1,
+	// shared secret
+	DKHIST_DH2,
+	// signature of the response
+	DKHIST_SIGN,
+	// all other messages: decrypt, handle, encrypt
+	DKHIST_REQUEST,
+	DKHIST_HISTOGRAMS
+};
+
+struct DoorKeeperHistogramData {
+	uint32_t count;
+	uint32_t maxCycles;
+	uint32_t buckets[DOORKEEPERMETRICS_BUCKETS];
+};
+
+class DoorKeeperMetrics {
+
+public:
+	void message(uint8_t type) {
+		messages[type < DOORKEEPERMETRICS_TYPES ? type : 0]++;
+	}
+
+	void count(uint8_t counter) {
+		counters[counter]++;
+	}
+
+	void time(uint8_t histogram, uint32_t cycles) {
+		DoorKeeperHistogramData* h = &histograms[histogram];
+		uint8_t bucket = 31 - __builtin_clz(cycles | 1);
+		bucket = bucket > DOORKEEPERMETRICS_SHIFT ?
+				bucket - DOORKEEPERMETRICS_SHIFT : 0;
+		if (bucket >= DOORKEEPERMETRICS_BUCKETS) {
+			bucket = DOORKEEPERMETRICS_BUCKETS - 1;
+		}
+		h->buckets[bucket]++;
+		h->count++;
+		if (cycles > h->maxCycles) {
+			h->maxCycles = cycles;
+		}
+	}
+
+	uint32_t getMessages(uint8_t type);
+	uint32_t getCounter(uint8_t counter);
+	const DoorKeeperHistogramData* getHistogram(uint8_t histogram);
+	uint32_t percentile(uint8_t histogram, uint8_t percent);
+	void reset();
+
+private:
+	uint32_t messages[DOORKEEPERMETRICS_TYPES] = { };
+	uint32_t counters[DKCNT_COUNTERS] = { };
+	DoorKeeperHistogramData histograms[DKHIST_HISTOGRAMS] = { };
+};
+
+extern DoorKeeperMetrics dkMetrics;
+
+#endif /* DOORKEEPERMETRICS_H_ */
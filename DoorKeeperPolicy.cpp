@@ -0,0 +1,156 @@
+/*
+ * Copyright (C) 2017 A. Koller - akandroid75@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <DoorKeeperPolicy.h>
+#include <cstring>
+
+static const uint8_t alwaysWeek[DOORKEEPERPOLICY_WEEKBYTES] = {
+		0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+		0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+static const uint8_t neverWeek[DOORKEEPERPOLICY_WEEKBYTES] = { };
+
+void DoorKeeperPolicy::clearSchedule(DoorKeeperSchedule* schedule) {
+	memset(schedule->week, 0, DOORKEEPERPOLICY_WEEKBYTES);
+}
+
+/**
+ * \brief allows the hours fromHour .. toHour - 1 on the days of the mask
+ * (bit 0: sunday .. bit 6: saturday), e.g. 0x3e, 7, 19: mon - fri 07:00 to
+ * 19:00. toHour <= fromHour wraps to the next day
+ */
+void DoorKeeperPolicy::addWindow(DoorKeeperSchedule* schedule, uint8_t days,
+		uint8_t fromHour, uint8_t toHour) {
+	if (fromHour >= 24 || toHour > 24) {
+		return;
+	}
+	uint8_t hours =
+			toHour > fromHour ? toHour - fromHour : toHour + 24 - fromHour;
+	for (uint8_t wday = 0; wday < 7; wday++) {
+		if ((days & (1 << wday)) == 0) {
+			continue;
+		}
+		for (uint8_t h = 0; h < hours; h++) {
+			uint8_t bit = (wday * 24 + fromHour + h) % DOORKEEPERPOLICY_HOURS;
+			schedule->week[bit >> 3] |= 1 << (bit & 7);
+		}
+	}
+}
+
+/**
+ * \brief date as a number ordered like the dates, year 0 .. 127 since
+ * 2000. later years (0xee, 0xff) give 0xffff
+ */
+uint16_t DoorKeeperPolicy::packDay(uint8_t year, uint8_t month,
+		uint8_t day) {
+	if (year > 127) {
+		return 0xffff;
+	}
+	if (month > 15) {
+		month = 15;
+	}
+	if (day > 31) {
+		day = 31;
+	}
+	return (year << 9) | (month << 5) | day;
+}
+
+/**
+ * \brief count entries, compiled by the owner. the schedules are not
+ * copied and have to stay
+ */
+void DoorKeeperPolicy::begin(DoorKeeperAccess* e, uint16_t c,
+		const DoorKeeperSchedule* s, uint8_t sc) {
+	entries = e;
+	count = c;
+	schedules = s;
+	scheduleCount = s != NULL ? sc : 0;
+	for (uint16_t i = 0; i < count; i++) {
+		never(i);
+	}
+}
+
+/**
+ * \brief schedule is a valid schedule number (or none)
+ */
+boolean DoorKeeperPolicy::isSchedule(uint8_t schedule) {
+	return schedule == 0 || schedule == DOORKEEPERPOLICY_NONE
+			|| schedule <= scheduleCount;
+}
+
+/**
+ * \brief compiles dates (year, month, day) and schedule number of entry
+ * index. validFrom 0xff 0xff 0xff: valid from now. an unknown schedule
+ * never allows access
+ */
+void DoorKeeperPolicy::compile(uint16_t index, const uint8_t* validFrom,
+		const uint8_t* validTo, uint8_t schedule) {
+	if (index >= count) {
+		return;
+	}
+	DoorKeeperAccess* a = &entries[index];
+	if (validFrom[0] == 0xff && validFrom[1] == 0xff && validFrom[2] == 0xff) {
+		a->fromDay = 0;
+	} else {
+		a->fromDay = packDay(validFrom[0], validFrom[1], validFrom[2]);
+	}
+	a->toDay = packDay(validTo[0], validTo[1], validTo[2]);
+	if (schedule == 0 || schedule == DOORKEEPERPOLICY_NONE) {
+		a->week = alwaysWeek;
+	} else if (schedule <= scheduleCount) {
+		a->week = schedules[schedule - 1].week;
+	} else {
+		a->week = neverWeek;
+	}
+}
+
+/**
+ * \brief entry index is allowed at any time
+ */
+void DoorKeeperPolicy::always(uint16_t index) {
+	if (index >= count) {
+		return;
+	}
+	entries[index].fromDay = 0;
+	entries[index].toDay = 0xffff;
+	entries[index].week = alwaysWeek;
+}
+
+/**
+ * \brief entry index is never allowed (free entry)
+ */
+void DoorKeeperPolicy::never(uint16_t index) {
+	if (index >= count) {
+		return;
+	}
+	entries[index].fromDay = 0xffff;
+	entries[index].toDay = 0;
+	entries[index].week = neverWeek;
+}
+
+/**
+ * \brief current date (year since 2000) and hour of the week
+ */
+void DoorKeeperPolicy::setTime(uint8_t year, uint8_t month, uint8_t day,
+		uint8_t wday, uint8_t hour) {
+	today = packDay(year, month, day);
+	weekHour = (wday % 7) * 24 + hour % 24;
+}
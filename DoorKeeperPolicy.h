@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2017 A. Koller - akandroid75@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef DOORKEEPERPOLICY_H_
+#define DOORKEEPERPOLICY_H_
+
+#include <Arduino.h>
+#include <stdint.h>
+
+/*
+ * Compiled access policies.
+ *
+ * A user may enter from its validFrom to its validTo date and, if it has a
+ * schedule, only in the hours of the week set in that schedule. compile()
+ * turns the dates of a user into two packed day numbers (year << 9 |
+ * month << 5 | day, ordered like the dates) and its schedule number into a
+ * pointer to a 168 bit week bitmap (bit wday * 24 + hour). setTime() packs
+ * the current date and hour of the week once, from CB1000ms, so allowed()
+ * is two compares and one bit test.
+ *
+ * The schedules are defined by the sketch (DoorKeeperConfig), a user
+ * refers to one by its number (1 .. count), 0 and 0xff: no schedule.
+ */
+
+// hours of a week
+#define DOORKEEPERPOLICY_HOURS 168
+#define DOORKEEPERPOLICY_WEEKBYTES (DOORKEEPERPOLICY_HOURS / 8)
+
+// schedule number of users without a schedule (also 0)
+#define DOORKEEPERPOLICY_NONE 0xff
+
+struct DoorKeeperSchedule {
+	// bit n: hour n % 24 of day n / 24 (0: sunday)
+	uint8_t week[DOORKEEPERPOLICY_WEEKBYTES];
+};
+
+struct DoorKeeperAccess {
+	uint16_t fromDay;
+	uint16_t toDay;
+	const uint8_t* week;
+};
+
+class DoorKeeperPolicy {
+
+public:
+	static void clearSchedule(DoorKeeperSchedule* schedule);
+	static void addWindow(DoorKeeperSchedule* schedule, uint8_t days,
+			uint8_t fromHour, uint8_t toHour);
+	static uint16_t packDay(uint8_t year, uint8_t month, uint8_t day);
+
+	void begin(DoorKeeperAccess* entries, uint16_t count,
+			const DoorKeeperSchedule* schedules, uint8_t scheduleCount);
+	boolean isSchedule(uint8_t schedule);
+	void compile(uint16_t index, const uint8_t* validFrom,
+			const uint8_t* validTo, uint8_t schedule);
+	void always(uint16_t index);
+	void never(uint16_t index);
+	void setTime(uint8_t year, uint8_t month, uint8_t day, uint8_t wday,
+			uint8_t hour);
+
+	/**
+	 * \brief may user index enter now
+	 */
+	boolean allowed(uint16_t index) {
+		DoorKeeperAccess* a = &entries[index];
+		return a->fromDay <= today && today <= a->toDay
+				&& (a->week[weekHour >> 3] & (1 << (weekHour & 7))) != 0;
+	}
+
+private:
+	DoorKeeperAccess* entries = NULL;
+	uint16_t count = 0;
+	const DoorKeeperSchedule* schedules = NULL;
+	uint8_t scheduleCount = 0;
+	uint16_t today = 0;
+	uint8_t weekHour = 0;
+};
+
+#endif /* DOORKEEPERPOLICY_H_ */
@@ -0,0 +1,262 @@
+/*
+ * Copyright (C) 2017 A. Koller - akandroid75@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <DoorKeeper.h>
+#include <DoorKeeperSessions.h>
+#include <cstring>
+#include <new>
+
+#define NOSLOT 0xffff
+
+DoorKeeperSessions::~DoorKeeperSessions() {
+	delete[] sessions;
+	delete[] slots;
+	delete[] table;
+}
+
+/**
+ * \brief allocates capacity sessions, call once.
+ * returns false if capacity is out of range or the memory is missing
+ */
+boolean DoorKeeperSessions::begin(DoorKeeper* keeper_, uint16_t capacity_,
+		uint32_t idleMs_) {
+	if (sessions != NULL || capacity_ == 0
+			|| capacity_ > DOORKEEPERSESSIONS_MAXCAPACITY) {
+		return false;
+	}
+	uint32_t tableSize = 2;
+	while (tableSize < 2 * (uint32_t) capacity_) {
+		tableSize <<= 1;
+	}
+	sessions = new (std::nothrow) DoorKeeperSession[capacity_];
+	slots = new (std::nothrow) Slot[capacity_];
+	table = new (std::nothrow) uint16_t[tableSize];
+	if (sessions == NULL || slots == NULL || table == NULL) {
+		delete[] sessions;
+		delete[] slots;
+		delete[] table;
+		sessions = NULL;
+		slots = NULL;
+		table = NULL;
+		return false;
+	}
+	keeper = keeper_;
+	capacity = capacity_;
+	idleMs = idleMs_;
+	tableMask = tableSize - 1;
+	memset(table, 0xff, tableSize * sizeof(uint16_t));
+	for (uint16_t i = 0; i < capacity; i++) {
+		slots[i].next = i + 1 < capacity ? i + 1 : NOSLOT;
+	}
+	freeSlot = 0;
+	newest = NOSLOT;
+	oldest = NOSLOT;
+	return true;
+}
+
+uint16_t DoorKeeperSessions::bucket(uint32_t id) {
+	// fibonacci hashing, connection ids are often sequential
+	return (uint16_t) ((id * 2654435761u) >> 16) & tableMask;
+}
+
+/**
+ * \brief position of id in the hash table, -1 if it has no session
+ */
+int DoorKeeperSessions::find(uint32_t id) {
+	if (table == NULL) {
+		return -1;
+	}
+	for (uint16_t position = bucket(id);; position = (position + 1)
+			& tableMask) {
+		uint16_t index = table[position];
+		if (index == NOSLOT) {
+			return -1;
+		}
+		if (slots[index].id == id) {
+			return position;
+		}
+	}
+}
+
+void DoorKeeperSessions::unlink(uint16_t index) {
+	Slot* slot = &slots[index];
+	if (slot->prev != NOSLOT) {
+		slots[slot->prev].next = slot->next;
+	} else {
+		newest = slot->next;
+	}
+	if (slot->next != NOSLOT) {
+		slots[slot->next].prev = slot->prev;
+	} else {
+		oldest = slot->prev;
+	}
+}
+
+void DoorKeeperSessions::pushFront(uint16_t index) {
+	Slot* slot = &slots[index];
+	slot->prev = NOSLOT;
+	slot->next = newest;
+	if (newest != NOSLOT) {
+		slots[newest].prev = index;
+	} else {
+		oldest = index;
+	}
+	newest = index;
+}
+
+/**
+ * \brief ends the session at table position and frees its slot
+ */
+void DoorKeeperSessions::release(int position) {
+	uint16_t index = table[position];
+	keeper->endSession(&sessions[index]);
+	unlink(index);
+	slots[index].next = freeSlot;
+	freeSlot = index;
+	active--;
+
+	// backward shift deletion, no tombstones
+	uint16_t hole = position;
+	uint16_t next = (hole + 1) & tableMask;
+	while (table[next] != NOSLOT) {
+		uint16_t home = bucket(slots[table[next]].id);
+		// entry may move to hole if hole is between home and next
+		if (((next - home) & tableMask) >= ((next - hole) & tableMask)) {
+			table[hole] = table[next];
+			hole = next;
+		}
+		next = (next + 1) & tableMask;
+	}
+	table[hole] = NOSLOT;
+}
+
+/**
+ * \brief new session for connection id, an old session of id is ended.
+ * returns NULL if all sessions are in use
+ */
+DoorKeeperSession* DoorKeeperSessions::create(uint32_t id) {
+	remove(id);
+	if (freeSlot == NOSLOT) {
+		full++;
+		return NULL;
+	}
+	uint16_t index = freeSlot;
+	freeSlot = slots[index].next;
+	Slot* slot = &slots[index];
+	slot->id = id;
+	slot->lastUsed = millis();
+	pushFront(index);
+	uint16_t position = bucket(id);
+	while (table[position] != NOSLOT) {
+		position = (position + 1) & tableMask;
+	}
+	table[position] = index;
+
+	DoorKeeperSession* session = &sessions[index];
+	// endSession has wiped it when it was freed, clear the frame state too
+	session->userindex = INVALIDINDEX;
+	session->aead = false;
+	session->compactFrame = false;
+	session->aeadFrame = false;
+	session->frameLength = ARDUCRYPTMESSAGESIZE;
+	created++;
+	active++;
+	if (active > maxActive) {
+		maxActive = active;
+	}
+	return session;
+}
+
+/**
+ * \brief session of connection id (now the most recently used one),
+ * NULL if there is none (never created, removed or evicted)
+ */
+DoorKeeperSession* DoorKeeperSessions::get(uint32_t id) {
+	int position = find(id);
+	if (position < 0) {
+		return NULL;
+	}
+	uint16_t index = table[position];
+	slots[index].lastUsed = millis();
+	if (newest != index) {
+		unlink(index);
+		pushFront(index);
+	}
+	return &sessions[index];
+}
+
+/**
+ * \brief ends the session of connection id, call it when the connection
+ * is closed
+ */
+void DoorKeeperSessions::remove(uint32_t id) {
+	int position = find(id);
+	if (position >= 0) {
+		release(position);
+		removed++;
+	}
+}
+
+/**
+ * \brief ends up to maxSessions sessions which were idle for idleMs,
+ * oldest first. returns the number of evicted sessions
+ */
+uint8_t DoorKeeperSessions::evictIdle(uint8_t maxSessions) {
+	uint8_t count = 0;
+	if (idleMs == 0) {
+		return 0;
+	}
+	uint32_t now = millis();
+	while (count < maxSessions && oldest != NOSLOT
+			&& now - slots[oldest].lastUsed >= idleMs) {
+		uint32_t id = slots[oldest].id;
+		DOORKEEPERLOG_INFO(DKEV_SESSIONEVICTED, (uint16_t ) id,
+				now - slots[oldest].lastUsed);
+		DOORKEEPERMETRICS_COUNT(DKCNT_SESSIONSEVICTED);
+		release(find(id));
+		evicted++;
+		count++;
+		if (evictHandler != NULL) {
+			evictHandler(id);
+		}
+	}
+	return count;
+}
+
+/**
+ * \brief handler called with the connection id of every evicted session
+ */
+void DoorKeeperSessions::setEvictHandler(void (*handler)(uint32_t id)) {
+	evictHandler = handler;
+}
+
+DoorKeeperSessionStats DoorKeeperSessions::getStats() {
+	DoorKeeperSessionStats stats;
+	stats.capacity = capacity;
+	stats.active = active;
+	stats.maxActive = maxActive;
+	stats.created = created;
+	stats.removed = removed;
+	stats.evicted = evicted;
+	stats.full = full;
+	return stats;
+}
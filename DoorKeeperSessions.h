@@ -0,0 +1,124 @@
+/*
+ * Copyright (C) 2017 A. Koller - akandroid75@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef DOORKEEPERSESSIONS_H_
+#define DOORKEEPERSESSIONS_H_
+
+#include <Arduino.h>
+#include <stdint.h>
+
+class DoorKeeper;
+struct DoorKeeperSession;
+
+/*
+ * Session manager.
+ *
+ * begin() allocates all sessions at once (a slab of capacity fixed size
+ * DoorKeeperSession objects plus a small index), nothing is allocated or
+ * freed later, so the heap does not fragment. A session belongs to a
+ * connection id chosen by the server (client slot, socket ...), get() finds
+ * it in O(1) through an open addressing hash of the ids.
+ *
+ * Sessions are kept in least recently used order, get() moves a session to
+ * the front. evictIdle() (from the loop) ends the sessions at the back which
+ * were not used for idleMs: DoorKeeper::endSession wipes the ChaCha state
+ * and the slot is free again. The evict handler gets the connection id so
+ * the server can close the connection too. remove() does the same when the
+ * connection is closed by the peer.
+ */
+
+// sessions not used for this long are evicted, 0: never
+#ifndef DOORKEEPERSESSIONS_IDLEMS
+#define DOORKEEPERSESSIONS_IDLEMS 300000
+#endif
+
+// max. number of sessions evicted per evictIdle() call
+#ifndef DOORKEEPERSESSIONS_EVICTMAX
+#define DOORKEEPERSESSIONS_EVICTMAX 4
+#endif
+
+// max. capacity, slot indexes are 16 bit
+#define DOORKEEPERSESSIONS_MAXCAPACITY 0x7fff
+
+struct DoorKeeperSessionStats {
+	uint16_t capacity;
+	uint16_t active;
+	uint16_t maxActive;
+	uint32_t created;
+	uint32_t removed;
+	// ended by evictIdle
+	uint32_t evicted;
+	// create() without a free slot
+	uint32_t full;
+};
+
+class DoorKeeperSessions {
+
+public:
+	~DoorKeeperSessions();
+
+	boolean begin(DoorKeeper* keeper, uint16_t capacity,
+			uint32_t idleMs = DOORKEEPERSESSIONS_IDLEMS);
+	DoorKeeperSession* create(uint32_t id);
+	DoorKeeperSession* get(uint32_t id);
+	void remove(uint32_t id);
+	uint8_t evictIdle(uint8_t maxSessions = DOORKEEPERSESSIONS_EVICTMAX);
+	void setEvictHandler(void (*handler)(uint32_t id));
+	DoorKeeperSessionStats getStats();
+
+private:
+	struct Slot {
+		uint32_t id;
+		uint32_t lastUsed;
+		// LRU list while in use, free list (next) otherwise
+		uint16_t prev;
+		uint16_t next;
+	};
+
+	int find(uint32_t id);
+	uint16_t bucket(uint32_t id);
+	void unlink(uint16_t index);
+	void pushFront(uint16_t index);
+	void release(int position);
+
+	DoorKeeper* keeper = NULL;
+	DoorKeeperSession* sessions = NULL;
+	Slot* slots = NULL;
+	// hash of the ids: slot index or NOSLOT, power of 2 >= 2 * capacity
+	uint16_t* table = NULL;
+	uint16_t tableMask = 0;
+	uint16_t capacity = 0;
+	uint16_t freeSlot;
+	uint16_t newest;
+	uint16_t oldest;
+	uint32_t idleMs = 0;
+	void (*evictHandler)(uint32_t id) = NULL;
+
+	uint16_t active = 0;
+	uint16_t maxActive = 0;
+	uint32_t created = 0;
+	uint32_t removed = 0;
+	uint32_t evicted = 0;
+	uint32_t full = 0;
+};
+
+#endif /* DOORKEEPERSESSIONS_H_ */
@@ -0,0 +1,237 @@
+/*
+ * Copyright (C) 2017 A. Koller - akandroid75@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <DoorKeeper.h>
+#include <DoorKeeperStream.h>
+#include <cstring>
+
+static_assert((DOORKEEPERSTREAM_SIZE & (DOORKEEPERSTREAM_SIZE - 1)) == 0,
+		"DOORKEEPERSTREAM_SIZE has to be a power of 2");
+static_assert(DOORKEEPERSTREAM_SIZE >= DOORKEEPERFRAMEMAXSIZE
+		&& DOORKEEPERSTREAM_SIZE <= 0x8000,
+		"DOORKEEPERSTREAM_SIZE out of range");
+
+static_assert(DOORKEEPEROUTQUEUE_SIZE >= DOORKEEPERFRAMEMAXSIZE
+		&& DOORKEEPEROUTQUEUE_SIZE <= 0xffff,
+		"DOORKEEPEROUTQUEUE_SIZE out of range");
+
+#define STREAMMASK (DOORKEEPERSTREAM_SIZE - 1)
+
+/**
+ * \brief free bytes in the ring
+ */
+int DoorKeeperStream::space() {
+	return DOORKEEPERSTREAM_SIZE - available();
+}
+
+/**
+ * \brief received bytes not handed out yet
+ */
+int DoorKeeperStream::available() {
+	return (uint16_t) (head - tail);
+}
+
+/**
+ * \brief copies up to length bytes into the ring, returns the bytes taken
+ */
+int DoorKeeperStream::write(const uint8_t* data, int length) {
+	int done = 0;
+	int chunk;
+	uint8_t* buffer;
+	while (done < length && (buffer = writeBuffer(&chunk)) != NULL) {
+		if (chunk > length - done) {
+			chunk = length - done;
+		}
+		memcpy(buffer, data + done, chunk);
+		commitWrite(chunk);
+		done += chunk;
+	}
+	return done;
+}
+
+/**
+ * \brief contiguous free part of the ring, NULL if the ring is full.
+ * data written there has to be committed with commitWrite
+ */
+uint8_t* DoorKeeperStream::writeBuffer(int* length) {
+	int free = space();
+	if (free == 0) {
+		*length = 0;
+		return NULL;
+	}
+	int offset = head & STREAMMASK;
+	*length = DOORKEEPERSTREAM_SIZE - offset;
+	if (*length > free) {
+		*length = free;
+	}
+	return &ring[offset];
+}
+
+void DoorKeeperStream::commitWrite(int length) {
+	head += length;
+	received += length;
+}
+
+uint8_t DoorKeeperStream::peek(int offset) {
+	return ring[(tail + offset) & STREAMMASK];
+}
+
+void DoorKeeperStream::copyOut(uint8_t* frame, int length) {
+	int offset = tail & STREAMMASK;
+	int first = DOORKEEPERSTREAM_SIZE - offset;
+	if (first > length) {
+		first = length;
+	}
+	memcpy(frame, &ring[offset], first);
+	memcpy(frame + first, ring, length - first);
+}
+
+void DoorKeeperStream::drop(int length) {
+	if (synced == true) {
+		DOORKEEPERLOG_WARN(DKEV_STREAMRESYNC, peek(0), resyncBytes);
+		synced = false;
+	}
+	tail += length;
+	resyncBytes += length;
+}
+
+/**
+ * \brief copies the next complete frame to frame (DOORKEEPERFRAMEMAXSIZE
+ * bytes) and returns its size, 0 if no complete frame is received yet
+ */
+int DoorKeeperStream::nextFrame(uint8_t* frame) {
+	uint8_t header[DOORKEEPERCOMPACTHEADERSIZE];
+	while (available() >= 2) {
+		uint8_t header2 = peek(1);
+		if (peek(0) != DOORKEEPERFRAME_HEADER1
+				|| (header2 != DOORKEEPERFRAME_HEADER2
+						&& header2 != DOORKEEPERFRAME_COMPACTHEADER2
+						&& header2 != DOORKEEPERFRAME_AEADHEADER2)) {
+			drop(1);
+			continue;
+		}
+		if (available() < DOORKEEPERCOMPACTHEADERSIZE) {
+			return 0;
+		}
+		copyOut(header, DOORKEEPERCOMPACTHEADERSIZE);
+		int size = DoorKeeper::frameSize(header);
+		if (size == 0) {
+			// length out of range, not a frame start
+			drop(1);
+			continue;
+		}
+		if (available() < size) {
+			return 0;
+		}
+		copyOut(frame, size);
+		tail += size;
+		frames++;
+		synced = true;
+		return size;
+	}
+	return 0;
+}
+
+/**
+ * \brief drops all received bytes (new connection)
+ */
+void DoorKeeperStream::reset() {
+	head = 0;
+	tail = 0;
+	synced = true;
+}
+
+DoorKeeperStreamStats DoorKeeperStream::getStats() {
+	DoorKeeperStreamStats stats;
+	stats.received = received;
+	stats.frames = frames;
+	stats.resyncBytes = resyncBytes;
+	stats.pending = available();
+	return stats;
+}
+
+/**
+ * \brief free bytes for responses
+ */
+int DoorKeeperOutQueue::space() {
+	return DOORKEEPEROUTQUEUE_SIZE - pending();
+}
+
+/**
+ * \brief bytes not written to the client yet
+ */
+int DoorKeeperOutQueue::pending() {
+	return head - tail;
+}
+
+/**
+ * \brief appends one response frame, false if there is no room for it.
+ * the sent part at the front is reused when the end is reached
+ */
+boolean DoorKeeperOutQueue::queue(const uint8_t* frame, int size) {
+	if (size > space()) {
+		full++;
+		return false;
+	}
+	if (DOORKEEPEROUTQUEUE_SIZE - head < size) {
+		memmove(buffer, &buffer[tail], pending());
+		head -= tail;
+		tail = 0;
+	}
+	memcpy(&buffer[head], frame, size);
+	head += size;
+	frames++;
+	bytes += size;
+	return true;
+}
+
+void DoorKeeperOutQueue::consume(int written, int length) {
+	writes++;
+	if (written < length) {
+		shortWrites++;
+	}
+	tail += written;
+	if (tail == head) {
+		head = 0;
+		tail = 0;
+	}
+}
+
+/**
+ * \brief drops all queued responses (connection closed)
+ */
+void DoorKeeperOutQueue::reset() {
+	head = 0;
+	tail = 0;
+}
+
+DoorKeeperOutQueueStats DoorKeeperOutQueue::getStats() {
+	DoorKeeperOutQueueStats stats;
+	stats.frames = frames;
+	stats.bytes = bytes;
+	stats.writes = writes;
+	stats.shortWrites = shortWrites;
+	stats.stalls = stalls;
+	stats.full = full;
+	stats.pending = pending();
+	return stats;
+}
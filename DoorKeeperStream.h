@@ -0,0 +1,180 @@
+/*
+ * Copyright (C) 2017 A. Koller - akandroid75@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef DOORKEEPERSTREAM_H_
+#define DOORKEEPERSTREAM_H_
+
+#include <Arduino.h>
+#include <stdint.h>
+
+/*
+ * Frame assembler for one TCP connection.
+ *
+ * TCP delivers a byte stream, a frame can be split over several reads and
+ * one read can hold several frames. The received bytes are collected in a
+ * ring, nextFrame() hands out complete frames only (in the order received)
+ * and is called until it returns 0, so pipelined requests are handled in
+ * one pass.
+ *
+ * A frame starts with DOORKEEPERFRAME_HEADER1 followed by one of the
+ * header2 bytes (0x42 fixed, 0x43 compact, 0x44 AEAD), the size is taken
+ * from DoorKeeper::frameSize. Bytes in front of a valid header are dropped
+ * (resync), so a garbage prefix does not block the connection.
+ *
+ * receive() with a client reads directly into the ring, no extra copy.
+ *
+ * DoorKeeperOutQueue collects the responses of one connection. They are
+ * queued while the received frames are handled and sent by flush() with one
+ * write at the end of the loop pass, so pipelined requests are answered in
+ * a few TCP segments instead of one per response. flush() writes no more than
+ * the client can take without blocking (availableForWrite), the rest stays
+ * queued. Stop handling frames of a connection while its queue has less
+ * than DOORKEEPERFRAMEMAXSIZE bytes free: the requests stay in the
+ * DoorKeeperStream, it is not read any more and TCP slows down the peer.
+ */
+
+// bytes per connection, power of 2, >= DOORKEEPERFRAMEMAXSIZE
+#ifndef DOORKEEPERSTREAM_SIZE
+#define DOORKEEPERSTREAM_SIZE 512
+#endif
+
+// bytes per connection, >= DOORKEEPERFRAMEMAXSIZE. default: one TCP segment,
+// ten fixed responses
+#ifndef DOORKEEPEROUTQUEUE_SIZE
+#define DOORKEEPEROUTQUEUE_SIZE 1460
+#endif
+
+struct DoorKeeperStreamStats {
+	uint32_t received;
+	uint32_t frames;
+	// bytes dropped in front of a frame header
+	uint32_t resyncBytes;
+	uint16_t pending;
+};
+
+class DoorKeeperStream {
+
+public:
+	int space();
+	int available();
+	int write(const uint8_t* data, int length);
+	uint8_t* writeBuffer(int* length);
+	void commitWrite(int length);
+	int nextFrame(uint8_t* frame);
+	void reset();
+	DoorKeeperStreamStats getStats();
+
+	/**
+	 * \brief reads what client has available into the ring (at most the
+	 * free space), returns the number of bytes read
+	 */
+	template<class Client> int receive(Client& client) {
+		int total = 0;
+		int length;
+		uint8_t* buffer;
+		while (client.available() > 0
+				&& (buffer = writeBuffer(&length)) != NULL) {
+			int read = client.read(buffer, length);
+			if (read <= 0) {
+				break;
+			}
+			commitWrite(read);
+			total += read;
+		}
+		return total;
+	}
+
+private:
+	uint8_t peek(int offset);
+	void copyOut(uint8_t* frame, int length);
+	void drop(int length);
+
+	uint8_t ring[DOORKEEPERSTREAM_SIZE];
+	uint16_t head = 0;
+	uint16_t tail = 0;
+	// false while bytes are dropped, resync is logged once per run
+	boolean synced = true;
+
+	uint32_t received = 0;
+	uint32_t frames = 0;
+	uint32_t resyncBytes = 0;
+};
+
+struct DoorKeeperOutQueueStats {
+	uint32_t frames;
+	uint32_t bytes;
+	// client write calls, partial ones and flushes without room
+	uint32_t writes;
+	uint32_t shortWrites;
+	uint32_t stalls;
+	// frames refused, queue full
+	uint32_t full;
+	uint16_t pending;
+};
+
+class DoorKeeperOutQueue {
+
+public:
+	int space();
+	int pending();
+	boolean queue(const uint8_t* frame, int size);
+	void reset();
+	DoorKeeperOutQueueStats getStats();
+
+	/**
+	 * \brief writes the queued bytes the client takes without blocking,
+	 * returns the number of bytes written
+	 */
+	template<class Client> int flush(Client& client) {
+		int length = pending();
+		if (length == 0) {
+			return 0;
+		}
+		int window = client.availableForWrite();
+		if (window <= 0) {
+			stalls++;
+			return 0;
+		}
+		if (length > window) {
+			length = window;
+		}
+		int written = client.write(&buffer[tail], (size_t) length);
+		consume(written > 0 ? written : 0, length);
+		return written > 0 ? written : 0;
+	}
+
+private:
+	void consume(int written, int length);
+
+	uint8_t buffer[DOORKEEPEROUTQUEUE_SIZE];
+	uint16_t head = 0;
+	uint16_t tail = 0;
+
+	uint32_t frames = 0;
+	uint32_t bytes = 0;
+	uint32_t writes = 0;
+	uint32_t shortWrites = 0;
+	uint32_t stalls = 0;
+	uint32_t full = 0;
+};
+
+#endif /* DOORKEEPERSTREAM_H_ */
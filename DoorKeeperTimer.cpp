@@ -0,0 +1,203 @@
+/*
+ * Copyright (C) 2017 A. Koller - akandroid75@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <DoorKeeperTimer.h>
+#include <cstring>
+
+static_assert(DOORKEEPERTIMER_LEVELS >= 1
+		&& DOORKEEPERTIMER_SLOTBITS * DOORKEEPERTIMER_LEVELS <= 30,
+		"DOORKEEPERTIMER_LEVELS out of range");
+
+#define SLOTMASK (DOORKEEPERTIMER_SLOTS - 1)
+
+DoorKeeperTimer::DoorKeeperTimer() {
+	memset(wheel, 0, sizeof(wheel));
+	current = millis();
+}
+
+void DoorKeeperTimer::link(DoorKeeperTimerNode** list,
+		DoorKeeperTimerNode* node) {
+	node->next = *list;
+	if (node->next != NULL) {
+		node->next->pprev = &node->next;
+	}
+	node->pprev = list;
+	*list = node;
+}
+
+void DoorKeeperTimer::unlink(DoorKeeperTimerNode* node) {
+	*node->pprev = node->next;
+	if (node->next != NULL) {
+		node->next->pprev = node->pprev;
+	}
+	node->next = NULL;
+	node->pprev = NULL;
+}
+
+/**
+ * \brief puts node into the slot of its expiry time, due ones into the
+ * expired list
+ */
+void DoorKeeperTimer::insert(DoorKeeperTimerNode* node) {
+	int32_t delta = (int32_t) (node->expires - current);
+	if (delta <= 0) {
+		link(&expired, node);
+		return;
+	}
+	int level = 0;
+	while (level < DOORKEEPERTIMER_LEVELS - 1
+			&& (uint32_t) delta >= (1UL << (DOORKEEPERTIMER_SLOTBITS
+					* (level + 1)))) {
+		level++;
+	}
+	int slot = (node->expires >> (DOORKEEPERTIMER_SLOTBITS * level))
+			& SLOTMASK;
+	link(&wheel[level][slot], node);
+	running++;
+}
+
+/**
+ * \brief (re)starts node, due delayMs after now
+ */
+void DoorKeeperTimer::start(DoorKeeperTimerNode* node, uint32_t delayMs) {
+	cancel(node);
+	if (delayMs > DOORKEEPERTIMER_MAXMS) {
+		delayMs = DOORKEEPERTIMER_MAXMS;
+	}
+	uint32_t now = millis();
+	if (running == 0) {
+		// nothing to walk, also covers a global wheel constructed before
+		// the clock ran
+		current = now;
+	}
+	// current can be behind now, the walk catches up
+	node->expires = now + delayMs;
+	node->active = true;
+	insert(node);
+	started++;
+}
+
+/**
+ * \brief stops node, nothing happens if it is not running
+ */
+void DoorKeeperTimer::cancel(DoorKeeperTimerNode* node) {
+	if (node->active == false) {
+		return;
+	}
+	if (node->pprev != NULL) {
+		// in the wheel or the expired list, only the wheel is counted
+		int32_t delta = (int32_t) (node->expires - current);
+		boolean inWheel = delta > 0;
+		unlink(node);
+		if (inWheel == true) {
+			running--;
+		}
+	}
+	node->active = false;
+	cancelled++;
+}
+
+/**
+ * \brief ms until node is due, 0 if it is due or not running
+ */
+uint32_t DoorKeeperTimer::remaining(DoorKeeperTimerNode* node) {
+	int32_t delta = (int32_t) (node->expires - (uint32_t) millis());
+	if (node->active == false || delta <= 0) {
+		return 0;
+	}
+	return delta;
+}
+
+/**
+ * \brief spreads the current slot of level over the levels below
+ */
+void DoorKeeperTimer::cascade(int level) {
+	int slot = (current >> (DOORKEEPERTIMER_SLOTBITS * level)) & SLOTMASK;
+	DoorKeeperTimerNode* node = wheel[level][slot];
+	wheel[level][slot] = NULL;
+	while (node != NULL) {
+		DoorKeeperTimerNode* next = node->next;
+		running--;
+		insert(node);
+		cascaded++;
+		node = next;
+	}
+}
+
+/**
+ * \brief walks the ticks up to now, due timers go to the expired list
+ */
+void DoorKeeperTimer::advance(uint32_t now) {
+	while ((int32_t) (now - current) > 0) {
+		if (running == 0) {
+			current = now;
+			return;
+		}
+		current++;
+		// highest level whose slot changes with this tick first
+		int level = 0;
+		while (level < DOORKEEPERTIMER_LEVELS - 1
+				&& ((current >> (DOORKEEPERTIMER_SLOTBITS * level))
+						& SLOTMASK) == 0) {
+			level++;
+		}
+		for (; level > 0; level--) {
+			cascade(level);
+		}
+		DoorKeeperTimerNode** slot = &wheel[0][current & SLOTMASK];
+		while (*slot != NULL) {
+			DoorKeeperTimerNode* node = *slot;
+			unlink(node);
+			running--;
+			link(&expired, node);
+		}
+	}
+}
+
+/**
+ * \brief takes one expired timer (no longer active), NULL if there is none
+ */
+DoorKeeperTimerNode* DoorKeeperTimer::nextExpired(uint32_t now) {
+	DoorKeeperTimerNode* node = expired;
+	if (node == NULL) {
+		return NULL;
+	}
+	unlink(node);
+	node->active = false;
+	expiredCount++;
+	uint32_t late = now - node->expires;
+	if ((int32_t) late > 0 && late > maxLateMs) {
+		maxLateMs = late;
+	}
+	return node;
+}
+
+DoorKeeperTimerStats DoorKeeperTimer::getStats() {
+	DoorKeeperTimerStats stats;
+	stats.started = started;
+	stats.expired = expiredCount;
+	stats.cancelled = cancelled;
+	stats.cascaded = cascaded;
+	stats.running = running;
+	stats.maxLateMs = maxLateMs;
+	return stats;
+}
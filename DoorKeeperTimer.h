@@ -0,0 +1,111 @@
+/*
+ * Copyright (C) 2017 A. Koller - akandroid75@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef DOORKEEPERTIMER_H_
+#define DOORKEEPERTIMER_H_
+
+#include <Arduino.h>
+#include <stdint.h>
+
+/*
+ * Hierarchical timer wheel, millisecond ticks.
+ *
+ * DOORKEEPERTIMER_LEVELS wheels of 64 slots: level 0 holds the timers due
+ * in the next 64 ms (one slot per ms), level 1 those due in the next 4 s
+ * (one slot per 64 ms) and so on. advance() walks the ticks up to millis():
+ * one slot per tick, every 64 ticks the next slot of the level above is
+ * spread over the level below (cascade). Start, cancel and every tick are
+ * O(1), the wheel does not care how many timers are running.
+ *
+ * Timers are DoorKeeperTimerNode objects owned by the caller (no heap), a
+ * node is in at most one list. Due timers are moved to the expired list,
+ * the owner takes them with nextExpired() and runs the job itself, so a
+ * job can restart its own timer.
+ */
+
+#define DOORKEEPERTIMER_SLOTBITS 6
+#define DOORKEEPERTIMER_SLOTS (1 << DOORKEEPERTIMER_SLOTBITS)
+
+#ifndef DOORKEEPERTIMER_LEVELS
+#define DOORKEEPERTIMER_LEVELS 4
+#endif
+
+// longest delay in ms (4.6 hours with 4 levels), longer ones are clamped
+#define DOORKEEPERTIMER_MAXMS \
+	((1UL << (DOORKEEPERTIMER_SLOTBITS * DOORKEEPERTIMER_LEVELS)) - 1)
+
+struct DoorKeeperTimerNode {
+	DoorKeeperTimerNode* next = NULL;
+	// the pointer to this node (list head or next of the previous node)
+	DoorKeeperTimerNode** pprev = NULL;
+	// millis() when due
+	uint32_t expires = 0;
+	// set by the owner: which job, and an argument for it
+	uint8_t job = 0;
+	uint8_t arg = 0;
+	boolean active = false;
+};
+
+struct DoorKeeperTimerStats {
+	uint32_t started;
+	uint32_t expired;
+	uint32_t cancelled;
+	// timers moved to a lower level
+	uint32_t cascaded;
+	uint32_t running;
+	// latest expiry behind its due time (a slow loop pass)
+	uint32_t maxLateMs;
+};
+
+class DoorKeeperTimer {
+
+public:
+	DoorKeeperTimer();
+
+	void start(DoorKeeperTimerNode* node, uint32_t delayMs);
+	void cancel(DoorKeeperTimerNode* node);
+	uint32_t remaining(DoorKeeperTimerNode* node);
+	void advance(uint32_t now);
+	DoorKeeperTimerNode* nextExpired(uint32_t now);
+	DoorKeeperTimerStats getStats();
+
+private:
+	void insert(DoorKeeperTimerNode* node);
+	void link(DoorKeeperTimerNode** list, DoorKeeperTimerNode* node);
+	void unlink(DoorKeeperTimerNode* node);
+	void cascade(int level);
+
+	DoorKeeperTimerNode* wheel[DOORKEEPERTIMER_LEVELS][DOORKEEPERTIMER_SLOTS];
+	DoorKeeperTimerNode* expired = NULL;
+	// last tick walked
+	uint32_t current;
+	// timers in the wheel (not expired yet)
+	uint32_t running = 0;
+
+	uint32_t started = 0;
+	uint32_t expiredCount = 0;
+	uint32_t cancelled = 0;
+	uint32_t cascaded = 0;
+	uint32_t maxLateMs = 0;
+};
+
+#endif /* DOORKEEPERTIMER_H_ */
@@ -22,10 +22,12 @@
 
 
 #include <arducrypt.h>
-#include <CRC32.h>
+#include <DoorKeeperLog.h>
+#include <DoorKeeperMetrics.h>
 #include <Curve25519.h>
 #include <Ed25519.h>
 #include <HardwareSerial.h>
+#include <SHA256.h>
 #include <cstring>
 #include "esp8266_peri.h"
 
@@ -46,15 +48,17 @@ void generateInitVector(uint8_t* sessionIv);
 
 
 /**
- * \brief validates signature of message with given signkey
+ * \brief validates signature of message with given signkey.
+ * decodes the key and uses the same (cofactored) check as the prepared
+ * keys and validateSignatures
  */
 boolean arducrypt::validateSignature(arducryptsignature* signature,
 		uint8_t* message, int length, arducryptkey* key) {
-	bool verified = Ed25519::verify(
-			(const unsigned char*) &signature->signaturebytes,
-			(const unsigned char*) &key->keybytes,
-			(const unsigned char*) message, length);
-	return verified;
+	arducryptpoint point;
+	if (preparePublicKey(&point, key) == false) {
+		return false;
+	}
+	return validateSignature(signature, message, length, key, &point);
 }
 
 /**
@@ -87,10 +91,10 @@ boolean arducrypt::generateSession(arducryptsession* session, arducryptkey* part
 	uint8_t secretShared[KEYSIZE];
 	memcpy(secretShared,partnerkey,KEYSIZE);
 	ESP.wdtFeed();
-	Curve25519::dh1(session->publicKey, privKey);
+	uint32_t start = DOORKEEPERMETRICS_CYCLES();
+	takeEphemeralKey(session->publicKey, privKey);
+	DOORKEEPERMETRICS_TIME(DKHIST_DH1, start);
 	ESP.wdtFeed();
-	ARDUCRYPTDEBUG_PRINT(F("sessionServerPrivKey:"));
-	ARDUCRYPTDEBUG_HEXPRINT((uint8_t* )&privKey, KEYSIZE);
 	ARDUCRYPTDEBUG_PRINT(F("sessionServerPubKey:"));
 	ARDUCRYPTDEBUG_HEXPRINT(
 			(uint8_t* )&session->publicKey,
@@ -99,28 +103,112 @@ boolean arducrypt::generateSession(arducryptsession* session, arducryptkey* part
 	ARDUCRYPTDEBUG_HEXPRINT(
 			(uint8_t* )&partnerkey->keybytes,
 			KEYSIZE);
-	if (Curve25519::dh2(secretShared, privKey) == true) {
+	start = DOORKEEPERMETRICS_CYCLES();
+	boolean shared = Curve25519::dh2(secretShared, privKey);
+	DOORKEEPERMETRICS_TIME(DKHIST_DH2, start);
+	if (shared == true) {
 		ESP.wdtFeed();
-		ARDUCRYPTDEBUG_PRINT(F("secret:"));
-		ARDUCRYPTDEBUG_HEXPRINT((uint8_t* )&secretShared, KEYSIZE);
 		// generate IV
 		generateInitVector((uint8_t*)&session->iv);
 		ESP.wdtFeed();
 		// copy to buffer out
 		ARDUCRYPTDEBUG_PRINT(F("generateIV:"));
 		ARDUCRYPTDEBUG_HEXPRINT((uint8_t* )&session->iv, IVSIZE);
-		session->encrypt.setKey(secretShared, KEYSIZE);
-		session->encrypt.setIV(session->iv, IVSIZE);
-		session->decrypt.setKey(secretShared, KEYSIZE);
-		session->decrypt.setIV(session->iv, IVSIZE);
+		initSession(session, secretShared);
 		ESP.wdtFeed();
 		// delete
 		memset(secretShared ,0,KEYSIZE);
 		return true;
 	}
+	DOORKEEPERLOG_ERROR(DKEV_DHFAILED, 0, 0);
 	return false;
 }
 
+/**
+ * \brief server side of the key exchange without key pool and without the
+ * RNG of the Crypto library, so it can run on several threads at once:
+ * new ephemeral key pair (publicKey), iv and the shared secret.
+ * the session keys are set from secret by initSession.
+ * dhCycles (optional) gets the cycles of key pair and shared secret
+ */
+boolean arducrypt::exchangeKeys(const uint8_t* partnerKey, uint8_t* publicKey,
+		uint8_t* iv, uint8_t* secret, uint32_t* dhCycles) {
+	uint8_t privKey[KEYSIZE];
+	uint32_t start = DOORKEEPERMETRICS_CYCLES();
+	for (int i = 0; i < KEYSIZE; i++) {
+		privKey[i] = (uint8_t) RANDOM_REG32;
+	}
+	privKey[0] &= 0xf8;
+	privKey[KEYSIZE - 1] = (privKey[KEYSIZE - 1] & 0x7f) | 0x40;
+	Curve25519::eval(publicKey, privKey, 0);
+	uint32_t dh1 = DOORKEEPERMETRICS_CYCLES();
+	memcpy(secret, partnerKey, KEYSIZE);
+	boolean shared = Curve25519::dh2(secret, privKey);
+	if (dhCycles != NULL) {
+		dhCycles[0] = dh1 - start;
+		dhCycles[1] = DOORKEEPERMETRICS_CYCLES() - dh1;
+	}
+	if (shared == false) {
+		return false;
+	}
+	for (int i = 0; i < IVSIZE; i++) {
+		iv[i] = (uint8_t) RANDOM_REG32;
+	}
+	return true;
+}
+
+/**
+ * \brief session keys from the shared secret, session->iv has to be set
+ */
+void arducrypt::initSession(arducryptsession* session, uint8_t* secret) {
+	session->encrypt.setKey(secret, KEYSIZE);
+	session->encrypt.setIV(session->iv, IVSIZE);
+	session->decrypt.setKey(secret, KEYSIZE);
+	session->decrypt.setIV(session->iv, IVSIZE);
+	initAead(session, secret);
+}
+
+/**
+ * \brief ephemeral key pair for a new session, from the pool if possible
+ */
+void arducrypt::takeEphemeralKey(uint8_t* publicKey, uint8_t* privateKey) {
+	if (keyPoolCount == 0) {
+		keyPoolMisses++;
+		Curve25519::dh1(publicKey, privateKey);
+		return;
+	}
+	keyPoolHits++;
+	keyPoolCount--;
+	arducryptephemeral* key = &keyPool[keyPoolCount];
+	memcpy(publicKey, key->publicKey, KEYSIZE);
+	memcpy(privateKey, key->privateKey, KEYSIZE);
+	// a key pair is used only once
+	memset(key, 0, sizeof(arducryptephemeral));
+}
+
+/**
+ * \brief generates one ephemeral key pair if the pool is not full.
+ * call it when there is nothing else to do, dh1 takes long on the esp8266.
+ * returns true if a key pair was generated
+ */
+boolean arducrypt::refillKeyPool() {
+	if (keyPoolCount >= ARDUCRYPTKEYPOOLSIZE) {
+		return false;
+	}
+	arducryptephemeral* key = &keyPool[keyPoolCount];
+	Curve25519::dh1(key->publicKey, key->privateKey);
+	keyPoolCount++;
+	return true;
+}
+
+arducryptpoolstats arducrypt::getKeyPoolStats() {
+	arducryptpoolstats stats;
+	stats.hits = keyPoolHits;
+	stats.misses = keyPoolMisses;
+	stats.available = keyPoolCount;
+	return stats;
+}
+
 /**
  * \brief signs message with given sign key
  */
@@ -142,39 +230,259 @@ void arducrypt::sign(arducryptkeypair* signKey, uint8_t* message, arducryptsigna
  */
 void arducrypt::decrypt(uint8_t* plainmessage,
 		uint8_t* encryptedmessage, arducryptsession* session) {
+	decrypt(plainmessage, encryptedmessage, session, messagesize);
+}
+
+/**
+ * \brief encrypt plainmessage with given arducryptsession
+ */
+void arducrypt::encrypt(uint8_t* plainmessage,
+		uint8_t* encryptedmessage, arducryptsession* session) {
+	encrypt(plainmessage, encryptedmessage, session, messagesize);
+}
+
+/**
+ * \brief decrypt length bytes, the stream position of the session moves on
+ * by length (compact frames)
+ */
+void arducrypt::decrypt(uint8_t* plainmessage,
+		uint8_t* encryptedmessage, arducryptsession* session, int length) {
 	ARDUCRYPTDEBUG_PRINT(F("decrypt_data: "));
-	ARDUCRYPTDEBUG_HEXPRINT((uint8_t* )encryptedmessage,  messagesize);
+	ARDUCRYPTDEBUG_HEXPRINT((uint8_t* )encryptedmessage,  length);
 
 		session->decrypt.decrypt((uint8_t*) plainmessage,
 				(const uint8_t*) encryptedmessage,
-				(size_t)  messagesize);
+				(size_t)  length);
 		ARDUCRYPTDEBUG_PRINT(F("decrypted: "));
-		ARDUCRYPTDEBUG_HEXPRINT((uint8_t* )plainmessage,  messagesize);
+		ARDUCRYPTDEBUG_HEXPRINT((uint8_t* )plainmessage,  length);
 }
 
 /**
- * \brief encrypt plainmessage with given arducryptsession
+ * \brief encrypt length bytes, see decrypt
  */
 void arducrypt::encrypt(uint8_t* plainmessage,
-		uint8_t* encryptedmessage, arducryptsession* session) {
+		uint8_t* encryptedmessage, arducryptsession* session, int length) {
 	ARDUCRYPTDEBUG_PRINT(F("encrypt_data: "));
-	ARDUCRYPTDEBUG_HEXPRINT((uint8_t* )plainmessage, messagesize);
+	ARDUCRYPTDEBUG_HEXPRINT((uint8_t* )plainmessage, length);
 
 		session->encrypt.encrypt((uint8_t*) encryptedmessage,
-				(const uint8_t*) plainmessage, (size_t) messagesize);
+				(const uint8_t*) plainmessage, (size_t) length);
 		ARDUCRYPTDEBUG_PRINT(F("encrypted: "));
-		ARDUCRYPTDEBUG_HEXPRINT((uint8_t* )encryptedmessage,  messagesize);
+		ARDUCRYPTDEBUG_HEXPRINT((uint8_t* )encryptedmessage,  length);
 
 }
 
 /**
- * \brief calculate CRC32 checksum for given message
+ * \brief calculate CRC32 checksum for given message (see arducryptcrc)
  */
 uint32_t arducrypt::calcChecksum(uint8_t* message, int length) {
-	uint32_t chksum = CRC32::calculate(message, length);
+	uint32_t chksum = arducryptcrc::calculate(message, length);
 	return chksum;
 }
 
+/**
+ * \brief fills buffer with random bytes from the hardware rng
+ */
+static void randomBytes(uint8_t* buffer, int length) {
+	for (int i = 0; i < length; i++) {
+		buffer[i] = (uint8_t) RANDOM_REG32;
+	}
+}
+
+/**
+ * \brief HMAC-SHA256(key, label | data1 | data2), truncated to outlen
+ */
+static void ticketHmac(uint8_t* key, uint8_t label, const uint8_t* data1,
+		int len1, const uint8_t* data2, int len2, uint8_t* out, int outlen) {
+	SHA256 hmac;
+	hmac.resetHMAC(key, KEYSIZE);
+	hmac.update(&label, 1);
+	hmac.update(data1, len1);
+	hmac.update(data2, len2);
+	hmac.finalizeHMAC(key, KEYSIZE, out, outlen);
+}
+
+/**
+ * \brief new random keys for sealing session tickets
+ */
+void arducrypt::generateTicketKey(arducryptticketkey* ticketKey) {
+	randomBytes(ticketKey->encryptKey, KEYSIZE);
+	randomBytes(ticketKey->macKey, KEYSIZE);
+}
+
+/**
+ * \brief encrypts content with a fresh iv and appends a mac (encrypt then mac)
+ */
+void arducrypt::sealTicket(arducryptticketkey* ticketKey,
+		arducryptticketcontent* content, arducryptticket* ticket) {
+	ChaCha cipher;
+	randomBytes(ticket->iv, IVSIZE);
+	cipher.setKey(ticketKey->encryptKey, KEYSIZE);
+	cipher.setIV(ticket->iv, IVSIZE);
+	cipher.encrypt(ticket->content, (const uint8_t*) content,
+			sizeof(arducryptticketcontent));
+	cipher.clear();
+	ticketHmac(ticketKey->macKey, 'T', ticket->iv, IVSIZE, ticket->content,
+			sizeof(ticket->content), ticket->mac, TICKETMACSIZE);
+}
+
+/**
+ * \brief checks the mac and decrypts the ticket
+ * returns false for tickets not sealed with ticketKey
+ */
+boolean arducrypt::openTicket(arducryptticketkey* ticketKey,
+		const arducryptticket* ticket, arducryptticketcontent* content) {
+	uint8_t mac[TICKETMACSIZE];
+	ticketHmac(ticketKey->macKey, 'T', ticket->iv, IVSIZE, ticket->content,
+			sizeof(ticket->content), mac, TICKETMACSIZE);
+	if (verifyProof(mac, ticket->mac) == false) {
+		return false;
+	}
+	ChaCha cipher;
+	cipher.setKey(ticketKey->encryptKey, KEYSIZE);
+	cipher.setIV(ticket->iv, IVSIZE);
+	cipher.decrypt((uint8_t*) content, ticket->content,
+			sizeof(arducryptticketcontent));
+	cipher.clear();
+	return true;
+}
+
+/**
+ * \brief client proof: client knows the secret which belongs to ticket
+ */
+void arducrypt::ticketProof(uint8_t* secret, const arducryptticket* ticket,
+		const uint8_t* clientNonce, uint8_t* proof) {
+	ticketHmac(secret, 'C', (const uint8_t*) ticket, sizeof(arducryptticket),
+			clientNonce, TICKETNONCESIZE, proof, TICKETMACSIZE);
+}
+
+/**
+ * \brief server proof: server could open the ticket
+ */
+void arducrypt::serverProof(uint8_t* secret, const uint8_t* clientNonce,
+		uint8_t* iv, uint8_t* proof) {
+	ticketHmac(secret, 'S', clientNonce, TICKETNONCESIZE, iv, IVSIZE, proof,
+			TICKETMACSIZE);
+}
+
+/**
+ * \brief constant time compare of two macs
+ */
+boolean arducrypt::verifyProof(const uint8_t* expected,
+		const uint8_t* proof) {
+	uint8_t diff = 0;
+	for (int i = 0; i < TICKETMACSIZE; i++) {
+		diff |= expected[i] ^ proof[i];
+	}
+	return diff == 0;
+}
+
+/**
+ * \brief server side of a resumed session: new iv, key derived from the
+ * ticket secret. no public key operations.
+ */
+boolean arducrypt::resumeSession(arducryptsession* session, uint8_t* secret,
+		const uint8_t* clientNonce) {
+	generateInitVector((uint8_t*) &session->iv);
+	memset(session->publicKey, 0, KEYSIZE);
+	deriveSession(session, secret, clientNonce);
+	return true;
+}
+
+/**
+ * \brief session key = HMAC-SHA256(secret, 'K' | client nonce | iv),
+ * session->iv has to be set
+ */
+void arducrypt::deriveSession(arducryptsession* session, uint8_t* secret,
+		const uint8_t* clientNonce) {
+	uint8_t sessionKey[KEYSIZE];
+	ticketHmac(secret, 'K', clientNonce, TICKETNONCESIZE, session->iv, IVSIZE,
+			sessionKey, KEYSIZE);
+	session->encrypt.setKey(sessionKey, KEYSIZE);
+	session->encrypt.setIV(session->iv, IVSIZE);
+	session->decrypt.setKey(sessionKey, KEYSIZE);
+	session->decrypt.setIV(session->iv, IVSIZE);
+	initAead(session, sessionKey);
+	memset(sessionKey, 0, KEYSIZE);
+}
+
+/**
+ * \brief AEAD key = HMAC-SHA256(secret, 'A' | iv), session->iv has to be set.
+ * the stream cipher keeps its key, so nonces of both never collide
+ */
+void arducrypt::initAead(arducryptsession* session, uint8_t* secret) {
+	uint8_t aeadKey[KEYSIZE];
+	ticketHmac(secret, 'A', session->iv, IVSIZE, NULL, 0, aeadKey, KEYSIZE);
+	session->aead.setKey(aeadKey, KEYSIZE);
+	session->aeadCounter[ARDUCRYPTAEAD_TOSERVER] = 0;
+	session->aeadCounter[ARDUCRYPTAEAD_TOCLIENT] = 0;
+	memset(aeadKey, 0, KEYSIZE);
+}
+
+/**
+ * \brief nonce of the next message in direction, false if the counter is
+ * used up (new session needed)
+ */
+boolean arducrypt::aeadNonce(arducryptsession* session, uint8_t direction,
+		uint8_t* nonce) {
+	uint32_t counter = session->aeadCounter[direction];
+	if (counter == 0xffffffff) {
+		return false;
+	}
+	memcpy(nonce, session->iv, IVSIZE);
+	nonce[0] ^= direction;
+	nonce[IVSIZE - 4] ^= (uint8_t) (counter >> 24);
+	nonce[IVSIZE - 3] ^= (uint8_t) (counter >> 16);
+	nonce[IVSIZE - 2] ^= (uint8_t) (counter >> 8);
+	nonce[IVSIZE - 1] ^= (uint8_t) counter;
+	return true;
+}
+
+/**
+ * \brief ChaCha20-Poly1305: encrypts length bytes and authenticates them
+ * together with the (plain) header in one pass, the tag has
+ * ARDUCRYPTTAGSIZE bytes
+ */
+boolean arducrypt::encryptAead(uint8_t* plainmessage,
+		uint8_t* encryptedmessage, int length, uint8_t* header,
+		int headerLength, uint8_t* tag, arducryptsession* session,
+		uint8_t direction) {
+	uint8_t nonce[IVSIZE];
+	if (aeadNonce(session, direction, nonce) == false) {
+		return false;
+	}
+	session->aead.setIV(nonce, IVSIZE);
+	session->aead.addAuthData(header, headerLength);
+	session->aead.encrypt(encryptedmessage, plainmessage, length);
+	session->aead.computeTag(tag, ARDUCRYPTTAGSIZE);
+	session->aeadCounter[direction]++;
+	return true;
+}
+
+/**
+ * \brief counterpart of encryptAead, returns false if the tag does not
+ * match (plainmessage is cleared then). only a valid message moves the
+ * counter on, a forged one does not break the session
+ */
+boolean arducrypt::decryptAead(uint8_t* plainmessage,
+		uint8_t* encryptedmessage, int length, uint8_t* header,
+		int headerLength, uint8_t* tag, arducryptsession* session,
+		uint8_t direction) {
+	uint8_t nonce[IVSIZE];
+	if (aeadNonce(session, direction, nonce) == false) {
+		return false;
+	}
+	session->aead.setIV(nonce, IVSIZE);
+	session->aead.addAuthData(header, headerLength);
+	session->aead.decrypt(plainmessage, encryptedmessage, length);
+	if (session->aead.checkTag(tag, ARDUCRYPTTAGSIZE) == false) {
+		memset(plainmessage, 0, length);
+		return false;
+	}
+	session->aeadCounter[direction]++;
+	return true;
+}
+
 /**
  * \brief helper method: print hexstring
  */
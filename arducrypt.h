@@ -26,15 +26,18 @@
 
 #include <Arduino.h>
 #include <ChaCha.h>
+#include <ChaChaPoly.h>
+#include <arducryptcrc.h>
 #include <stdint.h>
 
 #define SIGNATURESIZE 64
 #define KEYSIZE 32
 #define IVSIZE 12
 #define CHECKSUMSIZE 4
+#define ARDUCRYPTTAGSIZE 16
 #define INVALIDINDEX -1
 
-#define ARDUCRYPTDEBUG 1
+// verbose, blocking hex dumps for development only (build flag)
 
 #ifdef ARDUCRYPTDEBUG
 #define ARDUCRYPTDEBUG_HEXPRINT(x,y) arducrypt::printHex(x,y)
@@ -65,11 +68,97 @@ struct arducryptkeypair {
 	arducryptkey privateKey;
 };
 
+#define ARDUCRYPTLIMBS 10
+
+/**
+ * decoded Ed25519 public key (extended coordinates X:Y:Z:T),
+ * see arducrypt::preparePublicKey
+ */
+struct arducryptpoint {
+	int32_t x[ARDUCRYPTLIMBS];
+	int32_t y[ARDUCRYPTLIMBS];
+	int32_t z[ARDUCRYPTLIMBS];
+	int32_t t[ARDUCRYPTLIMBS];
+};
+
+// max. signatures per multi-scalar multiplication of validateSignatures
+#ifndef ARDUCRYPTBATCHMAX
+#define ARDUCRYPTBATCHMAX 64
+#endif
+
+/**
+ * one signature for arducrypt::validateSignatures
+ */
+struct arducryptbatchitem {
+	arducryptsignature* signature;
+	uint8_t* message;
+	int length;
+	arducryptkey* key;
+	// key prepared by preparePublicKey, NULL: key is decoded
+	arducryptpoint* point;
+};
+
+#define TICKETNONCESIZE 16
+#define TICKETMACSIZE 16
+
+/**
+ * server side keys for session tickets, random per boot
+ */
+struct arducryptticketkey {
+	uint8_t encryptKey[KEYSIZE];
+	uint8_t macKey[KEYSIZE];
+};
+
+/**
+ * plain content of a session ticket, only the server can read it
+ */
+struct arducryptticketcontent {
+	uint32_t expires;
+	uint8_t clientPubKey[KEYSIZE];
+	uint8_t secret[KEYSIZE];
+};
+
+/**
+ * sealed session ticket: iv | ChaCha20(content) | HMAC-SHA256 (truncated)
+ */
+struct arducryptticket {
+	uint8_t iv[IVSIZE];
+	uint8_t content[sizeof(arducryptticketcontent)];
+	uint8_t mac[TICKETMACSIZE];
+};
+
+// number of precomputed ephemeral Curve25519 key pairs
+#ifndef ARDUCRYPTKEYPOOLSIZE
+#define ARDUCRYPTKEYPOOLSIZE 2
+#endif
+
+struct arducryptephemeral {
+	uint8_t publicKey[KEYSIZE];
+	uint8_t privateKey[KEYSIZE];
+};
+
+/**
+ * key pool counters: hits = handshakes with a precomputed key pair,
+ * misses = handshakes which had to run dh1 inline
+ */
+struct arducryptpoolstats {
+	uint32_t hits;
+	uint32_t misses;
+	uint8_t available;
+};
+
+// direction of an AEAD message, part of the nonce
+#define ARDUCRYPTAEAD_TOSERVER 0
+#define ARDUCRYPTAEAD_TOCLIENT 1
+
 struct arducryptsession {
 	uint8_t publicKey[KEYSIZE];
 	uint8_t iv[IVSIZE];
 	ChaCha encrypt;
 	ChaCha decrypt;
+	// ChaCha20-Poly1305 with its own key, nonce = iv ^ (direction | counter)
+	ChaChaPoly aead;
+	uint32_t aeadCounter[2] = { 0, 0 };
 };
 
 class arducrypt {
@@ -86,23 +175,70 @@ public:
 
 	boolean generateSession(arducryptsession* session,
 			arducryptkey* partnerkey);
+	static boolean exchangeKeys(const uint8_t* partnerKey, uint8_t* publicKey,
+			uint8_t* iv, uint8_t* secret, uint32_t* dhCycles = NULL);
+	static void initSession(arducryptsession* session, uint8_t* secret);
 
-	void sign(arducryptkeypair* signKey, uint8_t* message,
+	static void sign(arducryptkeypair* signKey, uint8_t* message,
 			arducryptsignature* signature, int length);
-	boolean validateSignature(arducryptsignature* signature, uint8_t* message,
-			int length, arducryptkey* key);
+	static boolean validateSignature(arducryptsignature* signature,
+			uint8_t* message, int length, arducryptkey* key);
+	static boolean validateSignature(arducryptsignature* signature,
+			uint8_t* message, int length, arducryptkey* key,
+			arducryptpoint* point);
+	static boolean preparePublicKey(arducryptpoint* point, arducryptkey* key);
+	static int validateSignatures(arducryptbatchitem* items, int count,
+			boolean* valid);
 
 	void decrypt(uint8_t* plainmessage, uint8_t* encryptedmessage,
 			arducryptsession* session);
 	void encrypt(uint8_t* plainmessage, uint8_t* encryptedmessage,
 			arducryptsession* session);
+	void decrypt(uint8_t* plainmessage, uint8_t* encryptedmessage,
+			arducryptsession* session, int length);
+	void encrypt(uint8_t* plainmessage, uint8_t* encryptedmessage,
+			arducryptsession* session, int length);
+
+	boolean encryptAead(uint8_t* plainmessage, uint8_t* encryptedmessage,
+			int length, uint8_t* header, int headerLength, uint8_t* tag,
+			arducryptsession* session, uint8_t direction);
+	boolean decryptAead(uint8_t* plainmessage, uint8_t* encryptedmessage,
+			int length, uint8_t* header, int headerLength, uint8_t* tag,
+			arducryptsession* session, uint8_t direction);
 
 	uint32_t calcChecksum(uint8_t* message, int len);
 
+	static void generateTicketKey(arducryptticketkey* ticketKey);
+	void sealTicket(arducryptticketkey* ticketKey,
+			arducryptticketcontent* content, arducryptticket* ticket);
+	boolean openTicket(arducryptticketkey* ticketKey,
+			const arducryptticket* ticket, arducryptticketcontent* content);
+	static void ticketProof(uint8_t* secret, const arducryptticket* ticket,
+			const uint8_t* clientNonce, uint8_t* proof);
+	static void serverProof(uint8_t* secret, const uint8_t* clientNonce,
+			uint8_t* iv, uint8_t* proof);
+	static boolean verifyProof(const uint8_t* expected, const uint8_t* proof);
+	boolean resumeSession(arducryptsession* session, uint8_t* secret,
+			const uint8_t* clientNonce);
+	void deriveSession(arducryptsession* session, uint8_t* secret,
+			const uint8_t* clientNonce);
+
 	void static generateSigKeyPair(uint8_t* privateKey, uint8_t* publicKey);
 
+	boolean refillKeyPool();
+	arducryptpoolstats getKeyPoolStats();
+
 private:
+	void takeEphemeralKey(uint8_t* publicKey, uint8_t* privateKey);
+	static void initAead(arducryptsession* session, uint8_t* secret);
+	static boolean aeadNonce(arducryptsession* session, uint8_t direction,
+			uint8_t* nonce);
+
 	int messagesize;
+	arducryptephemeral keyPool[ARDUCRYPTKEYPOOLSIZE];
+	uint8_t keyPoolCount = 0;
+	uint32_t keyPoolHits = 0;
+	uint32_t keyPoolMisses = 0;
 };
 
 #endif /* ARDUCRYPT_H_ */
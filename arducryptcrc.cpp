@@ -0,0 +1,161 @@
+/*
+ * Copyright (C) 2017 A. Koller - akandroid75@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <arducryptcrc.h>
+#include <cstring>
+
+/*
+ * Table n (slicing) maps a byte to the CRC of this byte followed by n zero
+ * bytes, table 0 is the classic byte table. The entries are constexpr, so
+ * the tables are built by the compiler (C++11, recursion only).
+ */
+
+#define ARDUCRYPTCRC_POLY 0xedb88320
+
+#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "arducryptcrc: word kernels expect a little endian target"
+#endif
+
+static constexpr uint32_t crcBits(uint32_t crc, int bits) {
+	return bits == 0 ?
+			crc :
+			crcBits((crc >> 1) ^ (ARDUCRYPTCRC_POLY & (0 - (crc & 1))),
+					bits - 1);
+}
+
+static constexpr uint32_t crcZeroByte(uint32_t crc) {
+	return (crc >> 8) ^ crcBits(crc & 0xff, 8);
+}
+
+static constexpr uint32_t crcEntry(int table, uint32_t n) {
+	return table == 0 ? crcBits(n, 8) : crcZeroByte(crcEntry(table - 1, n));
+}
+
+#define CRCE4(t,n) crcEntry(t, n), crcEntry(t, n + 1), crcEntry(t, n + 2), \
+	crcEntry(t, n + 3)
+#define CRCE16(t,n) CRCE4(t, n), CRCE4(t, n + 4), CRCE4(t, n + 8), \
+	CRCE4(t, n + 12)
+#define CRCE64(t,n) CRCE16(t, n), CRCE16(t, n + 16), CRCE16(t, n + 32), \
+	CRCE16(t, n + 48)
+#define CRCTABLE(t) { CRCE64(t, 0), CRCE64(t, 64), CRCE64(t, 128), \
+	CRCE64(t, 192) }
+
+static constexpr uint32_t crcTable[256] = CRCTABLE(0);
+
+static constexpr uint32_t crcSlice4[4][256] = { CRCTABLE(0), CRCTABLE(1),
+		CRCTABLE(2), CRCTABLE(3) };
+
+static constexpr uint32_t crcSlice8[8][256] = { CRCTABLE(0), CRCTABLE(1),
+		CRCTABLE(2), CRCTABLE(3), CRCTABLE(4), CRCTABLE(5), CRCTABLE(6),
+		CRCTABLE(7) };
+
+static_assert(crcTable[1] == 0x77073096, "crc table");
+
+/**
+ * \brief 32 bit load, data has to be aligned (byte loads on the ESP8266
+ * are slow, unaligned word loads fault)
+ */
+static inline uint32_t load32(const uint8_t* data) {
+	uint32_t word;
+	memcpy(&word, __builtin_assume_aligned(data, 4), 4);
+	return word;
+}
+
+static inline uint32_t crcByte(uint32_t crc, uint8_t data) {
+	return crcTable[(crc ^ data) & 0xff] ^ (crc >> 8);
+}
+
+/**
+ * \brief bytes up to the next 4 byte boundary, returns the bytes done
+ */
+static inline int crcAlign(uint32_t* crc, const uint8_t* data, int length,
+		const uint32_t* table) {
+	int done = 0;
+	while (done < length && ((uintptr_t) (data + done) & 3) != 0) {
+		*crc = table[(*crc ^ data[done]) & 0xff] ^ (*crc >> 8);
+		done++;
+	}
+	return done;
+}
+
+uint32_t arducryptcrc::updateBitwise(uint32_t crc, const uint8_t* data,
+		int length) {
+	for (int i = 0; i < length; i++) {
+		crc = crcBits(crc ^ data[i], 8);
+	}
+	return crc;
+}
+
+uint32_t arducryptcrc::updateByte(uint32_t crc, const uint8_t* data,
+		int length) {
+	for (int i = 0; i < length; i++) {
+		crc = crcByte(crc, data[i]);
+	}
+	return crc;
+}
+
+uint32_t arducryptcrc::updateWord(uint32_t crc, const uint8_t* data,
+		int length) {
+	int i = crcAlign(&crc, data, length, crcTable);
+	for (; i + 4 <= length; i += 4) {
+		crc ^= load32(data + i);
+		crc = crcTable[crc & 0xff] ^ (crc >> 8);
+		crc = crcTable[crc & 0xff] ^ (crc >> 8);
+		crc = crcTable[crc & 0xff] ^ (crc >> 8);
+		crc = crcTable[crc & 0xff] ^ (crc >> 8);
+	}
+	for (; i < length; i++) {
+		crc = crcByte(crc, data[i]);
+	}
+	return crc;
+}
+
+uint32_t arducryptcrc::updateSlice4(uint32_t crc, const uint8_t* data,
+		int length) {
+	int i = crcAlign(&crc, data, length, crcSlice4[0]);
+	for (; i + 4 <= length; i += 4) {
+		crc ^= load32(data + i);
+		crc = crcSlice4[3][crc & 0xff] ^ crcSlice4[2][(crc >> 8) & 0xff]
+				^ crcSlice4[1][(crc >> 16) & 0xff] ^ crcSlice4[0][crc >> 24];
+	}
+	for (; i < length; i++) {
+		crc = crcSlice4[0][(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+	}
+	return crc;
+}
+
+uint32_t arducryptcrc::updateSlice8(uint32_t crc, const uint8_t* data,
+		int length) {
+	int i = crcAlign(&crc, data, length, crcSlice8[0]);
+	for (; i + 8 <= length; i += 8) {
+		uint32_t one = load32(data + i) ^ crc;
+		uint32_t two = load32(data + i + 4);
+		crc = crcSlice8[7][one & 0xff] ^ crcSlice8[6][(one >> 8) & 0xff]
+				^ crcSlice8[5][(one >> 16) & 0xff] ^ crcSlice8[4][one >> 24]
+				^ crcSlice8[3][two & 0xff] ^ crcSlice8[2][(two >> 8) & 0xff]
+				^ crcSlice8[1][(two >> 16) & 0xff] ^ crcSlice8[0][two >> 24];
+	}
+	for (; i < length; i++) {
+		crc = crcSlice8[0][(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+	}
+	return crc;
+}
@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) 2017 A. Koller - akandroid75@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef ARDUCRYPTCRC_H_
+#define ARDUCRYPTCRC_H_
+
+#include <Arduino.h>
+#include <stdint.h>
+
+/*
+ * CRC-32 (IEEE 802.3, reflected polynomial 0xedb88320), same result as the
+ * CRC32 library used before.
+ *
+ * Kernels, select one with the build flag ARDUCRYPTCRC_KERNEL:
+ *   ARDUCRYPTCRC_BITWISE  no table, 8 shift/xor steps per byte
+ *   ARDUCRYPTCRC_BYTE     one table lookup per byte (1 KB table)
+ *   ARDUCRYPTCRC_WORD     32 bit loads, 4 dependent lookups per word (1 KB)
+ *   ARDUCRYPTCRC_SLICE4   slicing-by-4, 4 independent lookups per word (4 KB)
+ *   ARDUCRYPTCRC_SLICE8   slicing-by-8, 8 lookups per 2 words (8 KB)
+ *
+ * The tables are generated at compile time (constexpr) and are const data,
+ * on the ESP8266 they take RAM. Only the selected kernel is linked (section
+ * garbage collection). extras/host bench_checksum measures all of them.
+ */
+
+#define ARDUCRYPTCRC_BITWISE 0
+#define ARDUCRYPTCRC_BYTE 1
+#define ARDUCRYPTCRC_WORD 2
+#define ARDUCRYPTCRC_SLICE4 3
+#define ARDUCRYPTCRC_SLICE8 4
+
+#ifndef ARDUCRYPTCRC_KERNEL
+#define ARDUCRYPTCRC_KERNEL ARDUCRYPTCRC_WORD
+#endif
+
+/**
+ * incremental CRC-32: update() can be called for several buffers
+ * (e.g. frame header and data), finalize() returns the checksum
+ */
+class arducryptcrc {
+
+public:
+	void reset() {
+		state = 0xffffffff;
+	}
+
+	void update(const uint8_t* data, int length) {
+		state = updateKernel(state, data, length);
+	}
+
+	uint32_t finalize() {
+		return ~state;
+	}
+
+	static uint32_t calculate(const uint8_t* data, int length) {
+		return ~updateKernel(0xffffffff, data, length);
+	}
+
+	// kernels: raw state update, without initial / final xor
+	static uint32_t updateBitwise(uint32_t crc, const uint8_t* data,
+			int length);
+	static uint32_t updateByte(uint32_t crc, const uint8_t* data, int length);
+	static uint32_t updateWord(uint32_t crc, const uint8_t* data, int length);
+	static uint32_t updateSlice4(uint32_t crc, const uint8_t* data,
+			int length);
+	static uint32_t updateSlice8(uint32_t crc, const uint8_t* data,
+			int length);
+
+private:
+	static uint32_t updateKernel(uint32_t crc, const uint8_t* data,
+			int length) {
+#if ARDUCRYPTCRC_KERNEL == ARDUCRYPTCRC_BITWISE
+		return updateBitwise(crc, data, length);
+#elif ARDUCRYPTCRC_KERNEL == ARDUCRYPTCRC_BYTE
+		return updateByte(crc, data, length);
+#elif ARDUCRYPTCRC_KERNEL == ARDUCRYPTCRC_SLICE4
+		return updateSlice4(crc, data, length);
+#elif ARDUCRYPTCRC_KERNEL == ARDUCRYPTCRC_SLICE8
+		return updateSlice8(crc, data, length);
+#else
+		return updateWord(crc, data, length);
+#endif
+	}
+
+	uint32_t state = 0xffffffff;
+};
+
+#endif /* ARDUCRYPTCRC_H_ */
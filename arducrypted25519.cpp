@@ -0,0 +1,899 @@
+/*
+ * Copyright (C) 2017 A. Koller - akandroid75@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <arducrypt.h>
+#include <SHA512.h>
+#include <cstring>
+#include <new>
+#include "esp8266_peri.h"
+
+/*
+ * Ed25519 signature verification with a precomputed public key.
+ *
+ * Ed25519::verify decodes (decompresses) the public key and the R part of
+ * the signature on every call and does two separate scalar
+ * multiplications. Here the public key is decoded once into an
+ * arducryptpoint (see preparePublicKey) and verification computes
+ * h * (-A) + s * B in one pass with sliding windows.
+ *
+ * Both single and batch verification use the cofactored equation
+ * 8 * (s * B - h * A - R) = 0, so a signature gets the same result in
+ * both. A signature where A or R has a small order component (which the
+ * cofactorless s * B = R + h * A rejects) is accepted by both, otherwise
+ * a batch of such signatures could pass where the single checks fail.
+ *
+ * validateSignatures checks a batch with one randomized multi-scalar
+ * multiplication: with random 128 bit z_i,
+ * 8 * ((sum z_i * s_i) * B + sum (z_i * h_i) * (-A_i) + sum z_i * (-R_i))
+ * = 0 holds for valid signatures (and a wrong one only with probability
+ * 2^-128). All points share the 256 doublings, every signature adds its
+ * R decoding and window additions. If the sum is not 0 every signature is
+ * checked on its own.
+ *
+ * Field elements use 10 signed limbs of alternating 26 and 25 bits
+ * (radix 2^25.5), points use extended coordinates (X:Y:Z:T).
+ * Verification is not constant time, it only handles public data.
+ */
+
+typedef int32_t fe[ARDUCRYPTLIMBS];
+
+struct geCompleted {
+	fe x;
+	fe y;
+	fe z;
+	fe t;
+};
+
+struct geProjective {
+	fe x;
+	fe y;
+	fe z;
+};
+
+struct geCached {
+	fe yPlusX;
+	fe yMinusX;
+	fe z;
+	fe t2d;
+};
+
+static const uint8_t dBytes[KEYSIZE] = { 0xa3, 0x78, 0x59, 0x13, 0xca, 0x4d,
+		0xeb, 0x75, 0xab, 0xd8, 0x41, 0x41, 0x4d, 0x0a, 0x70, 0x00, 0x98, 0xe8,
+		0x79, 0x77, 0x79, 0x40, 0xc7, 0x8c, 0x73, 0xfe, 0x6f, 0x2b, 0xee, 0x6c,
+		0x03, 0x52 };
+
+static const uint8_t sqrtm1Bytes[KEYSIZE] = { 0xb0, 0xa0, 0x0e, 0x4a, 0x27,
+		0x1b, 0xee, 0xc4, 0x78, 0xe4, 0x2f, 0xad, 0x06, 0x18, 0x43, 0x2f, 0xa7,
+		0xd7, 0xfb, 0x3d, 0x99, 0x00, 0x4d, 0x2b, 0x0b, 0xdf, 0xc1, 0x4f, 0x80,
+		0x24, 0x83, 0x2b };
+
+static const uint8_t basePointBytes[KEYSIZE] = { 0x58, 0x66, 0x66, 0x66,
+		0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66,
+		0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66,
+		0x66, 0x66, 0x66, 0x66 };
+
+// group order L, little endian
+static const uint8_t orderBytes[KEYSIZE] = { 0xed, 0xd3, 0xf5, 0x5c, 0x1a,
+		0x63, 0x12, 0x58, 0xd6, 0x9c, 0xf7, 0xa2, 0xde, 0xf9, 0xde, 0x14, 0x00,
+		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+		0x00, 0x00, 0x10 };
+
+static inline int limbBits(int i) {
+	return (i & 1) ? 25 : 26;
+}
+
+static void feZero(fe h) {
+	memset(h, 0, sizeof(fe));
+}
+
+static void feOne(fe h) {
+	feZero(h);
+	h[0] = 1;
+}
+
+static void feCopy(fe h, const fe f) {
+	memcpy(h, f, sizeof(fe));
+}
+
+// no carry, inputs and output stay below 2^27 per limb
+static void feAdd(fe h, const fe f, const fe g) {
+	for (int i = 0; i < ARDUCRYPTLIMBS; i++) {
+		h[i] = f[i] + g[i];
+	}
+}
+
+static void feSub(fe h, const fe f, const fe g) {
+	for (int i = 0; i < ARDUCRYPTLIMBS; i++) {
+		h[i] = f[i] - g[i];
+	}
+}
+
+static void feNeg(fe h, const fe f) {
+	for (int i = 0; i < ARDUCRYPTLIMBS; i++) {
+		h[i] = -f[i];
+	}
+}
+
+/**
+ * \brief carries 10 wide limbs back into radix 2^25.5
+ */
+static void feCarry(fe h, int64_t* t) {
+	int64_t c;
+	for (int i = 0; i < ARDUCRYPTLIMBS - 1; i++) {
+		int bits = limbBits(i);
+		c = (t[i] + ((int64_t) 1 << (bits - 1))) >> bits;
+		t[i + 1] += c;
+		t[i] -= c * ((int64_t) 1 << bits);
+	}
+	c = (t[9] + ((int64_t) 1 << 24)) >> 25;
+	t[0] += c * 19;
+	t[9] -= c * ((int64_t) 1 << 25);
+	c = (t[0] + ((int64_t) 1 << 25)) >> 26;
+	t[1] += c;
+	t[0] -= c * ((int64_t) 1 << 26);
+	for (int i = 0; i < ARDUCRYPTLIMBS; i++) {
+		h[i] = (int32_t) t[i];
+	}
+}
+
+/**
+ * \brief h = f * g
+ * limbs above 2^255 wrap around times 19, products of two odd limbs count
+ * twice (25.5 bit radix). 32x32 bit products only, 19 * (...) is applied
+ * to the 64 bit column sums.
+ */
+static void feMul(fe h, const fe f, const fe g) {
+	int32_t f0 = f[0], f1 = f[1], f2 = f[2], f3 = f[3], f4 = f[4];
+	int32_t f5 = f[5], f6 = f[6], f7 = f[7], f8 = f[8], f9 = f[9];
+	int32_t g0 = g[0], g1 = g[1], g2 = g[2], g3 = g[3], g4 = g[4];
+	int32_t g5 = g[5], g6 = g[6], g7 = g[7], g8 = g[8], g9 = g[9];
+	int32_t f1_2 = 2 * f1, f3_2 = 2 * f3, f5_2 = 2 * f5;
+	int32_t f7_2 = 2 * f7, f9_2 = 2 * f9;
+	int64_t t[ARDUCRYPTLIMBS];
+
+	t[0] = f0 * (int64_t) g0 + 19 * (f1_2 * (int64_t) g9 + f2 * (int64_t) g8
+			+ f3_2 * (int64_t) g7 + f4 * (int64_t) g6 + f5_2 * (int64_t) g5
+			+ f6 * (int64_t) g4 + f7_2 * (int64_t) g3 + f8 * (int64_t) g2
+			+ f9_2 * (int64_t) g1);
+	t[1] = f0 * (int64_t) g1 + f1 * (int64_t) g0 + 19 * (f2 * (int64_t) g9
+			+ f3 * (int64_t) g8 + f4 * (int64_t) g7 + f5 * (int64_t) g6
+			+ f6 * (int64_t) g5 + f7 * (int64_t) g4 + f8 * (int64_t) g3
+			+ f9 * (int64_t) g2);
+	t[2] = f0 * (int64_t) g2 + f1_2 * (int64_t) g1 + f2 * (int64_t) g0
+			+ 19 * (f3_2 * (int64_t) g9 + f4 * (int64_t) g8
+			+ f5_2 * (int64_t) g7 + f6 * (int64_t) g6 + f7_2 * (int64_t) g5
+			+ f8 * (int64_t) g4 + f9_2 * (int64_t) g3);
+	t[3] = f0 * (int64_t) g3 + f1 * (int64_t) g2 + f2 * (int64_t) g1
+			+ f3 * (int64_t) g0 + 19 * (f4 * (int64_t) g9 + f5 * (int64_t) g8
+			+ f6 * (int64_t) g7 + f7 * (int64_t) g6 + f8 * (int64_t) g5
+			+ f9 * (int64_t) g4);
+	t[4] = f0 * (int64_t) g4 + f1_2 * (int64_t) g3 + f2 * (int64_t) g2
+			+ f3_2 * (int64_t) g1 + f4 * (int64_t) g0
+			+ 19 * (f5_2 * (int64_t) g9 + f6 * (int64_t) g8
+			+ f7_2 * (int64_t) g7 + f8 * (int64_t) g6 + f9_2 * (int64_t) g5);
+	t[5] = f0 * (int64_t) g5 + f1 * (int64_t) g4 + f2 * (int64_t) g3
+			+ f3 * (int64_t) g2 + f4 * (int64_t) g1 + f5 * (int64_t) g0
+			+ 19 * (f6 * (int64_t) g9 + f7 * (int64_t) g8 + f8 * (int64_t) g7
+			+ f9 * (int64_t) g6);
+	t[6] = f0 * (int64_t) g6 + f1_2 * (int64_t) g5 + f2 * (int64_t) g4
+			+ f3_2 * (int64_t) g3 + f4 * (int64_t) g2 + f5_2 * (int64_t) g1
+			+ f6 * (int64_t) g0 + 19 * (f7_2 * (int64_t) g9 + f8 * (int64_t) g8
+			+ f9_2 * (int64_t) g7);
+	t[7] = f0 * (int64_t) g7 + f1 * (int64_t) g6 + f2 * (int64_t) g5
+			+ f3 * (int64_t) g4 + f4 * (int64_t) g3 + f5 * (int64_t) g2
+			+ f6 * (int64_t) g1 + f7 * (int64_t) g0 + 19 * (f8 * (int64_t) g9
+			+ f9 * (int64_t) g8);
+	t[8] = f0 * (int64_t) g8 + f1_2 * (int64_t) g7 + f2 * (int64_t) g6
+			+ f3_2 * (int64_t) g5 + f4 * (int64_t) g4 + f5_2 * (int64_t) g3
+			+ f6 * (int64_t) g2 + f7_2 * (int64_t) g1 + f8 * (int64_t) g0
+			+ 19 * (f9_2 * (int64_t) g9);
+	t[9] = f0 * (int64_t) g9 + f1 * (int64_t) g8 + f2 * (int64_t) g7
+			+ f3 * (int64_t) g6 + f4 * (int64_t) g5 + f5 * (int64_t) g4
+			+ f6 * (int64_t) g3 + f7 * (int64_t) g2 + f8 * (int64_t) g1
+			+ f9 * (int64_t) g0;
+	feCarry(h, t);
+}
+
+static void feSquare(fe h, const fe f) {
+	feMul(h, f, f);
+}
+
+static void feSquareTimes(fe h, const fe f, int n) {
+	feSquare(h, f);
+	for (int i = 1; i < n; i++) {
+		feSquare(h, h);
+	}
+}
+
+/**
+ * \brief out = z^(2^250 - 1), t0 = z^11
+ * first part of the square root exponent chain
+ */
+static void fePow250(fe out, fe t0, const fe z) {
+	fe t1;
+	fe t2;
+	feSquare(t0, z);
+	feSquareTimes(t1, t0, 2);
+	feMul(t1, z, t1);
+	feMul(t0, t0, t1);
+	feSquare(t2, t0);
+	feMul(t1, t1, t2);
+	feSquareTimes(t2, t1, 5);
+	feMul(t1, t2, t1);
+	feSquareTimes(t2, t1, 10);
+	feMul(t2, t2, t1);
+	feSquareTimes(out, t2, 20);
+	feMul(t2, out, t2);
+	feSquareTimes(t2, t2, 10);
+	feMul(t1, t2, t1);
+	feSquareTimes(t2, t1, 50);
+	feMul(t2, t2, t1);
+	feSquareTimes(out, t2, 100);
+	feMul(t2, out, t2);
+	feSquareTimes(t2, t2, 50);
+	feMul(out, t2, t1);
+}
+
+// out = z^((p - 5) / 8)
+static void fePow22523(fe out, const fe z) {
+	fe t0;
+	fe t1;
+	fePow250(t1, t0, z);
+	feSquareTimes(t1, t1, 2);
+	feMul(out, t1, z);
+}
+
+static void feFromBytes(fe h, const uint8_t* s) {
+	int offset = 0;
+	for (int i = 0; i < ARDUCRYPTLIMBS; i++) {
+		int bits = limbBits(i);
+		int byte = offset >> 3;
+		uint64_t v = 0;
+		for (int k = 0; k < 5 && byte + k < KEYSIZE; k++) {
+			v |= (uint64_t) s[byte + k] << (8 * k);
+		}
+		h[i] = (int32_t) ((v >> (offset & 7)) & (((uint64_t) 1 << bits) - 1));
+		offset += bits;
+	}
+}
+
+/**
+ * \brief canonical little endian encoding (fully reduced mod p)
+ */
+static void feToBytes(uint8_t* s, const fe f) {
+	int32_t h[ARDUCRYPTLIMBS];
+	feCopy(h, f);
+	// q = 1 if h >= p, 0 otherwise
+	int32_t q = (19 * h[9] + ((int32_t) 1 << 24)) >> 25;
+	for (int i = 0; i < ARDUCRYPTLIMBS; i++) {
+		q = (h[i] + q) >> limbBits(i);
+	}
+	h[0] += 19 * q;
+	for (int i = 0; i < ARDUCRYPTLIMBS - 1; i++) {
+		int bits = limbBits(i);
+		int32_t c = h[i] >> bits;
+		h[i + 1] += c;
+		h[i] -= c * ((int32_t) 1 << bits);
+	}
+	h[9] &= ((int32_t) 1 << 25) - 1;
+
+	uint64_t acc = 0;
+	int bits = 0;
+	int pos = 0;
+	for (int i = 0; i < ARDUCRYPTLIMBS; i++) {
+		acc |= (uint64_t) (uint32_t) h[i] << bits;
+		bits += limbBits(i);
+		while (bits >= 8) {
+			s[pos++] = (uint8_t) acc;
+			acc >>= 8;
+			bits -= 8;
+		}
+	}
+	s[pos] = (uint8_t) acc;
+}
+
+static boolean feIsNegative(const fe f) {
+	uint8_t s[KEYSIZE];
+	feToBytes(s, f);
+	return s[0] & 1;
+}
+
+static boolean feIsNonZero(const fe f) {
+	uint8_t s[KEYSIZE];
+	uint8_t r = 0;
+	feToBytes(s, f);
+	for (int i = 0; i < KEYSIZE; i++) {
+		r |= s[i];
+	}
+	return r != 0;
+}
+
+struct Ed25519Constants {
+	fe d;
+	fe d2;
+	fe sqrtm1;
+	// B, 3B, 5B, ... 15B
+	geCached base[8];
+	Ed25519Constants();
+};
+
+static void geToCached(geCached* r, const arducryptpoint* p, const fe d2) {
+	feAdd(r->yPlusX, p->y, p->x);
+	feSub(r->yMinusX, p->y, p->x);
+	feCopy(r->z, p->z);
+	feMul(r->t2d, p->t, d2);
+}
+
+static void geToExtended(arducryptpoint* r, const geCompleted* p) {
+	feMul(r->x, p->x, p->t);
+	feMul(r->y, p->y, p->z);
+	feMul(r->z, p->z, p->t);
+	feMul(r->t, p->x, p->y);
+}
+
+static void geToProjective(geProjective* r, const geCompleted* p) {
+	feMul(r->x, p->x, p->t);
+	feMul(r->y, p->y, p->z);
+	feMul(r->z, p->z, p->t);
+}
+
+static void geDouble(geCompleted* r, const geProjective* p) {
+	fe t0;
+	feSquare(r->x, p->x);
+	feSquare(r->z, p->y);
+	feSquare(r->t, p->z);
+	feAdd(r->t, r->t, r->t);
+	feAdd(r->y, p->x, p->y);
+	feSquare(t0, r->y);
+	feAdd(r->y, r->z, r->x);
+	feSub(r->z, r->z, r->x);
+	feSub(r->x, t0, r->y);
+	feSub(r->t, r->t, r->z);
+}
+
+static void geFromProjective(arducryptpoint* r, const geProjective* p) {
+	feMul(r->x, p->x, p->z);
+	feMul(r->y, p->y, p->z);
+	feSquare(r->z, p->z);
+	feMul(r->t, p->x, p->y);
+}
+
+/**
+ * \brief true if 8 * p is the neutral element (p is of small order),
+ * p is modified
+ */
+static boolean geIsSmallOrder(geProjective* p) {
+	geCompleted t;
+	for (int i = 0; i < 3; i++) {
+		geDouble(&t, p);
+		geToProjective(p, &t);
+	}
+	// neutral element: X = 0, Y = Z
+	fe d;
+	feSub(d, p->y, p->z);
+	return feIsNonZero(p->x) == false && feIsNonZero(d) == false;
+}
+
+/**
+ * \brief r = p + q (subtract = false) or r = p - q (subtract = true)
+ */
+static void geAdd(geCompleted* r, const arducryptpoint* p, const geCached* q,
+		boolean subtract) {
+	fe t0;
+	feAdd(r->x, p->y, p->x);
+	feSub(r->y, p->y, p->x);
+	feMul(r->z, r->x, subtract ? q->yMinusX : q->yPlusX);
+	feMul(r->y, r->y, subtract ? q->yPlusX : q->yMinusX);
+	feMul(r->t, q->t2d, p->t);
+	feMul(r->x, p->z, q->z);
+	feAdd(t0, r->x, r->x);
+	feSub(r->x, r->z, r->y);
+	feAdd(r->y, r->z, r->y);
+	if (subtract) {
+		feSub(r->z, t0, r->t);
+		feAdd(r->t, t0, r->t);
+	} else {
+		feAdd(r->z, t0, r->t);
+		feSub(r->t, t0, r->t);
+	}
+}
+
+/**
+ * \brief decodes s into -A (negate = true) or A
+ */
+static boolean geDecode(arducryptpoint* h, const uint8_t* s, boolean negate,
+		const Ed25519Constants& c) {
+	fe u;
+	fe v;
+	fe v3;
+	fe vxx;
+	fe check;
+
+	feFromBytes(h->y, s);
+	feOne(h->z);
+	feSquare(u, h->y);
+	feMul(v, u, c.d);
+	feSub(u, u, h->z); // u = y^2 - 1
+	feAdd(v, v, h->z); // v = d * y^2 + 1
+
+	feSquare(v3, v);
+	feMul(v3, v3, v); // v^3
+	feSquare(h->x, v3);
+	feMul(h->x, h->x, v);
+	feMul(h->x, h->x, u); // u * v^7
+	fePow22523(h->x, h->x);
+	feMul(h->x, h->x, v3);
+	feMul(h->x, h->x, u); // x = u * v^3 * (u * v^7)^((p - 5) / 8)
+
+	feSquare(vxx, h->x);
+	feMul(vxx, vxx, v);
+	feSub(check, vxx, u);
+	if (feIsNonZero(check)) {
+		feAdd(check, vxx, u);
+		if (feIsNonZero(check)) {
+			return false;
+		}
+		feMul(h->x, h->x, c.sqrtm1);
+	}
+	if ((feIsNegative(h->x) == (s[31] >> 7)) == negate) {
+		feNeg(h->x, h->x);
+	}
+	feMul(h->t, h->x, h->y);
+	return true;
+}
+
+Ed25519Constants::Ed25519Constants() {
+	feFromBytes(d, dBytes);
+	feAdd(d2, d, d);
+	feFromBytes(sqrtm1, sqrtm1Bytes);
+
+	arducryptpoint b;
+	arducryptpoint b2;
+	geProjective p;
+	geCompleted t;
+	geCached b2Cached;
+	geDecode(&b, basePointBytes, false, *this);
+	geToCached(&base[0], &b, d2);
+	memcpy(&p, &b, sizeof(p));
+	geDouble(&t, &p);
+	geToExtended(&b2, &t);
+	geToCached(&b2Cached, &b2, d2);
+	for (int i = 1; i < 8; i++) {
+		geAdd(&t, &b, &b2Cached, false);
+		geToExtended(&b, &t);
+		geToCached(&base[i], &b, d2);
+	}
+}
+
+static const Ed25519Constants& constants() {
+	static const Ed25519Constants c;
+	return c;
+}
+
+/**
+ * \brief signed sliding window digits (odd, -15..15) of a 256 bit scalar
+ */
+static void slide(int8_t* r, const uint8_t* a) {
+	for (int i = 0; i < 256; i++) {
+		r[i] = 1 & (a[i >> 3] >> (i & 7));
+	}
+	for (int i = 0; i < 256; i++) {
+		if (r[i] == 0) {
+			continue;
+		}
+		for (int b = 1; b <= 6 && i + b < 256; b++) {
+			if (r[i + b] == 0) {
+				continue;
+			}
+			if (r[i] + (r[i + b] << b) <= 15) {
+				r[i] += r[i + b] << b;
+				r[i + b] = 0;
+			} else if (r[i] - (r[i + b] << b) >= -15) {
+				r[i] -= r[i + b] << b;
+				for (int k = i + b; k < 256; k++) {
+					if (r[k] == 0) {
+						r[k] = 1;
+						break;
+					}
+					r[k] = 0;
+				}
+			} else {
+				break;
+			}
+		}
+	}
+}
+
+/**
+ * \brief table of A, 3A, 5A, ... 15A for the sliding window digits
+ */
+static void geOddMultiples(geCached* table, const arducryptpoint* A,
+		const fe d2) {
+	geCompleted t;
+	arducryptpoint u;
+	arducryptpoint a2;
+	geProjective p;
+	geToCached(&table[0], A, d2);
+	memcpy(&p, A, sizeof(p));
+	geDouble(&t, &p);
+	geToExtended(&a2, &t);
+	for (int i = 1; i < 8; i++) {
+		geAdd(&t, &a2, &table[i - 1], false);
+		geToExtended(&u, &t);
+		geToCached(&table[i], &u, d2);
+	}
+}
+
+/**
+ * \brief t = t + digit * P, table of P from geOddMultiples
+ */
+static void geAddDigit(geCompleted* t, int8_t digit, const geCached* table) {
+	arducryptpoint u;
+	geToExtended(&u, t);
+	geAdd(t, &u, &table[(digit < 0 ? -digit : digit) / 2], digit < 0);
+}
+
+/**
+ * \brief r = a * A + b * B
+ */
+static void geDoubleScalarMult(geProjective* r, const uint8_t* a,
+		const arducryptpoint* A, const uint8_t* b) {
+	const Ed25519Constants& c = constants();
+	int8_t aslide[256];
+	int8_t bslide[256];
+	geCached ai[8];
+	geCompleted t;
+
+	slide(aslide, a);
+	slide(bslide, b);
+	geOddMultiples(ai, A, c.d2);
+
+	feZero(r->x);
+	feOne(r->y);
+	feOne(r->z);
+
+	int i = 255;
+	while (i >= 0 && aslide[i] == 0 && bslide[i] == 0) {
+		i--;
+	}
+	for (; i >= 0; i--) {
+		geDouble(&t, r);
+		if (aslide[i] != 0) {
+			geAddDigit(&t, aslide[i], ai);
+		}
+		if (bslide[i] != 0) {
+			geAddDigit(&t, bslide[i], c.base);
+		}
+		geToProjective(r, &t);
+	}
+}
+
+/**
+ * \brief reduces a 512 bit hash modulo the group order L (in place, 32 bytes result)
+ */
+static void scReduce(uint8_t* s) {
+	int64_t x[64];
+	int64_t carry;
+	int i;
+	int j;
+	for (i = 0; i < 64; i++) {
+		x[i] = s[i];
+	}
+	for (i = 63; i >= 32; i--) {
+		carry = 0;
+		for (j = i - 32; j < i - 12; j++) {
+			x[j] += carry - 16 * x[i] * orderBytes[j - (i - 32)];
+			carry = (x[j] + 128) >> 8;
+			x[j] -= carry * 256;
+		}
+		x[j] += carry;
+		x[i] = 0;
+	}
+	carry = 0;
+	for (j = 0; j < 32; j++) {
+		x[j] += carry - (x[31] >> 4) * orderBytes[j];
+		carry = x[j] >> 8;
+		x[j] &= 255;
+	}
+	for (j = 0; j < 32; j++) {
+		x[j] -= carry * orderBytes[j];
+	}
+	for (i = 0; i < 32; i++) {
+		x[i + 1] += x[i] >> 8;
+		s[i] = x[i] & 255;
+	}
+}
+
+/**
+ * \brief out = a * b + c mod L, a and c 32 bytes (c may be NULL), b bLength
+ * bytes
+ */
+static void scMulAdd(uint8_t* out, const uint8_t* a, const uint8_t* b,
+		int bLength, const uint8_t* c) {
+	// column sums stay below 32 * 255 * 255 + 255
+	uint32_t t[64] = { };
+	uint8_t wide[64];
+	for (int i = 0; i < KEYSIZE; i++) {
+		for (int j = 0; j < bLength; j++) {
+			t[i + j] += a[i] * (uint32_t) b[j];
+		}
+		if (c != NULL) {
+			t[i] += c[i];
+		}
+	}
+	uint32_t carry = 0;
+	for (int k = 0; k < 64; k++) {
+		carry += t[k];
+		wide[k] = (uint8_t) carry;
+		carry >>= 8;
+	}
+	scReduce(wide);
+	memcpy(out, wide, KEYSIZE);
+}
+
+/**
+ * \brief true if the scalar s is below the group order (canonical)
+ */
+static boolean scIsCanonical(const uint8_t* s) {
+	for (int i = KEYSIZE - 1; i >= 0; i--) {
+		if (s[i] < orderBytes[i]) {
+			return true;
+		}
+		if (s[i] > orderBytes[i]) {
+			return false;
+		}
+	}
+	return false;
+}
+
+/**
+ * \brief true if s is the canonical encoding of a point (y < p and no
+ * sign bit for x = 0), h is s decoded
+ */
+static boolean geIsCanonical(const uint8_t* s, const arducryptpoint* h) {
+	if ((s[31] & 0x7f) == 0x7f && s[0] >= 0xed) {
+		uint8_t all = 0xff;
+		for (int i = 1; i < KEYSIZE - 1; i++) {
+			all &= s[i];
+		}
+		if (all == 0xff) {
+			return false;
+		}
+	}
+	return (s[31] >> 7) == 0 || feIsNonZero(h->x);
+}
+
+/**
+ * \brief decodes a Ed25519 public key for validateSignature.
+ * the point is stored negated (-A).
+ * returns false if key is not a valid curve point.
+ */
+boolean arducrypt::preparePublicKey(arducryptpoint* point, arducryptkey* key) {
+	return geDecode(point, key->keybytes, true, constants());
+}
+
+/**
+ * \brief validates signature of message with a key prepared by preparePublicKey
+ * (cofactored, like validateSignatures)
+ */
+boolean arducrypt::validateSignature(arducryptsignature* signature,
+		uint8_t* message, int length, arducryptkey* key,
+		arducryptpoint* point) {
+	const Ed25519Constants& c = constants();
+	uint8_t h[64];
+	arducryptpoint rPoint;
+	arducryptpoint sum;
+	geCached rCached;
+	geProjective r;
+	geCompleted t;
+	const uint8_t* s = signature->signaturebytes + KEYSIZE;
+
+	if (scIsCanonical(s) == false
+			|| geDecode(&rPoint, signature->signaturebytes, false, c) == false
+			|| geIsCanonical(signature->signaturebytes, &rPoint) == false) {
+		return false;
+	}
+	SHA512 hash;
+	hash.reset();
+	hash.update(signature->signaturebytes, KEYSIZE);
+	hash.update(key->keybytes, KEYSIZE);
+	hash.update(message, length);
+	hash.finalize(h, sizeof(h));
+	scReduce(h);
+
+	// 8 * (h * (-A) + s * B - R) = 0
+	geDoubleScalarMult(&r, h, point, s);
+	geFromProjective(&sum, &r);
+	geToCached(&rCached, &rPoint, c.d2);
+	geAdd(&t, &sum, &rCached, true);
+	geToProjective(&r, &t);
+	return geIsSmallOrder(&r);
+}
+
+/**
+ * per signature state of validateSignatures
+ */
+struct arducryptbatchentry {
+	// -A, decoded here if the item has no prepared point
+	arducryptpoint key;
+	const arducryptpoint* a;
+	// -R
+	arducryptpoint r;
+	// z * h
+	uint8_t scalar[KEYSIZE];
+	uint8_t z[KEYSIZE];
+	int8_t aslide[256];
+	int8_t rslide[256];
+	geCached atable[8];
+	geCached rtable[8];
+};
+
+/**
+ * \brief decodes R and A and computes h, false if the signature can not be
+ * valid (non canonical s or R, invalid point)
+ */
+static boolean batchPrepare(arducryptbatchentry* e, arducryptbatchitem* item,
+		const Ed25519Constants& c) {
+	const uint8_t* r = item->signature->signaturebytes;
+	if (scIsCanonical(r + KEYSIZE) == false
+			|| geDecode(&e->r, r, true, c) == false
+			|| geIsCanonical(r, &e->r) == false) {
+		return false;
+	}
+	e->a = item->point;
+	if (e->a == NULL) {
+		if (geDecode(&e->key, item->key->keybytes, true, c) == false) {
+			return false;
+		}
+		e->a = &e->key;
+	}
+	uint8_t h[64];
+	SHA512 hash;
+	hash.reset();
+	hash.update(r, KEYSIZE);
+	hash.update(item->key->keybytes, KEYSIZE);
+	hash.update(item->message, item->length);
+	hash.finalize(h, sizeof(h));
+	scReduce(h);
+
+	// random 128 bit z, never 0
+	memset(e->z, 0, KEYSIZE);
+	for (int i = 0; i < 16; i += 4) {
+		uint32_t random = RANDOM_REG32;
+		memcpy(e->z + i, &random, 4);
+	}
+	e->z[0] |= 1;
+	scMulAdd(e->scalar, h, e->z, 16, NULL);
+	return true;
+}
+
+/**
+ * \brief true if 8 * sum z_i * s_i * B + z_i * h_i * (-A_i) + z_i * (-R_i)
+ * is the neutral element
+ */
+static boolean batchCheck(arducryptbatchentry* entries, int count,
+		arducryptbatchitem** items, const Ed25519Constants& c) {
+	uint8_t b[KEYSIZE];
+	int8_t bslide[256];
+	memset(b, 0, KEYSIZE);
+	int top = 0;
+	for (int n = 0; n < count; n++) {
+		arducryptbatchentry* e = &entries[n];
+		scMulAdd(b, items[n]->signature->signaturebytes + KEYSIZE, e->z, 16,
+				b);
+		slide(e->aslide, e->scalar);
+		slide(e->rslide, e->z);
+		geOddMultiples(e->atable, e->a, c.d2);
+		geOddMultiples(e->rtable, &e->r, c.d2);
+		for (int i = 255; i > top; i--) {
+			if (e->aslide[i] != 0 || e->rslide[i] != 0) {
+				top = i;
+			}
+		}
+	}
+	slide(bslide, b);
+	for (int i = 255; i > top; i--) {
+		if (bslide[i] != 0) {
+			top = i;
+		}
+	}
+
+	geProjective r;
+	geCompleted t;
+	feZero(r.x);
+	feOne(r.y);
+	feOne(r.z);
+	for (int i = top; i >= 0; i--) {
+		geDouble(&t, &r);
+		for (int n = 0; n < count; n++) {
+			if (entries[n].aslide[i] != 0) {
+				geAddDigit(&t, entries[n].aslide[i], entries[n].atable);
+			}
+			if (entries[n].rslide[i] != 0) {
+				geAddDigit(&t, entries[n].rslide[i], entries[n].rtable);
+			}
+		}
+		if (bslide[i] != 0) {
+			geAddDigit(&t, bslide[i], c.base);
+		}
+		geToProjective(&r, &t);
+	}
+	return geIsSmallOrder(&r);
+}
+
+/**
+ * \brief validates count signatures, valid[i] is the result of items[i].
+ * up to ARDUCRYPTBATCHMAX signatures are checked with one multi-scalar
+ * multiplication, if that fails (or there is no memory for it) every
+ * signature is checked on its own. returns the number of valid signatures
+ */
+int arducrypt::validateSignatures(arducryptbatchitem* items, int count,
+		boolean* valid) {
+	const Ed25519Constants& c = constants();
+	int chunk = count < ARDUCRYPTBATCHMAX ? count : ARDUCRYPTBATCHMAX;
+	arducryptbatchentry* entries = NULL;
+	if (chunk > 1) {
+		entries = new (std::nothrow) arducryptbatchentry[chunk];
+	}
+	arducryptbatchitem* batch[ARDUCRYPTBATCHMAX];
+	int batchIndex[ARDUCRYPTBATCHMAX];
+	int validCount = 0;
+	for (int first = 0; first < count; first += chunk) {
+		int end = first + chunk < count ? first + chunk : count;
+		int used = 0;
+		for (int i = first; i < end; i++) {
+			valid[i] = false;
+			if (entries == NULL) {
+				batchIndex[used++] = i;
+			} else if (batchPrepare(&entries[used], &items[i], c) == true) {
+				batch[used] = &items[i];
+				batchIndex[used++] = i;
+			}
+		}
+		if (entries != NULL && used > 1
+				&& batchCheck(entries, used, batch, c) == true) {
+			for (int n = 0; n < used; n++) {
+				valid[batchIndex[n]] = true;
+			}
+			validCount += used;
+			continue;
+		}
+		// one by one, to find the invalid ones
+		for (int n = 0; n < used; n++) {
+			arducryptbatchitem* item = &items[batchIndex[n]];
+			arducryptpoint* point = item->point;
+			if (point == NULL && entries != NULL) {
+				point = &entries[n].key;
+			}
+			if (point != NULL) {
+				valid[batchIndex[n]] = validateSignature(item->signature,
+						item->message, item->length, item->key, point);
+			} else {
+				valid[batchIndex[n]] = validateSignature(item->signature,
+						item->message, item->length, item->key);
+			}
+			validCount += valid[batchIndex[n]] ? 1 : 0;
+		}
+	}
+	delete[] entries;
+	return validCount;
+}
@@ -20,7 +20,12 @@
  * DEALINGS IN THE SOFTWARE.
  */
 
+// serial output during setup, the library itself logs via DoorKeeperLog
+#define DOORKEEPERDEBUG 1
+
 #include <DoorKeeper.h>
+#include <DoorKeeperSessions.h>
+#include <DoorKeeperStream.h>
 #include <Esp.h>
 #include <ESP8266mDNS.h>
 #include <ESP8266WiFi.h>
@@ -72,6 +77,8 @@ const User testuser =
 //#define SERVERPORT 23
 
 DoorKeeperConfig dkconfig;
+// user schedules, 1: staff mon - fri 07:00 - 19:00
+DoorKeeperSchedule schedules[1];
 
 //Externals in SNTPClock.cpp
 extern SNTPClock Clock;
@@ -79,7 +86,12 @@ extern SNTPClock Clock;
 const int MAX_SRV_CLIENTS = 3;
 WiFiServer server(23);
 WiFiClient serverClients[MAX_SRV_CLIENTS];
-DoorKeeperSession sessions[MAX_SRV_CLIENTS];
+// one session per client slot, the slot number is the connection id
+DoorKeeperSessions sessions;
+// reassembles frames split over / coalesced in TCP segments
+DoorKeeperStream streams[MAX_SRV_CLIENTS];
+// responses of one loop pass, sent with one write
+DoorKeeperOutQueue outQueues[MAX_SRV_CLIENTS];
 
 DoorKeeper keeper;
 
@@ -93,11 +105,7 @@ void ClockCbFunction() {
 }
 
 boolean static defaultHandler(uint8_t messagetype, uint8_t reservedByte, MessagePayload* payload, DoorKeeperMessage* outbuffer) {
-	DOORKEEPERDEBUG_PRINTLN(F("default handler was called!"));
-	DOORKEEPERDEBUG_PRINT("messagetype: ");DOORKEEPERDEBUG_PRINT(messagetype);
-	DOORKEEPERDEBUG_PRINT(" reservebyte: ");DOORKEEPERDEBUG_PRINTLN(reservedByte);
-	DOORKEEPERDEBUG_PRINT("data: ");DOORKEEPERDEBUG_HEXPRINT((uint8_t*)payload,sizeof(MessagePayload));
-	DOORKEEPERDEBUG_PRINTLN();
+	DOORKEEPERLOG_INFO(DKEV_MESSAGE, messagetype, reservedByte);
 	// set return message
 	payload->data.custom.data[0] = 0x66;
 	// set type byte
@@ -118,6 +126,15 @@ void generateNewSignKeyPair() {
 	DOORKEEPERDEBUG_PRINTLN();
 }
 
+/**
+ * \brief evict handler: the session of slot id was idle too long
+ */
+void closeIdleClient(uint32_t id) {
+	serverClients[id].stop();
+	streams[id].reset();
+	outQueues[id].reset();
+	DOORKEEPERLOG_INFO(DKEV_CLIENTCLOSED, id, 0);
+}
 
 void setup() {
 
@@ -192,6 +209,15 @@ void setup() {
 	dkconfig.pins[3].OFF = LOW;
 	dkconfig.pins[3].ON = HIGH;
 
+	DoorKeeperPolicy::clearSchedule(&schedules[0]);
+	DoorKeeperPolicy::addWindow(&schedules[0], 0x3e, 7, 19);
+	dkconfig.schedules = schedules;
+	dkconfig.scheduleCount = 1;
+
+	// saveDB writes the user db to EEPROM, or to the flash journal if its
+	// sectors are set (between the filesystem and EEPROM, see README)
+	// dkconfig.saveDB = true;
+	// dkconfig.journalSector = ...;
 
 	keeper.initKeeper(&dkconfig);
 
@@ -199,6 +225,8 @@ void setup() {
 	keeper.addUser((User*)&testuser);
 	// add callback
 	keeper.addDefaultHandler(&defaultHandler);
+	sessions.begin(&keeper, MAX_SRV_CLIENTS);
+	sessions.setEvictHandler(&closeIdleClient);
 	// this is really hacky! :(
 	// we should also use DCF77 for time information
 	keeper.initTime((timestruct*) Clock.getTimeStruct());
@@ -212,52 +240,9 @@ void setup() {
 
 extern const uint32_t DoorKeeperMessageSize;
 
-void copyToArray(String* s, char* ar) {
-	int len = s->length() + 1;
-	s->toCharArray(ar, len, 0);
-}
-
-DoorKeeperSession* getSession(String sessionid) {
-	char tmp[sessionid.length()];
-	DOORKEEPERDEBUG_PRINTLN(sessionid.length());
-	//sessionid.toCharArray(tmp, sessionid.length(), 0);
-	copyToArray(&sessionid, tmp);
-	DOORKEEPERDEBUG_PRINT("getSession: ");
-	DOORKEEPERDEBUG_PRINTLN(tmp);
-	for (int i = 0; i < MAX_SRV_CLIENTS; i++) {
-		if (memcmp(sessions[i].name, tmp, sessionid.length()) == 0) {
-			return &sessions[i];
-		}
-	}
-	return NULL;
-}
-
-DoorKeeperSession* createSession(String sessionid) {
-	char tmp[sessionid.length()];
-	//sessionid.toCharArray(tmp, sessionid.length(), 0);
-	copyToArray(&sessionid, tmp);
-	DOORKEEPERDEBUG_PRINT("createSession: ");
-	DOORKEEPERDEBUG_PRINTLN(tmp);
-	for (int i = 0; i < MAX_SRV_CLIENTS; i++) {
-		if (sessions[i].name[0] == '\0') {
-			memcpy(sessions[i].name, tmp, sessionid.length());
-			return &sessions[i];
-		}
-	}
-	return NULL;
-}
-
-void destroySession(DoorKeeperSession* session) {
-	session->name[0] = '\0';
-	DOORKEEPERDEBUG_PRINT("destroySession: ");
-	DOORKEEPERDEBUG_PRINTLN(session->name);
-}
-
 void handleTelnetClients() {
-	uint8_t bufferin[DoorKeeperMessageSize];
-	DoorKeeperMessage* doorkeeperBufferIn = (DoorKeeperMessage*) bufferin;
-	uint8_t bufferout[DoorKeeperMessageSize];
-	DoorKeeperMessage* doorkeeperBufferOut = (DoorKeeperMessage*) bufferout;
+	uint8_t bufferin[DOORKEEPERFRAMEMAXSIZE] __attribute__((aligned(4)));
+	uint8_t bufferout[DOORKEEPERFRAMEMAXSIZE] __attribute__((aligned(4)));
 
 	if (server.hasClient()) {
 		for (int h = 0; h < MAX_SRV_CLIENTS; h++) {
@@ -267,8 +252,10 @@ void handleTelnetClients() {
 					serverClients[h].stop();
 				}
 				serverClients[h] = server.available();
-				DOORKEEPERDEBUG_PRINT("New client: ");
-				DOORKEEPERDEBUG_PRINTLN(h);
+				sessions.create(h);
+				streams[h].reset();
+				outQueues[h].reset();
+				DOORKEEPERLOG_INFO(DKEV_CLIENTCONNECTED, h, 0);
 				break;
 			}
 		}
@@ -281,32 +268,35 @@ void handleTelnetClients() {
 		if (serverClients[i] && serverClients[i].connected()) {
 
 			if (serverClients[i].available()) {
-				DOORKEEPERDEBUG_PRINT(serverClients[i].remoteIP().toString());
-				DOORKEEPERDEBUG_PRINT(":");
-				DOORKEEPERDEBUG_PRINTLN(serverClients[i].remotePort());
 				//get data from the client
-				DOORKEEPERDEBUG_PRINT("client read ");
 				ESP.wdtFeed();
-				int read = serverClients[i].read(bufferin,
-						sizeof(DoorKeeperMessage));
-				DOORKEEPERDEBUG_PRINT(read);
-				DOORKEEPERDEBUG_PRINTLN(" bytes");
-				DOORKEEPERDEBUG_PRINT("session ");
-				DOORKEEPERDEBUG_PRINTLN(i);
-				if (keeper.handleMessage(doorkeeperBufferIn, doorkeeperBufferOut,
-						&sessions[i]) == true) {
-					ESP.wdtFeed();
-					// send
-					sendResponse(doorkeeperBufferOut, serverClients[i]);
-					ESP.wdtFeed();
+				int read = streams[i].receive(serverClients[i]);
+				DOORKEEPERLOG_DEBUG(DKEV_CLIENTREAD, i, read);
+			}
+			// all complete frames, pipelined requests in one pass. no room
+			// for a response: leave the rest for the next pass (backpressure).
+			// only a client which sent something counts as active
+			DoorKeeperSession* session =
+					streams[i].available() > 0 ? sessions.get(i) : NULL;
+			while (session != NULL
+					&& outQueues[i].space() >= DOORKEEPERFRAMEMAXSIZE
+					&& streams[i].nextFrame(bufferin) > 0) {
+				int responseSize = keeper.handleFrame(bufferin, bufferout,
+						session);
+				if (responseSize > 0) {
+					outQueues[i].queue(bufferout, responseSize);
 					// delete buffer
-					memset(doorkeeperBufferOut, 0, DoorKeeperMessageSize);
-					continue;
+					memset(bufferout, 0, DOORKEEPERFRAMEMAXSIZE);
 				}
 			}
+			// send, never blocks
+			ESP.wdtFeed();
+			outQueues[i].flush(serverClients[i]);
 			if (serverClients[i].status() == wl_tcp_state::CLOSED) {
-				DOORKEEPERDEBUG_PRINTLN("client connection closed!");
-				destroySession(&sessions[i]);
+				DOORKEEPERLOG_INFO(DKEV_CLIENTCLOSED, i, 0);
+				sessions.remove(i);
+				streams[i].reset();
+				outQueues[i].reset();
 			}
 
 		}
@@ -316,14 +306,10 @@ void handleTelnetClients() {
 
 }
 
-void sendResponse(DoorKeeperMessage* response, WiFiClient client_) {
-
-	client_.write((uint8_t*) response, (size_t) DoorKeeperMessageSize);
-}
-
 void loop() {
 
 	handleTelnetClients();
+	sessions.evictIdle();
 	keeper.checkTimer();
 	keeper.doorkeeperLoop();
 }
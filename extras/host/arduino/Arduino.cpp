@@ -0,0 +1,336 @@
+/*
+ * Copyright (C) 2017 A. Koller - akandroid75@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <Arduino.h>
+#include <EEPROM.h>
+#include <esp8266_peri.h>
+#include <fcntl.h>
+#include <sys/random.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <chrono>
+#include <thread>
+
+HardwareSerial Serial;
+EspClass ESP;
+EEPROMClass EEPROM;
+
+// bit n: level of pin n, GPIO 0..15 are also the GPO register
+static uint32_t pinState = 0;
+static uint32_t gpioStores = 0;
+
+enum GpioFunction {
+	GPIOSET, GPIOCLEAR, GPIOOUT
+};
+
+HostGpioRegister hostGpos = { GPIOSET };
+HostGpioRegister hostGpoc = { GPIOCLEAR };
+HostGpioRegister hostGpo = { GPIOOUT };
+static unsigned long long advancedUs = 0;
+static const std::chrono::steady_clock::time_point startTime =
+		std::chrono::steady_clock::now();
+
+static unsigned long long elapsedUs() {
+	return std::chrono::duration_cast<std::chrono::microseconds>(
+			std::chrono::steady_clock::now() - startTime).count() + advancedUs;
+}
+
+void pinMode(uint8_t pin, uint8_t mode) {
+}
+
+void digitalWrite(uint8_t pin, uint8_t val) {
+	if (pin < HOSTMAXPINS) {
+		if (val) {
+			pinState |= 1UL << pin;
+		} else {
+			pinState &= ~(1UL << pin);
+		}
+	}
+}
+
+int digitalRead(uint8_t pin) {
+	if (pin < HOSTMAXPINS) {
+		return (pinState >> pin) & 1 ? HIGH : LOW;
+	}
+	return LOW;
+}
+
+HostGpioRegister& HostGpioRegister::operator=(uint32_t mask) {
+	mask &= 0xffff;
+	switch (function) {
+	case GPIOSET:
+		pinState |= mask;
+		break;
+	case GPIOCLEAR:
+		pinState &= ~mask;
+		break;
+	default:
+		pinState = (pinState & ~0xffffUL) | mask;
+		break;
+	}
+	gpioStores++;
+	return *this;
+}
+
+HostGpioRegister::operator uint32_t() const {
+	return pinState & 0xffff;
+}
+
+uint32_t hostGpioStores() {
+	return gpioStores;
+}
+
+unsigned long millis(void) {
+	return (unsigned long) (elapsedUs() / 1000);
+}
+
+unsigned long micros(void) {
+	return (unsigned long) elapsedUs();
+}
+
+void delay(unsigned long ms) {
+	std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+void hostAdvanceMillis(unsigned long ms) {
+	advancedUs += (unsigned long long) ms * 1000;
+}
+
+uint32_t EspClass::getCycleCount() {
+	// 80 cycles per us, without the hostAdvanceMillis offset
+	return (uint32_t) (std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now() - startTime).count() * 2 / 25);
+}
+
+static uint8_t flash[HOSTFLASHSECTORS * HOSTFLASHSECTORSIZE];
+static bool flashInit = false;
+static int storageFd = -1;
+
+/**
+ * \brief writes a changed range to the storage file (if there is one),
+ * offset is relative to the flash image
+ */
+static bool storageWrite(off_t offset, const uint8_t* data, size_t size) {
+	if (storageFd < 0) {
+		return true;
+	}
+	offset += HOSTEEPROMSIZE;
+	while (size > 0) {
+		ssize_t written = pwrite(storageFd, data, size, offset);
+		if (written <= 0) {
+			return false;
+		}
+		data += written;
+		offset += written;
+		size -= written;
+	}
+	return fdatasync(storageFd) == 0;
+}
+
+bool hostStorageOpen(const char* path) {
+	int fd = open(path, O_RDWR | O_CREAT, 0600);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st) != 0) {
+		return false;
+	}
+	if (flashInit == false) {
+		memset(flash, 0xff, sizeof(flash));
+		flashInit = true;
+	}
+	storageFd = fd;
+	size_t total = HOSTEEPROMSIZE + sizeof(flash);
+	if ((size_t) st.st_size != total) {
+		// new (or other layout): start erased
+		return ftruncate(fd, 0) == 0
+				&& storageWrite(-HOSTEEPROMSIZE, EEPROM.flashPtr(),
+						HOSTEEPROMSIZE)
+				&& storageWrite(0, flash, sizeof(flash));
+	}
+	return pread(fd, EEPROM.flashPtr(), HOSTEEPROMSIZE, 0) == HOSTEEPROMSIZE
+			&& pread(fd, flash, sizeof(flash), HOSTEEPROMSIZE)
+					== (ssize_t) sizeof(flash);
+}
+
+static bool flashRange(uint32_t offset, size_t size) {
+	if (flashInit == false) {
+		memset(flash, 0xff, sizeof(flash));
+		flashInit = true;
+	}
+	return (offset & 3) == 0 && (size & 3) == 0 && offset <= sizeof(flash)
+			&& size <= sizeof(flash) - offset;
+}
+
+bool EspClass::flashEraseSector(uint32_t sector) {
+	if (flashRange(sector * HOSTFLASHSECTORSIZE, HOSTFLASHSECTORSIZE)
+			== false) {
+		return false;
+	}
+	memset(flash + sector * HOSTFLASHSECTORSIZE, 0xff, HOSTFLASHSECTORSIZE);
+	eraseCount++;
+	return storageWrite(sector * HOSTFLASHSECTORSIZE,
+			flash + sector * HOSTFLASHSECTORSIZE, HOSTFLASHSECTORSIZE);
+}
+
+bool EspClass::flashWrite(uint32_t offset, uint32_t* data, size_t size) {
+	if (flashRange(offset, size) == false) {
+		return false;
+	}
+	const uint8_t* src = (const uint8_t*) data;
+	for (size_t i = 0; i < size; i++) {
+		flash[offset + i] &= src[i];
+	}
+	bytesWritten += size;
+	return storageWrite(offset, flash + offset, size);
+}
+
+bool EspClass::flashRead(uint32_t offset, uint32_t* data, size_t size) {
+	if (flashRange(offset, size) == false) {
+		return false;
+	}
+	memcpy(data, flash + offset, size);
+	return true;
+}
+
+/**
+ * \brief kernel randomness like the hardware register of the esp8266 (key
+ * material is generated from it, also on gateway worker threads), buffered
+ * per thread
+ */
+uint32_t hostRandom32() {
+	static thread_local uint32_t buffer[256];
+	static thread_local size_t used = 256;
+	if (used == 256) {
+		size_t done = 0;
+		while (done < sizeof(buffer)) {
+			ssize_t n = getrandom((uint8_t*) buffer + done,
+					sizeof(buffer) - done, 0);
+			if (n > 0) {
+				done += n;
+			}
+		}
+		used = 0;
+	}
+	return buffer[used++];
+}
+
+size_t HardwareSerial::write(uint8_t c) {
+	return write(&c, 1);
+}
+
+size_t HardwareSerial::write(const uint8_t* buffer, size_t size) {
+	if (output != NULL) {
+		fwrite(buffer, 1, size, output);
+	}
+	written += size;
+	return size;
+}
+
+size_t HardwareSerial::print(const __FlashStringHelper* s) {
+	return print(reinterpret_cast<const char*>(s));
+}
+
+size_t HardwareSerial::print(const char* s) {
+	return write((const uint8_t*) s, strlen(s));
+}
+
+size_t HardwareSerial::print(char c) {
+	return write((uint8_t) c);
+}
+
+size_t HardwareSerial::print(int n, int base) {
+	return print((long) n, base);
+}
+
+size_t HardwareSerial::print(unsigned int n, int base) {
+	return print((unsigned long) n, base);
+}
+
+size_t HardwareSerial::print(long n, int base) {
+	char buf[24];
+	snprintf(buf, sizeof(buf), base == HEX ? "%lx" : "%ld", n);
+	return print(buf);
+}
+
+size_t HardwareSerial::print(unsigned long n, int base) {
+	char buf[24];
+	snprintf(buf, sizeof(buf), base == HEX ? "%lx" : "%lu", n);
+	return print(buf);
+}
+
+size_t HardwareSerial::println() {
+	return print("\r\n");
+}
+
+EEPROMClass::EEPROMClass() {
+	memset(flash, 0xff, sizeof(flash));
+}
+
+void EEPROMClass::begin(size_t size_) {
+	if (size_ > HOSTEEPROMSIZE) {
+		size_ = HOSTEEPROMSIZE;
+	}
+	if (data != NULL) {
+		delete[] data;
+	}
+	data = new uint8_t[size_];
+	size = size_;
+	memcpy(data, flash, size);
+	dirty = false;
+}
+
+uint8_t EEPROMClass::read(int address) {
+	if (data == NULL || address < 0 || (size_t) address >= size) {
+		return 0;
+	}
+	return data[address];
+}
+
+void EEPROMClass::write(int address, uint8_t val) {
+	if (data == NULL || address < 0 || (size_t) address >= size) {
+		return;
+	}
+	if (data[address] != val) {
+		data[address] = val;
+		dirty = true;
+	}
+}
+
+bool EEPROMClass::commit() {
+	if (data == NULL) {
+		return false;
+	}
+	if (dirty) {
+		// the ESP8266 erases and programs the whole sector
+		memcpy(flash, data, size);
+		commitCount++;
+		dirty = false;
+		return storageWrite(-HOSTEEPROMSIZE, flash, size);
+	}
+	return true;
+}
+
+void EEPROMClass::end() {
+	commit();
+	delete[] data;
+	data = NULL;
+	size = 0;
+}
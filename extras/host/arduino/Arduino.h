@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2017 A. Koller - akandroid75@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Host stand-in for the parts of the ESP8266 Arduino core used by DoorKeeper
+ * and arducrypt on Linux. The benches and the production doorkeeper_gateway
+ * run on it: millis() is the steady clock, pin states are only kept in RAM,
+ * EEPROM and flash are RAM images which the gateway keeps in a file
+ * (hostStorageOpen), so its user db, journal and audit log survive restarts.
+ */
+
+#ifndef ARDUINO_H_
+#define ARDUINO_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+#define HIGH 0x1
+#define LOW  0x0
+
+#define INPUT  0x00
+#define OUTPUT 0x01
+
+#define DEC 10
+#define HEX 16
+
+#define HOSTMAXPINS 17
+
+class __FlashStringHelper;
+#define F(string_literal) (reinterpret_cast<const __FlashStringHelper *>(string_literal))
+#define PROGMEM
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int digitalRead(uint8_t pin);
+
+// no interrupts on the host
+inline void noInterrupts() {
+}
+inline void interrupts() {
+}
+
+unsigned long millis(void);
+unsigned long micros(void);
+void delay(unsigned long ms);
+
+/**
+ * \brief host only: move millis()/micros() forward without sleeping
+ */
+void hostAdvanceMillis(unsigned long ms);
+
+/**
+ * \brief host only: keeps EEPROM and flash in a file (EEPROM image, then the
+ * flash sectors), a missing file is created erased. Every flash write / erase
+ * and EEPROM commit is written through and synced. false on i/o errors
+ */
+bool hostStorageOpen(const char* path);
+
+#include <HardwareSerial.h>
+#include <Esp.h>
+
+#endif /* ARDUINO_H_ */
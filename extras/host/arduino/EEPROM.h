@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2017 A. Koller - akandroid75@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef EEPROM_H_
+#define EEPROM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// like the esp8266 (one flash sector), larger for big user dbs
+#ifndef HOSTEEPROMSIZE
+#define HOSTEEPROMSIZE 4096
+#endif
+
+/**
+ * \brief EEPROM stand-in
+ * like the ESP8266 emulation, begin() copies the sector to RAM and
+ * commit()/end() write the whole sector back.
+ */
+class EEPROMClass {
+public:
+	EEPROMClass();
+	void begin(size_t size);
+	uint8_t read(int address);
+	void write(int address, uint8_t val);
+	bool commit();
+	void end();
+
+	// host only
+	uint32_t commits() {
+		return commitCount;
+	}
+	uint8_t* flashPtr() {
+		return flash;
+	}
+
+private:
+	uint8_t flash[HOSTEEPROMSIZE];
+	uint8_t* data = NULL;
+	size_t size = 0;
+	bool dirty = false;
+	uint32_t commitCount = 0;
+};
+
+extern EEPROMClass EEPROM;
+
+#endif /* EEPROM_H_ */
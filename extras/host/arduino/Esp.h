@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2017 A. Koller - akandroid75@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef ESP_H_
+#define ESP_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define HOSTFLASHSECTORSIZE 4096
+#ifndef HOSTFLASHSECTORS
+#define HOSTFLASHSECTORS 64
+#endif
+
+/**
+ * \brief ESP stand-in
+ * getCycleCount() runs at a nominal 80 MHz derived from the host clock
+ * (steady, hostAdvanceMillis does not move it).
+ * flash* work on HOSTFLASHSECTORS sectors in RAM, with NOR semantics
+ * (erase sets all bits, write can only clear bits, 4 byte alignment).
+ */
+class EspClass {
+public:
+	void wdtFeed() {
+	}
+	uint32_t getCycleCount();
+	uint8_t getCpuFreqMHz() {
+		return 80;
+	}
+	uint32_t getFreeHeap() {
+		return 0;
+	}
+	bool flashEraseSector(uint32_t sector);
+	bool flashWrite(uint32_t offset, uint32_t* data, size_t size);
+	bool flashRead(uint32_t offset, uint32_t* data, size_t size);
+
+	// host only
+	uint32_t flashErases() {
+		return eraseCount;
+	}
+	uint32_t flashBytesWritten() {
+		return bytesWritten;
+	}
+
+private:
+	uint32_t eraseCount = 0;
+	uint32_t bytesWritten = 0;
+};
+
+extern EspClass ESP;
+
+#endif /* ESP_H_ */
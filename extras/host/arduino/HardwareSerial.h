@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2017 A. Koller - akandroid75@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef HARDWARESERIAL_H_
+#define HARDWARESERIAL_H_
+
+#include <Arduino.h>
+#include <stdio.h>
+
+/**
+ * \brief Serial stand-in
+ * output is discarded by default, only the number of bytes is counted.
+ * setOutput(stderr) makes it visible.
+ */
+class HardwareSerial {
+public:
+	void begin(unsigned long baud) {
+	}
+	void setDebugOutput(bool enable) {
+	}
+	int availableForWrite() {
+		// size of the ESP8266 uart tx fifo
+		return 128;
+	}
+	void setOutput(FILE* out) {
+		output = out;
+	}
+	size_t bytesWritten() {
+		return written;
+	}
+
+	size_t write(uint8_t c);
+	size_t write(const uint8_t* buffer, size_t size);
+
+	size_t print(const __FlashStringHelper* s);
+	size_t print(const char* s);
+	size_t print(char c);
+	size_t print(int n, int base = DEC);
+	size_t print(unsigned int n, int base = DEC);
+	size_t print(long n, int base = DEC);
+	size_t print(unsigned long n, int base = DEC);
+
+	size_t println();
+	template<typename T> size_t println(T value) {
+		size_t n = print(value);
+		return n + println();
+	}
+
+private:
+	FILE* output = NULL;
+	size_t written = 0;
+};
+
+extern HardwareSerial Serial;
+
+#endif /* HARDWARESERIAL_H_ */
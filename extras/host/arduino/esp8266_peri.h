@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2017 A. Koller - akandroid75@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef ESP8266_PERI_H_
+#define ESP8266_PERI_H_
+
+#include <stdint.h>
+
+uint32_t hostRandom32();
+
+#define RANDOM_REG32 (hostRandom32())
+
+/*
+ * GPIO 0..15 registers, shared with digitalWrite / digitalRead. A store to
+ * GPOS sets, to GPOC clears the pins of the mask, GPO and GPI read the
+ * levels. Stores are counted (hostGpioStores) so tests can check how many
+ * register writes a change took.
+ */
+struct HostGpioRegister {
+	uint8_t function;
+	HostGpioRegister& operator=(uint32_t mask);
+	operator uint32_t() const;
+};
+
+extern HostGpioRegister hostGpos;
+extern HostGpioRegister hostGpoc;
+extern HostGpioRegister hostGpo;
+uint32_t hostGpioStores();
+
+#define GPOS hostGpos
+#define GPOC hostGpoc
+#define GPO hostGpo
+#define GPI ((uint32_t) hostGpo)
+
+#endif /* ESP8266_PERI_H_ */
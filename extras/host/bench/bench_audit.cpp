@@ -0,0 +1,187 @@
+/*
+ * Copyright (C) 2017 A. Koller - akandroid75@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Host benchmark for the DoorKeeperAudit log.
+ *
+ * For several numbers of records (up to more than the flash log holds):
+ * times record() and the flushStep() calls of a loop, then reads the log
+ * page by page, once from RAM and flash and once after a simulated reboot
+ * (begin() on the same flash), and checks that the newest records are all
+ * there, in order and unchanged.
+ * Results are written as JSON to stdout.
+ */
+
+#include <DoorKeeperAudit.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#define COUNTS 4
+static const int Counts[COUNTS] = { 10, 200, 1000, 5000 };
+// records per page, as in an AuditResponse
+#define PAGE 7
+// flash sectors used by the log
+#define FIRSTSECTOR 8
+
+struct Result {
+	int records;
+	double recordNs;
+	double flushUs;
+	double maxFlushUs;
+	double pageUs;
+	uint32_t read;
+	DoorKeeperAuditStats stats;
+	int errors;
+};
+
+static double elapsedUs(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double, std::micro>(
+			std::chrono::steady_clock::now() - start).count();
+}
+
+/**
+ * \brief reads all pages, checks that the records follow each other and
+ * match what was recorded (user and relais from the sequence number)
+ */
+static uint32_t readAll(DoorKeeperAudit* audit, int expected, double* pageUs,
+		int* errors) {
+	DoorKeeperAuditRecord records[PAGE];
+	uint32_t from = 0;
+	uint32_t previous = 0;
+	uint32_t read = 0;
+	int pages = 0;
+	double us = 0;
+	while (true) {
+		uint32_t next;
+		std::chrono::steady_clock::time_point start =
+				std::chrono::steady_clock::now();
+		uint8_t count = audit->read(from, records, PAGE, &next);
+		us += elapsedUs(start);
+		pages++;
+		if (count == 0) {
+			break;
+		}
+		for (uint8_t i = 0; i < count; i++) {
+			DoorKeeperAuditRecord* r = &records[i];
+			if ((previous != 0 && r->sequence != previous + 1)
+					|| r->user != (uint16_t) (r->sequence * 7)
+					|| r->relais != (uint8_t) r->sequence) {
+				(*errors)++;
+			}
+			previous = r->sequence;
+			read++;
+		}
+		from = next;
+	}
+	if (previous != (uint32_t) expected || audit->last() != previous) {
+		(*errors)++;
+	}
+	if (pageUs != NULL) {
+		*pageUs = pages > 0 ? us / pages : 0;
+	}
+	return read;
+}
+
+static Result run(int count) {
+	Result result;
+	memset(&result, 0, sizeof(result));
+	result.records = count;
+	for (uint8_t s = 0; s < DOORKEEPERAUDIT_SECTORS; s++) {
+		ESP.flashEraseSector(FIRSTSECTOR + s);
+	}
+	DoorKeeperAudit audit;
+	audit.begin(FIRSTSECTOR);
+
+	double recordUs = 0;
+	double flushUs = 0;
+	int flushes = 0;
+	// bursts of records, one loop pass between two records
+	for (int i = 1; i <= count; i++) {
+		std::chrono::steady_clock::time_point start =
+				std::chrono::steady_clock::now();
+		audit.record(i, i * 7, AUDITRELAIS, i, 0x02, AUDITOK);
+		recordUs += elapsedUs(start);
+		start = std::chrono::steady_clock::now();
+		if (audit.flushStep(millis(), false) == true) {
+			double us = elapsedUs(start);
+			flushUs += us;
+			flushes++;
+			if (us > result.maxFlushUs) {
+				result.maxFlushUs = us;
+			}
+		}
+	}
+	result.recordNs = recordUs * 1000 / count;
+	result.flushUs = flushes > 0 ? flushUs / flushes : 0;
+
+	// pending records are read from RAM
+	result.read = readAll(&audit, count, &result.pageUs, &result.errors);
+	while (audit.flushStep(millis(), true) == true) {
+	}
+	result.stats = audit.getStats();
+	if (result.stats.dropped != 0 || result.stats.pending != 0) {
+		result.errors++;
+	}
+
+	// reboot: the same records from flash only
+	DoorKeeperAudit rebooted;
+	rebooted.begin(FIRSTSECTOR);
+	if (readAll(&rebooted, count, NULL, &result.errors) != result.read) {
+		result.errors++;
+	}
+	// and new records continue the sequence
+	rebooted.record(count + 1, (count + 1) * 7, AUDITRELAIS, count + 1, 0x01,
+			AUDITOK);
+	if (readAll(&rebooted, count + 1, NULL, &result.errors)
+			!= result.read + 1) {
+		result.errors++;
+	}
+	return result;
+}
+
+int main(int argc, char** argv) {
+	if (argc > 1) {
+		fprintf(stderr, "usage: %s\n", argv[0]);
+		return 2;
+	}
+	int errors = 0;
+	printf("{\n  \"benchmark\": \"audit\",\n");
+	printf("  \"sectors\": %d,\n  \"records_per_sector\": %u,\n",
+			DOORKEEPERAUDIT_SECTORS, (unsigned) DOORKEEPERAUDIT_RECORDS);
+	printf("  \"batch\": %d,\n  \"results\": [\n", DOORKEEPERAUDIT_BATCH);
+	for (int c = 0; c < COUNTS; c++) {
+		Result r = run(Counts[c]);
+		errors += r.errors;
+		printf("    {\"records\": %d, \"record_ns\": %.1f, ", r.records,
+				r.recordNs);
+		printf("\"flush_us\": %.2f, \"max_flush_us\": %.2f, ", r.flushUs,
+				r.maxFlushUs);
+		printf("\"flushes\": %u, \"erases\": %u, \"page_us\": %.2f, ",
+				r.stats.flushes, r.stats.erases, r.pageUs);
+		printf("\"read\": %u, \"first\": %u, \"errors\": %d}%s\n", r.read,
+				r.stats.first, r.errors, c + 1 < COUNTS ? "," : "");
+	}
+	printf("  ],\n  \"errors\": %d\n}\n", errors);
+	return errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,451 @@
+/*
+ * Copyright (C) 2017 A. Koller - akandroid75@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Host benchmark for arducrypt::validateSignatures.
+ *
+ * Signs 64 messages with 64 keys and verifies them one by one with
+ * validateSignature (prepared keys, as a handshake does) and in batches of
+ * 1 ... 64 signatures. Reports verifies per second and the speedup against
+ * single verification. Every batch size is also run with one broken
+ * signature (found by the per-item fallback) and with keys which are not
+ * prepared. A batch with two signatures whose R are offset by the same
+ * point of order 2 has to get the results of single verification.
+ * The RFC 8032 test vectors have to verify, each one broken (R, s, s + L,
+ * wrong key) has to fail alone and as the only bad one of a batch.
+ * Results are written as JSON to stdout.
+ */
+
+#include <arducrypt.h>
+#include <SHA512.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#define SIGNATURES 64
+#define SIZES 7
+static const int Sizes[SIZES] = { 1, 2, 4, 8, 16, 32, 64 };
+
+static arducryptkeypair keys[SIGNATURES];
+static arducryptpoint points[SIGNATURES];
+static arducryptsignature signatures[SIGNATURES];
+static uint8_t messages[SIGNATURES][KEYSIZE];
+
+// the neutral element (0, 1) as public key
+static const uint8_t NeutralKey[KEYSIZE] = { 0x01 };
+
+// p = 2^255 - 19, little endian
+static const uint8_t FieldPrime[KEYSIZE] = { 0xed, 0xff, 0xff, 0xff, 0xff,
+		0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+		0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+		0xff, 0xff, 0x7f };
+
+// group order L, little endian
+static const uint8_t GroupOrder[KEYSIZE] = { 0xed, 0xd3, 0xf5, 0x5c, 0x1a,
+		0x63, 0x12, 0x58, 0xd6, 0x9c, 0xf7, 0xa2, 0xde, 0xf9, 0xde, 0x14, 0x00,
+		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+		0x00, 0x00, 0x10 };
+
+// RFC 8032 section 7.1, TEST 1 ... 3
+struct KnownAnswer {
+	arducryptkeypair key;
+	uint8_t message[2];
+	int length;
+	arducryptsignature signature;
+};
+
+#define KNOWNANSWERS 3
+static const KnownAnswer KnownAnswers[KNOWNANSWERS] = {
+		// TEST 1
+		{ {
+				// pubkey
+				{ 0xd7, 0x5a, 0x98, 0x01, 0x82, 0xb1, 0x0a, 0xb7, 0xd5, 0x4b,
+						0xfe, 0xd3, 0xc9, 0x64, 0x07, 0x3a, 0x0e, 0xe1, 0x72,
+						0xf3, 0xda, 0xa6, 0x23, 0x25, 0xaf, 0x02, 0x1a, 0x68,
+						0xf7, 0x07, 0x51, 0x1a },
+				// privkey
+				{ 0x9d, 0x61, 0xb1, 0x9d, 0xef, 0xfd, 0x5a, 0x60, 0xba, 0x84,
+						0x4a, 0xf4, 0x92, 0xec, 0x2c, 0xc4, 0x44, 0x49, 0xc5,
+						0x69, 0x7b, 0x32, 0x69, 0x19, 0x70, 0x3b, 0xac, 0x03,
+						0x1c, 0xae, 0x7f, 0x60 } },
+				{ 0x00 }, 0,
+				{ { 0xe5, 0x56, 0x43, 0x00, 0xc3, 0x60, 0xac, 0x72, 0x90, 0x86,
+						0xe2, 0xcc, 0x80, 0x6e, 0x82, 0x8a, 0x84, 0x87, 0x7f,
+						0x1e, 0xb8, 0xe5, 0xd9, 0x74, 0xd8, 0x73, 0xe0, 0x65,
+						0x22, 0x49, 0x01, 0x55, 0x5f, 0xb8, 0x82, 0x15, 0x90,
+						0xa3, 0x3b, 0xac, 0xc6, 0x1e, 0x39, 0x70, 0x1c, 0xf9,
+						0xb4, 0x6b, 0xd2, 0x5b, 0xf5, 0xf0, 0x59, 0x5b, 0xbe,
+						0x24, 0x65, 0x51, 0x41, 0x43, 0x8e, 0x7a, 0x10, 0x0b } } },
+		// TEST 2
+		{ {
+				// pubkey
+				{ 0x3d, 0x40, 0x17, 0xc3, 0xe8, 0x43, 0x89, 0x5a, 0x92, 0xb7,
+						0x0a, 0xa7, 0x4d, 0x1b, 0x7e, 0xbc, 0x9c, 0x98, 0x2c,
+						0xcf, 0x2e, 0xc4, 0x96, 0x8c, 0xc0, 0xcd, 0x55, 0xf1,
+						0x2a, 0xf4, 0x66, 0x0c },
+				// privkey
+				{ 0x4c, 0xcd, 0x08, 0x9b, 0x28, 0xff, 0x96, 0xda, 0x9d, 0xb6,
+						0xc3, 0x46, 0xec, 0x11, 0x4e, 0x0f, 0x5b, 0x8a, 0x31,
+						0x9f, 0x35, 0xab, 0xa6, 0x24, 0xda, 0x8c, 0xf6, 0xed,
+						0x4f, 0xb8, 0xa6, 0xfb } },
+				{ 0x72 }, 1,
+				{ { 0x92, 0xa0, 0x09, 0xa9, 0xf0, 0xd4, 0xca, 0xb8, 0x72, 0x0e,
+						0x82, 0x0b, 0x5f, 0x64, 0x25, 0x40, 0xa2, 0xb2, 0x7b,
+						0x54, 0x16, 0x50, 0x3f, 0x8f, 0xb3, 0x76, 0x22, 0x23,
+						0xeb, 0xdb, 0x69, 0xda, 0x08, 0x5a, 0xc1, 0xe4, 0x3e,
+						0x15, 0x99, 0x6e, 0x45, 0x8f, 0x36, 0x13, 0xd0, 0xf1,
+						0x1d, 0x8c, 0x38, 0x7b, 0x2e, 0xae, 0xb4, 0x30, 0x2a,
+						0xee, 0xb0, 0x0d, 0x29, 0x16, 0x12, 0xbb, 0x0c, 0x00 } } },
+		// TEST 3
+		{ {
+				// pubkey
+				{ 0xfc, 0x51, 0xcd, 0x8e, 0x62, 0x18, 0xa1, 0xa3, 0x8d, 0xa4,
+						0x7e, 0xd0, 0x02, 0x30, 0xf0, 0x58, 0x08, 0x16, 0xed,
+						0x13, 0xba, 0x33, 0x03, 0xac, 0x5d, 0xeb, 0x91, 0x15,
+						0x48, 0x90, 0x80, 0x25 },
+				// privkey
+				{ 0xc5, 0xaa, 0x8d, 0xf4, 0x3f, 0x9f, 0x83, 0x7b, 0xed, 0xb7,
+						0x44, 0x2f, 0x31, 0xdc, 0xb7, 0xb1, 0x66, 0xd3, 0x85,
+						0x35, 0x07, 0x6f, 0x09, 0x4b, 0x85, 0xce, 0x3a, 0x2e,
+						0x0b, 0x44, 0x58, 0xf7 } },
+				{ 0xaf, 0x82 }, 2,
+				{ { 0x62, 0x91, 0xd6, 0x57, 0xde, 0xec, 0x24, 0x02, 0x48, 0x27,
+						0xe6, 0x9c, 0x3a, 0xbe, 0x01, 0xa3, 0x0c, 0xe5, 0x48,
+						0xa2, 0x84, 0x74, 0x3a, 0x44, 0x5e, 0x36, 0x80, 0xd7,
+						0xdb, 0x5a, 0xc3, 0xac, 0x18, 0xff, 0x9b, 0x53, 0x8d,
+						0x16, 0xf2, 0x90, 0xae, 0x67, 0xf7, 0x60, 0x98, 0x4d,
+						0xc6, 0x59, 0x4a, 0x7c, 0x15, 0xe9, 0x71, 0x6e, 0xd2,
+						0x8d, 0xc0, 0x27, 0xbe, 0xce, 0xea, 0x1e, 0xc4, 0x0a } } } };
+
+
+// ways to break a known answer, each one has to be rejected
+#define BROKENR 0
+#define BROKENS 1
+#define BROKENNONCANONICAL 2
+#define BROKENKEY 3
+#define BROKEN 4
+
+static double elapsedS(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double>(
+			std::chrono::steady_clock::now() - start).count();
+}
+
+static void fillItems(arducryptbatchitem* items, boolean prepared) {
+	for (int i = 0; i < SIGNATURES; i++) {
+		items[i].signature = &signatures[i];
+		items[i].message = messages[i];
+		items[i].length = KEYSIZE;
+		items[i].key = &keys[i].publicKey;
+		items[i].point = prepared == true ? &points[i] : NULL;
+	}
+}
+
+// r = a - b, little endian 256 bit numbers
+static void subtract(uint8_t* r, const uint8_t* a, const uint8_t* b) {
+	int borrow = 0;
+	for (int i = 0; i < KEYSIZE; i++) {
+		int d = a[i] - b[i] - borrow;
+		borrow = d < 0 ? 1 : 0;
+		r[i] = (uint8_t) d;
+	}
+}
+
+static boolean lessThan(const uint8_t* a, const uint8_t* b) {
+	for (int i = KEYSIZE - 1; i >= 0; i--) {
+		if (a[i] != b[i]) {
+			return a[i] < b[i];
+		}
+	}
+	return false;
+}
+
+// r = a + b, little endian 256 bit numbers
+static void add(uint8_t* r, const uint8_t* a, const uint8_t* b) {
+	int carry = 0;
+	for (int i = 0; i < KEYSIZE; i++) {
+		int d = a[i] + b[i] + carry;
+		carry = d >> 8;
+		r[i] = (uint8_t) d;
+	}
+}
+
+/**
+ * \brief signature for NeutralKey with R = r * B + (0, -1) and s = r.
+ * s * B - h * A - R is the point (0, -1) of order 2: the cofactorless
+ * equation rejects it, the cofactored one accepts it
+ */
+static void smallOrderSignature(arducryptsignature* signature) {
+	arducryptkeypair nonce;
+	uint8_t r[64];
+	uint8_t y[KEYSIZE];
+	arducrypt::generateSigKeyPair(nonce.privateKey.keybytes,
+			nonce.publicKey.keybytes);
+	// r is the clamped hash of the private key (public key = r * B)
+	SHA512 hash;
+	hash.reset();
+	hash.update(nonce.privateKey.keybytes, KEYSIZE);
+	hash.finalize(r, sizeof(r));
+	r[0] &= 0xf8;
+	r[31] &= 0x7f;
+	r[31] |= 0x40;
+	while (lessThan(r, GroupOrder) == false) {
+		subtract(r, r, GroupOrder);
+	}
+	// (x, y) + (0, -1) = (-x, -y)
+	uint8_t* encoded = signature->signaturebytes;
+	memcpy(y, nonce.publicKey.keybytes, KEYSIZE);
+	y[31] &= 0x7f;
+	subtract(encoded, FieldPrime, y);
+	encoded[31] |= (nonce.publicKey.keybytes[31] & 0x80) ^ 0x80;
+	memcpy(signature->signaturebytes + KEYSIZE, r, KEYSIZE);
+}
+
+/**
+ * \brief two signatures of smallOrderSignature in a batch with two good
+ * ones, every result has to match single verification. returns the number
+ * of wrong results
+ */
+static int checkSmallOrder() {
+	arducryptkey key;
+	arducryptpoint point;
+	arducryptsignature pair[2];
+	arducryptbatchitem items[4];
+	boolean valid[4];
+	int errors = 0;
+	memcpy(key.keybytes, NeutralKey, KEYSIZE);
+	if (arducrypt::preparePublicKey(&point, &key) == false) {
+		return 1;
+	}
+	fillItems(items, true);
+	for (int i = 0; i < 2; i++) {
+		smallOrderSignature(&pair[i]);
+		items[i].signature = &pair[i];
+		items[i].key = &key;
+		items[i].point = i == 0 ? &point : NULL;
+	}
+	for (int size = 2; size <= 4; size += 2) {
+		arducrypt::validateSignatures(items, size, valid);
+		for (int i = 0; i < size; i++) {
+			boolean single = arducrypt::validateSignature(items[i].signature,
+					items[i].message, items[i].length, items[i].key);
+			errors += valid[i] != single ? 1 : 0;
+		}
+	}
+	return errors;
+}
+
+/**
+ * \brief signature and key of known answer v, broken as how: a bit of R or
+ * s flipped, s + L (not canonical, the same point) or the key of the next
+ * known answer
+ */
+static void breakKnownAnswer(int v, int how, arducryptsignature* signature,
+		arducryptkey* key) {
+	const KnownAnswer* answer = &KnownAnswers[v];
+	memcpy(signature, &answer->signature, sizeof(arducryptsignature));
+	memcpy(key, &answer->key.publicKey, sizeof(arducryptkey));
+	uint8_t* s = signature->signaturebytes + KEYSIZE;
+	switch (how) {
+	case BROKENR:
+		signature->signaturebytes[1] ^= 0x01;
+		break;
+	case BROKENS:
+		s[1] ^= 0x01;
+		break;
+	case BROKENNONCANONICAL:
+		add(s, s, GroupOrder);
+		break;
+	case BROKENKEY:
+		memcpy(key, &KnownAnswers[(v + 1) % KNOWNANSWERS].key.publicKey,
+				sizeof(arducryptkey));
+	}
+}
+
+/**
+ * \brief the known answers have to be signed as in RFC 8032 and verified
+ * alone, with prepared keys and in a batch. Every broken one has to fail
+ * alone and in a batch with the other two. returns the number of wrong
+ * results
+ */
+static int checkKnownAnswers() {
+	arducryptkeypair keyPairs[KNOWNANSWERS];
+	arducryptsignature good[KNOWNANSWERS];
+	uint8_t message[KNOWNANSWERS][2];
+	arducryptpoint prepared[KNOWNANSWERS];
+	arducryptkey keys[KNOWNANSWERS];
+	arducryptbatchitem items[KNOWNANSWERS];
+	boolean valid[KNOWNANSWERS];
+	int errors = 0;
+	for (int v = 0; v < KNOWNANSWERS; v++) {
+		memcpy(&keyPairs[v], &KnownAnswers[v].key, sizeof(arducryptkeypair));
+		memcpy(message[v], KnownAnswers[v].message, 2);
+		arducrypt::sign(&keyPairs[v], message[v], &good[v],
+				KnownAnswers[v].length);
+		errors += memcmp(&good[v], &KnownAnswers[v].signature,
+				sizeof(arducryptsignature)) != 0 ? 1 : 0;
+		memcpy(&keys[v], &keyPairs[v].publicKey, sizeof(arducryptkey));
+		errors += arducrypt::preparePublicKey(&prepared[v], &keys[v]) == false
+				? 1 : 0;
+		errors += arducrypt::validateSignature(&good[v], message[v],
+				KnownAnswers[v].length, &keys[v]) == false ? 1 : 0;
+		errors += arducrypt::validateSignature(&good[v], message[v],
+				KnownAnswers[v].length, &keys[v], &prepared[v]) == false ? 1 : 0;
+	}
+	for (int v = 0; v < KNOWNANSWERS; v++) {
+		items[v].signature = &good[v];
+		items[v].message = message[v];
+		items[v].length = KnownAnswers[v].length;
+		items[v].key = &keys[v];
+		items[v].point = v % 2 == 0 ? &prepared[v] : NULL;
+	}
+	errors += arducrypt::validateSignatures(items, KNOWNANSWERS, valid)
+			!= KNOWNANSWERS ? 1 : 0;
+
+	arducryptsignature broken;
+	arducryptkey brokenKey;
+	arducryptpoint brokenPoint;
+	for (int v = 0; v < KNOWNANSWERS; v++) {
+		for (int how = 0; how < BROKEN; how++) {
+			breakKnownAnswer(v, how, &broken, &brokenKey);
+			arducrypt::preparePublicKey(&brokenPoint, &brokenKey);
+			errors += arducrypt::validateSignature(&broken, message[v],
+					KnownAnswers[v].length, &brokenKey) == true ? 1 : 0;
+			errors += arducrypt::validateSignature(&broken, message[v],
+					KnownAnswers[v].length, &brokenKey, &brokenPoint) == true
+					? 1 : 0;
+			// exactly one bad signature, with prepared and decoded keys
+			for (int p = 0; p < 2; p++) {
+				items[v].signature = &broken;
+				items[v].key = &brokenKey;
+				items[v].point = p == 0 ? &brokenPoint : NULL;
+				int count = arducrypt::validateSignatures(items, KNOWNANSWERS,
+						valid);
+				errors += count != KNOWNANSWERS - 1 ? 1 : 0;
+				for (int i = 0; i < KNOWNANSWERS; i++) {
+					errors += valid[i] != (i != v) ? 1 : 0;
+				}
+				errors += arducrypt::validateSignatures(&items[v], 1, valid)
+						!= 0 || valid[0] == true ? 1 : 0;
+			}
+			items[v].signature = &good[v];
+			items[v].key = &keys[v];
+			items[v].point = v % 2 == 0 ? &prepared[v] : NULL;
+		}
+	}
+	return errors;
+}
+
+/**
+ * \brief checks batches of size with one broken signature at position bad
+ * (-1: none), returns the number of wrong results
+ */
+static int check(int size, int bad, boolean prepared) {
+	arducryptbatchitem items[SIGNATURES];
+	boolean valid[SIGNATURES];
+	int errors = 0;
+	fillItems(items, prepared);
+	if (bad >= 0) {
+		messages[bad][0] ^= 0x01;
+	}
+	for (int first = 0; first < SIGNATURES; first += size) {
+		int count = arducrypt::validateSignatures(&items[first], size,
+				&valid[first]);
+		int expected = size - (bad >= first && bad < first + size ? 1 : 0);
+		errors += count != expected ? 1 : 0;
+	}
+	for (int i = 0; i < SIGNATURES; i++) {
+		errors += valid[i] != (i != bad) ? 1 : 0;
+	}
+	if (bad >= 0) {
+		messages[bad][0] ^= 0x01;
+	}
+	return errors;
+}
+
+int main(int argc, char** argv) {
+	int rounds = 16;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--rounds") == 0 && i + 1 < argc) {
+			rounds = atoi(argv[++i]);
+		} else {
+			fprintf(stderr, "usage: %s [--rounds N]\n", argv[0]);
+			return 2;
+		}
+	}
+	for (int i = 0; i < SIGNATURES; i++) {
+		arducrypt::generateSigKeyPair(keys[i].privateKey.keybytes,
+				keys[i].publicKey.keybytes);
+		arducrypt::preparePublicKey(&points[i], &keys[i].publicKey);
+		for (int k = 0; k < KEYSIZE; k++) {
+			messages[i][k] = rand();
+		}
+		arducrypt::sign(&keys[i], messages[i], &signatures[i], KEYSIZE);
+	}
+
+	int errors = 0;
+	std::chrono::steady_clock::time_point start =
+			std::chrono::steady_clock::now();
+	for (int r = 0; r < rounds; r++) {
+		for (int i = 0; i < SIGNATURES; i++) {
+			if (arducrypt::validateSignature(&signatures[i], messages[i],
+					KEYSIZE, &keys[i].publicKey, &points[i]) == false) {
+				errors++;
+			}
+		}
+	}
+	double single = rounds * SIGNATURES / elapsedS(start);
+
+	printf("{\n  \"benchmark\": \"batchverify\",\n");
+	printf("  \"signatures\": %d,\n  \"rounds\": %d,\n", SIGNATURES, rounds);
+	printf("  \"single_per_s\": %.1f,\n  \"results\": [\n", single);
+	arducryptbatchitem items[SIGNATURES];
+	boolean valid[SIGNATURES];
+	fillItems(items, true);
+	for (int s = 0; s < SIZES; s++) {
+		int size = Sizes[s];
+		start = std::chrono::steady_clock::now();
+		for (int r = 0; r < rounds; r++) {
+			for (int first = 0; first < SIGNATURES; first += size) {
+				if (arducrypt::validateSignatures(&items[first], size,
+						&valid[first]) != size) {
+					errors++;
+				}
+			}
+		}
+		double batch = rounds * SIGNATURES / elapsedS(start);
+		int wrong = check(size, -1, false) + check(size, size / 2, true)
+				+ check(size, SIGNATURES - 1, false);
+		errors += wrong;
+		printf("    {\"batch\": %d, \"verifies_per_s\": %.1f, ", size, batch);
+		printf("\"speedup\": %.2f, \"errors\": %d}%s\n", batch / single, wrong,
+				s + 1 < SIZES ? "," : "");
+	}
+	int smallOrder = checkSmallOrder();
+	errors += smallOrder;
+	int knownAnswers = checkKnownAnswers();
+	errors += knownAnswers;
+	printf("  ],\n  \"small_order_errors\": %d,\n", smallOrder);
+	printf("  \"known_answer_errors\": %d,\n", knownAnswers);
+	printf("  \"errors\": %d\n}\n", errors);
+	return errors == 0 ? 0 : 1;
+}
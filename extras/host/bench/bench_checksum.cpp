@@ -0,0 +1,193 @@
+/*
+ * Copyright (C) 2017 A. Koller - akandroid75@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Host micro benchmark for the arducryptcrc kernels.
+ *
+ * Checks that all kernels return the same CRC (random data, offsets and
+ * split incremental updates) and times them for the frame sizes DoorKeeper
+ * checksums: compact header + small message, compact header + key record,
+ * a full payload and 1 KB. The kernel with the least time over the frame
+ * sizes is reported with the build flag to select it.
+ *
+ * Run it on (or for) the target, the best kernel depends on cache and
+ * memory speed. Results are written as JSON to stdout.
+ */
+
+#include <arducryptcrc.h>
+#include <esp8266_peri.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+struct Kernel {
+	const char* name;
+	const char* define;
+	uint32_t (*update)(uint32_t, const uint8_t*, int);
+	int tableBytes;
+};
+
+static const Kernel Kernels[] = {
+		{ "bitwise", "ARDUCRYPTCRC_BITWISE", arducryptcrc::updateBitwise, 0 },
+		{ "byte", "ARDUCRYPTCRC_BYTE", arducryptcrc::updateByte, 1024 },
+		{ "word", "ARDUCRYPTCRC_WORD", arducryptcrc::updateWord, 1024 },
+		{ "slice4", "ARDUCRYPTCRC_SLICE4", arducryptcrc::updateSlice4, 4096 },
+		{ "slice8", "ARDUCRYPTCRC_SLICE8", arducryptcrc::updateSlice8, 8192 } };
+
+#define KERNELS ((int) (sizeof(Kernels) / sizeof(Kernels[0])))
+
+// header + StatusRequest, header + AddKeyRequest, header + MessageData, 1 KB
+static const int Sizes[] = { 6, 43, 133, 1024 };
+#define SIZES ((int) (sizeof(Sizes) / sizeof(Sizes[0])))
+// sizes up to this one are frames, they decide the fastest kernel
+#define FRAMESIZES 3
+
+static volatile uint32_t sink;
+
+/**
+ * \brief all kernels against the bitwise one, returns the mismatches
+ */
+static int verify(int rounds) {
+	uint8_t buffer[1100];
+	int errors = 0;
+	for (int r = 0; r < rounds; r++) {
+		int offset = RANDOM_REG32 % 8;
+		int length = RANDOM_REG32 % (sizeof(buffer) - 8);
+		for (int i = 0; i < offset + length; i++) {
+			buffer[i] = (uint8_t) RANDOM_REG32;
+		}
+		uint8_t* data = buffer + offset;
+		uint32_t expected = ~arducryptcrc::updateBitwise(0xffffffff, data,
+				length);
+		for (int k = 0; k < KERNELS; k++) {
+			if (~Kernels[k].update(0xffffffff, data, length) != expected) {
+				errors++;
+			}
+		}
+		// incremental, split at a random position
+		int split = length > 0 ? RANDOM_REG32 % length : 0;
+		arducryptcrc crc;
+		crc.update(data, split);
+		crc.update(data + split, length - split);
+		if (crc.finalize() != expected
+				|| arducryptcrc::calculate(data, length) != expected) {
+			errors++;
+		}
+	}
+	// check value of CRC-32
+	if (arducryptcrc::calculate((const uint8_t*) "123456789", 9)
+			!= 0xcbf43926) {
+		errors++;
+	}
+	return errors;
+}
+
+/**
+ * \brief ns per call of kernel for length bytes, best of 5 runs
+ */
+static double timeKernel(const Kernel* kernel, const uint8_t* data,
+		int length, int bytes) {
+	int calls = bytes / length + 1;
+	double best = 0;
+	for (int run = 0; run < 5; run++) {
+		uint32_t crc = 0xffffffff;
+		std::chrono::steady_clock::time_point start =
+				std::chrono::steady_clock::now();
+		for (int i = 0; i < calls; i++) {
+			crc = kernel->update(crc, data, length);
+		}
+		double ns = std::chrono::duration<double, std::nano>(
+				std::chrono::steady_clock::now() - start).count() / calls;
+		sink = crc;
+		if (run == 0 || ns < best) {
+			best = ns;
+		}
+	}
+	return best;
+}
+
+static void usage(const char* name) {
+	fprintf(stderr, "usage: %s [--bytes N] [--verify N]\n", name);
+}
+
+int main(int argc, char** argv) {
+	// bytes per timed run
+	int bytes = 16 << 20;
+	int rounds = 2000;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--bytes") == 0 && i + 1 < argc) {
+			bytes = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--verify") == 0 && i + 1 < argc) {
+			rounds = atoi(argv[++i]);
+		} else {
+			usage(argv[0]);
+			return 2;
+		}
+	}
+
+	int errors = verify(rounds);
+
+	// word aligned, like MessagePayload
+	static uint32_t words[1024 / 4];
+	uint8_t* data = (uint8_t*) words;
+	for (int i = 0; i < 1024; i++) {
+		data[i] = (uint8_t) RANDOM_REG32;
+	}
+
+	double ns[KERNELS][SIZES];
+	int fastest = 0;
+	double fastestNs = 0;
+	for (int k = 0; k < KERNELS; k++) {
+		double frameNs = 0;
+		for (int s = 0; s < SIZES; s++) {
+			ns[k][s] = timeKernel(&Kernels[k], data, Sizes[s], bytes);
+			if (s < FRAMESIZES) {
+				frameNs += ns[k][s];
+			}
+		}
+		if (k == 0 || frameNs < fastestNs) {
+			fastest = k;
+			fastestNs = frameNs;
+		}
+	}
+
+	printf("{\n  \"benchmark\": \"checksum\",\n");
+	printf("  \"selected\": %d,\n", ARDUCRYPTCRC_KERNEL);
+	printf("  \"verify_rounds\": %d,\n  \"errors\": %d,\n", rounds, errors);
+	printf("  \"results\": [\n");
+	for (int k = 0; k < KERNELS; k++) {
+		printf("    {\"kernel\": \"%s\", \"table_bytes\": %d, \"sizes\": [",
+				Kernels[k].name, Kernels[k].tableBytes);
+		for (int s = 0; s < SIZES; s++) {
+			printf("{\"bytes\": %d, \"ns\": %.1f, \"mb_per_s\": %.1f}%s",
+					Sizes[s], ns[k][s], Sizes[s] * 1e3 / ns[k][s],
+					s + 1 < SIZES ? ", " : "");
+		}
+		printf("]}%s\n", k + 1 < KERNELS ? "," : "");
+	}
+	printf("  ],\n");
+	printf("  \"fastest\": \"%s\",\n", Kernels[fastest].name);
+	printf("  \"build_flag\": \"-DARDUCRYPTCRC_KERNEL=%s\"\n}\n",
+			Kernels[fastest].define);
+	return errors == 0 ? 0 : 1;
+}
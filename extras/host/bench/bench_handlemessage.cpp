@@ -0,0 +1,591 @@
+/*
+ * Copyright (C) 2017 A. Koller - akandroid75@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Host benchmark for DoorKeeper::handleMessage.
+ *
+ * Runs complete StartSessionRequest handshakes, ticket based
+ * ResumeSessionRequest handshakes and then encrypted Firmware,
+ * Status, Relais, MultiRelais, Audit, Stats, AddKey and RemoveKey frames
+ * against one DoorKeeper instance. Only the handleMessage (and
+ * doorkeeperLoop) calls are timed, the client side crypto is not.
+ * The "metrics" object is what the keeper measured itself (DoorKeeperMetrics),
+ * the Stats sample fails if its message counts do not match the requests.
+ * The "forged StartSession" sample fails if a StartSessionRequest with the
+ * admin key and a bad signature changes the session of a plain user.
+ *
+ * With --compact the session is resumed with compact framing and the
+ * encrypted requests are sent as compact frames through handleFrame.
+ * --aead does the same with ChaCha20-Poly1305 AEAD frames.
+ *
+ * Results are written as JSON to stdout.
+ */
+
+#include <DoorKeeper.h>
+#include <DoorKeeperClient.h>
+#include <esp8266_peri.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+static const arducryptkeypair ServerKey = {
+		// pubkey
+		{ 0xd7, 0x5a, 0x98, 0x01, 0x82, 0xb1, 0x0a, 0xb7, 0xd5, 0x4b, 0xfe,
+				0xd3, 0xc9, 0x64, 0x07, 0x3a, 0x0e, 0xe1, 0x72, 0xf3, 0xda,
+				0xa6, 0x23, 0x25, 0xaf, 0x02, 0x1a, 0x68, 0xf7, 0x07, 0x51,
+				0x1a },
+		// privkey
+		{ 0x9d, 0x61, 0xb1, 0x9d, 0xef, 0xfd, 0x5a, 0x60, 0xba, 0x84, 0x4a,
+				0xf4, 0x92, 0xec, 0x2c, 0xc4, 0x44, 0x49, 0xc5, 0x69, 0x7b,
+				0x32, 0x69, 0x19, 0x70, 0x3b, 0xac, 0x03, 0x1c, 0xae, 0x7f,
+				0x60 } };
+
+struct Sample {
+	const char* name;
+	std::vector<double> us;
+	size_t serialBytes = 0;
+	uint32_t flashBytes = 0;
+	uint32_t flashErases = 0;
+	// request and response bytes on the wire
+	size_t wireBytes = 0;
+	int errors = 0;
+};
+
+static DoorKeeper keeper;
+static DoorKeeperConfig dkconfig;
+static timestruct now;
+static uint8_t framing = 0x00;
+
+static double elapsedUs(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double, std::micro>(
+			std::chrono::steady_clock::now() - start).count();
+}
+
+/**
+ * \brief times one handleMessage call and accounts serial output,
+ * returns the response size
+ */
+static int timedHandle(Sample* sample, uint8_t* in, uint8_t* out,
+		DoorKeeperSession* session) {
+	size_t serialBefore = Serial.bytesWritten();
+	std::chrono::steady_clock::time_point start =
+			std::chrono::steady_clock::now();
+	boolean response = keeper.handleMessage((DoorKeeperMessage*) in,
+			(DoorKeeperMessage*) out, session);
+	sample->us.push_back(elapsedUs(start));
+	sample->serialBytes += Serial.bytesWritten() - serialBefore;
+	sample->wireBytes += DoorKeeperMessageSize;
+	if (response == true) {
+		sample->wireBytes += DoorKeeperMessageSize;
+		return DoorKeeperMessageSize;
+	}
+	return 0;
+}
+
+/**
+ * \brief times one handleFrame call, returns the response size
+ */
+static int timedFrame(Sample* sample, uint8_t* in, uint8_t* out,
+		DoorKeeperSession* session) {
+	size_t serialBefore = Serial.bytesWritten();
+	std::chrono::steady_clock::time_point start =
+			std::chrono::steady_clock::now();
+	int response = keeper.handleFrame(in, out, session);
+	sample->us.push_back(elapsedUs(start));
+	sample->serialBytes += Serial.bytesWritten() - serialBefore;
+	sample->wireBytes += DoorKeeper::frameSize(in) + response;
+	return response;
+}
+
+/**
+ * \brief client side of the handshake, only handleMessage is timed
+ */
+static boolean startSession(Sample* sample, DoorKeeperClient* client,
+		DoorKeeperSession* session) {
+	uint8_t in[DOORKEEPERFRAMEMAXSIZE] __attribute__((aligned(4)));
+	uint8_t out[DOORKEEPERFRAMEMAXSIZE] __attribute__((aligned(4)));
+	client->startSession(in);
+	int size = timedHandle(sample, in, out, session);
+	return client->finishSession(out, size);
+}
+
+/**
+ * \brief requests a session ticket in the current session
+ */
+static boolean getTicket(DoorKeeperClient* client, TicketResponse* ticket,
+		DoorKeeperSession* session) {
+	uint8_t in[DOORKEEPERFRAMEMAXSIZE] __attribute__((aligned(4)));
+	uint8_t out[DOORKEEPERFRAMEMAXSIZE] __attribute__((aligned(4)));
+	MessageData data;
+	memset(&data, 0, sizeof(data));
+	client->request(MesType::TICKETREQUEST, &data, in);
+	if (keeper.handleMessage((DoorKeeperMessage*) in, (DoorKeeperMessage*) out,
+			session) == false
+			|| client->response(out, DoorKeeperMessageSize, &data)
+					!= MesType::TICKETRESPONSE) {
+		return false;
+	}
+	*ticket = data.ticketResponse;
+	return true;
+}
+
+/**
+ * \brief client side of a ticket based resume, only handleMessage is timed
+ */
+static boolean resumeSession(Sample* sample, DoorKeeperClient* client,
+		const TicketResponse* ticket, DoorKeeperSession* session) {
+	uint8_t in[DOORKEEPERFRAMEMAXSIZE] __attribute__((aligned(4)));
+	uint8_t out[DOORKEEPERFRAMEMAXSIZE] __attribute__((aligned(4)));
+	client->resumeSession(ticket, framing, in);
+	int size = timedHandle(sample, in, out, session);
+	return client->finishResume(out, size) == true
+			&& client->getFraming() == framing;
+}
+
+/**
+ * \brief sends one encrypted request in the framing of the session, checks
+ * the response
+ */
+static void request(Sample* sample, DoorKeeperClient* client,
+		DoorKeeperSession* session, uint8_t type, MessageData* data,
+		uint8_t expectedResponse) {
+	uint8_t in[DOORKEEPERFRAMEMAXSIZE] __attribute__((aligned(4)));
+	uint8_t out[DOORKEEPERFRAMEMAXSIZE] __attribute__((aligned(4)));
+	client->request(type, data, in);
+	int size;
+	if (framing == 0x00) {
+		size = timedHandle(sample, in, out, session);
+	} else {
+		size = timedFrame(sample, in, out, session);
+	}
+	if (expectedResponse == 0x00) {
+		if (size != 0) {
+			sample->errors++;
+		}
+		return;
+	}
+	if (client->response(out, size, NULL) != expectedResponse) {
+		sample->errors++;
+	}
+}
+
+/**
+ * \brief a user in a started session sends a StartSessionRequest with the
+ * public key of the admin (signed with the own key). There must be no
+ * response, the session stays the user's: an AddKeyRequest is rejected,
+ * a FirmwareRequest still answered
+ */
+static void forgedSession(Sample* sample, arducryptkey* adminKey) {
+	uint8_t in[DOORKEEPERFRAMEMAXSIZE] __attribute__((aligned(4)));
+	uint8_t out[DOORKEEPERFRAMEMAXSIZE] __attribute__((aligned(4)));
+	arducryptkeypair userKey;
+	arducrypt::generateSigKeyPair(userKey.privateKey.keybytes,
+			userKey.publicKey.keybytes);
+	User plain;
+	memset(&plain, 0xff, sizeof(User));
+	memcpy(plain.userPubKey, userKey.publicKey.keybytes, KEYSIZE);
+	plain.validToYear = 30;
+	plain.validToMonth = 12;
+	plain.validToDay = 31;
+	keeper.addUser(&plain);
+	DoorKeeperClient user(&userKey, (arducryptkey*) &ServerKey.publicKey);
+	DoorKeeperSession session;
+	if (startSession(sample, &user, &session) == false) {
+		sample->errors++;
+		return;
+	}
+
+	arducryptkeypair forgedKey;
+	forgedKey.publicKey = *adminKey;
+	forgedKey.privateKey = userKey.privateKey;
+	DoorKeeperClient forger(&forgedKey, (arducryptkey*) &ServerKey.publicKey);
+	forger.startSession(in);
+	if (timedHandle(sample, in, out, &session) != 0) {
+		sample->errors++;
+	}
+
+	MessageData data;
+	memset(&data, 0, sizeof(data));
+	memcpy(data.addKeyRequest.clientPubKey, userKey.publicKey.keybytes,
+			KEYSIZE);
+	data.addKeyRequest.validtoYear = 0xee;
+	data.addKeyRequest.validtoMonth = 0xee;
+	data.addKeyRequest.validtoDay = 0xee;
+	user.request(MesType::ADDKEYREQUEST, &data, in);
+	if (timedHandle(sample, in, out, &session) != 0) {
+		sample->errors++;
+	}
+	memset(&data, 0, sizeof(data));
+	user.request(MesType::FIRMWAREREQUEST, &data, in);
+	int size = timedHandle(sample, in, out, &session);
+	if (user.response(out, size, &data) != MesType::FIRMWARERESPONSE) {
+		sample->errors++;
+	}
+}
+
+/**
+ * \brief times doorkeeperLoop, which appends modified users to the journal
+ */
+static void timedLoop(Sample* sample) {
+	uint32_t bytesBefore = ESP.flashBytesWritten();
+	uint32_t erasesBefore = ESP.flashErases();
+	size_t serialBefore = Serial.bytesWritten();
+	std::chrono::steady_clock::time_point start =
+			std::chrono::steady_clock::now();
+	keeper.checkTimer();
+	keeper.doorkeeperLoop();
+	sample->us.push_back(elapsedUs(start));
+	sample->serialBytes += Serial.bytesWritten() - serialBefore;
+	sample->flashBytes += ESP.flashBytesWritten() - bytesBefore;
+	sample->flashErases += ESP.flashErases() - erasesBefore;
+}
+
+/**
+ * \brief untimed idle loop passes, the first one only clears the busy flag
+ */
+static void idle(int passes) {
+	for (int i = 0; i < passes; i++) {
+		keeper.doorkeeperLoop();
+	}
+}
+
+static double percentile(std::vector<double>& sorted, double p) {
+	if (sorted.empty()) {
+		return 0;
+	}
+	size_t index = (size_t) (p * (sorted.size() - 1) + 0.5);
+	return sorted[index];
+}
+
+static void report(FILE* out, std::vector<Sample*>& samples, int handshakes,
+		int requests, int idlePasses) {
+	arducryptpoolstats pool = keeper.getKeyPoolStats();
+	fprintf(out, "{\n  \"benchmark\": \"handleMessage\",\n");
+	fprintf(out, "  \"handshakes\": %d,\n  \"requests\": %d,\n", handshakes,
+			requests);
+	fprintf(out, "  \"idle_passes\": %d,\n", idlePasses);
+	fprintf(out, "  \"framing\": \"%s\",\n",
+			framing == DOORKEEPERFRAME_COMPACT ? "compact" :
+			framing == DOORKEEPERFRAME_AEAD ? "aead" : "fixed");
+	fprintf(out, "  \"keypool\": {\"size\": %d, \"hits\": %u, ",
+			ARDUCRYPTKEYPOOLSIZE, pool.hits);
+	fprintf(out, "\"misses\": %u},\n", pool.misses);
+	DoorKeeperFlushStats flush = keeper.getFlushStats();
+	fprintf(out, "  \"flush\": {\"flushes\": %u, \"records\": %u, ",
+			flush.flushes, flush.records);
+	fprintf(out, "\"commits\": %u, \"max_latency_ms\": %u, ", flush.commits,
+			flush.maxLatencyMs);
+	fprintf(out, "\"failures\": %u, \"pending\": %u},\n", flush.failures,
+			flush.pending);
+	DoorKeeperJournalStats journal = keeper.getJournalStats();
+	fprintf(out, "  \"journal\": {\"appends\": %u, \"commits\": %u, ",
+			journal.appends, journal.commits);
+	fprintf(out, "\"compactions\": %u, ", journal.compactions);
+	fprintf(out, "\"foreground_compactions\": %u, \"relocated\": %u, ",
+			journal.foregroundCompactions, journal.relocated);
+	fprintf(out, "\"erase_count_min\": %u, \"erase_count_max\": %u},\n",
+			journal.minEraseCount, journal.maxEraseCount);
+	DoorKeeperAuditStats audit = keeper.getAuditStats();
+	fprintf(out, "  \"audit\": {\"recorded\": %u, \"dropped\": %u, ",
+			audit.recorded, audit.dropped);
+	fprintf(out, "\"flushes\": %u, \"erases\": %u},\n", audit.flushes,
+			audit.erases);
+	static const char* counters[DKCNT_COUNTERS] = { "checksum_errors",
+			"frame_errors", "no_session", "auth_failures", "sessions_started",
+			"sessions_resumed", "sessions_evicted", "sessions_ended" };
+	fprintf(out, "  \"metrics\": {");
+	for (uint8_t c = 0; c < DKCNT_COUNTERS; c++) {
+		fprintf(out, "\"%s\": %u, ", counters[c], dkMetrics.getCounter(c));
+	}
+	static const char* histograms[DKHIST_HISTOGRAMS] = { "verify", "dh1",
+			"dh2", "sign", "request" };
+	double cyclesPerUs = ESP.getCpuFreqMHz();
+	for (uint8_t h = 0; h < DKHIST_HISTOGRAMS; h++) {
+		fprintf(out, "\n    \"%s\": {\"count\": %u, ", histograms[h],
+				dkMetrics.getHistogram(h)->count);
+		fprintf(out, "\"p50_upper_us\": %.1f, \"p99_upper_us\": %.1f, ",
+				dkMetrics.percentile(h, 50) / cyclesPerUs,
+				dkMetrics.percentile(h, 99) / cyclesPerUs);
+		fprintf(out, "\"max_us\": %.1f}%s",
+				dkMetrics.getHistogram(h)->maxCycles / cyclesPerUs,
+				h + 1 < DKHIST_HISTOGRAMS ? "," : "},\n");
+	}
+	fprintf(out, "  \"results\": [\n");
+	for (size_t i = 0; i < samples.size(); i++) {
+		Sample* s = samples[i];
+		std::vector<double> sorted = s->us;
+		std::sort(sorted.begin(), sorted.end());
+		double total = 0;
+		for (size_t k = 0; k < sorted.size(); k++) {
+			total += sorted[k];
+		}
+		size_t n = sorted.size();
+		fprintf(out, "    {\"type\": \"%s\", \"count\": %zu, ", s->name, n);
+		fprintf(out, "\"mean_us\": %.3f, \"p50_us\": %.3f, \"p90_us\": %.3f, ",
+				n ? total / n : 0, percentile(sorted, 0.50),
+				percentile(sorted, 0.90));
+		fprintf(out, "\"p99_us\": %.3f, \"max_us\": %.3f, ",
+				percentile(sorted, 0.99), n ? sorted[n - 1] : 0);
+		fprintf(out, "\"throughput_per_s\": %.1f, ",
+				total > 0 ? n * 1e6 / total : 0);
+		fprintf(out, "\"serial_bytes_per_op\": %.1f, ",
+				n ? (double) s->serialBytes / n : 0);
+		fprintf(out, "\"wire_bytes_per_op\": %.1f, ",
+				n ? (double) s->wireBytes / n : 0);
+		fprintf(out, "\"flash_bytes\": %u, \"flash_erases\": %u, ",
+				s->flashBytes, s->flashErases);
+		fprintf(out, "\"errors\": %d}%s\n", s->errors,
+				i + 1 < samples.size() ? "," : "");
+	}
+	fprintf(out, "  ]\n}\n");
+}
+
+static void usage(const char* name) {
+	fprintf(stderr, "usage: %s [--handshakes N] [--requests N] [--idle N] "
+			"[--gap MS] [--serial] [--compact | --aead]\n", name);
+}
+
+int main(int argc, char** argv) {
+	int handshakes = 50;
+	int requests = 2000;
+	// doorkeeperLoop passes between two handshakes (key pool refill)
+	int idlePasses = 2;
+	// simulated time between two request rounds
+	int gapMs = 0;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--handshakes") == 0 && i + 1 < argc) {
+			handshakes = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--requests") == 0 && i + 1 < argc) {
+			requests = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--gap") == 0 && i + 1 < argc) {
+			gapMs = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--idle") == 0 && i + 1 < argc) {
+			idlePasses = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--compact") == 0) {
+			framing = DOORKEEPERFRAME_COMPACT;
+		} else if (strcmp(argv[i], "--aead") == 0) {
+			framing = DOORKEEPERFRAME_AEAD;
+		} else if (strcmp(argv[i], "--serial") == 0) {
+			Serial.setOutput(stderr);
+		} else {
+			usage(argv[0]);
+			return 2;
+		}
+	}
+
+	now.tm_year = 2026;
+	now.tm_mon = 9;
+	now.tm_mday = 17;
+
+	dkconfig.serverkeys = (arducryptkeypair*) &ServerKey;
+	dkconfig.saveDB = true;
+	dkconfig.auditLog = true;
+	for (int i = 0; i < MAXRELAISNR; i++) {
+		dkconfig.pins[i].portpin = 12 + i;
+		dkconfig.pins[i].initstate = HIGH;
+		dkconfig.pins[i].OFF = HIGH;
+		dkconfig.pins[i].ON = LOW;
+	}
+	keeper.initKeeper(&dkconfig);
+	keeper.initTime(&now);
+
+	// admin user, valid from now till forever
+	arducryptkeypair clientKey;
+	arducrypt::generateSigKeyPair(clientKey.privateKey.keybytes,
+			clientKey.publicKey.keybytes);
+	DoorKeeperClient client(&clientKey,
+			(arducryptkey*) &ServerKey.publicKey);
+	User admin;
+	memset(&admin, 0xff, sizeof(User));
+	memcpy(admin.userPubKey, clientKey.publicKey.keybytes, KEYSIZE);
+	admin.validToYear = 0xee;
+	admin.validToMonth = 0xee;
+	admin.validToDay = 0xee;
+	keeper.addUser(&admin);
+
+	Sample handshake;
+	handshake.name = "StartSession";
+	Sample resume;
+	resume.name = "ResumeSession";
+	Sample firmware;
+	firmware.name = "Firmware";
+	Sample status;
+	status.name = "Status";
+	Sample relais;
+	relais.name = "Relais";
+	Sample multiRelais;
+	multiRelais.name = "MultiRelais";
+	Sample auditLog;
+	auditLog.name = "Audit";
+	Sample stats;
+	stats.name = "Stats";
+	Sample addKey;
+	addKey.name = "AddKey";
+	Sample removeKey;
+	removeKey.name = "RemoveKey";
+	Sample persist;
+	persist.name = "doorkeeperLoop";
+	Sample forged;
+	forged.name = "forged StartSession";
+
+	DoorKeeperSession session;
+	for (int i = 0; i < handshakes; i++) {
+		DoorKeeperSession fresh;
+		if (startSession(&handshake, &client, &fresh) == false) {
+			handshake.errors++;
+		}
+		idle(idlePasses);
+	}
+	TicketResponse ticket;
+	if (startSession(&handshake, &client, &session) == false
+			|| getTicket(&client, &ticket, &session) == false) {
+		fprintf(stderr, "handshake failed\n");
+		return 1;
+	}
+	for (int i = 0; i < handshakes; i++) {
+		DoorKeeperSession fresh;
+		if (resumeSession(&resume, &client, &ticket, &fresh) == false) {
+			resume.errors++;
+		}
+	}
+	// continue in a resumed session
+	if (resumeSession(&resume, &client, &ticket, &session) == false) {
+		fprintf(stderr, "resume failed\n");
+		return 1;
+	}
+
+	MessageData data;
+	// keys stay for a few iterations, so that several users are modified
+	// between two flushes
+	const int tempKeys = MAXUSERS / 2;
+	uint8_t tempKey[tempKeys][KEYSIZE];
+	for (int i = 0; i < requests; i++) {
+		hostAdvanceMillis(gapMs);
+
+		memset(&data, 0, sizeof(data));
+		request(&firmware, &client, &session, MesType::FIRMWAREREQUEST, &data,
+				MesType::FIRMWARERESPONSE);
+
+		memset(&data, 0, sizeof(data));
+		data.statusRequest.relaisnr = i % MAXRELAISNR;
+		request(&status, &client, &session, MesType::STATUSREQUEST, &data,
+				MesType::STATUSRESPONSE);
+
+		memset(&data, 0, sizeof(data));
+		data.relaisRequest.relaisnumber = i % MAXRELAISNR;
+		data.relaisRequest.relaisstate =
+				(i & 1) ? RelaisStatus::OPEN : RelaisStatus::CLOSE;
+		data.relaisRequest.duration_s = 0;
+		request(&relais, &client, &session, MesType::RELAISREQUEST, &data,
+				0x00);
+
+		// all relays with one output register store
+		memset(&data, 0, sizeof(data));
+		data.multiRelaisRequest.mask = (1 << MAXRELAISNR) - 1;
+		data.multiRelaisRequest.states = i & data.multiRelaisRequest.mask;
+		uint32_t stores = hostGpioStores();
+		request(&multiRelais, &client, &session, MesType::MULTIRELAISREQUEST,
+				&data, MesType::MULTIRELAISRESPONSE);
+		if (hostGpioStores() - stores > 1) {
+			multiRelais.errors++;
+		}
+		for (int nr = 0; nr < MAXRELAISNR; nr++) {
+			boolean closed = (data.multiRelaisRequest.states & (1 << nr)) != 0;
+			if (digitalRead(dkconfig.pins[nr].portpin)
+					!= (closed ? dkconfig.pins[nr].ON : dkconfig.pins[nr].OFF)) {
+				multiRelais.errors++;
+				break;
+			}
+		}
+
+		// newest page of the audit log
+		memset(&data, 0, sizeof(data));
+		data.auditRequest.from = keeper.getAuditStats().next - AUDITRECORDS;
+		request(&auditLog, &client, &session, MesType::AUDITREQUEST, &data,
+				MesType::AUDITRESPONSE);
+
+		memset(&data, 0, sizeof(data));
+		data.statsRequest.page = i % STATSPAGES;
+		request(&stats, &client, &session, MesType::STATSREQUEST, &data,
+				MesType::STATSRESPONSE);
+
+		uint8_t* key = tempKey[i % tempKeys];
+		if (i >= tempKeys) {
+			memset(&data, 0, sizeof(data));
+			memcpy(data.removeKeyRequest.clientPubKey, key, KEYSIZE);
+			request(&removeKey, &client, &session,
+					MesType::REMOVEKEYREQUEST, &data,
+					MesType::REMOVEKEYRESPONSE);
+			timedLoop(&persist);
+		}
+
+		for (int k = 0; k < KEYSIZE; k++) {
+			key[k] = (uint8_t) RANDOM_REG32;
+		}
+		memset(&data, 0, sizeof(data));
+		memcpy(data.addKeyRequest.clientPubKey, key, KEYSIZE);
+		data.addKeyRequest.validFromYear = 0xff;
+		data.addKeyRequest.validFromMonth = 0xff;
+		data.addKeyRequest.validFromDay = 0xff;
+		data.addKeyRequest.validtoYear = 30;
+		data.addKeyRequest.validtoMonth = 12;
+		data.addKeyRequest.validtoDay = 31;
+		request(&addKey, &client, &session, MesType::ADDKEYREQUEST, &data,
+				MesType::ADDKEYRESPONSE);
+		timedLoop(&persist);
+	}
+	// quiet period, the rest is flushed
+	hostAdvanceMillis(DOORKEEPERFLUSH_QUIETMS);
+	timedLoop(&persist);
+	if (dkMetrics.getMessages(MesType::STATSREQUEST) != (uint32_t) requests
+			|| dkMetrics.getMessages(MesType::STARTSESSIONREQUEST)
+					!= (uint32_t) handshakes + 1
+			|| dkMetrics.getCounter(DKCNT_SESSIONSRESUMED)
+					!= (uint32_t) handshakes + 1) {
+		stats.errors++;
+	}
+	forgedSession(&forged, &clientKey.publicKey);
+
+	std::vector<Sample*> samples;
+	samples.push_back(&handshake);
+	samples.push_back(&resume);
+	samples.push_back(&firmware);
+	samples.push_back(&status);
+	samples.push_back(&relais);
+	samples.push_back(&multiRelais);
+	samples.push_back(&auditLog);
+	samples.push_back(&stats);
+	samples.push_back(&addKey);
+	samples.push_back(&removeKey);
+	samples.push_back(&persist);
+	samples.push_back(&forged);
+	report(stdout, samples, handshakes, requests, idlePasses);
+
+	int errors = 0;
+	for (size_t i = 0; i < samples.size(); i++) {
+		errors += samples[i]->errors;
+	}
+	return errors == 0 ? 0 : 1;
+}
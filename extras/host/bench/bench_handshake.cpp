@@ -0,0 +1,237 @@
+/*
+ * Copyright (C) 2017 A. Koller - akandroid75@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Host benchmark for the handshake worker pool (DoorKeeperWorkers).
+ *
+ * Prepares --handshakes StartSessionRequest frames of one user and serves
+ * them once inline with handleFrame (as the sketch does) and then with
+ * beginHandshake / runHandshake on 1, 2, 4 ... --max-workers threads /
+ * endHandshake, like the Linux gateway. Every response signature is checked
+ * after the timed part.
+ *
+ * Results (handshakes per second and speedup against inline) are written as
+ * JSON to stdout.
+ */
+
+#include <DoorKeeper.h>
+#include <DoorKeeperWorkers.h>
+#include <DoorKeeperClient.h>
+#include <poll.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+struct Job {
+	DoorKeeperHandshake handshake;
+	DoorKeeperSession session;
+	uint8_t frameIn[DOORKEEPERFRAMEMAXSIZE] __attribute__((aligned(4)));
+	uint8_t frameOut[DOORKEEPERFRAMEMAXSIZE] __attribute__((aligned(4)));
+	int size;
+};
+
+struct Result {
+	int workers;
+	double seconds;
+	uint64_t stolen;
+	uint32_t maxQueued;
+	int errors;
+};
+
+static DoorKeeper keeper;
+static DoorKeeperConfig dkconfig;
+static arducryptkeypair serverKey;
+static arducryptkeypair clientKey;
+static timestruct now;
+
+static double elapsedS(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double>(
+			std::chrono::steady_clock::now() - start).count();
+}
+
+/**
+ * \brief checks the signed StartSessionResponses, returns the errors
+ */
+static int verify(std::vector<Job>& jobs) {
+	int errors = 0;
+	for (size_t i = 0; i < jobs.size(); i++) {
+		DoorKeeperMessage* out = (DoorKeeperMessage*) jobs[i].frameOut;
+		StartSessionResponse* response =
+				&out->message.data.startSessionResponse;
+		if (jobs[i].size != DoorKeeperMessageSize
+				|| out->messagetype != MesType::STARTSESSIONRESPONSE
+				|| arducrypt::validateSignature(
+						(arducryptsignature*) response->signature,
+						response->sessionServerPubKey, KEYSIZE + IVSIZE,
+						&serverKey.publicKey) == false) {
+			errors++;
+		}
+	}
+	return errors;
+}
+
+static void reset(std::vector<Job>& jobs, std::vector<Job>& requests) {
+	for (size_t i = 0; i < jobs.size(); i++) {
+		memcpy(jobs[i].frameIn, requests[i].frameIn, DoorKeeperMessageSize);
+		memset(jobs[i].frameOut, 0, DOORKEEPERFRAMEMAXSIZE);
+		jobs[i].size = 0;
+	}
+}
+
+static Result runInline(std::vector<Job>& jobs, std::vector<Job>& requests) {
+	Result result = { 0, 0, 0, 0, 0 };
+	reset(jobs, requests);
+	std::chrono::steady_clock::time_point start =
+			std::chrono::steady_clock::now();
+	for (size_t i = 0; i < jobs.size(); i++) {
+		jobs[i].size = keeper.handleFrame(jobs[i].frameIn, jobs[i].frameOut,
+				&jobs[i].session);
+	}
+	result.seconds = elapsedS(start);
+	result.errors = verify(jobs);
+	return result;
+}
+
+static void runJob(void* arg) {
+	DoorKeeper::runHandshake(&((Job*) arg)->handshake);
+}
+
+/**
+ * \brief all handshakes are started at once, the I/O thread finishes them
+ * in the order the workers complete them
+ */
+static Result runPool(std::vector<Job>& jobs, std::vector<Job>& requests,
+		int threads) {
+	Result result = { threads, 0, 0, 0, 0 };
+	reset(jobs, requests);
+	DoorKeeperWorkers workers(threads, runJob);
+	std::chrono::steady_clock::time_point start =
+			std::chrono::steady_clock::now();
+	for (size_t i = 0; i < jobs.size(); i++) {
+		if (keeper.beginHandshake(jobs[i].frameIn, &jobs[i].handshake,
+				&jobs[i].session) == false) {
+			result.errors++;
+			continue;
+		}
+		workers.submit(&jobs[i]);
+	}
+	size_t pending = jobs.size() - result.errors;
+	void* done[64];
+	struct pollfd event = { workers.eventFd(), POLLIN, 0 };
+	while (pending > 0) {
+		poll(&event, 1, -1);
+		int count = workers.completed(done, 64);
+		for (int i = 0; i < count; i++) {
+			Job* job = (Job*) done[i];
+			job->size = keeper.endHandshake(&job->handshake, job->frameOut,
+					&job->session);
+		}
+		pending -= count;
+	}
+	result.seconds = elapsedS(start);
+	DoorKeeperWorkerStats stats = workers.getStats();
+	result.stolen = stats.stolen;
+	result.maxQueued = stats.maxQueued;
+	result.errors += verify(jobs);
+	return result;
+}
+
+static void usage(const char* name) {
+	fprintf(stderr, "usage: %s [--handshakes N] [--max-workers N]\n", name);
+}
+
+int main(int argc, char** argv) {
+	int handshakes = 256;
+	int maxWorkers = std::thread::hardware_concurrency();
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--handshakes") == 0 && i + 1 < argc) {
+			handshakes = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--max-workers") == 0 && i + 1 < argc) {
+			maxWorkers = atoi(argv[++i]);
+		} else {
+			usage(argv[0]);
+			return 2;
+		}
+	}
+	if (maxWorkers < 1) {
+		maxWorkers = 1;
+	}
+
+	now.tm_year = 2026;
+	now.tm_mon = 9;
+	now.tm_mday = 17;
+	arducrypt::generateSigKeyPair(serverKey.privateKey.keybytes,
+			serverKey.publicKey.keybytes);
+	arducrypt::generateSigKeyPair(clientKey.privateKey.keybytes,
+			clientKey.publicKey.keybytes);
+	dkconfig.serverkeys = &serverKey;
+	keeper.initKeeper(&dkconfig);
+	keeper.initTime(&now);
+	User user;
+	memset(&user, 0xff, sizeof(User));
+	memcpy(user.userPubKey, clientKey.publicKey.keybytes, KEYSIZE);
+	user.validToYear = 0xee;
+	user.validToMonth = 0xee;
+	user.validToDay = 0xee;
+	keeper.addUser(&user);
+
+	// every request has its own ephemeral key
+	DoorKeeperClient client(&clientKey, &serverKey.publicKey);
+	std::vector<Job> requests(handshakes);
+	std::vector<Job> jobs(handshakes);
+	for (int i = 0; i < handshakes; i++) {
+		client.startSession(requests[i].frameIn);
+	}
+
+	std::vector<Result> results;
+	results.push_back(runInline(jobs, requests));
+	for (int threads = 1; threads <= maxWorkers; threads *= 2) {
+		results.push_back(runPool(jobs, requests, threads));
+		if (threads < maxWorkers && threads * 2 > maxWorkers) {
+			results.push_back(runPool(jobs, requests, maxWorkers));
+		}
+	}
+
+	int errors = 0;
+	double inlineRate = handshakes / results[0].seconds;
+	printf("{\n  \"benchmark\": \"handshake\",\n");
+	printf("  \"handshakes\": %d,\n  \"cores\": %u,\n", handshakes,
+			std::thread::hardware_concurrency());
+	printf("  \"results\": [\n");
+	for (size_t i = 0; i < results.size(); i++) {
+		Result& r = results[i];
+		double rate = handshakes / r.seconds;
+		errors += r.errors;
+		printf("    {\"workers\": %d, \"handshakes_per_s\": %.1f, ",
+				r.workers, rate);
+		printf("\"speedup\": %.2f, \"stolen\": %llu, \"max_queued\": %u, ",
+				rate / inlineRate, (unsigned long long) r.stolen,
+				r.maxQueued);
+		printf("\"errors\": %d}%s\n", r.errors,
+				i + 1 < results.size() ? "," : "");
+	}
+	printf("  ],\n  \"errors\": %d\n}\n", errors);
+	return errors == 0 ? 0 : 1;
+}
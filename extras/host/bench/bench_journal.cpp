@@ -0,0 +1,233 @@
+/*
+ * Copyright (C) 2017 A. Koller - akandroid75@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Host benchmark for the DoorKeeperJournal user store.
+ *
+ * Times commits of single records and of full batches while the idle loop
+ * compacts in the background, and checks every entry with read() and after
+ * a simulated reboot (begin() on the same flash).
+ * Then a transaction is aborted after its records were written: read(),
+ * the replay and the compaction of its sector must all keep the entries it
+ * touched as they were before, a transaction ended afterwards must win.
+ * Results are written as JSON to stdout.
+ */
+
+#include <DoorKeeperJournal.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+// entries of the store
+#define ENTRIES 32
+#define ENTRYSIZE 32
+// flash sectors used by the journal
+#define FIRSTSECTOR 8
+// records committed per run
+#define RECORDS 5000
+
+struct Result {
+	const char* name;
+	int records;
+	double commitUs;
+	double maxCommitUs;
+	DoorKeeperJournalStats stats;
+	int errors;
+};
+
+static uint16_t positions[ENTRIES];
+static uint8_t entries[ENTRIES][ENTRYSIZE];
+// what the entries should hold
+static uint8_t expected[ENTRIES][ENTRYSIZE];
+
+static double elapsedUs(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double, std::micro>(
+			std::chrono::steady_clock::now() - start).count();
+}
+
+static void fill(uint8_t* entry, uint16_t index, uint32_t round) {
+	for (int k = 0; k < ENTRYSIZE; k++) {
+		entry[k] = (uint8_t) (index * 31 + round * 7 + k);
+	}
+}
+
+/**
+ * \brief compares read() of every entry and the replay into a second
+ * journal on the same flash with expected
+ */
+static void check(DoorKeeperJournal* journal, int* errors) {
+	uint8_t data[ENTRYSIZE];
+	for (uint16_t i = 0; i < ENTRIES; i++) {
+		if (journal->read(i, data) == false
+				|| memcmp(data, expected[i], ENTRYSIZE) != 0) {
+			(*errors)++;
+		}
+	}
+	DoorKeeperJournal rebooted;
+	uint16_t replayed[ENTRIES];
+	memset(entries, 0, sizeof(entries));
+	if (rebooted.begin(FIRSTSECTOR, replayed, (uint8_t*) entries, ENTRYSIZE,
+			ENTRIES, false) == false
+			|| memcmp(entries, expected, sizeof(entries)) != 0) {
+		(*errors)++;
+	}
+}
+
+/**
+ * \brief a fresh journal which holds all entries
+ */
+static void freshJournal(DoorKeeperJournal* journal) {
+	for (uint8_t s = 0; s < DOORKEEPERJOURNAL_SECTORS; s++) {
+		ESP.flashEraseSector(FIRSTSECTOR + s);
+	}
+	memset(entries, 0xff, sizeof(entries));
+	journal->begin(FIRSTSECTOR, positions, (uint8_t*) entries, ENTRYSIZE,
+			ENTRIES, true);
+	journal->takeOver();
+	for (uint16_t i = 0; i < ENTRIES; i++) {
+		fill(expected[i], i, 0);
+		journal->append(i, expected[i]);
+	}
+	journal->commit();
+}
+
+/**
+ * \brief RECORDS records in commits of batch records, one compactStep()
+ * between two commits
+ */
+static Result run(const char* name, int batch) {
+	Result result;
+	memset(&result, 0, sizeof(result));
+	result.name = name;
+	DoorKeeperJournal journal;
+	freshJournal(&journal);
+	double us = 0;
+	int commits = 0;
+	for (int r = 0; r < RECORDS; commits++) {
+		std::chrono::steady_clock::time_point start =
+				std::chrono::steady_clock::now();
+		for (int k = 0; k < batch; k++, r++) {
+			uint16_t index = (uint16_t) (r * 7 % ENTRIES);
+			fill(expected[index], index, r + 1);
+			journal.append(index, expected[index]);
+		}
+		if (journal.commit() == false) {
+			result.errors++;
+		}
+		double commitUs = elapsedUs(start);
+		us += commitUs;
+		if (commitUs > result.maxCommitUs) {
+			result.maxCommitUs = commitUs;
+		}
+		journal.compactStep();
+	}
+	result.records = RECORDS;
+	result.commitUs = us / commits;
+	result.stats = journal.getStats();
+	check(&journal, &result.errors);
+	return result;
+}
+
+/**
+ * \brief aborts a transaction whose records are in flash already, then
+ * compacts until its sector is erased and ends a second transaction
+ */
+static Result runAbort() {
+	Result result;
+	memset(&result, 0, sizeof(result));
+	result.name = "abort";
+	DoorKeeperJournal journal;
+	freshJournal(&journal);
+	uint8_t data[ENTRYSIZE];
+
+	// the first half of the entries, written before the abort
+	if (journal.beginTransaction(ENTRIES / 2) == false) {
+		result.errors++;
+	}
+	for (uint16_t i = 0; i < ENTRIES / 2; i++) {
+		fill(data, i, 1);
+		journal.append(i, data);
+	}
+	if (journal.commit() == false) {
+		result.errors++;
+	}
+	journal.abortTransaction();
+	check(&journal, &result.errors);
+
+	// records of the other half until every sector was compacted
+	uint32_t compactions = journal.getStats().compactions;
+	for (uint32_t r = 2; journal.getStats().compactions
+			< compactions + 2 * DOORKEEPERJOURNAL_SECTORS; r++) {
+		uint16_t index = ENTRIES / 2 + r % (ENTRIES / 2);
+		fill(expected[index], index, r);
+		journal.append(index, expected[index]);
+		journal.commit();
+		journal.compactStep();
+		result.records++;
+	}
+	check(&journal, &result.errors);
+
+	// an ended transaction is read and replayed
+	journal.beginTransaction(ENTRIES / 2);
+	for (uint16_t i = 0; i < ENTRIES / 2; i++) {
+		fill(expected[i], i, 0xff);
+		journal.append(i, expected[i]);
+	}
+	if (journal.endTransaction() == false) {
+		result.errors++;
+	}
+	check(&journal, &result.errors);
+	result.stats = journal.getStats();
+	return result;
+}
+
+int main(int argc, char** argv) {
+	if (argc > 1) {
+		fprintf(stderr, "usage: %s\n", argv[0]);
+		return 2;
+	}
+	Result results[3];
+	results[0] = run("single", 1);
+	results[1] = run("batch", DOORKEEPERJOURNAL_BATCH);
+	results[2] = runAbort();
+
+	int errors = 0;
+	printf("{\n  \"benchmark\": \"journal\",\n");
+	printf("  \"sectors\": %d,\n  \"records_per_sector\": %u,\n",
+			DOORKEEPERJOURNAL_SECTORS, (unsigned) DOORKEEPERJOURNAL_RECORDS);
+	printf("  \"entries\": %d,\n  \"results\": [\n", ENTRIES);
+	for (int i = 0; i < 3; i++) {
+		Result* r = &results[i];
+		errors += r->errors;
+		printf("    {\"name\": \"%s\", \"records\": %d, ", r->name,
+				r->records);
+		printf("\"commit_us\": %.2f, \"max_commit_us\": %.2f, ", r->commitUs,
+				r->maxCommitUs);
+		printf("\"commits\": %u, \"compactions\": %u, \"relocated\": %u, ",
+				r->stats.commits, r->stats.compactions, r->stats.relocated);
+		printf("\"max_erase_count\": %u, \"errors\": %d}%s\n",
+				r->stats.maxEraseCount, r->errors, i + 1 < 3 ? "," : "");
+	}
+	printf("  ],\n  \"errors\": %d\n}\n", errors);
+	return errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,213 @@
+/*
+ * Copyright (C) 2017 A. Koller - akandroid75@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Host benchmark for DoorKeeperPolicy.
+ *
+ * For several numbers of users with random validity dates and schedules:
+ * compiles them, then checks every user at every hour of a week on random
+ * days against a plain evaluation of the dates (nested compares as before
+ * the policies) and of the schedule windows. Reports the cost of compile
+ * and allowed() next to the plain evaluation.
+ * Results are written as JSON to stdout.
+ */
+
+#include <DoorKeeperPolicy.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#define COUNTS 3
+static const int Counts[COUNTS] = { 16, 1024, 16384 };
+#define DAYS 16
+
+struct Window {
+	uint8_t days;
+	uint8_t fromHour;
+	uint8_t toHour;
+};
+
+// schedule n + 1: staff mon - fri 07 - 19, night 22 - 06, weekend, none
+#define SCHEDULES 4
+static const Window Windows[SCHEDULES] = { { 0x3e, 7, 19 }, { 0x7f, 22, 6 },
+		{ 0x41, 0, 24 }, { 0x00, 0, 0 } };
+
+struct Entry {
+	uint8_t from[3];
+	uint8_t to[3];
+	uint8_t schedule;
+};
+
+struct Result {
+	int users;
+	double compileNs;
+	double allowedNs;
+	double plainNs;
+	uint32_t checks;
+	uint32_t allowed;
+	int errors;
+};
+
+static double elapsedNs(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double, std::nano>(
+			std::chrono::steady_clock::now() - start).count();
+}
+
+static boolean dateValid(const Entry* e, const uint8_t* now) {
+	boolean from = (e->from[0] == 0xff && e->from[1] == 0xff
+			&& e->from[2] == 0xff) || e->from[0] < now[0]
+			|| (e->from[0] == now[0] && e->from[1] < now[1])
+			|| (e->from[0] == now[0] && e->from[1] == now[1]
+					&& e->from[2] <= now[2]);
+	boolean to = e->to[0] > now[0] || (e->to[0] == now[0] && e->to[1] > now[1])
+			|| (e->to[0] == now[0] && e->to[1] == now[1] && e->to[2] >= now[2]);
+	return from && to;
+}
+
+static boolean inWindow(const Window* w, int wday, int hour) {
+	if (w->toHour > w->fromHour) {
+		return (w->days & (1 << wday)) != 0 && hour >= w->fromHour
+				&& hour < w->toHour;
+	}
+	// wraps to the next day
+	return ((w->days & (1 << wday)) != 0 && hour >= w->fromHour)
+			|| ((w->days & (1 << ((wday + 6) % 7))) != 0 && hour < w->toHour);
+}
+
+static boolean plainAllowed(const Entry* e, const uint8_t* now, int wday,
+		int hour) {
+	if (dateValid(e, now) == false) {
+		return false;
+	}
+	if (e->schedule == 0 || e->schedule == DOORKEEPERPOLICY_NONE) {
+		return true;
+	}
+	if (e->schedule > SCHEDULES) {
+		return false;
+	}
+	return inWindow(&Windows[e->schedule - 1], wday, hour);
+}
+
+static Result run(int count, DoorKeeperSchedule* schedules) {
+	Result result;
+	memset(&result, 0, sizeof(result));
+	result.users = count;
+	std::mt19937 random(count);
+	std::vector<Entry> users(count);
+	std::vector<DoorKeeperAccess> access(count);
+	for (int i = 0; i < count; i++) {
+		Entry* e = &users[i];
+		e->from[0] = 20 + random() % 10;
+		e->from[1] = 1 + random() % 12;
+		e->from[2] = 1 + random() % 31;
+		e->to[0] = e->from[0] + random() % 10;
+		e->to[1] = 1 + random() % 12;
+		e->to[2] = 1 + random() % 31;
+		if (random() % 8 == 0) {
+			memset(e->from, 0xff, 3);
+		}
+		if (random() % 8 == 0) {
+			memset(e->to, 0xee, 3);
+		}
+		// none, the schedules and one unknown
+		e->schedule = random() % (SCHEDULES + 2);
+		if (e->schedule == SCHEDULES + 1 && random() % 2 == 0) {
+			e->schedule = DOORKEEPERPOLICY_NONE;
+		}
+	}
+
+	DoorKeeperPolicy policy;
+	policy.begin(access.data(), count, schedules, SCHEDULES);
+	std::chrono::steady_clock::time_point start =
+			std::chrono::steady_clock::now();
+	for (int i = 0; i < count; i++) {
+		policy.compile(i, users[i].from, users[i].to, users[i].schedule);
+	}
+	result.compileNs = elapsedNs(start) / count;
+
+	double allowedNs = 0;
+	double plainNs = 0;
+	std::vector<uint8_t> got(count);
+	for (int d = 0; d < DAYS; d++) {
+		uint8_t now[3];
+		now[0] = 20 + random() % 20;
+		now[1] = 1 + random() % 12;
+		now[2] = 1 + random() % 28;
+		for (int hour = 0; hour < DOORKEEPERPOLICY_HOURS; hour++) {
+			policy.setTime(now[0], now[1], now[2], hour / 24, hour % 24);
+			start = std::chrono::steady_clock::now();
+			for (int i = 0; i < count; i++) {
+				got[i] = policy.allowed(i);
+			}
+			allowedNs += elapsedNs(start);
+			uint32_t errors = 0;
+			start = std::chrono::steady_clock::now();
+			for (int i = 0; i < count; i++) {
+				if (plainAllowed(&users[i], now, hour / 24, hour % 24)
+						!= (got[i] != 0)) {
+					errors++;
+				}
+			}
+			plainNs += elapsedNs(start);
+			for (int i = 0; i < count; i++) {
+				result.allowed += got[i];
+			}
+			result.errors += errors;
+			result.checks += count;
+		}
+	}
+	result.allowedNs = allowedNs / result.checks;
+	result.plainNs = plainNs / result.checks;
+	return result;
+}
+
+int main(int argc, char** argv) {
+	if (argc > 1) {
+		fprintf(stderr, "usage: %s\n", argv[0]);
+		return 2;
+	}
+	DoorKeeperSchedule schedules[SCHEDULES];
+	for (int s = 0; s < SCHEDULES; s++) {
+		DoorKeeperPolicy::clearSchedule(&schedules[s]);
+		if (Windows[s].days != 0) {
+			DoorKeeperPolicy::addWindow(&schedules[s], Windows[s].days,
+					Windows[s].fromHour, Windows[s].toHour);
+		}
+	}
+	int errors = 0;
+	printf("{\n  \"benchmark\": \"policy\",\n");
+	printf("  \"days\": %d,\n  \"results\": [\n", DAYS);
+	for (int c = 0; c < COUNTS; c++) {
+		Result r = run(Counts[c], schedules);
+		errors += r.errors;
+		printf("    {\"users\": %d, \"compile_ns\": %.1f, \"allowed_ns\": %.2f, ",
+				r.users, r.compileNs, r.allowedNs);
+		printf("\"plain_ns\": %.2f, \"checks\": %u, \"allowed\": %u, ",
+				r.plainNs, r.checks, r.allowed);
+		printf("\"errors\": %d}%s\n", r.errors, c + 1 < COUNTS ? "," : "");
+	}
+	printf("  ],\n  \"errors\": %d\n}\n", errors);
+	return errors == 0 ? 0 : 1;
+}
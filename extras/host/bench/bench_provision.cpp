@@ -0,0 +1,346 @@
+/*
+ * Copyright (C) 2017 A. Koller - akandroid75@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Host benchmark for key provisioning.
+ *
+ * Provisions --keys N keys once with one AddKeyRequest per key (each one
+ * waits for its response) and once with BulkKeyRequest frames (streamed,
+ * only the commit frame is answered). Reports the time spent in
+ * handleMessage / doorkeeperLoop, round trips, flash writes and an estimate
+ * of the wall time with --rtt MS per round trip.
+ * The result of both runs is checked by replaying the journal into a second
+ * DoorKeeper, an aborted bulk transfer must not leave any key behind.
+ *
+ * Results are written as JSON to stdout.
+ */
+
+#include <DoorKeeper.h>
+#include <DoorKeeperClient.h>
+#include <esp8266_peri.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+static const arducryptkeypair ServerKey = {
+		// pubkey
+		{ 0xd7, 0x5a, 0x98, 0x01, 0x82, 0xb1, 0x0a, 0xb7, 0xd5, 0x4b, 0xfe,
+				0xd3, 0xc9, 0x64, 0x07, 0x3a, 0x0e, 0xe1, 0x72, 0xf3, 0xda,
+				0xa6, 0x23, 0x25, 0xaf, 0x02, 0x1a, 0x68, 0xf7, 0x07, 0x51,
+				0x1a },
+		// privkey
+		{ 0x9d, 0x61, 0xb1, 0x9d, 0xef, 0xfd, 0x5a, 0x60, 0xba, 0x84, 0x4a,
+				0xf4, 0x92, 0xec, 0x2c, 0xc4, 0x44, 0x49, 0xc5, 0x69, 0x7b,
+				0x32, 0x69, 0x19, 0x70, 0x3b, 0xac, 0x03, 0x1c, 0xae, 0x7f,
+				0x60 } };
+
+struct Run {
+	const char* name;
+	int frames = 0;
+	int roundTrips = 0;
+	double us = 0;
+	uint32_t flashBytes = 0;
+	uint32_t journalCommits = 0;
+	int errors = 0;
+};
+
+typedef std::vector<std::vector<uint8_t> > KeyList;
+
+static arducryptkeypair clientKey;
+// the admin client, a local of main
+static DoorKeeperClient* client;
+static DoorKeeper keeper;
+// replays the journal to check what has been written
+static DoorKeeper replay;
+static DoorKeeperConfig dkconfig;
+static DoorKeeperSession session;
+static timestruct now;
+
+static boolean startSession() {
+	DoorKeeperMessage in;
+	DoorKeeperMessage out;
+	client->startSession((uint8_t*) &in);
+	if (keeper.handleMessage(&in, &out, &session) == false) {
+		return false;
+	}
+	return client->finishSession((uint8_t*) &out, DoorKeeperMessageSize);
+}
+
+/**
+ * \brief sends one encrypted frame, returns true and the decrypted response
+ * if there is a valid one
+ */
+static boolean send(Run* run, uint8_t type, MessageData* data) {
+	DoorKeeperMessage in;
+	DoorKeeperMessage out;
+	client->request(type, data, (uint8_t*) &in);
+
+	uint32_t bytesBefore = ESP.flashBytesWritten();
+	std::chrono::steady_clock::time_point start =
+			std::chrono::steady_clock::now();
+	boolean response = keeper.handleMessage(&in, &out, &session);
+	keeper.doorkeeperLoop();
+	run->us += std::chrono::duration<double, std::micro>(
+			std::chrono::steady_clock::now() - start).count();
+	run->flashBytes += ESP.flashBytesWritten() - bytesBefore;
+	run->frames++;
+	if (response == false) {
+		return false;
+	}
+	return client->response((uint8_t*) &out, DoorKeeperMessageSize, data)
+			!= 0x00;
+}
+
+static void setKey(AddKeyRequest* request, std::vector<uint8_t>& key) {
+	memcpy(request->clientPubKey, key.data(), KEYSIZE);
+	request->validFromYear = 0xff;
+	request->validFromMonth = 0xff;
+	request->validFromDay = 0xff;
+	request->validtoYear = 30;
+	request->validtoMonth = 12;
+	request->validtoDay = 31;
+}
+
+/**
+ * \brief one AddKeyRequest per key, the client waits for every response
+ */
+static void provisionSingle(Run* run, KeyList& keys, int rttMs) {
+	MessageData data;
+	for (size_t i = 0; i < keys.size(); i++) {
+		memset(&data, 0, sizeof(data));
+		setKey(&data.addKeyRequest, keys[i]);
+		if (send(run, MesType::ADDKEYREQUEST, &data) == false
+				|| data.addKeyResponse.status_ != 0x01) {
+			run->errors++;
+		}
+		run->roundTrips++;
+		hostAdvanceMillis(rttMs);
+	}
+	// quiet period, the rest is flushed
+	hostAdvanceMillis(DOORKEEPERFLUSH_QUIETMS);
+	uint32_t bytesBefore = ESP.flashBytesWritten();
+	keeper.doorkeeperLoop();
+	run->flashBytes += ESP.flashBytesWritten() - bytesBefore;
+}
+
+/**
+ * \brief streams BulkKeyRequest frames, only the last one (commit or
+ * abort) is answered. removeKeys: remove instead of add
+ */
+static void provisionBulk(Run* run, KeyList& keys, boolean removeKeys,
+		uint8_t lastFlags, uint8_t expectedStatus) {
+	MessageData data;
+	uint16_t frame = 0;
+	size_t next = 0;
+	do {
+		memset(&data, 0, sizeof(data));
+		BulkKeyRequest* request = &data.bulkKeyRequest;
+		request->frame = frame;
+		if (frame == 0) {
+			request->flags |= BULKBEGIN;
+		}
+		while (request->count < BULKKEYRECORDS && next < keys.size()) {
+			setKey(&request->keys[request->count], keys[next++]);
+			if (removeKeys == true) {
+				request->removeMask |= 1 << request->count;
+			}
+			request->count++;
+		}
+		boolean last = next == keys.size();
+		if (last == true) {
+			request->flags |= lastFlags;
+		}
+		boolean response = send(run, MesType::BULKKEYREQUEST, &data);
+		if (last == true) {
+			run->roundTrips++;
+			if (response == false
+					|| data.bulkKeyResponse.status_ != expectedStatus) {
+				run->errors++;
+			}
+		} else if (response == true && expectedStatus == BULKOK) {
+			// error response of an intermediate frame
+			run->errors++;
+		}
+		frame++;
+	} while (next < keys.size());
+}
+
+/**
+ * \brief number of keys found in the db replayed from flash
+ */
+static int replayedKeys(KeyList& keys) {
+	replay.initKeeper(&dkconfig);
+	int found = 0;
+	for (size_t i = 0; i < keys.size(); i++) {
+		for (int index = 0; index < MAXUSERS; index++) {
+			if (memcmp(replay.getUser(index)->userPubKey, keys[i].data(),
+					KEYSIZE) == 0) {
+				found++;
+				break;
+			}
+		}
+	}
+	return found;
+}
+
+static void report(FILE* out, std::vector<Run*>& runs, int keys, int rttMs) {
+	fprintf(out, "{\n  \"benchmark\": \"provision\",\n");
+	fprintf(out, "  \"maxusers\": %d,\n  \"keys\": %d,\n  \"rtt_ms\": %d,\n",
+			MAXUSERS, keys, rttMs);
+	fprintf(out, "  \"results\": [\n");
+	for (size_t i = 0; i < runs.size(); i++) {
+		Run* r = runs[i];
+		fprintf(out, "    {\"type\": \"%s\", \"frames\": %d, ", r->name,
+				r->frames);
+		fprintf(out, "\"round_trips\": %d, \"handle_ms\": %.3f, ",
+				r->roundTrips, r->us / 1000);
+		fprintf(out, "\"estimated_ms\": %.1f, ",
+				r->us / 1000 + (double) r->roundTrips * rttMs);
+		fprintf(out, "\"flash_bytes\": %u, \"journal_commits\": %u, ",
+				r->flashBytes, r->journalCommits);
+		fprintf(out, "\"errors\": %d}%s\n", r->errors,
+				i + 1 < runs.size() ? "," : "");
+	}
+	fprintf(out, "  ]\n}\n");
+}
+
+int main(int argc, char** argv) {
+	int keyCount = 500;
+	// round trip of one frame over WLAN
+	int rttMs = 30;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--keys") == 0 && i + 1 < argc) {
+			keyCount = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--rtt") == 0 && i + 1 < argc) {
+			rttMs = atoi(argv[++i]);
+		} else {
+			fprintf(stderr, "usage: %s [--keys N] [--rtt MS]\n", argv[0]);
+			return 2;
+		}
+	}
+	if (2 * keyCount + 1 > MAXUSERS) {
+		fprintf(stderr, "MAXUSERS too small for %d keys\n", keyCount);
+		return 2;
+	}
+
+	now.tm_year = 2026;
+	now.tm_mon = 9;
+	now.tm_mday = 17;
+	dkconfig.serverkeys = (arducryptkeypair*) &ServerKey;
+	dkconfig.saveDB = true;
+	keeper.initKeeper(&dkconfig);
+	keeper.initTime(&now);
+
+	arducrypt::generateSigKeyPair(clientKey.privateKey.keybytes,
+			clientKey.publicKey.keybytes);
+	DoorKeeperClient adminClient(&clientKey,
+			(arducryptkey*) &ServerKey.publicKey);
+	client = &adminClient;
+	User admin;
+	memset(&admin, 0xff, sizeof(User));
+	memcpy(admin.userPubKey, clientKey.publicKey.keybytes, KEYSIZE);
+	admin.validToYear = 0xee;
+	admin.validToMonth = 0xee;
+	admin.validToDay = 0xee;
+	keeper.addUser(&admin);
+	if (startSession() == false) {
+		fprintf(stderr, "handshake failed\n");
+		return 1;
+	}
+
+	KeyList singleKeys(keyCount, std::vector<uint8_t>(KEYSIZE));
+	KeyList bulkKeys(keyCount, std::vector<uint8_t>(KEYSIZE));
+	KeyList abortKeys(keyCount, std::vector<uint8_t>(KEYSIZE));
+	for (int i = 0; i < keyCount; i++) {
+		for (int k = 0; k < KEYSIZE; k++) {
+			singleKeys[i][k] = (uint8_t) RANDOM_REG32;
+			bulkKeys[i][k] = (uint8_t) RANDOM_REG32;
+			abortKeys[i][k] = (uint8_t) RANDOM_REG32;
+		}
+	}
+
+	Run single;
+	single.name = "AddKey";
+	uint32_t commitsBefore = keeper.getJournalStats().commits;
+	provisionSingle(&single, singleKeys, rttMs);
+	single.journalCommits = keeper.getJournalStats().commits - commitsBefore;
+	if (replayedKeys(singleKeys) != keyCount) {
+		single.errors++;
+	}
+
+	Run bulk;
+	bulk.name = "BulkKey";
+	commitsBefore = keeper.getJournalStats().commits;
+	provisionBulk(&bulk, bulkKeys, false, BULKCOMMIT, BULKOK);
+	bulk.journalCommits = keeper.getJournalStats().commits - commitsBefore;
+	if (replayedKeys(bulkKeys) != keyCount) {
+		bulk.errors++;
+	}
+
+	// a removal of the single keys which is aborted, nothing changes
+	Run aborted;
+	aborted.name = "BulkKey abort";
+	commitsBefore = keeper.getJournalStats().commits;
+	provisionBulk(&aborted, singleKeys, true, BULKABORT, BULKOK);
+	aborted.journalCommits = keeper.getJournalStats().commits - commitsBefore;
+	if (replayedKeys(singleKeys) != keyCount) {
+		aborted.errors++;
+	}
+
+	// more keys than free entries, the commit fails and nothing is written
+	Run full;
+	full.name = "BulkKey full";
+	for (int i = 2 * keyCount + 1; i < MAXUSERS; i++) {
+		abortKeys.push_back(std::vector<uint8_t>(KEYSIZE, (uint8_t) i));
+		abortKeys.back()[1] = (uint8_t) (i >> 8);
+	}
+	abortKeys.push_back(std::vector<uint8_t>(KEYSIZE, 0xaa));
+	commitsBefore = keeper.getJournalStats().commits;
+	provisionBulk(&full, abortKeys, false, BULKCOMMIT, BULKERROR);
+	full.journalCommits = keeper.getJournalStats().commits - commitsBefore;
+	if (replayedKeys(abortKeys) != 0 || replayedKeys(bulkKeys) != keyCount) {
+		full.errors++;
+	}
+	// the transfer was rolled back in RAM, too
+	MessageData data;
+	memset(&data, 0, sizeof(data));
+	setKey(&data.addKeyRequest, abortKeys[0]);
+	if (send(&full, MesType::ADDKEYREQUEST, &data) == false
+			|| data.addKeyResponse.status_ != 0x01) {
+		full.errors++;
+	}
+
+	std::vector<Run*> runs;
+	runs.push_back(&single);
+	runs.push_back(&bulk);
+	runs.push_back(&aborted);
+	runs.push_back(&full);
+	report(stdout, runs, keyCount, rttMs);
+
+	int errors = 0;
+	for (size_t i = 0; i < runs.size(); i++) {
+		errors += runs[i]->errors;
+	}
+	return errors == 0 ? 0 : 1;
+}
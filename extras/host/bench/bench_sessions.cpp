@@ -0,0 +1,197 @@
+/*
+ * Copyright (C) 2017 A. Koller - akandroid75@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Host benchmark for DoorKeeperSessions.
+ *
+ * For several capacities: fills all sessions with spread connection ids,
+ * times get() of random ids (hits and misses) and create()/remove() churn,
+ * then lets half of the sessions go idle (hostAdvanceMillis) and checks that
+ * evictIdle() ends exactly those, oldest first, with their ChaCha state
+ * wiped. Results are written as JSON to stdout.
+ */
+
+#include <DoorKeeper.h>
+#include <DoorKeeperSessions.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#define CAPACITIES 5
+static const uint16_t Capacities[CAPACITIES] = { 3, 64, 1024, 8192, 30000 };
+#define IDLEMS 60000
+
+struct Result {
+	uint16_t capacity;
+	double getNs;
+	double missNs;
+	double churnNs;
+	uint32_t evicted;
+	uint32_t full;
+	int errors;
+};
+
+static DoorKeeper keeper;
+static DoorKeeperConfig dkconfig;
+static std::vector<uint32_t> evictedIds;
+
+static void evicted(uint32_t id) {
+	evictedIds.push_back(id);
+}
+
+static double elapsedNs(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double, std::nano>(
+			std::chrono::steady_clock::now() - start).count();
+}
+
+static uint32_t connectionId(int i) {
+	// like sockets of a busy server: not dense
+	return 1000 + i * 7;
+}
+
+static Result run(uint16_t capacity, int lookups) {
+	Result result;
+	memset(&result, 0, sizeof(result));
+	result.capacity = capacity;
+	DoorKeeperSessions sessions;
+	if (sessions.begin(&keeper, capacity, IDLEMS) == false) {
+		result.errors++;
+		return result;
+	}
+	sessions.setEvictHandler(evicted);
+	std::mt19937 random(capacity);
+	std::vector<DoorKeeperSession*> created(capacity);
+	for (int i = 0; i < capacity; i++) {
+		created[i] = sessions.create(connectionId(i));
+		if (created[i] == NULL) {
+			result.errors++;
+		}
+	}
+	if (sessions.create(1) != NULL) {
+		result.errors++;
+	}
+
+	std::vector<int> order(lookups);
+	for (int i = 0; i < lookups; i++) {
+		order[i] = random() % capacity;
+	}
+	std::chrono::steady_clock::time_point start =
+			std::chrono::steady_clock::now();
+	for (int i = 0; i < lookups; i++) {
+		if (sessions.get(connectionId(order[i])) != created[order[i]]) {
+			result.errors++;
+		}
+	}
+	result.getNs = elapsedNs(start) / lookups;
+
+	start = std::chrono::steady_clock::now();
+	for (int i = 0; i < lookups; i++) {
+		if (sessions.get(connectionId(order[i]) + 1) != NULL) {
+			result.errors++;
+		}
+	}
+	result.missNs = elapsedNs(start) / lookups;
+
+	// churn: close and reopen connections under the same ids
+	start = std::chrono::steady_clock::now();
+	for (int i = 0; i < lookups; i++) {
+		uint32_t id = connectionId(order[i]);
+		sessions.remove(id);
+		created[order[i]] = sessions.create(id);
+		if (created[order[i]] == NULL) {
+			result.errors++;
+		}
+	}
+	result.churnNs = elapsedNs(start) / lookups;
+
+	// the first half goes idle, the second half stays active
+	hostAdvanceMillis(IDLEMS / 2);
+	for (int i = capacity / 2; i < capacity; i++) {
+		sessions.get(connectionId(i));
+	}
+	// a started session, its cipher has to be wiped on eviction
+	created[0]->userindex = 0;
+	created[0]->cryptSession.encrypt.setKey(
+			dkconfig.serverkeys->privateKey.keybytes, KEYSIZE);
+	hostAdvanceMillis(IDLEMS / 2);
+	evictedIds.clear();
+	while (sessions.evictIdle() > 0) {
+	}
+	DoorKeeperSessionStats stats = sessions.getStats();
+	result.evicted = stats.evicted;
+	result.full = stats.full;
+	if (evictedIds.size() != (size_t) capacity / 2
+			|| stats.active != capacity - capacity / 2
+			|| created[0]->userindex != INVALIDINDEX) {
+		result.errors++;
+	}
+	for (size_t i = 0; i < evictedIds.size(); i++) {
+		if (sessions.get(evictedIds[i]) != NULL
+				|| evictedIds[i] >= connectionId(capacity / 2)) {
+			result.errors++;
+		}
+	}
+	for (int i = capacity / 2; i < capacity; i++) {
+		if (sessions.get(connectionId(i)) != created[i]) {
+			result.errors++;
+		}
+	}
+	return result;
+}
+
+static void usage(const char* name) {
+	fprintf(stderr, "usage: %s [--lookups N]\n", name);
+}
+
+int main(int argc, char** argv) {
+	int lookups = 200000;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--lookups") == 0 && i + 1 < argc) {
+			lookups = atoi(argv[++i]);
+		} else {
+			usage(argv[0]);
+			return 2;
+		}
+	}
+	static arducryptkeypair serverKey;
+	dkconfig.serverkeys = &serverKey;
+	keeper.initKeeper(&dkconfig);
+
+	int errors = 0;
+	printf("{\n  \"benchmark\": \"sessions\",\n");
+	printf("  \"session_bytes\": %u,\n", (unsigned) sizeof(DoorKeeperSession));
+	printf("  \"results\": [\n");
+	for (int c = 0; c < CAPACITIES; c++) {
+		Result r = run(Capacities[c], lookups);
+		errors += r.errors;
+		printf("    {\"capacity\": %u, \"get_ns\": %.1f, \"miss_ns\": %.1f, ",
+				r.capacity, r.getNs, r.missNs);
+		printf("\"churn_ns\": %.1f, \"evicted\": %u, \"full\": %u, ",
+				r.churnNs, r.evicted, r.full);
+		printf("\"errors\": %d}%s\n", r.errors, c + 1 < CAPACITIES ? "," : "");
+	}
+	printf("  ],\n  \"errors\": %d\n}\n", errors);
+	return errors == 0 ? 0 : 1;
+}
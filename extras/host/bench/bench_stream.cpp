@@ -0,0 +1,279 @@
+/*
+ * Copyright (C) 2017 A. Koller - akandroid75@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Host benchmark for the DoorKeeperStream frame assembler.
+ *
+ * A stream of fixed, compact and AEAD frames (random data, some with a
+ * garbage prefix) is written into one DoorKeeperStream in chunks of random
+ * size up to the chunk size of the run, after every chunk all complete
+ * frames are taken out. Chunk size 1 splits every frame into single bytes,
+ * the large ones coalesce several frames per read like pipelined requests.
+ *
+ * Every frame has to come out unchanged and in order, the dropped bytes
+ * have to match the garbage.
+ *
+ * The output part queues bursts of responses (pipelined requests) in a
+ * DoorKeeperOutQueue and flushes once per loop pass into a client that
+ * takes everything or, as a slow peer, a random window of 0..300 bytes
+ * (and sometimes less than that).
+ * It reports the writes (segments) per burst and checks that the peer
+ * gets every byte in order.
+ *
+ * Results are written as JSON to stdout.
+ */
+
+#include <DoorKeeper.h>
+#include <DoorKeeperStream.h>
+#include <esp8266_peri.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+// single bytes, part of a frame, about a TCP segment, several segments
+static const int Chunks[] = { 1, 7, 64, 536, 1460, 4096 };
+#define CHUNKS ((int) (sizeof(Chunks) / sizeof(Chunks[0])))
+
+struct Result {
+	int chunk;
+	int frames;
+	uint32_t bytes;
+	double ns;
+	int maxPerPass;
+	uint32_t resyncBytes;
+	int errors;
+};
+
+/**
+ * \brief appends one random frame, returns its size
+ */
+static int appendFrame(std::vector<uint8_t>* stream) {
+	uint8_t frame[DOORKEEPERFRAMEMAXSIZE];
+	int kind = RANDOM_REG32 % 3;
+	int length = RANDOM_REG32 % (sizeof(MessageData) + 1);
+	for (int i = 0; i < DOORKEEPERFRAMEMAXSIZE; i++) {
+		frame[i] = (uint8_t) RANDOM_REG32;
+	}
+	frame[0] = DOORKEEPERFRAME_HEADER1;
+	if (kind == 0) {
+		frame[1] = DOORKEEPERFRAME_HEADER2;
+	} else {
+		frame[1] = kind == 1 ? DOORKEEPERFRAME_COMPACTHEADER2 :
+				DOORKEEPERFRAME_AEADHEADER2;
+		frame[DOORKEEPERCOMPACTHEADERSIZE - 1] = length;
+	}
+	int size = DoorKeeper::frameSize(frame);
+	stream->insert(stream->end(), frame, frame + size);
+	return size;
+}
+
+/**
+ * \brief bytes which never start a frame
+ */
+static int appendGarbage(std::vector<uint8_t>* stream) {
+	int length = 1 + RANDOM_REG32 % 40;
+	for (int i = 0; i < length; i++) {
+		stream->push_back(RANDOM_REG32 % DOORKEEPERFRAME_HEADER1);
+	}
+	return length;
+}
+
+static Result run(int chunk, int frames) {
+	Result result = { };
+	std::vector<uint8_t> stream;
+	std::vector<int> offsets;
+	std::vector<int> sizes;
+	uint32_t garbage = 0;
+	for (int f = 0; f < frames; f++) {
+		if (RANDOM_REG32 % 16 == 0) {
+			garbage += appendGarbage(&stream);
+		}
+		offsets.push_back(stream.size());
+		sizes.push_back(appendFrame(&stream));
+	}
+
+	DoorKeeperStream assembler;
+	uint8_t frame[DOORKEEPERFRAMEMAXSIZE] __attribute__((aligned(4)));
+	size_t written = 0;
+	int next = 0;
+	std::chrono::steady_clock::time_point start =
+			std::chrono::steady_clock::now();
+	while (written < stream.size()) {
+		int length = 1 + RANDOM_REG32 % chunk;
+		if (length > (int) (stream.size() - written)) {
+			length = stream.size() - written;
+		}
+		written += assembler.write(&stream[written], length);
+		int pass = 0;
+		int size;
+		while ((size = assembler.nextFrame(frame)) > 0) {
+			if (next >= frames || size != sizes[next]
+					|| memcmp(frame, &stream[offsets[next]], size) != 0) {
+				result.errors++;
+			}
+			next++;
+			pass++;
+		}
+		if (pass > result.maxPerPass) {
+			result.maxPerPass = pass;
+		}
+	}
+	result.ns = std::chrono::duration<double, std::nano>(
+			std::chrono::steady_clock::now() - start).count();
+
+	DoorKeeperStreamStats stats = assembler.getStats();
+	if (next != frames || stats.pending != 0 || stats.resyncBytes != garbage
+			|| stats.received != stream.size()) {
+		result.errors++;
+	}
+	result.chunk = chunk;
+	result.frames = next;
+	result.bytes = stream.size();
+	result.resyncBytes = stats.resyncBytes;
+	return result;
+}
+
+// responses queued per loop pass
+static const int Bursts[] = { 1, 10, 32 };
+#define BURSTS ((int) (sizeof(Bursts) / sizeof(Bursts[0])))
+
+/**
+ * \brief WiFiClient stand-in, takes at most window bytes per pass
+ */
+struct BenchClient {
+	std::vector<uint8_t> received;
+	int maxWindow;
+	int window;
+
+	int availableForWrite() {
+		return window;
+	}
+
+	size_t write(const uint8_t* data, size_t length) {
+		if ((int) length > window) {
+			length = window;
+		}
+		// a slow peer sometimes takes less than announced
+		if (maxWindow <= 1460 && RANDOM_REG32 % 2 == 0) {
+			length = RANDOM_REG32 % (length + 1);
+		}
+		received.insert(received.end(), data, data + length);
+		window -= length;
+		return length;
+	}
+};
+
+struct OutputResult {
+	int burst;
+	int maxWindow;
+	int passes;
+	DoorKeeperOutQueueStats stats;
+	int errors;
+};
+
+static OutputResult runOutput(int burst, int maxWindow, int frames) {
+	OutputResult result = { };
+	std::vector<uint8_t> stream;
+	std::vector<int> offsets;
+	std::vector<int> sizes;
+	for (int f = 0; f < frames; f++) {
+		offsets.push_back(stream.size());
+		sizes.push_back(appendFrame(&stream));
+	}
+
+	DoorKeeperOutQueue queue;
+	BenchClient client;
+	client.maxWindow = maxWindow;
+	int next = 0;
+	while (next < frames || queue.pending() > 0) {
+		// handle up to burst requests, no room: rest waits (backpressure)
+		for (int b = 0; b < burst && next < frames
+				&& queue.space() >= DOORKEEPERFRAMEMAXSIZE; b++) {
+			if (queue.queue(&stream[offsets[next]], sizes[next]) == false) {
+				result.errors++;
+			}
+			next++;
+		}
+		client.window = maxWindow > 1460 ? maxWindow :
+				RANDOM_REG32 % (maxWindow + 1);
+		queue.flush(client);
+		result.passes++;
+	}
+	if (client.received != stream) {
+		result.errors++;
+	}
+	result.burst = burst;
+	result.maxWindow = maxWindow;
+	result.stats = queue.getStats();
+	return result;
+}
+
+static void usage(const char* name) {
+	fprintf(stderr, "usage: %s [--frames N]\n", name);
+}
+
+int main(int argc, char** argv) {
+	int frames = 20000;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+			frames = atoi(argv[++i]);
+		} else {
+			usage(argv[0]);
+			return 2;
+		}
+	}
+
+	int errors = 0;
+	printf("{\n  \"benchmark\": \"stream\",\n");
+	printf("  \"ring_bytes\": %d,\n", DOORKEEPERSTREAM_SIZE);
+	printf("  \"results\": [\n");
+	for (int c = 0; c < CHUNKS; c++) {
+		Result r = run(Chunks[c], frames);
+		errors += r.errors;
+		printf("    {\"max_chunk\": %d, \"frames\": %d, \"bytes\": %u, ",
+				r.chunk, r.frames, r.bytes);
+		printf("\"ns_per_frame\": %.1f, \"mb_per_s\": %.1f, ",
+				r.frames ? r.ns / r.frames : 0, r.bytes * 1e3 / r.ns);
+		printf("\"max_frames_per_pass\": %d, \"resync_bytes\": %u, ",
+				r.maxPerPass, r.resyncBytes);
+		printf("\"errors\": %d}%s\n", r.errors, c + 1 < CHUNKS ? "," : "");
+	}
+	printf("  ],\n  \"output\": [\n");
+	for (int b = 0; b < BURSTS; b++) {
+		for (int slow = 0; slow < 2; slow++) {
+			OutputResult r = runOutput(Bursts[b], slow ? 300 : 65535,
+					frames / 4);
+			errors += r.errors;
+			printf("    {\"burst\": %d, \"peer\": \"%s\", \"passes\": %d, ",
+					r.burst, slow ? "slow" : "fast", r.passes);
+			printf("\"writes_per_burst\": %.2f, \"short_writes\": %u, ",
+					(double) r.stats.writes * r.burst / r.stats.frames,
+					r.stats.shortWrites);
+			printf("\"stalls\": %u, \"errors\": %d}%s\n", r.stats.stalls,
+					r.errors, b + 1 < BURSTS || slow == 0 ? "," : "");
+		}
+	}
+	printf("  ],\n  \"errors\": %d\n}\n", errors);
+	return errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,148 @@
+/*
+ * Copyright (C) 2017 A. Koller - akandroid75@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Host benchmark for the DoorKeeperTimer wheel.
+ *
+ * For several numbers of running timers (random delays from 1 ms to 10
+ * minutes): times start and cancel, then walks the (host) clock 1 ms at a
+ * time and checks that every timer expires in the walk of its due tick and
+ * that restarted and cancelled timers do not fire. The cost per tick is
+ * reported, it does not grow with the number of timers.
+ * Results are written as JSON to stdout.
+ */
+
+#include <DoorKeeperTimer.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#define COUNTS 4
+static const int Counts[COUNTS] = { 4, 256, 4096, 65536 };
+#define MAXDELAYMS 600000
+
+struct Result {
+	int timers;
+	double startNs;
+	double cancelNs;
+	double tickNs;
+	DoorKeeperTimerStats stats;
+	int errors;
+};
+
+static double elapsedNs(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double, std::nano>(
+			std::chrono::steady_clock::now() - start).count();
+}
+
+static Result run(int count) {
+	Result result;
+	memset(&result, 0, sizeof(result));
+	result.timers = count;
+	DoorKeeperTimer timers;
+	std::vector<DoorKeeperTimerNode> nodes(count);
+	std::vector<uint32_t> due(count);
+	std::vector<int> fired(count, 0);
+	std::mt19937 random(count);
+
+	// timers with short delays can be due (host clock) before the walk
+	uint32_t last = millis();
+	std::chrono::steady_clock::time_point start =
+			std::chrono::steady_clock::now();
+	for (int i = 0; i < count; i++) {
+		timers.start(&nodes[i], 1 + random() % MAXDELAYMS);
+	}
+	result.startNs = elapsedNs(start) / count;
+
+	// every 4th timer is cancelled, every 4th restarted with a new delay
+	start = std::chrono::steady_clock::now();
+	for (int i = 0; i < count; i += 4) {
+		timers.cancel(&nodes[i]);
+	}
+	result.cancelNs = elapsedNs(start) / ((count + 3) / 4);
+	for (int i = 0; i < count; i++) {
+		if (i % 4 == 1) {
+			timers.start(&nodes[i], 1 + random() % MAXDELAYMS);
+		}
+		due[i] = nodes[i].expires;
+	}
+
+	int ticks = 0;
+	double tickNs = 0;
+	for (uint32_t ms = 0; ms <= MAXDELAYMS; ms++) {
+		hostAdvanceMillis(1);
+		uint32_t now = millis();
+		start = std::chrono::steady_clock::now();
+		timers.advance(now);
+		DoorKeeperTimerNode* node;
+		while ((node = timers.nextExpired(now)) != NULL) {
+			int i = node - &nodes[0];
+			fired[i]++;
+			// the host clock also runs in real time, a walk can be 2 ms
+			if ((int32_t) (due[i] - last) <= 0
+					|| (int32_t) (due[i] - now) > 0 || i % 4 == 0) {
+				result.errors++;
+			}
+		}
+		tickNs += elapsedNs(start);
+		ticks++;
+		last = now;
+	}
+	result.tickNs = tickNs / ticks;
+	for (int i = 0; i < count; i++) {
+		if (fired[i] != (i % 4 == 0 ? 0 : 1) || nodes[i].active == true) {
+			result.errors++;
+		}
+	}
+	result.stats = timers.getStats();
+	if (result.stats.running != 0) {
+		result.errors++;
+	}
+	return result;
+}
+
+int main(int argc, char** argv) {
+	if (argc > 1) {
+		fprintf(stderr, "usage: %s\n", argv[0]);
+		return 2;
+	}
+	int errors = 0;
+	printf("{\n  \"benchmark\": \"timer\",\n");
+	printf("  \"levels\": %d,\n  \"max_ms\": %lu,\n", DOORKEEPERTIMER_LEVELS,
+			(unsigned long) DOORKEEPERTIMER_MAXMS);
+	printf("  \"results\": [\n");
+	for (int c = 0; c < COUNTS; c++) {
+		Result r = run(Counts[c]);
+		errors += r.errors;
+		printf("    {\"timers\": %d, \"start_ns\": %.1f, \"cancel_ns\": %.1f, ",
+				r.timers, r.startNs, r.cancelNs);
+		printf("\"tick_ns\": %.1f, \"expired\": %u, \"cascaded\": %u, ",
+				r.tickNs, r.stats.expired, r.stats.cascaded);
+		printf("\"max_late_ms\": %u, \"errors\": %d}%s\n", r.stats.maxLateMs,
+				r.errors, c + 1 < COUNTS ? "," : "");
+	}
+	printf("  ],\n  \"errors\": %d\n}\n", errors);
+	return errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,333 @@
+/*
+ * Copyright (C) 2017 A. Koller - akandroid75@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Host benchmark for the user db index.
+ *
+ * Built once per MAXUSERS (bench_userdb_<n>). Fills the db with random keys
+ * through AddKeyRequests and then times lookups of existing keys (AddKey
+ * update), lookups of unknown keys (RemoveKey miss) and remove / add churn.
+ * Times include decrypt, checksum and encrypt of the frame.
+ * At last a key pair is added, replaced and removed: every StartSession
+ * has to verify with the decoded key kept by the keeper as with a freshly
+ * decoded one.
+ *
+ * Results are written as JSON to stdout.
+ */
+
+#include <DoorKeeper.h>
+#include <DoorKeeperClient.h>
+#include <esp8266_peri.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+static const arducryptkeypair ServerKey = {
+		// pubkey
+		{ 0xd7, 0x5a, 0x98, 0x01, 0x82, 0xb1, 0x0a, 0xb7, 0xd5, 0x4b, 0xfe,
+				0xd3, 0xc9, 0x64, 0x07, 0x3a, 0x0e, 0xe1, 0x72, 0xf3, 0xda,
+				0xa6, 0x23, 0x25, 0xaf, 0x02, 0x1a, 0x68, 0xf7, 0x07, 0x51,
+				0x1a },
+		// privkey
+		{ 0x9d, 0x61, 0xb1, 0x9d, 0xef, 0xfd, 0x5a, 0x60, 0xba, 0x84, 0x4a,
+				0xf4, 0x92, 0xec, 0x2c, 0xc4, 0x44, 0x49, 0xc5, 0x69, 0x7b,
+				0x32, 0x69, 0x19, 0x70, 0x3b, 0xac, 0x03, 0x1c, 0xae, 0x7f,
+				0x60 } };
+
+struct Sample {
+	const char* name;
+	std::vector<double> us;
+	int errors = 0;
+};
+
+static arducryptkeypair clientKey;
+// the admin client, a local of main
+static DoorKeeperClient* client;
+static DoorKeeper keeper;
+static DoorKeeperConfig dkconfig;
+static DoorKeeperSession session;
+static timestruct now;
+
+static boolean startSession() {
+	DoorKeeperMessage in;
+	DoorKeeperMessage out;
+	client->startSession((uint8_t*) &in);
+	if (keeper.handleMessage(&in, &out, &session) == false) {
+		return false;
+	}
+	return client->finishSession((uint8_t*) &out, DoorKeeperMessageSize);
+}
+
+/**
+ * \brief sends one encrypted key request, returns the status byte
+ * (0xff if there was no valid response)
+ */
+static uint8_t keyRequest(Sample* sample, uint8_t type, uint8_t* key) {
+	DoorKeeperMessage in;
+	DoorKeeperMessage out;
+	MessageData data;
+	memset(&data, 0, sizeof(data));
+
+	if (type == MesType::ADDKEYREQUEST) {
+		memcpy(data.addKeyRequest.clientPubKey, key, KEYSIZE);
+		data.addKeyRequest.validFromYear = 0xff;
+		data.addKeyRequest.validFromMonth = 0xff;
+		data.addKeyRequest.validFromDay = 0xff;
+		data.addKeyRequest.validtoYear = 30;
+		data.addKeyRequest.validtoMonth = 12;
+		data.addKeyRequest.validtoDay = 31;
+	} else {
+		memcpy(data.removeKeyRequest.clientPubKey, key, KEYSIZE);
+	}
+	client->request(type, &data, (uint8_t*) &in);
+
+	std::chrono::steady_clock::time_point start =
+			std::chrono::steady_clock::now();
+	boolean response = keeper.handleMessage(&in, &out, &session);
+	if (sample != NULL) {
+		sample->us.push_back(
+				std::chrono::duration<double, std::micro>(
+						std::chrono::steady_clock::now() - start).count());
+	}
+	if (response == false
+			|| client->response((uint8_t*) &out, DoorKeeperMessageSize, &data)
+					== 0x00) {
+		return 0xff;
+	}
+	return data.addKeyResponse.status_;
+}
+
+/**
+ * \brief handshake of the user with userKey through beginHandshake. The
+ * decoded key which the job took from the keeper has to verify the
+ * StartSession signature like a freshly decoded key, and reject it with a
+ * flipped bit. returns the user index, INVALIDINDEX if the keeper does not
+ * know the user
+ */
+static int cachedHandshake(Sample* sample, arducryptkeypair* userKey) {
+	DoorKeeperClient user(userKey, (arducryptkey*) &ServerKey.publicKey);
+	DoorKeeperSession userSession;
+	DoorKeeperHandshake job;
+	uint8_t frameIn[DOORKEEPERFRAMEMAXSIZE] __attribute__((aligned(4)));
+	uint8_t frameOut[DOORKEEPERFRAMEMAXSIZE] __attribute__((aligned(4)));
+	user.startSession(frameIn);
+
+	std::chrono::steady_clock::time_point start =
+			std::chrono::steady_clock::now();
+	if (keeper.beginHandshake(frameIn, &job, &userSession) == false) {
+		return INVALIDINDEX;
+	}
+	StartSessionRequest* request = &job.request;
+	arducryptsignature* signature = (arducryptsignature*) request->signature;
+	for (uint8_t flip = 0; flip < 2; flip++) {
+		signature->signaturebytes[0] ^= flip;
+		boolean fresh = arducrypt::validateSignature(signature,
+				request->sessionClientPubKey, KEYSIZE,
+				(arducryptkey*) request->clientPubKey);
+		boolean cached = job.userKeyValid == true
+				&& arducrypt::validateSignature(signature,
+						request->sessionClientPubKey, KEYSIZE,
+						(arducryptkey*) request->clientPubKey, &job.userKey);
+		if (cached != fresh || fresh != (flip == 0)) {
+			sample->errors++;
+		}
+		signature->signaturebytes[0] ^= flip;
+	}
+	DoorKeeper::runHandshake(&job);
+	int size = keeper.endHandshake(&job, frameOut, &userSession);
+	sample->us.push_back(
+			std::chrono::duration<double, std::micro>(
+					std::chrono::steady_clock::now() - start).count());
+	if (size == 0
+			|| user.finishSession(frameOut, DoorKeeperMessageSize) == false) {
+		sample->errors++;
+	}
+	keeper.endSession(&userSession);
+	return job.userindex;
+}
+
+static void randomKey(uint8_t* key) {
+	for (int i = 0; i < KEYSIZE; i++) {
+		key[i] = (uint8_t) RANDOM_REG32;
+	}
+}
+
+static double percentile(std::vector<double>& sorted, double p) {
+	if (sorted.empty()) {
+		return 0;
+	}
+	size_t index = (size_t) (p * (sorted.size() - 1) + 0.5);
+	return sorted[index];
+}
+
+static void report(FILE* out, std::vector<Sample*>& samples, int users) {
+	fprintf(out, "{\n  \"benchmark\": \"userdb\",\n");
+	fprintf(out, "  \"maxusers\": %d,\n  \"users\": %d,\n", MAXUSERS, users);
+	fprintf(out, "  \"results\": [\n");
+	for (size_t i = 0; i < samples.size(); i++) {
+		Sample* s = samples[i];
+		std::vector<double> sorted = s->us;
+		std::sort(sorted.begin(), sorted.end());
+		double total = 0;
+		for (size_t k = 0; k < sorted.size(); k++) {
+			total += sorted[k];
+		}
+		size_t n = sorted.size();
+		fprintf(out, "    {\"type\": \"%s\", \"count\": %zu, ", s->name, n);
+		fprintf(out, "\"mean_us\": %.3f, \"p50_us\": %.3f, \"p99_us\": %.3f, ",
+				n ? total / n : 0, percentile(sorted, 0.50),
+				percentile(sorted, 0.99));
+		fprintf(out, "\"max_us\": %.3f, \"errors\": %d}%s\n",
+				n ? sorted[n - 1] : 0, s->errors,
+				i + 1 < samples.size() ? "," : "");
+	}
+	fprintf(out, "  ]\n}\n");
+}
+
+int main(int argc, char** argv) {
+	int requests = 2000;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--requests") == 0 && i + 1 < argc) {
+			requests = atoi(argv[++i]);
+		} else {
+			fprintf(stderr, "usage: %s [--requests N]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	now.tm_year = 2026;
+	now.tm_mon = 9;
+	now.tm_mday = 17;
+	dkconfig.serverkeys = (arducryptkeypair*) &ServerKey;
+	// measure the index, not the flash
+	dkconfig.saveDB = false;
+	keeper.initKeeper(&dkconfig);
+	keeper.initTime(&now);
+
+	arducrypt::generateSigKeyPair(clientKey.privateKey.keybytes,
+			clientKey.publicKey.keybytes);
+	DoorKeeperClient adminClient(&clientKey,
+			(arducryptkey*) &ServerKey.publicKey);
+	client = &adminClient;
+	User admin;
+	memset(&admin, 0xff, sizeof(User));
+	memcpy(admin.userPubKey, clientKey.publicKey.keybytes, KEYSIZE);
+	admin.validToYear = 0xee;
+	admin.validToMonth = 0xee;
+	admin.validToDay = 0xee;
+	keeper.addUser(&admin);
+	if (startSession() == false) {
+		fprintf(stderr, "handshake failed\n");
+		return 1;
+	}
+
+	Sample insert;
+	insert.name = "AddKey new";
+	Sample hit;
+	hit.name = "AddKey existing";
+	Sample miss;
+	miss.name = "RemoveKey unknown";
+	Sample churn;
+	churn.name = "RemoveKey + AddKey";
+
+	// fill all but one entry, the last one is needed for churn
+	std::vector<std::vector<uint8_t> > keys;
+	uint8_t key[KEYSIZE];
+	for (int i = 1; i < MAXUSERS - 1; i++) {
+		randomKey(key);
+		if (keyRequest(&insert, MesType::ADDKEYREQUEST, key) != 0x01) {
+			insert.errors++;
+		}
+		keys.push_back(std::vector<uint8_t>(key, key + KEYSIZE));
+	}
+	if (keys.empty()) {
+		fprintf(stderr, "MAXUSERS too small\n");
+		return 1;
+	}
+
+	for (int i = 0; i < requests; i++) {
+		std::vector<uint8_t>& existing = keys[RANDOM_REG32 % keys.size()];
+		if (keyRequest(&hit, MesType::ADDKEYREQUEST, existing.data())
+				!= 0x01) {
+			hit.errors++;
+		}
+
+		randomKey(key);
+		if (keyRequest(&miss, MesType::REMOVEKEYREQUEST, key) != 0xff) {
+			miss.errors++;
+		}
+
+		std::vector<uint8_t>& victim = keys[RANDOM_REG32 % keys.size()];
+		if (keyRequest(&churn, MesType::REMOVEKEYREQUEST, victim.data())
+				!= 0x01) {
+			churn.errors++;
+		}
+		randomKey(victim.data());
+		if (keyRequest(&churn, MesType::ADDKEYREQUEST, victim.data())
+				!= 0x01) {
+			churn.errors++;
+		}
+	}
+
+	// the decoded key of an entry follows added, replaced and removed keys
+	Sample cache;
+	cache.name = "StartSession cached key";
+	arducryptkeypair first;
+	arducryptkeypair second;
+	arducrypt::generateSigKeyPair(first.privateKey.keybytes,
+			first.publicKey.keybytes);
+	arducrypt::generateSigKeyPair(second.privateKey.keybytes,
+			second.publicKey.keybytes);
+	keyRequest(NULL, MesType::ADDKEYREQUEST, first.publicKey.keybytes);
+	int entry = cachedHandshake(&cache, &first);
+	if (entry == INVALIDINDEX) {
+		cache.errors++;
+	}
+	// the last free entry is taken again by the new key
+	keyRequest(NULL, MesType::REMOVEKEYREQUEST, first.publicKey.keybytes);
+	keyRequest(NULL, MesType::ADDKEYREQUEST, second.publicKey.keybytes);
+	if (cachedHandshake(&cache, &second) != entry
+			|| cachedHandshake(&cache, &first) != INVALIDINDEX) {
+		cache.errors++;
+	}
+	keyRequest(NULL, MesType::REMOVEKEYREQUEST, second.publicKey.keybytes);
+	if (cachedHandshake(&cache, &second) != INVALIDINDEX) {
+		cache.errors++;
+	}
+
+	std::vector<Sample*> samples;
+	samples.push_back(&insert);
+	samples.push_back(&hit);
+	samples.push_back(&miss);
+	samples.push_back(&churn);
+	samples.push_back(&cache);
+	report(stdout, samples, (int) keys.size() + 1);
+
+	int errors = 0;
+	for (size_t i = 0; i < samples.size(); i++) {
+		errors += samples[i]->errors;
+	}
+	return errors == 0 ? 0 : 1;
+}
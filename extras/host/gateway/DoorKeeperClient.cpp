@@ -0,0 +1,308 @@
+/*
+ * Copyright (C) 2017 A. Koller - akandroid75@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <DoorKeeperClient.h>
+#include <Curve25519.h>
+#include <arducryptcrc.h>
+#include <esp8266_peri.h>
+#include <cstring>
+
+static arducrypt clientcrypt(sizeof(MessagePayload));
+
+static void setHeader(DoorKeeperMessage* msg, uint8_t type) {
+	msg->headerbyte1 = DOORKEEPERFRAME_HEADER1;
+	msg->headerbyte2 = DOORKEEPERFRAME_HEADER2;
+	msg->messagetype = type;
+	msg->reserved = 0x00;
+}
+
+DoorKeeperClient::DoorKeeperClient(arducryptkeypair* clientKey_,
+		arducryptkey* serverKey_) {
+	clientKey = clientKey_;
+	serverKey = serverKey_;
+}
+
+DoorKeeperClient::~DoorKeeperClient() {
+	endSession();
+}
+
+/**
+ * \brief StartSessionRequest with a new ephemeral key into frame,
+ * returns its size
+ */
+int DoorKeeperClient::startSession(uint8_t* frame) {
+	DoorKeeperMessage* in = (DoorKeeperMessage*) frame;
+	endSession();
+	memset(in, 0, DoorKeeperMessageSize);
+	setHeader(in, MesType::STARTSESSIONREQUEST);
+	StartSessionRequest* request = &in->message.data.startSessionRequest;
+	Curve25519::dh1(request->sessionClientPubKey, sessionPrivKey);
+	arducrypt::sign(clientKey, request->sessionClientPubKey,
+			(arducryptsignature*) request->signature, KEYSIZE);
+	memcpy(request->clientPubKey, clientKey->publicKey.keybytes, KEYSIZE);
+	in->message.checksum = clientcrypt.calcChecksum(
+			(uint8_t*) &in->message.data, sizeof(MessageData));
+	return DoorKeeperMessageSize;
+}
+
+/**
+ * \brief checks the StartSessionResponse (type, checksum, server signature)
+ * and starts the session. frame is modified
+ */
+boolean DoorKeeperClient::finishSession(uint8_t* frame, int size) {
+	DoorKeeperMessage* out = (DoorKeeperMessage*) frame;
+	if (size != (int) DoorKeeperMessageSize
+			|| out->messagetype != MesType::STARTSESSIONRESPONSE
+			|| clientcrypt.calcChecksum((uint8_t*) &out->message.data,
+					sizeof(MessageData)) != out->message.checksum) {
+		return false;
+	}
+	StartSessionResponse* response = &out->message.data.startSessionResponse;
+	if (arducrypt::validateSignature((arducryptsignature*) response->signature,
+			response->sessionServerPubKey, KEYSIZE + IVSIZE, serverKey)
+			== false) {
+		return false;
+	}
+	uint8_t secret[KEYSIZE];
+	memcpy(secret, response->sessionServerPubKey, KEYSIZE);
+	boolean shared = Curve25519::dh2(secret, sessionPrivKey);
+	memset(sessionPrivKey, 0, KEYSIZE);
+	if (shared == false) {
+		return false;
+	}
+	memcpy(session.iv, response->sessionIV, IVSIZE);
+	arducrypt::initSession(&session, secret);
+	memset(secret, 0, KEYSIZE);
+	started = true;
+	return true;
+}
+
+/**
+ * \brief ResumeSessionRequest with ticket into frame, returns its size.
+ * framing: 0x00, DOORKEEPERFRAME_COMPACT or DOORKEEPERFRAME_AEAD for the
+ * frames of the resumed session
+ */
+int DoorKeeperClient::resumeSession(const TicketResponse* ticket,
+		uint8_t framingRequest, uint8_t* frame) {
+	DoorKeeperMessage* in = (DoorKeeperMessage*) frame;
+	endSession();
+	memset(in, 0, DoorKeeperMessageSize);
+	setHeader(in, MesType::RESUMESESSIONREQUEST);
+	in->reserved = framingRequest;
+	ResumeSessionRequest* request = &in->message.data.resumeSessionRequest;
+	request->ticket = ticket->ticket;
+	for (int i = 0; i < TICKETNONCESIZE; i++) {
+		clientNonce[i] = (uint8_t) RANDOM_REG32;
+	}
+	memcpy(request->clientNonce, clientNonce, TICKETNONCESIZE);
+	memcpy(ticketSecret, ticket->secret, KEYSIZE);
+	arducrypt::ticketProof(ticketSecret, &request->ticket, clientNonce,
+			request->proof);
+	in->message.checksum = clientcrypt.calcChecksum(
+			(uint8_t*) &in->message.data, sizeof(MessageData));
+	return DoorKeeperMessageSize;
+}
+
+/**
+ * \brief checks the ResumeSessionResponse (type, checksum, framing, server
+ * proof) and starts the session. frame is modified
+ */
+boolean DoorKeeperClient::finishResume(uint8_t* frame, int size) {
+	DoorKeeperMessage* out = (DoorKeeperMessage*) frame;
+	if (size != (int) DoorKeeperMessageSize
+			|| out->messagetype != MesType::RESUMESESSIONRESPONSE
+			|| clientcrypt.calcChecksum((uint8_t*) &out->message.data,
+					sizeof(MessageData)) != out->message.checksum) {
+		return false;
+	}
+	ResumeSessionResponse* response = &out->message.data.resumeSessionResponse;
+	uint8_t proof[TICKETMACSIZE];
+	arducrypt::serverProof(ticketSecret, clientNonce, response->sessionIV,
+			proof);
+	if (arducrypt::verifyProof(proof, response->proof) == false) {
+		return false;
+	}
+	memcpy(session.iv, response->sessionIV, IVSIZE);
+	clientcrypt.deriveSession(&session, ticketSecret, clientNonce);
+	memset(ticketSecret, 0, KEYSIZE);
+	framing = out->reserved & (DOORKEEPERFRAME_COMPACT | DOORKEEPERFRAME_AEAD);
+	started = true;
+	return true;
+}
+
+void DoorKeeperClient::endSession() {
+	started = false;
+	framing = 0x00;
+	memset(sessionPrivKey, 0, KEYSIZE);
+	memset(ticketSecret, 0, KEYSIZE);
+	session.encrypt.clear();
+	session.decrypt.clear();
+	session.aead.clear();
+}
+
+/**
+ * \brief encrypted request of type with data into frame (at least
+ * DOORKEEPERFRAMEMAXSIZE bytes), returns its size, 0 without a started
+ * session
+ */
+int DoorKeeperClient::request(uint8_t type, const MessageData* data,
+		uint8_t* frame) {
+	if (started == false) {
+		return 0;
+	}
+	if (framing == DOORKEEPERFRAME_COMPACT) {
+		return compactRequest(type, data, frame);
+	}
+	if (framing == DOORKEEPERFRAME_AEAD) {
+		return aeadRequest(type, data, frame);
+	}
+	DoorKeeperMessage* in = (DoorKeeperMessage*) frame;
+	MessagePayload plain;
+	setHeader(in, type);
+	memcpy(&plain.data, data, sizeof(MessageData));
+	plain.checksum = clientcrypt.calcChecksum((uint8_t*) &plain.data,
+			sizeof(MessageData));
+	clientcrypt.encrypt((uint8_t*) &plain, (uint8_t*) &in->message,
+			&session);
+	memset(&plain, 0, sizeof(plain));
+	return DoorKeeperMessageSize;
+}
+
+/**
+ * \brief compact frame: the checksum covers header and data
+ */
+int DoorKeeperClient::compactRequest(uint8_t type, const MessageData* data,
+		uint8_t* frame) {
+	uint8_t length = DoorKeeper::messageLength(type);
+	frame[0] = DOORKEEPERFRAME_HEADER1;
+	frame[1] = DOORKEEPERFRAME_COMPACTHEADER2;
+	frame[2] = type;
+	frame[3] = 0x00;
+	frame[4] = length;
+	arducryptcrc crc;
+	crc.update(frame, DOORKEEPERCOMPACTHEADERSIZE);
+	crc.update((uint8_t*) data, length);
+	uint32_t checksum = crc.finalize();
+	clientcrypt.encrypt((uint8_t*) data, frame + DOORKEEPERCOMPACTHEADERSIZE,
+			&session, length);
+	clientcrypt.encrypt((uint8_t*) &checksum,
+			frame + DOORKEEPERCOMPACTHEADERSIZE + length, &session,
+			CHECKSUMSIZE);
+	return DoorKeeper::frameSize(frame);
+}
+
+/**
+ * \brief AEAD frame: the header is authenticated, the tag follows the data
+ */
+int DoorKeeperClient::aeadRequest(uint8_t type, const MessageData* data,
+		uint8_t* frame) {
+	uint8_t length = DoorKeeper::messageLength(type);
+	frame[0] = DOORKEEPERFRAME_HEADER1;
+	frame[1] = DOORKEEPERFRAME_AEADHEADER2;
+	frame[2] = type;
+	frame[3] = 0x00;
+	frame[4] = length;
+	clientcrypt.encryptAead((uint8_t*) data,
+			frame + DOORKEEPERCOMPACTHEADERSIZE, length, frame,
+			DOORKEEPERCOMPACTHEADERSIZE,
+			frame + DOORKEEPERCOMPACTHEADERSIZE + length, &session,
+			ARDUCRYPTAEAD_TOSERVER);
+	return DoorKeeper::frameSize(frame);
+}
+
+/**
+ * \brief decrypts a response frame into data (may be NULL).
+ * returns its message type, 0 if it is broken (then the session is out of
+ * sync and has to be started again)
+ */
+uint8_t DoorKeeperClient::response(uint8_t* frame, int size,
+		MessageData* data) {
+	if (started == true && framing != 0x00) {
+		return compactResponse(frame, size, data);
+	}
+	DoorKeeperMessage* out = (DoorKeeperMessage*) frame;
+	MessagePayload plain;
+	if (started == false || size != (int) DoorKeeperMessageSize
+			|| out->headerbyte1 != DOORKEEPERFRAME_HEADER1
+			|| out->headerbyte2 != DOORKEEPERFRAME_HEADER2) {
+		return 0;
+	}
+	clientcrypt.decrypt((uint8_t*) &plain, (uint8_t*) &out->message,
+			&session);
+	if (clientcrypt.calcChecksum((uint8_t*) &plain.data, sizeof(MessageData))
+			!= plain.checksum) {
+		return 0;
+	}
+	if (data != NULL) {
+		memcpy(data, &plain.data, sizeof(MessageData));
+	}
+	return out->messagetype;
+}
+
+/**
+ * \brief response as compact or AEAD frame, see response
+ */
+uint8_t DoorKeeperClient::compactResponse(uint8_t* frame, int size,
+		MessageData* data) {
+	uint8_t header2 =
+			framing == DOORKEEPERFRAME_AEAD ?
+					DOORKEEPERFRAME_AEADHEADER2 : DOORKEEPERFRAME_COMPACTHEADER2;
+	if (size < DOORKEEPERCOMPACTHEADERSIZE
+			|| frame[0] != DOORKEEPERFRAME_HEADER1 || frame[1] != header2
+			|| size != DoorKeeper::frameSize(frame)) {
+		return 0;
+	}
+	MessageData plain;
+	uint8_t length = frame[4];
+	uint8_t* encrypted = frame + DOORKEEPERCOMPACTHEADERSIZE;
+	if (framing == DOORKEEPERFRAME_AEAD) {
+		if (clientcrypt.decryptAead((uint8_t*) &plain, encrypted, length,
+				frame, DOORKEEPERCOMPACTHEADERSIZE, encrypted + length,
+				&session, ARDUCRYPTAEAD_TOCLIENT) == false) {
+			return 0;
+		}
+	} else {
+		uint32_t checksum;
+		clientcrypt.decrypt((uint8_t*) &plain, encrypted, &session, length);
+		clientcrypt.decrypt((uint8_t*) &checksum, encrypted + length,
+				&session, CHECKSUMSIZE);
+		arducryptcrc crc;
+		crc.update(frame, DOORKEEPERCOMPACTHEADERSIZE);
+		crc.update((uint8_t*) &plain, length);
+		if (crc.finalize() != checksum) {
+			return 0;
+		}
+	}
+	if (data != NULL) {
+		memset(data, 0, sizeof(MessageData));
+		memcpy(data, &plain, length);
+	}
+	memset(&plain, 0, sizeof(plain));
+	return frame[2];
+}
+
+/**
+ * \brief false for requests the server does not answer
+ */
+boolean DoorKeeperClient::hasResponse(uint8_t type) {
+	return type != MesType::RELAISREQUEST;
+}
@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2017 A. Koller - akandroid75@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef DOORKEEPERCLIENT_H_
+#define DOORKEEPERCLIENT_H_
+
+#include <DoorKeeper.h>
+#include <stdint.h>
+
+/*
+ * Client side of the DoorKeeper protocol (protocol.md), without transport.
+ *
+ * startSession() writes a StartSessionRequest frame (new ephemeral
+ * Curve25519 key, signed with the client key), finishSession() checks the
+ * StartSessionResponse with the server key and sets the session keys.
+ * resumeSession() / finishResume() do the same with a ticket of an earlier
+ * session (TicketRequest), and can ask for compact or AEAD frames.
+ * request() encrypts a request into a frame, response() decrypts and checks
+ * a response frame. Frames are fixed frames of DoorKeeperMessageSize bytes
+ * unless the resume switched the framing, responses have to be passed in
+ * the order of the requests.
+ *
+ * The keys are not copied, they have to live as long as the client.
+ */
+class DoorKeeperClient {
+
+public:
+	DoorKeeperClient(arducryptkeypair* clientKey, arducryptkey* serverKey);
+	~DoorKeeperClient();
+
+	int startSession(uint8_t* frame);
+	boolean finishSession(uint8_t* frame, int size);
+	int resumeSession(const TicketResponse* ticket, uint8_t framing,
+			uint8_t* frame);
+	boolean finishResume(uint8_t* frame, int size);
+	boolean isStarted() {
+		return started;
+	}
+	// 0x00 (fixed frames), DOORKEEPERFRAME_COMPACT or DOORKEEPERFRAME_AEAD
+	uint8_t getFraming() {
+		return framing;
+	}
+	void endSession();
+
+	int request(uint8_t type, const MessageData* data, uint8_t* frame);
+	uint8_t response(uint8_t* frame, int size, MessageData* data);
+	static boolean hasResponse(uint8_t type);
+
+private:
+	int compactRequest(uint8_t type, const MessageData* data, uint8_t* frame);
+	int aeadRequest(uint8_t type, const MessageData* data, uint8_t* frame);
+	uint8_t compactResponse(uint8_t* frame, int size, MessageData* data);
+
+	arducryptkeypair* clientKey;
+	arducryptkey* serverKey;
+	arducryptsession session;
+	uint8_t sessionPrivKey[KEYSIZE];
+	// ticket secret and nonce of a pending resume
+	uint8_t ticketSecret[KEYSIZE];
+	uint8_t clientNonce[TICKETNONCESIZE];
+	uint8_t framing = 0x00;
+	boolean started = false;
+};
+
+#endif /* DOORKEEPERCLIENT_H_ */
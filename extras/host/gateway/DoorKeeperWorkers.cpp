@@ -0,0 +1,160 @@
+/*
+ * Copyright (C) 2017 A. Koller - akandroid75@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <Arduino.h>
+#include <DoorKeeperWorkers.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+DoorKeeperWorkers::DoorKeeperWorkers(int threads, DoorKeeperTask task_) :
+		task(task_), completedCount(0), stolen(0) {
+	completionFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	for (int i = 0; i < threads; i++) {
+		queues.push_back(new Queue());
+	}
+	for (int i = 0; i < threads; i++) {
+		workers.push_back(std::thread(&DoorKeeperWorkers::run, this, i));
+	}
+}
+
+DoorKeeperWorkers::~DoorKeeperWorkers() {
+	{
+		std::lock_guard<std::mutex> guard(sleepLock);
+		stopping = true;
+	}
+	wake.notify_all();
+	for (size_t i = 0; i < workers.size(); i++) {
+		workers[i].join();
+	}
+	for (size_t i = 0; i < queues.size(); i++) {
+		delete queues[i];
+	}
+	close(completionFd);
+}
+
+/**
+ * \brief queues arg for task, I/O thread only
+ */
+void DoorKeeperWorkers::submit(void* arg) {
+	Queue* queue = queues[next];
+	next = (next + 1) % queues.size();
+	{
+		std::lock_guard<std::mutex> guard(queue->lock);
+		queue->tasks.push_back(arg);
+	}
+	submitted++;
+	{
+		std::lock_guard<std::mutex> guard(sleepLock);
+		queued++;
+		if ((uint32_t) queued > maxQueued) {
+			maxQueued = queued;
+		}
+	}
+	wake.notify_one();
+}
+
+/**
+ * \brief own queue first (front), then the back of the others
+ */
+boolean DoorKeeperWorkers::take(int index, void** arg) {
+	int count = queues.size();
+	for (int i = 0; i < count; i++) {
+		Queue* queue = queues[(index + i) % count];
+		std::lock_guard<std::mutex> guard(queue->lock);
+		if (queue->tasks.empty() == true) {
+			continue;
+		}
+		if (i == 0) {
+			*arg = queue->tasks.front();
+			queue->tasks.pop_front();
+		} else {
+			*arg = queue->tasks.back();
+			queue->tasks.pop_back();
+			stolen++;
+		}
+		return true;
+	}
+	return false;
+}
+
+void DoorKeeperWorkers::run(int index) {
+	while (true) {
+		{
+			std::unique_lock<std::mutex> guard(sleepLock);
+			wake.wait(guard, [this] {
+				return queued > 0 || stopping == true;
+			});
+			if (stopping == true) {
+				return;
+			}
+			// claim one task, it is in one of the queues
+			queued--;
+		}
+		void* arg;
+		while (take(index, &arg) == false) {
+			// submit queues before it counts, the task is on its way
+			std::this_thread::yield();
+		}
+		task(arg);
+		{
+			std::lock_guard<std::mutex> guard(completionLock);
+			done.push_back(arg);
+		}
+		completedCount++;
+		uint64_t one = 1;
+		if (write(completionFd, &one, sizeof(one)) < 0) {
+			// counter full, the I/O thread is woken up anyway
+		}
+	}
+}
+
+/**
+ * \brief up to max finished args, I/O thread only
+ */
+int DoorKeeperWorkers::completed(void** args, int max) {
+	uint64_t count;
+	if (read(completionFd, &count, sizeof(count)) < 0) {
+		// nothing signalled, there may be leftovers of the last call
+	}
+	std::lock_guard<std::mutex> guard(completionLock);
+	int n = 0;
+	while (n < max && done.empty() == false) {
+		args[n++] = done.back();
+		done.pop_back();
+	}
+	if (done.empty() == false) {
+		// leftovers: stay readable
+		uint64_t one = 1;
+		if (write(completionFd, &one, sizeof(one)) < 0) {
+		}
+	}
+	return n;
+}
+
+DoorKeeperWorkerStats DoorKeeperWorkers::getStats() {
+	DoorKeeperWorkerStats stats;
+	stats.submitted = submitted;
+	stats.completed = completedCount;
+	stats.stolen = stolen;
+	stats.maxQueued = maxQueued;
+	return stats;
+}
@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2017 A. Koller - akandroid75@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef DOORKEEPERWORKERS_H_
+#define DOORKEEPERWORKERS_H_
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+ * Work-stealing thread pool for the public key operations of handshakes.
+ *
+ * submit() is called by the I/O thread, it puts the task on the queue of
+ * the next worker (round robin). A worker takes its own tasks from the
+ * front and steals from the back of the other queues when its own one is
+ * empty, so one burst of handshakes is spread over all cores even if it
+ * was queued unevenly. Idle workers sleep on a condition variable.
+ *
+ * A finished task is put on the completion list and eventFd() becomes
+ * readable. The I/O thread takes the finished tasks with completed() and
+ * finishes them itself, so sessions and DoorKeeper are only used by the
+ * I/O thread and need no locks.
+ */
+
+typedef void (*DoorKeeperTask)(void* arg);
+
+struct DoorKeeperWorkerStats {
+	uint64_t submitted;
+	uint64_t completed;
+	uint64_t stolen;
+	uint32_t maxQueued;
+};
+
+class DoorKeeperWorkers {
+
+public:
+	DoorKeeperWorkers(int threads, DoorKeeperTask task);
+	~DoorKeeperWorkers();
+
+	void submit(void* arg);
+	int completed(void** args, int max);
+	int eventFd() {
+		return completionFd;
+	}
+	int threads() {
+		return (int) workers.size();
+	}
+	DoorKeeperWorkerStats getStats();
+
+private:
+	struct Queue {
+		std::mutex lock;
+		std::deque<void*> tasks;
+	};
+
+	void run(int index);
+	boolean take(int index, void** arg);
+
+	DoorKeeperTask task;
+	std::vector<std::thread> workers;
+	std::vector<Queue*> queues;
+	int next = 0;
+
+	std::mutex sleepLock;
+	std::condition_variable wake;
+	int queued = 0;
+	boolean stopping = false;
+
+	std::mutex completionLock;
+	std::vector<void*> done;
+	int completionFd = -1;
+
+	uint64_t submitted = 0;
+	std::atomic<uint64_t> completedCount;
+	std::atomic<uint64_t> stolen;
+	uint32_t maxQueued = 0;
+};
+
+#endif /* DOORKEEPERWORKERS_H_ */
@@ -0,0 +1,678 @@
+/*
+ * Copyright (C) 2017 A. Koller - akandroid75@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * DoorKeeper gateway for Linux.
+ *
+ * Serves the DoorKeeper protocol on a TCP port with the same DoorKeeper,
+ * arducrypt and DoorKeeperStream code as the ESP8266 sketch, one epoll event
+ * loop for all connections (the number is only limited by --max-clients and
+ * the open file limit). Every connection has its own DoorKeeperSession (in
+ * DoorKeeperSessions, by socket), DoorKeeperStream (request reassembly) and
+ * DoorKeeperOutQueue (responses of one pass, sent with one non-blocking
+ * write). Connections without a request for --idle-timeout seconds are
+ * evicted and closed.
+ *
+ * The user db (EEPROM image and flash journal of the host stand-ins) is kept
+ * in <data>/storage.bin, the server sign key in <data>/server.key (created
+ * on the first start, public key first). --admin adds the public key of a
+ * key file (first 32 bytes) as user valid forever at every start, like the
+ * admin key of the sketch it is not stored. Users added with AddKeyRequest
+ * are written behind to the journal as on the ESP8266.
+ *
+ * The public key operations of StartSession (signature check, key exchange,
+ * signature of the response) run on --workers threads (DoorKeeperWorkers,
+ * default one per core, 0 runs them on the event loop). The event loop only
+ * starts and finishes a handshake, all symmetric traffic stays on it.
+ * While the handshake of a connection runs its further frames wait in its
+ * stream. The handshakes started in one pass of the event loop are handed
+ * to the workers in batches of up to --batch (spread over all workers),
+ * the signatures of a batch are checked together
+ * (DoorKeeper::runHandshakes), which pays off in login bursts.
+ *
+ * Requests of unknown (custom) message types are echoed with the type
+ * | 0x80 (the default handler of the sketch does application work here).
+ *
+ *   ./build/doorkeeper_gateway --port 2323 --data /var/lib/doorkeeper
+ */
+
+#include <DoorKeeper.h>
+#include <DoorKeeperSessions.h>
+#include <DoorKeeperStream.h>
+#include <DoorKeeperWorkers.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define GATEWAYEVENTS 256
+// epoll timeout, time base of doorkeeperLoop while there is no traffic
+#define GATEWAYIDLEMS 10
+// idle sessions evicted per loop pass
+#define GATEWAYEVICTMAX 64
+// handshakes per worker task
+#define GATEWAYBATCH 16
+
+/**
+ * \brief one client connection
+ */
+struct Connection {
+	int fd;
+	DoorKeeperStream in;
+	DoorKeeperOutQueue out;
+	// epoll events currently registered
+	uint32_t events = 0;
+	boolean failed = false;
+	// handshake on a worker, the connection is released when it is done
+	DoorKeeperHandshake handshake;
+	boolean handshakePending = false;
+	// events of the same epoll batch may still point to it, deleted after
+	// the batch (releaseClosed)
+	boolean closed = false;
+};
+
+/**
+ * \brief client for DoorKeeperOutQueue::flush on a non-blocking socket
+ */
+struct SocketClient {
+	Connection* connection;
+
+	int availableForWrite() {
+		// the kernel takes what fits into the socket buffer
+		return DOORKEEPEROUTQUEUE_SIZE;
+	}
+
+	size_t write(const uint8_t* data, size_t length) {
+		ssize_t written = send(connection->fd, data, length, MSG_NOSIGNAL);
+		if (written < 0) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK) {
+				connection->failed = true;
+			}
+			return 0;
+		}
+		return written;
+	}
+};
+
+struct GatewayStats {
+	uint32_t accepted;
+	uint32_t rejected;
+	uint32_t closed;
+	uint32_t open;
+	uint32_t maxOpen;
+	uint64_t frames;
+	uint64_t responses;
+	uint64_t handshakes;
+	uint64_t batches;
+};
+
+/**
+ * \brief handshakes of one worker task
+ */
+struct HandshakeBatch {
+	int count;
+	Connection* connections[ARDUCRYPTBATCHMAX];
+};
+
+static DoorKeeper keeper;
+static DoorKeeperSessions sessions;
+static DoorKeeperConfig dkconfig;
+static arducryptkeypair serverKey;
+static timestruct now;
+static GatewayStats stats;
+static volatile sig_atomic_t running = 1;
+static int epollFd = -1;
+static DoorKeeperWorkers* workers = NULL;
+// handshakes begun in this pass of the event loop, see submitHandshakes
+static std::vector<Connection*> begunHandshakes;
+static int batchSize = GATEWAYBATCH;
+// closed in this pass of the event loop, see releaseClosed
+static std::vector<Connection*> closedConnections;
+// epoll tag of the worker completions, NULL is the listen socket
+static int completionTag;
+
+static void stop(int signal) {
+	running = 0;
+}
+
+static bool readFile(const std::string& path, uint8_t* data, size_t size) {
+	FILE* f = fopen(path.c_str(), "rb");
+	if (f == NULL) {
+		return false;
+	}
+	bool ok = fread(data, 1, size, f) == size;
+	fclose(f);
+	return ok;
+}
+
+static bool writeFile(const std::string& path, const uint8_t* data,
+		size_t size) {
+	int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0) {
+		return false;
+	}
+	bool ok = write(fd, data, size) == (ssize_t) size && fsync(fd) == 0;
+	close(fd);
+	return ok;
+}
+
+/**
+ * \brief server sign key of data, a new one on the first start
+ */
+static bool loadServerKey(const std::string& data) {
+	std::string path = data + "/server.key";
+	if (readFile(path, (uint8_t*) &serverKey, sizeof(serverKey)) == true) {
+		return true;
+	}
+	arducrypt::generateSigKeyPair(serverKey.privateKey.keybytes,
+			serverKey.publicKey.keybytes);
+	fprintf(stderr, "new server key %s\n", path.c_str());
+	return writeFile(path, (uint8_t*) &serverKey, sizeof(serverKey));
+}
+
+/**
+ * \brief local time for the date checks of the user db
+ */
+static void updateTime() {
+	time_t seconds = time(NULL);
+	struct tm local;
+	localtime_r(&seconds, &local);
+	now.tm_sec = local.tm_sec;
+	now.tm_min = local.tm_min;
+	now.tm_hour = local.tm_hour;
+	now.tm_mday = local.tm_mday;
+	now.tm_mon = local.tm_mon;
+	now.tm_year = local.tm_year + 1900;
+	now.tm_wday = local.tm_wday;
+	now.tm_yday = local.tm_yday;
+	now.tm_isdst = local.tm_isdst;
+	keeper.CB1000ms((ulong) seconds);
+}
+
+static int listenSocket(int port) {
+	int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+	if (fd < 0) {
+		return -1;
+	}
+	int one = 1;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	struct sockaddr_in address;
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_ANY);
+	address.sin_port = htons(port);
+	if (bind(fd, (struct sockaddr*) &address, sizeof(address)) != 0
+			|| listen(fd, SOMAXCONN) != 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/**
+ * \brief registers the events connection needs now: input only while there
+ * is room for responses (backpressure) and no handshake runs, output while
+ * responses are queued
+ */
+static void updateEvents(Connection* connection) {
+	uint32_t events = 0;
+	if (connection->out.space() >= DOORKEEPERFRAMEMAXSIZE
+			&& connection->handshakePending == false) {
+		events |= EPOLLIN;
+	}
+	if (connection->out.pending() > 0) {
+		events |= EPOLLOUT;
+	}
+	if (events != connection->events) {
+		struct epoll_event event;
+		event.events = events;
+		event.data.ptr = connection;
+		epoll_ctl(epollFd, EPOLL_CTL_MOD, connection->fd, &event);
+		connection->events = events;
+	}
+}
+
+static void closeConnection(Connection* connection) {
+	epoll_ctl(epollFd, EPOLL_CTL_DEL, connection->fd, NULL);
+	// before close, the fd may be reused at once
+	sessions.remove(connection->fd);
+	close(connection->fd);
+	stats.closed++;
+	stats.open--;
+	connection->closed = true;
+	// a pending job is released by completeHandshake
+	if (connection->handshakePending == false) {
+		closedConnections.push_back(connection);
+	}
+}
+
+/**
+ * \brief deletes the connections closed in this pass, no event of the
+ * last epoll batch is left that points to them
+ */
+static void releaseClosed() {
+	for (size_t i = 0; i < closedConnections.size(); i++) {
+		delete closedConnections[i];
+	}
+	closedConnections.clear();
+}
+
+/**
+ * \brief evict handler: the session is gone, the hangup closes the
+ * connection in the event loop
+ */
+static void evictConnection(uint32_t fd) {
+	shutdown(fd, SHUT_RDWR);
+}
+
+/**
+ * \brief custom message types (not in MesType) are echoed with the type
+ * | 0x80, for load tests of the callback path
+ */
+static boolean echoHandler(uint8_t messagetype, uint8_t reservedByte,
+		MessagePayload* payload, DoorKeeperMessage* outbuffer) {
+	outbuffer->messagetype = messagetype | 0x80;
+	return true;
+}
+
+static void acceptConnections(int listenFd, uint32_t maxClients) {
+	while (true) {
+		int fd = accept4(listenFd, NULL, NULL, SOCK_NONBLOCK);
+		if (fd < 0) {
+			return;
+		}
+		if (stats.open >= maxClients) {
+			close(fd);
+			stats.rejected++;
+			continue;
+		}
+		int one = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		if (sessions.create(fd) == NULL) {
+			close(fd);
+			stats.rejected++;
+			continue;
+		}
+		Connection* connection = new Connection();
+		connection->fd = fd;
+		connection->events = EPOLLIN;
+		struct epoll_event event;
+		event.events = connection->events;
+		event.data.ptr = connection;
+		if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) != 0) {
+			sessions.remove(fd);
+			close(fd);
+			delete connection;
+			continue;
+		}
+		stats.accepted++;
+		stats.open++;
+		if (stats.open > stats.maxOpen) {
+			stats.maxOpen = stats.open;
+		}
+	}
+}
+
+/**
+ * \brief reads what the socket has (as long as the stream has room),
+ * false if the peer closed the connection
+ */
+static bool receive(Connection* connection) {
+	int length;
+	uint8_t* buffer;
+	while ((buffer = connection->in.writeBuffer(&length)) != NULL) {
+		ssize_t read = recv(connection->fd, buffer, length, 0);
+		if (read > 0) {
+			connection->in.commitWrite(read);
+			continue;
+		}
+		if (read < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			return true;
+		}
+		return false;
+	}
+	return true;
+}
+
+/**
+ * \brief handles the complete frames while there is room for responses,
+ * then sends the responses with one write. frames left over because the
+ * queue was full are handled as soon as a write made room again.
+ * a connection whose session was evicted fails
+ */
+static void process(Connection* connection) {
+	uint8_t frameIn[DOORKEEPERFRAMEMAXSIZE] __attribute__((aligned(4)));
+	uint8_t frameOut[DOORKEEPERFRAMEMAXSIZE] __attribute__((aligned(4)));
+	SocketClient client = { connection };
+	DoorKeeperSession* session = NULL;
+	// only received data counts as activity, not a flush
+	if (connection->in.available() > 0) {
+		session = sessions.get(connection->fd);
+		if (session == NULL) {
+			connection->failed = true;
+			return;
+		}
+	}
+	do {
+		while (session != NULL && connection->handshakePending == false
+				&& connection->out.space() >= DOORKEEPERFRAMEMAXSIZE
+				&& connection->in.nextFrame(frameIn) > 0) {
+			stats.frames++;
+			if (workers != NULL
+					&& keeper.beginHandshake(frameIn, &connection->handshake,
+							session) == true) {
+				connection->handshakePending = true;
+				begunHandshakes.push_back(connection);
+				break;
+			}
+			int size = keeper.handleFrame(frameIn, frameOut, session);
+			if (size > 0) {
+				connection->out.queue(frameOut, size);
+				stats.responses++;
+			}
+		}
+	} while (connection->out.flush(client) > 0 && connection->failed == false
+			&& connection->in.available() > 0);
+}
+
+static void handleEvent(Connection* connection, uint32_t events) {
+	if (connection->closed == true) {
+		// by an earlier event of this batch
+		return;
+	}
+	bool open = (events & (EPOLLERR | EPOLLHUP)) == 0;
+	if (open == true && (events & EPOLLIN) != 0) {
+		open = receive(connection);
+	}
+	// also after EOF: answer what was received before
+	process(connection);
+	if (open == false || connection->failed == true) {
+		closeConnection(connection);
+		return;
+	}
+	updateEvents(connection);
+}
+
+static void runHandshakes(void* arg) {
+	HandshakeBatch* batch = (HandshakeBatch*) arg;
+	DoorKeeperHandshake* jobs[ARDUCRYPTBATCHMAX];
+	for (int i = 0; i < batch->count; i++) {
+		jobs[i] = &batch->connections[i]->handshake;
+	}
+	DoorKeeper::runHandshakes(jobs, batch->count);
+}
+
+/**
+ * \brief hands the handshakes begun in this pass to the workers: batches
+ * of up to batchSize, but at least one per worker as long as there are
+ * handshakes for them
+ */
+static void submitHandshakes() {
+	int count = (int) begunHandshakes.size();
+	if (count == 0) {
+		return;
+	}
+	int batches = (count + batchSize - 1) / batchSize;
+	batches = std::max(batches, std::min(count, workers->threads()));
+	int first = 0;
+	for (int b = 0; b < batches; b++) {
+		HandshakeBatch* batch = new HandshakeBatch();
+		batch->count = (count - first) / (batches - b);
+		for (int i = 0; i < batch->count; i++) {
+			batch->connections[i] = begunHandshakes[first + i];
+		}
+		first += batch->count;
+		stats.batches++;
+		workers->submit(batch);
+	}
+	begunHandshakes.clear();
+}
+
+/**
+ * \brief finishes one handshake of a batch and goes on with the frames
+ * which waited for it
+ */
+static void completeHandshake(Connection* connection) {
+	uint8_t frameOut[DOORKEEPERFRAMEMAXSIZE] __attribute__((aligned(4)));
+	connection->handshakePending = false;
+	if (connection->closed == true) {
+		memset(connection->handshake.secret, 0, KEYSIZE);
+		closedConnections.push_back(connection);
+		return;
+	}
+	DoorKeeperSession* session = sessions.get(connection->fd);
+	if (session == NULL) {
+		memset(connection->handshake.secret, 0, KEYSIZE);
+		closeConnection(connection);
+		return;
+	}
+	stats.handshakes++;
+	int size = keeper.endHandshake(&connection->handshake, frameOut, session);
+	if (size > 0) {
+		connection->out.queue(frameOut, size);
+		stats.responses++;
+	}
+	process(connection);
+	if (connection->failed == true) {
+		closeConnection(connection);
+		return;
+	}
+	updateEvents(connection);
+}
+
+/**
+ * \brief finishes the handshakes the workers are done with
+ */
+static void completeHandshakes() {
+	void* done[GATEWAYEVENTS];
+	int count = workers->completed(done, GATEWAYEVENTS);
+	for (int i = 0; i < count; i++) {
+		HandshakeBatch* batch = (HandshakeBatch*) done[i];
+		for (int k = 0; k < batch->count; k++) {
+			completeHandshake(batch->connections[k]);
+		}
+		delete batch;
+	}
+}
+
+static void report(FILE* out) {
+	DoorKeeperFlushStats flush = keeper.getFlushStats();
+	arducryptpoolstats pool = keeper.getKeyPoolStats();
+	DoorKeeperSessionStats sessionStats = sessions.getStats();
+	fprintf(out, "{\"accepted\": %u, \"rejected\": %u, \"closed\": %u, ",
+			stats.accepted, stats.rejected, stats.closed);
+	fprintf(out, "\"max_sessions\": %u, \"evicted\": %u, ",
+			sessionStats.maxActive, sessionStats.evicted);
+	fprintf(out, "\"max_open\": %u, \"frames\": %llu, \"responses\": %llu, ",
+			stats.maxOpen, (unsigned long long) stats.frames,
+			(unsigned long long) stats.responses);
+	if (workers != NULL) {
+		DoorKeeperWorkerStats pool = workers->getStats();
+		fprintf(out, "\"workers\": %d, \"handshakes\": %llu, "
+				"\"batches\": %llu, ", workers->threads(),
+				(unsigned long long) stats.handshakes,
+				(unsigned long long) stats.batches);
+		fprintf(out, "\"stolen\": %llu, \"max_queued\": %u, ",
+				(unsigned long long) pool.stolen, pool.maxQueued);
+	}
+	fprintf(out, "\"keypool_hits\": %u, \"keypool_misses\": %u, ", pool.hits,
+			pool.misses);
+	fprintf(out, "\"flushes\": %u, \"flush_failures\": %u, ", flush.flushes,
+			flush.failures);
+	fprintf(out, "\"pending_users\": %u}\n", flush.pending);
+}
+
+static void usage(const char* name) {
+	fprintf(stderr, "usage: %s [--port N] [--data DIR] [--admin KEYFILE] "
+			"[--max-clients N] [--idle-timeout S] [--workers N] [--batch N] "
+			"[--log]\n",
+			name);
+}
+
+int main(int argc, char** argv) {
+	int port = 2323;
+	std::string data = "gateway-data";
+	const char* admin = NULL;
+	uint32_t maxClients = 10000;
+	uint32_t idleMs = DOORKEEPERSESSIONS_IDLEMS;
+	int threads = std::thread::hardware_concurrency();
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--port") == 0 && i + 1 < argc) {
+			port = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--data") == 0 && i + 1 < argc) {
+			data = argv[++i];
+		} else if (strcmp(argv[i], "--admin") == 0 && i + 1 < argc) {
+			admin = argv[++i];
+		} else if (strcmp(argv[i], "--max-clients") == 0 && i + 1 < argc) {
+			maxClients = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--idle-timeout") == 0 && i + 1 < argc) {
+			idleMs = atoi(argv[++i]) * 1000;
+		} else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+			threads = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+			batchSize = std::min(std::max(atoi(argv[++i]), 1),
+					ARDUCRYPTBATCHMAX);
+		} else if (strcmp(argv[i], "--log") == 0) {
+			Serial.setOutput(stderr);
+		} else {
+			usage(argv[0]);
+			return 2;
+		}
+	}
+
+	// one descriptor per client
+	struct rlimit limit;
+	if (getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+		limit.rlim_cur = limit.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &limit);
+	}
+	signal(SIGPIPE, SIG_IGN);
+	signal(SIGINT, stop);
+	signal(SIGTERM, stop);
+
+	mkdir(data.c_str(), 0700);
+	if (hostStorageOpen((data + "/storage.bin").c_str()) == false
+			|| loadServerKey(data) == false) {
+		fprintf(stderr, "can not use %s: %s\n", data.c_str(),
+				strerror(errno));
+		return 1;
+	}
+
+	dkconfig.serverkeys = &serverKey;
+	dkconfig.saveDB = true;
+	dkconfig.auditLog = true;
+	for (int i = 0; i < MAXRELAISNR; i++) {
+		dkconfig.pins[i].portpin = 12 + i;
+		dkconfig.pins[i].initstate = HIGH;
+		dkconfig.pins[i].OFF = HIGH;
+		dkconfig.pins[i].ON = LOW;
+	}
+	updateTime();
+	keeper.initKeeper(&dkconfig);
+	keeper.initTime(&now);
+	keeper.addDefaultHandler(echoHandler);
+	if (maxClients > DOORKEEPERSESSIONS_MAXCAPACITY
+			|| sessions.begin(&keeper, maxClients, idleMs) == false) {
+		fprintf(stderr, "can not allocate %u sessions\n", maxClients);
+		return 1;
+	}
+	sessions.setEvictHandler(evictConnection);
+
+	if (admin != NULL) {
+		User user;
+		memset(&user, 0xff, sizeof(User));
+		if (readFile(admin, user.userPubKey, KEYSIZE) == false) {
+			fprintf(stderr, "can not read %s\n", admin);
+			return 1;
+		}
+		user.validToYear = 0xee;
+		user.validToMonth = 0xee;
+		user.validToDay = 0xee;
+		keeper.addUser(&user);
+	}
+
+	int listenFd = listenSocket(port);
+	epollFd = epoll_create1(0);
+	if (listenFd < 0 || epollFd < 0) {
+		fprintf(stderr, "can not listen on %d: %s\n", port, strerror(errno));
+		return 1;
+	}
+	struct epoll_event event;
+	event.events = EPOLLIN;
+	event.data.ptr = NULL;
+	epoll_ctl(epollFd, EPOLL_CTL_ADD, listenFd, &event);
+	if (threads > 0) {
+		workers = new DoorKeeperWorkers(threads, runHandshakes);
+		event.events = EPOLLIN;
+		event.data.ptr = &completionTag;
+		epoll_ctl(epollFd, EPOLL_CTL_ADD, workers->eventFd(), &event);
+	}
+	fprintf(stderr, "listening on %d, max %u clients, %d workers\n", port,
+			maxClients, threads > 0 ? threads : 0);
+
+	struct epoll_event events[GATEWAYEVENTS];
+	unsigned long lastSecond = millis();
+	while (running) {
+		int count = epoll_wait(epollFd, events, GATEWAYEVENTS, GATEWAYIDLEMS);
+		for (int i = 0; i < count; i++) {
+			if (events[i].data.ptr == NULL) {
+				acceptConnections(listenFd, maxClients);
+			} else if (events[i].data.ptr == &completionTag) {
+				completeHandshakes();
+			} else {
+				handleEvent((Connection*) events[i].data.ptr,
+						events[i].events);
+			}
+		}
+		releaseClosed();
+		if (millis() - lastSecond >= 1000) {
+			lastSecond += 1000;
+			updateTime();
+		}
+		if (workers != NULL) {
+			submitHandshakes();
+		}
+		sessions.evictIdle(GATEWAYEVICTMAX);
+		keeper.checkTimer();
+		keeper.doorkeeperLoop();
+	}
+
+	keeper.flush();
+	report(stdout);
+	delete workers;
+	return 0;
+}
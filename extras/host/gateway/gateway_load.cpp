@@ -0,0 +1,550 @@
+/*
+ * Copyright (C) 2017 A. Koller - akandroid75@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Load generator for the DoorKeeper gateway.
+ *
+ * Opens --connections connections and starts a session on each of them
+ * (StartSessionRequest with Ed25519 / X25519 through DoorKeeperClient, all
+ * handshakes in flight at once). When all sessions are started every
+ * session sends --requests encrypted requests with up to --depth requests
+ * in flight (pipelined). The requests are drawn from --mix, weights of
+ * Status, Relais, Firmware and custom requests (--custom-type, echoed by
+ * the gateway), e.g. --mix status=70,relais=10,firmware=10,custom=10.
+ * RelaisRequests have no response, they are counted but not timed.
+ * One epoll loop drives all sockets, the responses are reassembled with
+ * DoorKeeperStream and checked (type, decryption, checksum).
+ *
+ * Handshake rate, request rate and the latency (send to complete response)
+ * per message type are written as JSON to stdout. The client does the
+ * same crypto per message as the gateway (the StartSessionRequests are
+ * prepared before the clock starts), use --connections large enough or
+ * several clients to keep the gateway busy.
+ *
+ *   ./build/gateway_load --init-key client.key
+ *   ./build/doorkeeper_gateway --data data --admin client.key &
+ *   ./build/gateway_load --key client.key --server-key data/server.key
+ */
+
+#include <DoorKeeper.h>
+#include <DoorKeeperClient.h>
+#include <DoorKeeperStream.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+typedef std::chrono::steady_clock Clock;
+
+// requests in flight per connection
+#define LOADMAXDEPTH 64
+// no response for this long: give up
+#define LOADTIMEOUTMS 10000
+
+enum LoadKind {
+	LOADSTATUS, LOADRELAIS, LOADFIRMWARE, LOADCUSTOM, LOADKINDS
+};
+
+struct LoadType {
+	const char* name;
+	uint8_t type;
+	uint8_t response;
+	int weight;
+	int sent;
+	std::vector<double> us;
+};
+
+static LoadType loadTypes[LOADKINDS] = { { "Status", MesType::STATUSREQUEST,
+		MesType::STATUSRESPONSE, 100, 0 }, { "Relais", MesType::RELAISREQUEST,
+		0x00, 0, 0 }, { "Firmware", MesType::FIRMWAREREQUEST,
+		MesType::FIRMWARERESPONSE, 0, 0 }, { "Custom", 0x40, 0xc0, 0, 0 } };
+static int totalWeight = 100;
+
+static arducryptkeypair clientKey;
+static arducryptkey serverPublicKey;
+
+struct LoadConnection {
+	int fd;
+	DoorKeeperClient client;
+	DoorKeeperStream in;
+	uint8_t startFrame[DoorKeeperMessageSize] __attribute__((aligned(4)));
+	Clock::time_point handshakeStart;
+	uint32_t random;
+	int sent = 0;
+	int done = 0;
+	// requests in flight, in the order of their responses
+	int pending = 0;
+	int answered = 0;
+	uint8_t kinds[LOADMAXDEPTH];
+	Clock::time_point sendTimes[LOADMAXDEPTH];
+
+	LoadConnection() :
+			client(&clientKey, &serverPublicKey) {
+	}
+};
+
+static std::vector<double> handshakeUs;
+static int errors = 0;
+
+static double elapsedUs(Clock::time_point start, Clock::time_point end) {
+	return std::chrono::duration<double, std::micro>(end - start).count();
+}
+
+static bool readFile(const char* path, uint8_t* data, size_t size) {
+	FILE* f = fopen(path, "rb");
+	if (f == NULL) {
+		return false;
+	}
+	bool ok = fread(data, 1, size, f) == size;
+	fclose(f);
+	return ok;
+}
+
+static bool sendAll(int fd, const uint8_t* data, size_t size) {
+	while (size > 0) {
+		ssize_t written = send(fd, data, size, MSG_NOSIGNAL);
+		if (written <= 0) {
+			return false;
+		}
+		data += written;
+		size -= written;
+	}
+	return true;
+}
+
+static int connectTo(const char* host, int port) {
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0) {
+		return -1;
+	}
+	struct sockaddr_in address;
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_port = htons(port);
+	if (inet_pton(AF_INET, host, &address.sin_addr) != 1
+			|| connect(fd, (struct sockaddr*) &address, sizeof(address))
+					!= 0) {
+		close(fd);
+		return -1;
+	}
+	int one = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	return fd;
+}
+
+/**
+ * \brief "status=70,relais=30" into the weights of loadTypes
+ */
+static bool parseMix(const char* mix) {
+	for (int k = 0; k < LOADKINDS; k++) {
+		loadTypes[k].weight = 0;
+	}
+	totalWeight = 0;
+	while (*mix != '\0') {
+		const char* end = strchr(mix, ',');
+		size_t length = end != NULL ? (size_t) (end - mix) : strlen(mix);
+		const char* equals = (const char*) memchr(mix, '=', length);
+		if (equals == NULL) {
+			return false;
+		}
+		int k = 0;
+		while (k < LOADKINDS
+				&& ((size_t) (equals - mix) != strlen(loadTypes[k].name)
+						|| strncasecmp(mix, loadTypes[k].name, equals - mix)
+								!= 0)) {
+			k++;
+		}
+		int weight = atoi(equals + 1);
+		if (k == LOADKINDS || weight < 0) {
+			return false;
+		}
+		loadTypes[k].weight = weight;
+		totalWeight += weight;
+		mix += length + (end != NULL ? 1 : 0);
+	}
+	return totalWeight > 0;
+}
+
+/**
+ * \brief next request type of the connection, drawn by weight
+ */
+static int nextKind(LoadConnection* connection) {
+	uint32_t x = connection->random;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	connection->random = x;
+	int pick = x % totalWeight;
+	int k = 0;
+	while (pick >= loadTypes[k].weight) {
+		pick -= loadTypes[k].weight;
+		k++;
+	}
+	return k;
+}
+
+static bool sendRequest(LoadConnection* connection) {
+	uint8_t frame[DoorKeeperMessageSize] __attribute__((aligned(4)));
+	MessageData data;
+	int kind = nextKind(connection);
+	LoadType* type = &loadTypes[kind];
+	memset(&data, 0, sizeof(data));
+	switch (kind) {
+	case LOADSTATUS:
+		data.statusRequest.relaisnr = connection->sent % MAXRELAISNR;
+		break;
+	case LOADRELAIS:
+		data.relaisRequest.relaisnumber = connection->sent % MAXRELAISNR;
+		data.relaisRequest.relaisstate =
+				(connection->sent & 1) ? RelaisStatus::OPEN : RelaisStatus::CLOSE;
+		break;
+	case LOADCUSTOM:
+		// echoed by the gateway, number of the response
+		memcpy(data.custom.data, &connection->pending, sizeof(int));
+		break;
+	}
+	int size = connection->client.request(type->type, &data, frame);
+	type->sent++;
+	connection->sent++;
+	if (DoorKeeperClient::hasResponse(type->type) == false) {
+		connection->done++;
+	} else {
+		int slot = connection->pending % LOADMAXDEPTH;
+		connection->kinds[slot] = kind;
+		connection->sendTimes[slot] = Clock::now();
+		connection->pending++;
+	}
+	return size > 0 && sendAll(connection->fd, frame, size);
+}
+
+/**
+ * \brief keeps depth requests in flight until all requests are sent
+ */
+static bool fill(LoadConnection* connection, int requests, int depth) {
+	while (connection->sent < requests
+			&& connection->pending - connection->answered < depth) {
+		if (sendRequest(connection) == false) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * \brief checks one response, false for a broken one
+ */
+static bool checkResponse(LoadConnection* connection, uint8_t* frame,
+		int size) {
+	if (connection->answered == connection->pending) {
+		return false;
+	}
+	int slot = connection->answered % LOADMAXDEPTH;
+	LoadType* type = &loadTypes[connection->kinds[slot]];
+	MessageData data;
+	if (connection->client.response(frame, size, &data) != type->response) {
+		return false;
+	}
+	if (type == &loadTypes[LOADCUSTOM]
+			&& memcmp(data.custom.data, &connection->answered, sizeof(int))
+					!= 0) {
+		return false;
+	}
+	type->us.push_back(elapsedUs(connection->sendTimes[slot], Clock::now()));
+	connection->answered++;
+	connection->done++;
+	return true;
+}
+
+/**
+ * \brief reads the responses, finishes the handshake or sends the next
+ * requests. returns false when the connection is broken
+ */
+static bool handleReadable(LoadConnection* connection, int requests,
+		int depth) {
+	uint8_t frame[DOORKEEPERFRAMEMAXSIZE] __attribute__((aligned(4)));
+	int length;
+	uint8_t* buffer;
+	bool open = true;
+	while ((buffer = connection->in.writeBuffer(&length)) != NULL) {
+		ssize_t read = recv(connection->fd, buffer, length, MSG_DONTWAIT);
+		if (read > 0) {
+			connection->in.commitWrite(read);
+			continue;
+		}
+		open = read < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+		break;
+	}
+	int size;
+	while ((size = connection->in.nextFrame(frame)) > 0) {
+		if (connection->client.isStarted() == false) {
+			if (connection->client.finishSession(frame, size) == false) {
+				return false;
+			}
+			handshakeUs.push_back(
+					elapsedUs(connection->handshakeStart, Clock::now()));
+			continue;
+		}
+		if (checkResponse(connection, frame, size) == false) {
+			return false;
+		}
+		if (fill(connection, requests, depth) == false) {
+			return false;
+		}
+	}
+	return open;
+}
+
+static double percentile(std::vector<double>& sorted, double p) {
+	if (sorted.empty()) {
+		return 0;
+	}
+	size_t index = (size_t) (p * (sorted.size() - 1) + 0.5);
+	return sorted[index];
+}
+
+static void reportLatency(const char* name, std::vector<double>& us,
+		size_t count, double seconds, bool last) {
+	std::sort(us.begin(), us.end());
+	double total = 0;
+	for (size_t i = 0; i < us.size(); i++) {
+		total += us[i];
+	}
+	size_t n = us.size();
+	printf("    {\"type\": \"%s\", \"count\": %zu, ", name, count);
+	printf("\"mean_us\": %.1f, \"p50_us\": %.1f, \"p90_us\": %.1f, ",
+			n ? total / n : 0, percentile(us, 0.50), percentile(us, 0.90));
+	printf("\"p99_us\": %.1f, \"p999_us\": %.1f, \"max_us\": %.1f, ",
+			percentile(us, 0.99), percentile(us, 0.999), n ? us[n - 1] : 0);
+	printf("\"throughput_per_s\": %.1f}%s\n",
+			seconds > 0 ? count / seconds : 0, last ? "" : ",");
+}
+
+static void usage(const char* name) {
+	fprintf(stderr, "usage: %s --init-key FILE\n"
+			"       %s --key FILE --server-key FILE [--host IP] [--port N]\n"
+			"          [--connections N] [--requests N] [--depth N]\n"
+			"          [--mix status=W,relais=W,firmware=W,custom=W]\n"
+			"          [--custom-type T]\n", name, name);
+}
+
+/**
+ * \brief epoll loop until no connection is busy(connection) any more or
+ * nothing happened for LOADTIMEOUTMS. broken connections are closed
+ */
+static void run(int epollFd, std::vector<LoadConnection*>& open,
+		bool (*busy)(LoadConnection*, int), int requests, int depth) {
+	int active = 0;
+	for (size_t i = 0; i < open.size(); i++) {
+		if (open[i]->fd >= 0 && busy(open[i], requests) == true) {
+			active++;
+		}
+	}
+	struct epoll_event events[256];
+	Clock::time_point lastProgress = Clock::now();
+	while (active > 0) {
+		int count = epoll_wait(epollFd, events, 256, 100);
+		for (int i = 0; i < count; i++) {
+			LoadConnection* connection = (LoadConnection*) events[i].data.ptr;
+			if (connection->fd < 0) {
+				continue;
+			}
+			bool wasBusy = busy(connection, requests);
+			if (handleReadable(connection, requests, depth) == false) {
+				epoll_ctl(epollFd, EPOLL_CTL_DEL, connection->fd, NULL);
+				close(connection->fd);
+				connection->fd = -1;
+				errors++;
+				active -= wasBusy ? 1 : 0;
+			} else if (wasBusy == true && busy(connection, requests) == false) {
+				active--;
+			}
+		}
+		if (count > 0) {
+			lastProgress = Clock::now();
+		} else if (elapsedUs(lastProgress, Clock::now()) / 1000
+				> LOADTIMEOUTMS) {
+			fprintf(stderr, "timeout, %d connections not done\n", active);
+			errors += active;
+			break;
+		}
+	}
+}
+
+static bool handshaking(LoadConnection* connection, int requests) {
+	return connection->client.isStarted() == false;
+}
+
+static bool requesting(LoadConnection* connection, int requests) {
+	return connection->done < requests;
+}
+
+int main(int argc, char** argv) {
+	const char* host = "127.0.0.1";
+	int port = 2323;
+	int connections = 1000;
+	int requests = 100;
+	int depth = 8;
+	const char* keyFile = NULL;
+	const char* serverKeyFile = NULL;
+	const char* mix = "status=100";
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--init-key") == 0 && i + 1 < argc) {
+			arducrypt::generateSigKeyPair(clientKey.privateKey.keybytes,
+					clientKey.publicKey.keybytes);
+			FILE* f = fopen(argv[++i], "wb");
+			if (f == NULL
+					|| fwrite(&clientKey, sizeof(clientKey), 1, f) != 1) {
+				fprintf(stderr, "can not write %s\n", argv[i]);
+				return 1;
+			}
+			fclose(f);
+			return 0;
+		} else if (strcmp(argv[i], "--key") == 0 && i + 1 < argc) {
+			keyFile = argv[++i];
+		} else if (strcmp(argv[i], "--server-key") == 0 && i + 1 < argc) {
+			serverKeyFile = argv[++i];
+		} else if (strcmp(argv[i], "--host") == 0 && i + 1 < argc) {
+			host = argv[++i];
+		} else if (strcmp(argv[i], "--port") == 0 && i + 1 < argc) {
+			port = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--connections") == 0 && i + 1 < argc) {
+			connections = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--requests") == 0 && i + 1 < argc) {
+			requests = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--depth") == 0 && i + 1 < argc) {
+			depth = std::min(std::max(atoi(argv[++i]), 1), LOADMAXDEPTH);
+		} else if (strcmp(argv[i], "--mix") == 0 && i + 1 < argc) {
+			mix = argv[++i];
+		} else if (strcmp(argv[i], "--custom-type") == 0 && i + 1 < argc) {
+			loadTypes[LOADCUSTOM].type = strtol(argv[++i], NULL, 0);
+			loadTypes[LOADCUSTOM].response = loadTypes[LOADCUSTOM].type | 0x80;
+		} else {
+			usage(argv[0]);
+			return 2;
+		}
+	}
+	if (keyFile == NULL || serverKeyFile == NULL || parseMix(mix) == false
+			|| readFile(keyFile, (uint8_t*) &clientKey, sizeof(clientKey))
+					== false
+			|| readFile(serverKeyFile, serverPublicKey.keybytes, KEYSIZE)
+					== false) {
+		usage(argv[0]);
+		return 2;
+	}
+
+	struct rlimit limit;
+	if (getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+		limit.rlim_cur = limit.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &limit);
+	}
+
+	// connections and StartSessionRequests first, they are not timed
+	std::vector<LoadConnection*> open;
+	int epollFd = epoll_create1(0);
+	for (int i = 0; i < connections; i++) {
+		LoadConnection* connection = new LoadConnection();
+		connection->fd = connectTo(host, port);
+		if (connection->fd < 0) {
+			delete connection;
+			errors++;
+			continue;
+		}
+		connection->random = 0x9e3779b9 * (i + 1);
+		connection->client.startSession(connection->startFrame);
+		struct epoll_event event;
+		event.events = EPOLLIN;
+		event.data.ptr = connection;
+		epoll_ctl(epollFd, EPOLL_CTL_ADD, connection->fd, &event);
+		open.push_back(connection);
+	}
+
+	// all handshakes in flight at once
+	Clock::time_point start = Clock::now();
+	for (size_t i = 0; i < open.size(); i++) {
+		open[i]->handshakeStart = Clock::now();
+		if (sendAll(open[i]->fd, open[i]->startFrame, DoorKeeperMessageSize)
+				== false) {
+			errors++;
+		}
+	}
+	run(epollFd, open, handshaking, requests, depth);
+	double handshakeSeconds = elapsedUs(start, Clock::now()) / 1e6;
+
+	start = Clock::now();
+	size_t sessions = 0;
+	for (size_t i = 0; i < open.size(); i++) {
+		if (open[i]->fd < 0 || open[i]->client.isStarted() == false) {
+			continue;
+		}
+		sessions++;
+		if (fill(open[i], requests, depth) == false) {
+			errors++;
+		}
+	}
+	run(epollFd, open, requesting, requests, depth);
+	double requestSeconds = elapsedUs(start, Clock::now()) / 1e6;
+	size_t done = 0;
+	for (size_t i = 0; i < open.size(); i++) {
+		done += open[i]->done;
+		if (open[i]->fd >= 0) {
+			close(open[i]->fd);
+		}
+		delete open[i];
+	}
+	close(epollFd);
+
+	printf("{\n  \"benchmark\": \"gateway\",\n");
+	printf("  \"connections\": %d,\n  \"sessions\": %zu,\n", connections,
+			sessions);
+	printf("  \"requests_per_connection\": %d,\n  \"depth\": %d,\n",
+			requests, depth);
+	printf("  \"mix\": \"%s\",\n", mix);
+	printf("  \"handshake_rate_per_s\": %.1f,\n",
+			handshakeSeconds > 0 ? sessions / handshakeSeconds : 0);
+	printf("  \"request_rate_per_s\": %.1f,\n",
+			requestSeconds > 0 ? done / requestSeconds : 0);
+	printf("  \"results\": [\n");
+	reportLatency("StartSession", handshakeUs, handshakeUs.size(),
+			handshakeSeconds, false);
+	int last = LOADKINDS - 1;
+	while (loadTypes[last].weight == 0) {
+		last--;
+	}
+	for (int k = 0; k <= last; k++) {
+		if (loadTypes[k].weight > 0) {
+			reportLatency(loadTypes[k].name, loadTypes[k].us,
+					loadTypes[k].sent, requestSeconds, k == last);
+		}
+	}
+	printf("  ],\n  \"errors\": %d\n}\n", errors);
+	return errors == 0 ? 0 : 1;
+}